@@ -35,6 +35,7 @@ distribution.
 #include <forward_list>
 #include <type_traits>
 #include <cstdarg>
+#include <ctime>
 using namespace std;
 
 #include "Error.h"
@@ -46,6 +47,7 @@ using namespace std;
 #include "VersionInfoFactory.h"
 #include "VersionInfo.h"
 #include "PluginManager.h"
+#include "Profiler.h"
 #include "ModuleFactory.h"
 #include "modules/EventManager.h"
 #include "modules/Filesystem.h"
@@ -89,6 +91,12 @@ using namespace DFHack;
 #include <dlfcn.h>
 #endif
 
+#ifdef _LINUX
+#include <sys/inotify.h>
+#include <unistd.h>
+#define SCRIPT_INDEX_USE_INOTIFY
+#endif
+
 using namespace df::enums;
 using df::global::init;
 using df::global::world;
@@ -288,43 +296,282 @@ static std::string getScriptHelp(std::string path, std::string helpprefix)
     return "No help available.";
 }
 
-static void listScripts(PluginManager *plug_mgr, std::map<string,string> &pset, std::string path, bool all, std::string prefix = "")
-{
-    std::vector<string> files;
-    Filesystem::listdir(path, files);
+/*
+ * Index of the script directories, so that finding a script doesn't stat
+ * every script path on every command, and ls doesn't reread every script.
+ *
+ * The listing of a directory is reused until the directory changes. On
+ * Linux, inotify reports the changes; elsewhere (or if a watch can't be
+ * added) the directory mtime is checked, at most once a second. Script
+ * help is kept until the script's mtime changes.
+ */
+class ScriptIndex
+{
+    struct Entry
+    {
+        std::string name;
+        bool is_dir;
+    };
 
-    path += '/';
-    for (size_t i = 0; i < files.size(); i++)
+    struct Dir
     {
-        if (hasEnding(files[i], ".lua"))
+        bool valid;
+        int64_t mtime;      // of the directory, when it was listed
+        int64_t listed_at;
+        int64_t checked_at; // last mtime check, for unwatched directories
+        int watch;          // inotify watch, or -1
+        std::map<std::string, Entry> entries; // by key()
+
+        Dir() : valid(false), mtime(-1), listed_at(-1), checked_at(-1), watch(-1) {}
+    };
+
+    struct Help
+    {
+        int64_t mtime;
+        int64_t read_at;
+        std::string text;
+    };
+
+    std::mutex mutex;
+    std::map<std::string, Dir> dirs;
+    std::map<std::string, Help> helps;
+    int inotify_fd;
+    std::map<int, std::string> watches;
+
+    static std::string key(const std::string &name)
+    {
+#ifdef _WIN32
+        return toLower(name); // file names are case insensitive
+#else
+        return name;
+#endif
+    }
+
+    void pollChanges()
+    {
+#ifdef SCRIPT_INDEX_USE_INOTIFY
+        if (inotify_fd < 0)
+            return;
+
+        char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        ssize_t len;
+        while ((len = read(inotify_fd, buf, sizeof(buf))) > 0)
         {
-            string help = getScriptHelp(path + files[i], "--");
-            string key = prefix + files[i].substr(0, files[i].size()-4);
-            if (pset.find(key) == pset.end()) {
-                pset[key] = help;
+            for (char *ptr = buf; ptr < buf + len; )
+            {
+                const struct inotify_event *event = (const struct inotify_event *)ptr;
+                ptr += sizeof(struct inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW)
+                {
+                    // events were dropped, so nothing cached can be trusted
+                    for (auto dir = dirs.begin(); dir != dirs.end(); ++dir)
+                        dir->second.valid = false;
+                    helps.clear();
+                    continue;
+                }
+
+                auto it = watches.find(event->wd);
+                if (it == watches.end())
+                    continue;
+                Dir &dir = dirs[it->second];
+                dir.valid = false;
+                if (event->len)
+                {
+                    // the entry may be a script, or a directory that was created or removed
+                    std::string child = it->second + "/" + event->name;
+                    helps.erase(child);
+                    auto child_dir = dirs.find(child);
+                    if (child_dir != dirs.end())
+                        child_dir->second.valid = false;
+                }
+                if (event->mask & IN_IGNORED)
+                {
+                    dir.watch = -1;
+                    watches.erase(it);
+                }
             }
         }
-        else if (plug_mgr->ruby && plug_mgr->ruby->is_enabled() && hasEnding(files[i], ".rb"))
+#endif
+    }
+
+    void watch(const std::string &path, Dir &dir)
+    {
+#ifdef SCRIPT_INDEX_USE_INOTIFY
+        if (inotify_fd < 0 || dir.watch >= 0)
+            return;
+        dir.watch = inotify_add_watch(inotify_fd, path.c_str(),
+            IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY |
+            IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+        if (dir.watch >= 0)
+            watches[dir.watch] = path;
+#endif
+    }
+
+    Dir &getDir(const std::string &path)
+    {
+        Dir &dir = dirs[path];
+        if (dir.valid && dir.watch < 0)
         {
-            string help = getScriptHelp(path + files[i], "#");
-            string key = prefix + files[i].substr(0, files[i].size()-3);
-            if (pset.find(key) == pset.end()) {
-                pset[key] = help;
+            int64_t now = time(NULL);
+            if (now != dir.checked_at)
+            {
+                dir.checked_at = now;
+                int64_t mtime = Filesystem::mtime(path);
+                // mtime is in seconds, so a listing from the second of a change can't be trusted
+                dir.valid = mtime == dir.mtime && dir.listed_at > mtime;
             }
         }
-        else if (all && !files[i].empty() && files[i][0] != '.')
+        if (dir.valid)
+            return dir;
+
+        // watch first, so changes during the listing aren't missed
+        watch(path, dir);
+
+        dir.entries.clear();
+        std::vector<std::string> files;
+        Filesystem::listdir(path, files);
+        for (size_t i = 0; i < files.size(); i++)
         {
-            listScripts(plug_mgr, pset, path+files[i]+"/", all, prefix+files[i]+"/");
+            if (files[i] == "." || files[i] == "..")
+                continue;
+            _filetype type = Filesystem::filetype(path + "/" + files[i]);
+            if (type != FILETYPE_FILE && type != FILETYPE_DIRECTORY)
+                continue;
+            Entry &entry = dir.entries[key(files[i])];
+            entry.name = files[i];
+            entry.is_dir = (type == FILETYPE_DIRECTORY);
         }
+        dir.mtime = Filesystem::mtime(path);
+        dir.listed_at = dir.checked_at = time(NULL);
+        dir.valid = true;
+        return dir;
+    }
+
+    const std::string &getHelpLocked(const std::string &path, const std::string &helpprefix)
+    {
+        Help &help = helps[path];
+        int64_t mtime = Filesystem::mtime(path);
+        if (help.text.empty() || mtime != help.mtime || help.read_at <= mtime)
+        {
+            help.text = getScriptHelp(path, helpprefix);
+            help.mtime = mtime;
+            help.read_at = time(NULL);
+        }
+        return help.text;
+    }
+
+    void listLocked(PluginManager *plug_mgr, std::map<string,string> &pset, std::string path, bool all, std::string prefix)
+    {
+        Dir &dir = getDir(path);
+        // the directory may be relisted by recursive calls
+        std::vector<Entry> entries;
+        for (auto it = dir.entries.begin(); it != dir.entries.end(); ++it)
+            entries.push_back(it->second);
+
+        path += '/';
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            const std::string &file = entries[i].name;
+            if (entries[i].is_dir)
+            {
+                if (all && !file.empty() && file[0] != '.')
+                    listLocked(plug_mgr, pset, path+file, all, prefix+file+"/");
+            }
+            else if (hasEnding(file, ".lua"))
+            {
+                string key = prefix + file.substr(0, file.size()-4);
+                if (pset.find(key) == pset.end())
+                    pset[key] = getHelpLocked(path + file, "--");
+            }
+            else if (plug_mgr->ruby && plug_mgr->ruby->is_enabled() && hasEnding(file, ".rb"))
+            {
+                string key = prefix + file.substr(0, file.size()-3);
+                if (pset.find(key) == pset.end())
+                    pset[key] = getHelpLocked(path + file, "#");
+            }
+        }
+    }
+
+public:
+    ScriptIndex() : inotify_fd(-1)
+    {
+#ifdef SCRIPT_INDEX_USE_INOTIFY
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+    }
+
+    ~ScriptIndex()
+    {
+#ifdef SCRIPT_INDEX_USE_INOTIFY
+        if (inotify_fd >= 0)
+            close(inotify_fd);
+#endif
+    }
+
+    // Path of the script in the first of the roots that has it, or ""
+    std::string find(const std::vector<std::string> &roots, const std::string &name)
+    {
+        if (name.empty() || name.find('\\') != std::string::npos ||
+            name.find("..") != std::string::npos || name[0] == '/')
+        {
+            // unusual names are resolved the slow way
+            for (auto it = roots.begin(); it != roots.end(); ++it)
+            {
+                if (Filesystem::isfile(*it + "/" + name))
+                    return *it + "/" + name;
+            }
+            return "";
+        }
+
+        size_t slash = name.rfind('/');
+        std::string subdir = (slash == std::string::npos) ? "" : "/" + name.substr(0, slash);
+        std::string base = key(name.substr(slash + 1));
+
+        lock_guard<std::mutex> lock(mutex);
+        pollChanges();
+        for (auto it = roots.begin(); it != roots.end(); ++it)
+        {
+            Dir &dir = getDir(*it + subdir);
+            auto entry = dir.entries.find(base);
+            if (entry != dir.entries.end() && !entry->second.is_dir)
+                return *it + "/" + name;
+        }
+        return "";
     }
-}
+
+    void list(PluginManager *plug_mgr, std::map<string,string> &pset, const std::string &root, bool all)
+    {
+        lock_guard<std::mutex> lock(mutex);
+        pollChanges();
+        listLocked(plug_mgr, pset, root, all, "");
+    }
+
+    std::string getHelp(const std::string &path, const std::string &helpprefix)
+    {
+        lock_guard<std::mutex> lock(mutex);
+        pollChanges();
+        return getHelpLocked(path, helpprefix);
+    }
+
+    // Lists the roots ahead of the first lookups
+    void prepare(const std::vector<std::string> &roots)
+    {
+        lock_guard<std::mutex> lock(mutex);
+        pollChanges();
+        for (auto it = roots.begin(); it != roots.end(); ++it)
+            getDir(*it);
+    }
+};
+
+static ScriptIndex script_index;
 
 static void listAllScripts(map<string, string> &pset, bool all)
 {
     vector<string> paths;
     Core::getInstance().getScriptPaths(&paths);
     for (string path : paths)
-        listScripts(Core::getInstance().getPluginManager(), pset, path, all);
+        script_index.list(Core::getInstance().getPluginManager(), pset, path, all);
 }
 
 namespace {
@@ -443,6 +690,8 @@ static const std::set<std::string> built_in_commands = {
     "reload" ,
     "enable" ,
     "disable" ,
+    "event-stats" ,
+    "profile" ,
     "plug" ,
     "keybinding" ,
     "alias" ,
@@ -561,13 +810,7 @@ string Core::findScript(string name)
 {
     vector<string> paths;
     getScriptPaths(&paths);
-    for (auto it = paths.begin(); it != paths.end(); ++it)
-    {
-        string path = *it + "/" + name;
-        if (Filesystem::isfile(path))
-            return path;
-    }
-    return "";
+    return script_index.find(paths, name);
 }
 
 bool loadScriptPaths(color_ostream &out, bool silent = false)
@@ -767,14 +1010,14 @@ command_result Core::runCommand(color_ostream &con, const std::string &first_, v
                 }
                 string file = findScript(parts[0] + ".lua");
                 if ( file != "" ) {
-                    string help = getScriptHelp(file, "--");
+                    string help = script_index.getHelp(file, "--");
                     con.print("%s: %s\n", parts[0].c_str(), help.c_str());
                     return CR_OK;
                 }
                 if (plug_mgr->ruby && plug_mgr->ruby->is_enabled() ) {
                     file = findScript(parts[0] + ".rb");
                     if ( file != "" ) {
-                        string help = getScriptHelp(file, "#");
+                        string help = script_index.getHelp(file, "#");
                         con.print("%s: %s\n", parts[0].c_str(), help.c_str());
                         return CR_OK;
                     }
@@ -849,6 +1092,8 @@ command_result Core::runCommand(color_ostream &con, const std::string &first_, v
                     }
 
                     Plugin * plug = (*plug_mgr)[part];
+                    if (plug)
+                        plug_mgr->loadDeferred(part);
 
                     if(!plug)
                     {
@@ -943,6 +1188,8 @@ command_result Core::runCommand(color_ostream &con, const std::string &first_, v
                 "  reload PLUGIN|-all [...]    - Reload a plugin or all loaded plugins.\n"
                 "  enable/disable PLUGIN [...] - Enable or disable a plugin if supported.\n"
                 "  type COMMAND                - Display information about where a command is implemented\n"
+                "  event-stats [reset]         - Show how much time event handlers take.\n"
+                "  profile [SECONDS]           - Show what takes time in recent updates.\n"
                 "\n"
                 "plugins:\n"
                 );
@@ -1149,6 +1396,117 @@ command_result Core::runCommand(color_ostream &con, const std::string &first_, v
                     << "  alias list" << endl;
             }
         }
+        else if (builtin == "event-stats")
+        {
+            CoreSuspender suspend;
+            if (parts.size() == 1 && parts[0] == "reset")
+            {
+                EventManager::resetHandlerStats();
+                con.print("Event handler statistics reset.\n");
+            }
+            else if (parts.size())
+            {
+                con << "Usage: event-stats [reset]" << endl;
+                return CR_WRONG_USAGE;
+            }
+            else
+            {
+                auto stats = EventManager::getHandlerStats();
+                if (stats.empty())
+                {
+                    con.print("No event handlers are registered.\n");
+                    return CR_OK;
+                }
+                const char *header_format = "%-17s %-24s %6s %9s %8s %8s %10s %9s %8s\n";
+                const char *row_format = "%-17s %-24s %6d %9d %8d %8llu %10.2f %9.3f %8u\n";
+                con.print(header_format, "Event", "Plugin", "Freq", "Budget us", "Interval", "Calls", "Total ms", "Max ms", "Overruns");
+                for (auto it = stats.begin(); it != stats.end(); ++it)
+                {
+                    con.print(row_format,
+                        EventManager::getEventTypeName(it->type),
+                        it->plugin ? it->plugin->getName().c_str() : "(core)",
+                        it->freq,
+                        it->budget,
+                        it->interval,
+                        (unsigned long long)it->calls,
+                        it->total_ns / 1e6,
+                        it->max_ns / 1e6,
+                        it->overruns);
+                }
+            }
+        }
+        else if (builtin == "profile")
+        {
+            // Window of samples to look at, 10 seconds by default
+            double seconds = 10;
+            auto parse_seconds = [&](const std::string &arg) {
+                char *end = NULL;
+                seconds = strtod(arg.c_str(), &end);
+                return end != arg.c_str() && !*end && seconds > 0;
+            };
+            std::string action = parts.size() ? parts[0] : "";
+            if (parts.size() == 1 && parse_seconds(parts[0]))
+                action = "";
+            else if (action == "trace" && parts.size() == 3 && !parse_seconds(parts[2]))
+                action = "?";
+            uint64_t window_ns = uint64_t(seconds * 1e9);
+
+            if (action == "reset" && parts.size() == 1)
+            {
+                Profiler::reset();
+                con.print("Profiler samples discarded.\n");
+            }
+            else if ((action == "enable" || action == "disable") && parts.size() == 1)
+            {
+                Profiler::setEnabled(action == "enable");
+                con.print("Profiler %s.\n", action == "enable" ? "enabled" : "disabled");
+            }
+            else if (action == "trace" && parts.size() >= 2 && parts.size() <= 3)
+            {
+                if (!Profiler::writeTrace(parts[1], window_ns))
+                {
+                    con.printerr("Could not write %s\n", parts[1].c_str());
+                    return CR_FAILURE;
+                }
+                con.print("Wrote the last %g seconds to %s\n", seconds, parts[1].c_str());
+            }
+            else if (action.empty())
+            {
+                auto stats = Profiler::getStats(window_ns);
+                if (stats.empty())
+                {
+                    con.print("Nothing was recorded in the last %g seconds%s.\n", seconds,
+                        Profiler::isEnabled() ? "" : " (the profiler is disabled)");
+                    return CR_OK;
+                }
+                const char *header_format = "%-36s %-9s %7s %10s %8s %8s %8s %8s\n";
+                const char *row_format = "%-36s %-9s %7u %10.2f %8.3f %8.3f %8.3f %8.3f\n";
+                con.print(header_format, "Source", "Kind", "Calls", "Total ms", "p50 ms", "p95 ms", "p99 ms", "Max ms");
+                size_t shown = std::min(stats.size(), size_t(30));
+                for (size_t i = 0; i < shown; i++)
+                {
+                    const Profiler::SourceStats &it = stats[i];
+                    con.print(row_format,
+                        it.name.c_str(),
+                        Profiler::getCategoryName(it.category),
+                        it.calls,
+                        it.total_ns / 1e6,
+                        it.p50_ns / 1e6,
+                        it.p95_ns / 1e6,
+                        it.p99_ns / 1e6,
+                        it.max_ns / 1e6);
+                }
+                if (shown < stats.size())
+                    con.print("(%d more)\n", int(stats.size() - shown));
+            }
+            else
+            {
+                con << "Usage: profile [SECONDS]" << endl
+                    << "       profile trace FILE [SECONDS]" << endl
+                    << "       profile reset|enable|disable" << endl;
+                return CR_WRONG_USAGE;
+            }
+        }
         else if (builtin == "fpause")
         {
             World::SetPauseState(true);
@@ -1543,6 +1901,7 @@ Core::Core() :
     last_world_data_ptr = NULL;
     last_local_map_ptr = NULL;
     last_pause_state = false;
+    update_count = 0;
     top_viewscreen = NULL;
     screen_window = NULL;
     server = NULL;
@@ -1763,6 +2122,11 @@ bool Core::Init()
     }
 
     loadScriptPaths(con);
+    {
+        vector<string> paths;
+        getScriptPaths(&paths);
+        script_index.prepare(paths);
+    }
 
     // initialize common lua context
     if (!Lua::Core::Init(con))
@@ -2077,22 +2441,46 @@ int Core::Update()
 extern bool buildings_do_onupdate;
 void buildings_onStateChange(color_ostream &out, state_change_event event);
 void buildings_onUpdate(color_ostream &out);
+void units_onStateChange(color_ostream &out, state_change_event event);
+void items_onStateChange(color_ostream &out, state_change_event event);
+void mapcache_onStateChange(color_ostream &out, state_change_event event);
 
 static int buildings_timer = 0;
 
 void Core::onUpdate(color_ostream &out)
 {
-    EventManager::manageEvents(out);
+    static const int update_source = Profiler::getSource(Profiler::STAGE, "update");
+    static const int events_source = Profiler::getSource(Profiler::STAGE, "events");
+    static const int buildings_source = Profiler::getSource(Profiler::STAGE, "buildings");
+    static const int plugins_source = Profiler::getSource(Profiler::STAGE, "plugins");
+    static const int lua_source = Profiler::getSource(Profiler::STAGE, "lua timers");
+
+    Profiler::Scope timing(update_source);
+    update_count++;
+
+    {
+        Profiler::Scope stage(events_source);
+        EventManager::manageEvents(out);
+    }
 
     // convert building reagents
     if (buildings_do_onupdate && (++buildings_timer & 1))
+    {
+        Profiler::Scope stage(buildings_source);
         buildings_onUpdate(out);
+    }
 
     // notify all the plugins that a game tick is finished
-    plug_mgr->OnUpdate(out);
+    {
+        Profiler::Scope stage(plugins_source);
+        plug_mgr->OnUpdate(out);
+    }
 
     // process timers in lua
-    Lua::Core::onUpdate(out);
+    {
+        Profiler::Scope stage(lua_source);
+        Lua::Core::onUpdate(out);
+    }
 }
 
 void getFilesWithPrefixAndSuffix(const std::string& folder, const std::string& prefix, const std::string& suffix, std::vector<std::string>& result) {
@@ -2275,6 +2663,9 @@ void Core::onStateChange(color_ostream &out, state_change_event event)
     EventManager::onStateChange(out, event);
 
     buildings_onStateChange(out, event);
+    units_onStateChange(out, event);
+    items_onStateChange(out, event);
+    mapcache_onStateChange(out, event);
 
     plug_mgr->OnStateChange(out, event);
 
@@ -24,6 +24,7 @@ distribution.
 
 #include "Internal.h"
 
+#include <atomic>
 #include <string>
 #include <vector>
 #include <map>
@@ -120,6 +121,9 @@ std::string compound_identity::getFullName()
 
 static tthread::mutex *known_mutex = NULL;
 
+/* Structs and classes without a parent, filled by doInit. */
+static std::vector<struct_identity*> struct_roots;
+
 void compound_identity::Init(Core *core)
 {
     if (!known_mutex)
@@ -129,6 +133,11 @@ void compound_identity::Init(Core *core)
     // they are called in an undefined order.
     for (compound_identity *p = list; p; p = p->next)
         p->doInit(core);
+
+    // Number the class hierarchy, so that subclass tests are range checks
+    int32_t next = 0;
+    for (auto it = struct_roots.begin(); it != struct_roots.end(); ++it)
+        (*it)->number_subtree(next);
 }
 
 bitfield_identity::bitfield_identity(size_t size,
@@ -173,7 +182,7 @@ struct_identity::struct_identity(size_t size, TAllocateFn alloc,
                                  compound_identity *scope_parent, const char *dfhack_name,
                                  struct_identity *parent, const struct_field_info *fields)
     : compound_identity(size, alloc, scope_parent, dfhack_name),
-      parent(parent), has_children(false), fields(fields)
+      parent(parent), has_children(false), tree_index(-1), tree_last(-1), fields(fields)
 {
 }
 
@@ -185,13 +194,21 @@ void struct_identity::doInit(Core *core)
         parent->children.push_back(this);
         parent->has_children = true;
     }
+    else
+        struct_roots.push_back(this);
 }
 
-bool struct_identity::is_subclass(struct_identity *actual)
+void struct_identity::number_subtree(int32_t &next)
 {
-    if (!has_children && actual != this)
-        return false;
+    tree_index = next++;
+    for (size_t i = 0; i < children.size(); i++)
+        children[i]->number_subtree(next);
+    tree_last = next - 1;
+}
 
+bool struct_identity::is_subclass_slow(struct_identity *actual)
+{
+    // For types that weren't numbered by Init
     for (; actual; actual = actual->getParent())
         if (actual == this) return true;
 
@@ -244,8 +261,102 @@ virtual_identity::~virtual_identity()
 /* Vtable name to identity lookup. */
 static std::map<std::string, virtual_identity*> name_lookup;
 
-/* Vtable pointer to identity lookup. */
-std::map<void*, virtual_identity*> virtual_identity::known;
+/*
+ * Vtable pointer to identity lookup.
+ *
+ * An open addressing hash table that is read without locking. Entries are
+ * only ever added, under known_mutex: the identity is stored before the
+ * vtable that makes the slot visible. A full table is replaced by a bigger
+ * copy, and old tables are kept, as readers may still be probing them.
+ */
+namespace {
+    struct KnownSlot {
+        std::atomic<void*> vtable;
+        std::atomic<virtual_identity*> identity;
+    };
+
+    struct KnownTable {
+        size_t mask;
+        size_t count;
+        KnownSlot *slots;
+        KnownTable *previous;
+    };
+
+    std::atomic<KnownTable*> known_table(NULL);
+
+    inline size_t known_hash(void *vtable)
+    {
+        uint64_t v = uint64_t(uintptr_t(vtable)) * 0x9E3779B97F4A7C15ULL;
+        return size_t(v >> 32);
+    }
+
+    bool known_find(void *vtable, virtual_identity **identity)
+    {
+        KnownTable *table = known_table.load(std::memory_order_acquire);
+        if (!table)
+            return false;
+
+        for (size_t i = known_hash(vtable) & table->mask; ; i = (i + 1) & table->mask)
+        {
+            KnownSlot &slot = table->slots[i];
+            void *key = slot.vtable.load(std::memory_order_acquire);
+            if (key == vtable)
+            {
+                *identity = slot.identity.load(std::memory_order_relaxed);
+                return true;
+            }
+            if (!key)
+                return false;
+        }
+    }
+
+    void known_put(KnownTable *table, void *vtable, virtual_identity *identity)
+    {
+        size_t i = known_hash(vtable) & table->mask;
+        while (table->slots[i].vtable.load(std::memory_order_relaxed))
+            i = (i + 1) & table->mask;
+
+        table->slots[i].identity.store(identity, std::memory_order_relaxed);
+        table->slots[i].vtable.store(vtable, std::memory_order_release);
+        table->count++;
+    }
+
+    // Caller must hold known_mutex, and vtable must not be in the table yet
+    void known_insert(void *vtable, virtual_identity *identity)
+    {
+        KnownTable *table = known_table.load(std::memory_order_relaxed);
+
+        if (!table || (table->count + 1) * 2 > table->mask + 1)
+        {
+            size_t size = table ? (table->mask + 1) * 2 : 1024;
+            KnownTable *grown = new KnownTable();
+            grown->mask = size - 1;
+            grown->count = 0;
+            grown->slots = new KnownSlot[size];
+            grown->previous = table;
+            for (size_t i = 0; i < size; i++)
+            {
+                grown->slots[i].vtable.store(NULL, std::memory_order_relaxed);
+                grown->slots[i].identity.store(NULL, std::memory_order_relaxed);
+            }
+
+            if (table)
+            {
+                for (size_t i = 0; i <= table->mask; i++)
+                {
+                    void *key = table->slots[i].vtable.load(std::memory_order_relaxed);
+                    if (key)
+                        known_put(grown, key, table->slots[i].identity.load(std::memory_order_relaxed));
+                }
+            }
+
+            known_table.store(grown, std::memory_order_release);
+            table = grown;
+        }
+
+        known_put(table, vtable, identity);
+    }
+}
 
 void virtual_identity::doInit(Core *core)
 {
@@ -256,7 +367,12 @@ void virtual_identity::doInit(Core *core)
 
     vtable_ptr = core->vinfo->getVTable(vtname);
     if (vtable_ptr)
-        known[vtable_ptr] = this;
+    {
+        tthread::lock_guard<tthread::mutex> lock(*known_mutex);
+        virtual_identity *prev;
+        if (!known_find(vtable_ptr, &prev))
+            known_insert(vtable_ptr, this);
+    }
 }
 
 virtual_identity *virtual_identity::find(const std::string &name)
@@ -278,16 +394,17 @@ virtual_identity *virtual_identity::find(void *vtable)
     if (!vtable)
         return NULL;
 
-    // Actually, a reader/writer lock would be sufficient,
-    // since the table is only written once per class.
-    tthread::lock_guard<tthread::mutex> lock(*known_mutex);
+    virtual_identity *identity;
+    if (known_find(vtable, &identity))
+        return identity;
 
-    std::map<void*, virtual_identity*>::iterator it = known.find(vtable);
+    // First sighting of this vtable: look it up by class name
+    tthread::lock_guard<tthread::mutex> lock(*known_mutex);
 
-    if (it != known.end())
-        return it->second;
+    // Another thread may have got here first
+    if (known_find(vtable, &identity))
+        return identity;
 
-    // If using a reader/writer lock, re-grab as write here, and recheck
     Core &core = Core::getInstance();
     std::string name = core.p->doReadClassName(vtable);
 
@@ -307,15 +424,15 @@ virtual_identity *virtual_identity::find(void *vtable)
                       << std::hex << pv << std::dec << "'/>" << std::endl;
         }
 
-        known[vtable] = p;
         p->vtable_ptr = vtable;
+        known_insert(vtable, p);
         return p;
     }
 
     std::cerr << "UNKNOWN CLASS '" << name << "': vtable = 0x"
               << std::hex << uintptr_t(vtable) << std::dec << std::endl;
 
-    known[vtable] = NULL;
+    known_insert(vtable, NULL);
     return NULL;
 }
 
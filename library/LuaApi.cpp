@@ -1664,6 +1664,22 @@ static int units_getNoblePositions(lua_State *state)
     return 1;
 }
 
+static void units_filter(lua_State *state, int idx, std::vector<df::unit*> &units)
+{
+    if (lua_isnone(state, idx))
+        return;
+
+    luaL_checktype(state, idx, LUA_TFUNCTION);
+    units.erase(std::remove_if(units.begin(), units.end(), [&state, idx](df::unit *unit) -> bool {
+        lua_pushvalue(state, idx); // copy function
+        Lua::PushDFObject(state, unit);
+        lua_call(state, 1, 1);
+        bool ret = lua_toboolean(state, -1);
+        lua_pop(state, 1); // remove return value
+        return !ret;
+    }), units.end());
+}
+
 static int units_getUnitsInBox(lua_State *state)
 {
     std::vector<df::unit*> units;
@@ -1676,18 +1692,44 @@ static int units_getUnitsInBox(lua_State *state)
 
     bool ok = Units::getUnitsInBox(units, x1, y1, z1, x2, y2, z2);
 
-    if (ok && !lua_isnone(state, 7))
-    {
-        luaL_checktype(state, 7, LUA_TFUNCTION);
-        units.erase(std::remove_if(units.begin(), units.end(), [&state](df::unit *unit) -> bool {
-            lua_dup(state); // copy function
-            Lua::PushDFObject(state, unit);
-            lua_call(state, 1, 1);
-            bool ret = lua_toboolean(state, -1);
-            lua_pop(state, 1); // remove return value
-            return !ret;
-        }), units.end());
-    }
+    if (ok)
+        units_filter(state, 7, units);
+
+    Lua::PushVector(state, units);
+    lua_pushboolean(state, ok);
+    return 2;
+}
+
+static int units_getUnitsInRadius(lua_State *state)
+{
+    std::vector<df::unit*> units;
+    df::coord center;
+    center.x = luaL_checkint(state, 1);
+    center.y = luaL_checkint(state, 2);
+    center.z = luaL_checkint(state, 3);
+    int radius = luaL_checkint(state, 4);
+
+    bool ok = Units::getUnitsInRadius(units, center, radius);
+
+    if (ok)
+        units_filter(state, 5, units);
+
+    Lua::PushVector(state, units);
+    lua_pushboolean(state, ok);
+    return 2;
+}
+
+static int units_getUnitsInBlock(lua_State *state)
+{
+    std::vector<df::unit*> units;
+    int x = luaL_checkint(state, 1);
+    int y = luaL_checkint(state, 2);
+    int z = luaL_checkint(state, 3);
+
+    bool ok = Units::getUnitsInBlock(units, x, y, z);
+
+    if (ok)
+        units_filter(state, 4, units);
 
     Lua::PushVector(state, units);
     lua_pushboolean(state, ok);
@@ -1706,6 +1748,8 @@ static const luaL_Reg dfhack_units_funcs[] = {
     { "getPosition", units_getPosition },
     { "getNoblePositions", units_getNoblePositions },
     { "getUnitsInBox", units_getUnitsInBox },
+    { "getUnitsInRadius", units_getUnitsInRadius },
+    { "getUnitsInBlock", units_getUnitsInBlock },
     { "getStressCutoffs", units_getStressCutoffs },
     { NULL, NULL }
 };
@@ -2045,6 +2089,16 @@ static int buildings_findCivzonesAt(lua_State *L)
     return 1;
 }
 
+static int buildings_findInBox(lua_State *L)
+{
+    df::coord p1(luaL_checkint(L, 1), luaL_checkint(L, 2), luaL_checkint(L, 3));
+    df::coord p2(luaL_checkint(L, 4), luaL_checkint(L, 5), luaL_checkint(L, 6));
+    std::vector<df::building*> pvec;
+    Buildings::findInBox(&pvec, p1, p2);
+    Lua::PushVector(L, pvec);
+    return 1;
+}
+
 static int buildings_findPenPitAt(lua_State *L)
 {
     auto pos = CheckCoordXYZ(L, 1, true);
@@ -2116,6 +2170,7 @@ static int buildings_getCageOccupants(lua_State *state)
 static const luaL_Reg dfhack_buildings_funcs[] = {
     { "findAtTile", buildings_findAtTile },
     { "findCivzonesAt", buildings_findCivzonesAt },
+    { "findInBox", buildings_findInBox },
     { "getCorrectSize", buildings_getCorrectSize },
     CWRAP(setSize, buildings_setSize),
     CWRAP(getStockpileContents, buildings_getStockpileContents),
@@ -50,6 +50,7 @@ distribution.
 #include "MiscUtils.h"
 #include "DFHackVersion.h"
 #include "PluginManager.h"
+#include "Profiler.h"
 
 #include "df/job.h"
 #include "df/job_item.h"
@@ -1850,6 +1851,33 @@ void DFHack::Lua::Core::onStateChange(color_ostream &out, int code) {
     Lua::Event::Invoke(out, State, (void*)onStateChange, 1);
 }
 
+// Profiler sources of timer callbacks, by where they were defined. The
+// chunk name pointer is only a hint, so the name itself is compared too.
+struct TimerSource
+{
+    std::string chunk;
+    int source;
+};
+static std::map<std::pair<const char*,int>, TimerSource> timer_sources;
+
+// Source of the function on top of the stack
+static int get_timer_source(lua_State *L)
+{
+    lua_Debug ar;
+    lua_pushvalue(L, -1);
+    if (!lua_getinfo(L, ">S", &ar))
+        return -1;
+
+    TimerSource &entry = timer_sources[std::make_pair(ar.source, ar.linedefined)];
+    if (entry.chunk.empty() || entry.chunk != ar.source)
+    {
+        entry.chunk = ar.source;
+        entry.source = Profiler::getSource(Profiler::LUA_TIMER,
+            stl_sprintf("%s:%d", ar.short_src, ar.linedefined));
+    }
+    return entry.source;
+}
+
 static void run_timers(color_ostream &out, lua_State *L,
                        std::multimap<int,int> &timers, int table, int bound)
 {
@@ -1867,6 +1895,10 @@ static void run_timers(color_ostream &out, lua_State *L,
             lua_pushnil(L);
             lua_rawseti(L, table, id);
 
+            // Timers are attributed to the place the callback was defined
+            int source = Profiler::isEnabled() ? get_timer_source(L) : -1;
+
+            Profiler::Scope timing(source);
             Lua::SafeCall(out, L, 0, 0);
         }
     }
@@ -664,6 +664,71 @@ static int meta_struct_next(lua_State *state)
     return 2;
 }
 
+/*
+ * Upvalues of field getters, after the struct method ones.
+ */
+#define UPVAL_GETTER_NAME lua_upvalueindex(4)
+#define UPVAL_GETTER_FIELD lua_upvalueindex(5)
+
+/**
+ * Field getter from df.fields(): reads the field like __index,
+ * but without looking the name up on every call.
+ */
+static int meta_field_getter(lua_State *state)
+{
+    lua_settop(state, 1);
+    lua_pushvalue(state, UPVAL_GETTER_NAME);
+
+    if (!lua_isuserdata(state, 1) || !lua_getmetatable(state, 1))
+        field_error(state, 2, "invalid object", "read");
+
+    // Objects of subclasses have their own metatables
+    if (!lua_rawequal(state, -1, UPVAL_METATABLE))
+    {
+        lua_rawgetp(state, -1, &DFHACK_IDENTITY_FIELD_TOKEN);
+        auto type = (type_identity*)lua_touserdata(state, -1);
+        lua_rawgetp(state, UPVAL_METATABLE, &DFHACK_IDENTITY_FIELD_TOKEN);
+        auto base = (struct_identity*)lua_touserdata(state, -1);
+
+        if (!type || lua_islightuserdata(state, 1) ||
+            (type->type() != IDTYPE_STRUCT && type->type() != IDTYPE_CLASS) ||
+            !base->is_subclass((struct_identity*)type))
+            field_error(state, 2, "invalid object metatable", "read");
+
+        lua_pop(state, 2);
+    }
+
+    lua_pop(state, 1);
+
+    auto ptr = (uint8_t*)get_object_ref(state, 1);
+    auto field = (struct_field_info*)lua_touserdata(state, UPVAL_GETTER_FIELD);
+    read_field(state, field, ptr + field->offset);
+    return 1;
+}
+
+void LuaWrapper::PushFieldGetter(lua_State *state, int meta_idx, int ftable_idx, int name_idx)
+{
+    if (lua_type(state, name_idx) != LUA_TSTRING)
+        luaL_error(state, "Field name expected in df.fields()");
+
+    lua_pushvalue(state, name_idx);
+    lua_rawget(state, ftable_idx);
+
+    // Methods are functions, and metafields NULL
+    void *field = lua_islightuserdata(state, -1) ? lua_touserdata(state, -1) : NULL;
+    if (!field)
+        luaL_error(state, "Not a data field in df.fields(): %s", lua_tostring(state, name_idx));
+
+    lua_pop(state, 1);
+
+    lua_rawgetp(state, LUA_REGISTRYINDEX, &DFHACK_TYPETABLE_TOKEN);
+    lua_pushvalue(state, meta_idx);
+    lua_pushvalue(state, ftable_idx);
+    lua_pushvalue(state, name_idx);
+    lua_pushlightuserdata(state, field);
+    lua_pushcclosure(state, meta_field_getter, 5);
+}
+
 /**
  * Field lookup for primitive refs: behave as a quasi-array with numeric indices.
  */
@@ -164,15 +164,49 @@ static void BuildTypeMetatable(lua_State *state, type_identity *type);
 
 /**
  * Push the pointer as DF object ref using metatable on the stack.
+ *
+ * Refs are reused while they are alive: every metatable keeps
+ * a weak-valued table of its refs, keyed by the pointer.
  */
 void LuaWrapper::push_object_ref(lua_State *state, void *ptr)
 {
     // stack: [metatable]
+    lua_rawgetp(state, -1, &DFHACK_REF_CACHE_TOKEN);
+
+    if (lua_isnil(state, -1))
+    {
+        lua_pop(state, 1);
+        lua_newtable(state);
+        lua_newtable(state);
+        lua_pushstring(state, "v");
+        lua_setfield(state, -2, "__mode");
+        lua_setmetatable(state, -2);
+        lua_dup(state);
+        lua_rawsetp(state, -3, &DFHACK_REF_CACHE_TOKEN);
+    }
+    else
+    {
+        lua_rawgetp(state, -1, ptr);
+        if (!lua_isnil(state, -1))
+        {
+            lua_replace(state, -3);
+            lua_pop(state, 1);
+            return;
+        }
+        lua_pop(state, 1);
+    }
+
+    // stack: [metatable] [cache]
     auto ref = (DFRefHeader*)lua_newuserdata(state, sizeof(DFRefHeader));
     ref->ptr = ptr;
 
-    lua_swap(state);
+    lua_pushvalue(state, -3);
     lua_setmetatable(state, -2);
+    lua_dup(state);
+    lua_rawsetp(state, -3, ptr);
+
+    lua_replace(state, -3);
+    lua_pop(state, 1);
     // stack: [userdata]
 }
 
@@ -754,6 +788,42 @@ static int meta_reinterpret_cast(lua_State *state)
     return 1;
 }
 
+/**
+ * Method: getter closures for fields of a struct type.
+ */
+static int meta_fields(lua_State *state)
+{
+    if (lua_gettop(state) != 2 || !lua_istable(state, 2))
+        luaL_error(state, "Usage: df.fields(type,{name,...})");
+
+    type_identity *id = get_object_identity(state, 1, "df.fields()", true);
+    if (id->type() != IDTYPE_STRUCT && id->type() != IDTYPE_CLASS)
+        luaL_error(state, "Struct or class type expected in df.fields()");
+
+    lua_pushlightuserdata(state, id); // () -> type
+
+    if (!LookupTypeInfo(state, true)) // type -> metatable?
+        BuildTypeMetatable(state, id); // () -> metatable
+
+    // The field table is UPVAL_FIELDTABLE of __index
+    lua_getfield(state, 3, "__index");
+    lua_getupvalue(state, 4, 3);
+    lua_remove(state, 4);
+
+    // stack: type names metatable fieldtable
+    int count = lua_rawlen(state, 2);
+    luaL_checkstack(state, count + 1, "too many fields in df.fields()");
+
+    for (int i = 1; i <= count; i++)
+    {
+        lua_rawgeti(state, 2, i);
+        PushFieldGetter(state, 3, 4, lua_gettop(state));
+        lua_remove(state, -2);
+    }
+
+    return count;
+}
+
 static void invoke_resize(lua_State *state, int table, lua_Integer size)
 {
     lua_getfield(state, table, "resize");
@@ -1756,6 +1826,10 @@ static int DoAttach(lua_State *state)
     lua_pushcclosure(state, meta_delete, 1);
     lua_setfield(state, LUA_REGISTRYINDEX, DFHACK_DELETE_NAME);
 
+    lua_rawgetp(state, LUA_REGISTRYINDEX, &DFHACK_TYPETABLE_TOKEN);
+    lua_pushcclosure(state, meta_fields, 1);
+    lua_setfield(state, LUA_REGISTRYINDEX, DFHACK_FIELDS_NAME);
+
     {
         // Assign df a metatable with read-only contents
         lua_newtable(state);
@@ -1780,6 +1854,8 @@ static int DoAttach(lua_State *state)
         lua_setfield(state, -2, "is_instance");
         lua_getfield(state, LUA_REGISTRYINDEX, DFHACK_CAST_NAME);
         lua_setfield(state, -2, "reinterpret_cast");
+        lua_getfield(state, LUA_REGISTRYINDEX, DFHACK_FIELDS_NAME);
+        lua_setfield(state, -2, "fields");
 
         lua_pushlightuserdata(state, NULL);
         lua_setfield(state, -2, "NULL");
@@ -1841,4 +1917,5 @@ namespace DFHack { namespace LuaWrapper {
     LuaToken DFHACK_ENUM_TABLE_TOKEN;
     LuaToken DFHACK_PTR_IDTABLE_TOKEN;
     LuaToken DFHACK_EMPTY_TABLE_TOKEN;
+    LuaToken DFHACK_REF_CACHE_TOKEN;
 }}
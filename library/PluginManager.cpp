@@ -29,6 +29,7 @@ distribution.
 #include "Core.h"
 #include "MemAccess.h"
 #include "PluginManager.h"
+#include "Profiler.h"
 #include "RemoteServer.h"
 #include "Console.h"
 #include "Types.h"
@@ -43,11 +44,18 @@ distribution.
 
 using namespace DFHack;
 
+#include <algorithm>
+#include <atomic>
+#include <ctime>
+#include <fstream>
 #include <string>
+#include <thread>
 #include <vector>
 #include <map>
 using namespace std;
 
+#include "json/json.h"
+
 #include "tinythread.h"
 
 #include <assert.h>
@@ -77,6 +85,49 @@ static string getPluginPath (std::string name)
     return getPluginPath() + name + plugin_suffix;
 }
 
+/*
+ * Reads plugin files ahead of the loader, so that opening them mostly
+ * hits the disk cache. The libraries themselves are still opened one at
+ * a time, as the system loader serializes that anyway, and plugin_init
+ * has to run in a fixed order.
+ */
+namespace {
+class PluginPrefetcher
+{
+    vector<string> paths;
+    std::atomic<size_t> next;
+    std::atomic<bool> stopping;
+    vector<std::thread> threads;
+
+    void run()
+    {
+        vector<char> buf(1 << 16);
+        size_t i;
+        while (!stopping && (i = next++) < paths.size())
+        {
+            ifstream file(paths[i].c_str(), ios::binary);
+            while (!stopping && file.read(buf.data(), buf.size()))
+                ;
+        }
+    }
+
+public:
+    PluginPrefetcher(const vector<string> &paths)
+        : paths(paths), next(0), stopping(false)
+    {
+        unsigned count = std::min(std::max(std::thread::hardware_concurrency(), 1U), 4U);
+        for (unsigned i = 0; i < count && i < paths.size(); i++)
+            threads.push_back(std::thread(&PluginPrefetcher::run, this));
+    }
+    ~PluginPrefetcher()
+    {
+        stopping = true;
+        for (auto &thread : threads)
+            thread.join();
+    }
+};
+}
+
 struct Plugin::RefLock
 {
     RefLock()
@@ -198,6 +249,8 @@ Plugin::Plugin(Core * core, const std::string & path,
     plugin_enable = 0;
     plugin_is_enabled = 0;
     state = PS_UNLOADED;
+    profile_source = Profiler::getSource(Profiler::PLUGIN, name);
+    open_ns = init_ns = 0;
     access = new RefLock();
 }
 
@@ -247,6 +300,7 @@ bool Plugin::load(color_ostream &con)
     // enter suspend
     CoreSuspender suspend;
     // open the library, etc
+    uint64_t load_start = Profiler::now();
     fprintf(stderr, "loading plugin %s\n", name.c_str());
     DFLibrary * plug = OpenPlugin(path.c_str());
     if(!plug)
@@ -352,7 +406,11 @@ bool Plugin::load(color_ostream &con)
     index_lua(plug);
     plugin_lib = plug;
     commands.clear();
-    if(plugin_init(con,commands) == CR_OK)
+    uint64_t init_start = Profiler::now();
+    open_ns = init_start - load_start;
+    command_result init_result = plugin_init(con,commands);
+    init_ns = Profiler::now() - init_start;
+    if(init_result == CR_OK)
     {
         RefAutolock lock(access);
         state = PS_LOADED;
@@ -535,6 +593,7 @@ command_result Plugin::on_update(color_ostream &out)
     access->lock_add();
     if(state == PS_LOADED && plugin_onupdate)
     {
+        Profiler::Scope timing(profile_source);
         cr = plugin_onupdate(out);
         Lua::Core::Reset(out, "plugin_onupdate");
     }
@@ -788,6 +847,7 @@ PluginManager::PluginManager(Core * core) : core(core)
     plugin_mutex = new tthread::recursive_mutex();
     cmdlist_mutex = new tthread::mutex();
     ruby = NULL;
+    listed_mtime = listed_at = -1;
 }
 
 PluginManager::~PluginManager()
@@ -804,7 +864,45 @@ PluginManager::~PluginManager()
 
 void PluginManager::init()
 {
-    loadAll();
+    MUTEX_GUARD(plugin_mutex);
+
+    // Plugins listed in the manifest are loaded on first use of one of
+    // their commands, e.g.
+    //   { "deferred": { "stocks": [ "stocks" ] } }
+    Json::Value manifest;
+    ifstream manifest_file("dfhack-config/plugins.json");
+    if (manifest_file.is_open())
+    {
+        try
+        {
+            manifest_file >> manifest;
+        }
+        catch (std::exception &e)
+        {
+            Core::printerr("Could not read dfhack-config/plugins.json: %s\n", e.what());
+            manifest = Json::Value();
+        }
+    }
+    Json::Value deferred = manifest.isObject() ? manifest["deferred"] : Json::Value();
+
+    vector<string> names;
+    auto files = listPlugins();
+    for (auto f = files.begin(); f != files.end(); ++f)
+    {
+        if (!deferred.isObject() || !deferred.isMember(*f) || !deferred[*f].isArray())
+        {
+            names.push_back(*f);
+            continue;
+        }
+        vector<string> commands;
+        for (auto cmd = deferred[*f].begin(); cmd != deferred[*f].end(); ++cmd)
+        {
+            if ((*cmd).isString())
+                commands.push_back((*cmd).asString());
+        }
+        deferPlugin(*f, commands);
+    }
+    loadList(names);
 
     bool any_loaded = false;
     for (auto p : all_plugins)
@@ -846,6 +944,14 @@ bool PluginManager::addPlugin(string name)
 
 vector<string> PluginManager::listPlugins()
 {
+    MUTEX_GUARD(plugin_mutex);
+
+    // The listing is reused while the directory is unchanged. Listings made
+    // in the same second as a change are not trusted, as mtime is in seconds.
+    int64_t mtime = Filesystem::mtime(getPluginPath());
+    if (mtime != -1 && mtime == listed_mtime && listed_at > mtime)
+        return listed_plugins;
+
     vector<string> results;
     vector<string> files;
     Filesystem::listdir(getPluginPath(), files);
@@ -857,6 +963,12 @@ vector<string> PluginManager::listPlugins()
             results.push_back(shortname);
         }
     }
+    // load in the same order everywhere
+    std::sort(results.begin(), results.end());
+
+    listed_plugins = results;
+    listed_mtime = mtime;
+    listed_at = time(NULL);
     return results;
 }
 
@@ -888,17 +1000,75 @@ bool PluginManager::load (const string &name)
 bool PluginManager::loadAll()
 {
     MUTEX_GUARD(plugin_mutex);
-    auto files = listPlugins();
-    bool ok = true;
     // load all plugins in hack/plugins
-    for (auto f = files.begin(); f != files.end(); ++f)
+    return loadList(listPlugins());
+}
+
+bool PluginManager::loadList(const vector<string> &names)
+{
+    MUTEX_GUARD(plugin_mutex);
+    vector<string> paths;
+    for (auto name = names.begin(); name != names.end(); ++name)
+        paths.push_back(getPluginPath(*name));
+    PluginPrefetcher prefetch(paths);
+
+    bool ok = true;
+    uint64_t start = Profiler::now();
+    vector<Plugin*> loaded;
+    for (auto name = names.begin(); name != names.end(); ++name)
     {
-        if (!load(*f))
+        if (!load(*name))
             ok = false;
+        Plugin *p = (*this)[*name];
+        if (p && p->getState() == Plugin::PS_LOADED)
+            loaded.push_back(p);
     }
+    uint64_t total_ns = Profiler::now() - start;
+
+    if (loaded.empty())
+        return ok;
+
+    std::sort(loaded.begin(), loaded.end(), [](Plugin *a, Plugin *b) {
+        return a->open_ns + a->init_ns > b->open_ns + b->init_ns;
+    });
+    fprintf(stderr, "Loaded %d plugins in %.1f ms:\n", int(loaded.size()), total_ns / 1e6);
+    fprintf(stderr, "  %-24s %9s %9s\n", "plugin", "open ms", "init ms");
+    for (auto p = loaded.begin(); p != loaded.end(); ++p)
+    {
+        fprintf(stderr, "  %-24s %9.2f %9.2f\n",
+            (*p)->getName().c_str(), (*p)->open_ns / 1e6, (*p)->init_ns / 1e6);
+    }
+    fflush(stderr);
     return ok;
 }
 
+void PluginManager::deferPlugin(const string &name, const vector<string> &commands)
+{
+    Plugin *p = (*this)[name];
+    if (!p || p->getState() == Plugin::PS_LOADED)
+        return;
+
+    tthread::lock_guard<tthread::mutex> lock(*cmdlist_mutex);
+    deferred_plugins.insert(name);
+    for (auto cmd = commands.begin(); cmd != commands.end(); ++cmd)
+    {
+        if (command_map.find(*cmd) == command_map.end())
+            command_map[*cmd] = p;
+    }
+    fprintf(stderr, "deferred plugin %s\n", name.c_str());
+}
+
+bool PluginManager::loadDeferred(const string &name)
+{
+    {
+        tthread::lock_guard<tthread::mutex> lock(*cmdlist_mutex);
+        // only one attempt, so a broken plugin doesn't retry on every command
+        if (!deferred_plugins.erase(name))
+            return false;
+    }
+    return load(name);
+}
+
 bool PluginManager::unload (const string &name)
 {
     MUTEX_GUARD(plugin_mutex);
@@ -960,12 +1130,21 @@ Plugin *PluginManager::getPluginByCommand(const std::string &command)
 command_result PluginManager::InvokeCommand(color_ostream &out, const std::string & command, std::vector <std::string> & parameters)
 {
     Plugin *plugin = getPluginByCommand(command);
+    if (plugin && plugin->getState() == Plugin::PS_UNLOADED)
+        loadDeferred(plugin->getName());
     return plugin ? plugin->invoke(out, command, parameters) : CR_NOT_IMPLEMENTED;
 }
 
 bool PluginManager::CanInvokeHotkey(const std::string &command, df::viewscreen *top)
 {
     Plugin *plugin = getPluginByCommand(command);
+    if (plugin && plugin->getState() == Plugin::PS_UNLOADED)
+    {
+        // checked once it is loaded by the invocation
+        tthread::lock_guard<tthread::mutex> lock(*cmdlist_mutex);
+        if (deferred_plugins.count(plugin->getName()))
+            return true;
+    }
     return plugin ? plugin->can_invoke_hotkey(command, top) : true;
 }
 
@@ -984,6 +1163,15 @@ void PluginManager::OnStateChange(color_ostream &out, state_change_event event)
 void PluginManager::registerCommands( Plugin * p )
 {
     cmdlist_mutex->lock();
+    // drop the placeholders of a deferred plugin
+    deferred_plugins.erase(p->getName());
+    for (auto it = command_map.begin(); it != command_map.end(); )
+    {
+        if (it->second == p)
+            it = command_map.erase(it);
+        else
+            ++it;
+    }
     vector <PluginCommand> & cmds = p->commands;
     for (size_t i = 0; i < cmds.size();i++)
     {
@@ -27,6 +27,7 @@ distribution.
 #include <errno.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 
 #include <string>
@@ -35,6 +36,7 @@ distribution.
 #include <set>
 #include <cstdio>
 #include <cstring>
+#include <fstream>
 using namespace std;
 
 #include <md5wrapper.h>
@@ -46,6 +48,43 @@ using namespace std;
 #include <string.h>
 using namespace DFHack;
 
+/*
+ * The MD5 of the executable is remembered along with the file's size,
+ * mtime and inode, so it is only computed again after the file changes.
+ */
+static const char *md5_cache_path = "hack/executable-md5.cache";
+
+static string getFingerprint(const string &path)
+{
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+        return "";
+
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%llu %lld.%09ld %llu %llu ",
+             (unsigned long long)info.st_size,
+             (long long)info.st_mtim.tv_sec, (long)info.st_mtim.tv_nsec,
+             (unsigned long long)info.st_dev, (unsigned long long)info.st_ino);
+    return buf + path;
+}
+
+static string getCachedMD5(const string &fingerprint)
+{
+    ifstream in(md5_cache_path);
+    string line, md5;
+    if (fingerprint.empty() || !getline(in, line) || line != fingerprint || !getline(in, md5))
+        return "";
+    return md5.size() == 32 ? md5 : "";
+}
+
+static void setCachedMD5(const string &fingerprint, const string &md5)
+{
+    if (fingerprint.empty())
+        return;
+    ofstream out(md5_cache_path, ios::trunc);
+    out << fingerprint << "\n" << md5 << "\n";
+}
+
 Process::Process(VersionInfoFactory * known_versions)
 {
     const char * dir_name = "/proc/self/";
@@ -68,13 +107,22 @@ Process::Process(VersionInfoFactory * known_versions)
         self_exe_name = self_exe;
 
     md5wrapper md5;
-    uint32_t length;
+    uint32_t length = 0;
     uint8_t first_kb [1024];
     memset(first_kb, 0, sizeof(first_kb));
-    // get hash of the running DF process
-    my_md5 = md5.getHashFromFile(self_exe_name, length, (char *) first_kb);
-    // create linux process, add it to the vector
-    VersionInfo * vinfo = known_versions->getVersionInfoByMD5(my_md5);
+    VersionInfo * vinfo = NULL;
+    string fingerprint = getFingerprint(self_exe_name);
+    my_md5 = getCachedMD5(fingerprint);
+    if (!my_md5.empty())
+        vinfo = known_versions->getVersionInfoByMD5(my_md5);
+    if (!vinfo)
+    {
+        // get hash of the running DF process
+        my_md5 = md5.getHashFromFile(self_exe_name, length, (char *) first_kb);
+        setCachedMD5(fingerprint, my_md5);
+        // create linux process, add it to the vector
+        vinfo = known_versions->getVersionInfoByMD5(my_md5);
+    }
     if(vinfo)
     {
         my_descriptor = new VersionInfo(*vinfo);
@@ -0,0 +1,273 @@
+/*
+https://github.com/peterix/dfhack
+Copyright (c) 2009-2012 Petr Mrázek (peterix@gmail.com)
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any
+damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any
+purpose, including commercial applications, and to alter it and
+redistribute it freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must
+not claim that you wrote the original software. If you use this
+software in a product, an acknowledgment in the product documentation
+would be appreciated but is not required.
+
+2. Altered source versions must be plainly marked as such, and
+must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any source
+distribution.
+*/
+
+#include "Internal.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <mutex>
+
+using namespace DFHack;
+using namespace DFHack::Profiler;
+
+namespace {
+    const int max_sources = 1024;
+    const uint64_t ring_size = 4096;
+
+    struct Sample
+    {
+        std::atomic<uint64_t> start;
+        std::atomic<uint64_t> duration;
+    };
+
+    /*
+     * A writer claims a slot by bumping head and then fills it in, so a
+     * reader racing with it may see the previous sample of that slot.
+     * That is harmless for statistics, and keeps recording lock-free.
+     */
+    struct Source
+    {
+        std::string name;
+        Category category;
+        std::atomic<uint64_t> head;
+        std::atomic<uint64_t> floor; // samples before this index were reset
+        Sample ring[ring_size];
+    };
+
+    struct Event
+    {
+        const Source *source;
+        uint64_t start;
+        uint64_t duration;
+    };
+
+    std::atomic<bool> enabled(true);
+    std::atomic<int> source_count(0);
+    Source *sources[max_sources];
+
+    std::mutex &registry_mutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    void collect(const Source *source, uint64_t since, std::vector<Event> &out)
+    {
+        uint64_t head = source->head.load(std::memory_order_acquire);
+        uint64_t first = head > ring_size ? head - ring_size : 0;
+        first = std::max(first, source->floor.load(std::memory_order_relaxed));
+
+        for (uint64_t i = first; i < head; i++)
+        {
+            const Sample &sample = source->ring[i % ring_size];
+            Event event = {
+                source,
+                sample.start.load(std::memory_order_relaxed),
+                sample.duration.load(std::memory_order_relaxed)
+            };
+            if (event.start != 0 && event.start >= since)
+                out.push_back(event);
+        }
+    }
+
+    uint64_t windowStart(uint64_t window_ns)
+    {
+        uint64_t t = now();
+        return window_ns < t ? t - window_ns : 0;
+    }
+
+    std::string jsonEscape(const std::string &s)
+    {
+        std::string out;
+        for (size_t i = 0; i < s.size(); i++)
+        {
+            unsigned char c = s[i];
+            if (c == '"' || c == '\\')
+            {
+                out += '\\';
+                out += c;
+            }
+            else if (c < 0x20)
+            {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            }
+            else
+                out += c;
+        }
+        return out;
+    }
+}
+
+bool Profiler::isEnabled()
+{
+    return enabled.load(std::memory_order_relaxed);
+}
+
+void Profiler::setEnabled(bool value)
+{
+    enabled.store(value, std::memory_order_relaxed);
+}
+
+int Profiler::getSource(Category category, const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(registry_mutex());
+
+    static std::map<std::pair<int, std::string>, int> ids;
+    auto key = std::make_pair(int(category), name);
+    auto it = ids.find(key);
+    if (it != ids.end())
+        return it->second;
+
+    int id = source_count.load(std::memory_order_relaxed);
+    if (id >= max_sources)
+        return -1;
+
+    Source *source = new Source();
+    source->name = name;
+    source->category = category;
+    sources[id] = source;
+    ids[key] = id;
+    source_count.store(id + 1, std::memory_order_release);
+    return id;
+}
+
+void Profiler::record(int id, uint64_t start_ns, uint64_t end_ns)
+{
+    if (id < 0 || id >= source_count.load(std::memory_order_acquire))
+        return;
+
+    Source *source = sources[id];
+    uint64_t index = source->head.fetch_add(1, std::memory_order_acq_rel);
+    Sample &sample = source->ring[index % ring_size];
+    sample.start.store(start_ns, std::memory_order_relaxed);
+    sample.duration.store(end_ns > start_ns ? end_ns - start_ns : 0, std::memory_order_relaxed);
+}
+
+std::vector<SourceStats> Profiler::getStats(uint64_t window_ns)
+{
+    std::vector<SourceStats> result;
+    uint64_t since = windowStart(window_ns);
+    int count = source_count.load(std::memory_order_acquire);
+
+    std::vector<Event> events;
+    std::vector<uint64_t> durations;
+    for (int i = 0; i < count; i++)
+    {
+        events.clear();
+        collect(sources[i], since, events);
+        if (events.empty())
+            continue;
+
+        durations.clear();
+        SourceStats stats;
+        stats.name = sources[i]->name;
+        stats.category = sources[i]->category;
+        stats.calls = events.size();
+        stats.total_ns = 0;
+        for (size_t j = 0; j < events.size(); j++)
+        {
+            durations.push_back(events[j].duration);
+            stats.total_ns += events[j].duration;
+        }
+
+        std::sort(durations.begin(), durations.end());
+        size_t last = durations.size() - 1;
+        stats.p50_ns = durations[last * 50 / 100];
+        stats.p95_ns = durations[last * 95 / 100];
+        stats.p99_ns = durations[last * 99 / 100];
+        stats.max_ns = durations[last];
+        result.push_back(stats);
+    }
+
+    std::sort(result.begin(), result.end(), [](const SourceStats &a, const SourceStats &b) {
+        return a.total_ns > b.total_ns;
+    });
+    return result;
+}
+
+void Profiler::reset()
+{
+    int count = source_count.load(std::memory_order_acquire);
+    for (int i = 0; i < count; i++)
+        sources[i]->floor.store(sources[i]->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+}
+
+bool Profiler::writeTrace(const std::string &path, uint64_t window_ns)
+{
+    uint64_t since = windowStart(window_ns);
+    int count = source_count.load(std::memory_order_acquire);
+
+    std::vector<Event> events;
+    for (int i = 0; i < count; i++)
+        collect(sources[i], since, events);
+
+    // Enclosing samples first, so viewers nest them correctly
+    std::sort(events.begin(), events.end(), [](const Event &a, const Event &b) {
+        if (a.start != b.start)
+            return a.start < b.start;
+        return a.duration > b.duration;
+    });
+
+    std::ofstream out(path.c_str());
+    if (!out.good())
+        return false;
+
+    uint64_t base = events.empty() ? 0 : events[0].start;
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (size_t i = 0; i < events.size(); i++)
+    {
+        const Event &event = events[i];
+        char times[64];
+        snprintf(times, sizeof(times), "\"ts\":%.3f,\"dur\":%.3f",
+                 (event.start - base) / 1000.0, event.duration / 1000.0);
+        out << (i ? ",\n" : "\n")
+            << "{\"name\":\"" << jsonEscape(event.source->name)
+            << "\",\"cat\":\"" << getCategoryName(event.source->category)
+            << "\",\"ph\":\"X\"," << times << ",\"pid\":1,\"tid\":1}";
+    }
+    out << "\n]}\n";
+    return out.good();
+}
+
+const char *Profiler::getCategoryName(Category category)
+{
+    switch (category)
+    {
+    case STAGE:
+        return "stage";
+    case PLUGIN:
+        return "plugin";
+    case EVENT_HANDLER:
+        return "event";
+    case LUA_TIMER:
+        return "lua-timer";
+    }
+    return "?";
+}
@@ -365,39 +365,13 @@ bool sendRemoteMessage(CSimpleSocket *socket, int16_t id, const MessageLite *msg
     return (got == fullsz);
 }
 
-command_result RemoteFunctionBase::execute(color_ostream &out,
-                                           const message_type *input, message_type *output)
+/*
+ * Reads text notifications until the final result or failure code
+ * of a call arrives, and decodes the result into output.
+ */
+static command_result receiveReply(color_ostream &out, CSimpleSocket *socket, MessageLite *output,
+                                   const char *plugin, const char *name)
 {
-    if (!isValid())
-    {
-        out.printerr("Calling an unbound RPC function %s::%s.\n",
-                     this->plugin.c_str(), this->name.c_str());
-        return CR_NOT_IMPLEMENTED;
-    }
-
-    if (!p_client->socket->IsSocketValid())
-    {
-        out.printerr("In call to %s::%s: invalid socket.\n",
-                     this->plugin.c_str(), this->name.c_str());
-        return CR_LINK_FAILURE;
-    }
-
-    int send_size = input->ByteSize();
-
-    if (send_size > RPCMessageHeader::MAX_MESSAGE_SIZE)
-    {
-        out.printerr("In call to %s::%s: message too large: %d.\n",
-                     this->plugin.c_str(), this->name.c_str(), send_size);
-        return CR_LINK_FAILURE;
-    }
-
-    if (!sendRemoteMessage(p_client->socket, id, input, true))
-    {
-        out.printerr("In call to %s::%s: I/O error in send.\n",
-                     this->plugin.c_str(), this->name.c_str());
-        return CR_LINK_FAILURE;
-    }
-
     color_ostream_proxy text_decoder(out);
     CoreTextNotification text_data;
 
@@ -406,10 +380,10 @@ command_result RemoteFunctionBase::execute(color_ostream &out,
     for (;;) {
         RPCMessageHeader header;
 
-        if (!readFullBuffer(p_client->socket, &header, sizeof(header)))
+        if (!readFullBuffer(socket, &header, sizeof(header)))
         {
             out.printerr("In call to %s::%s: I/O error in receive header.\n",
-                         this->plugin.c_str(), this->name.c_str());
+                         plugin, name);
             return CR_LINK_FAILURE;
         }
 
@@ -421,16 +395,17 @@ command_result RemoteFunctionBase::execute(color_ostream &out,
         if (header.size < 0 || header.size > RPCMessageHeader::MAX_MESSAGE_SIZE)
         {
             out.printerr("In call to %s::%s: invalid received size %d.\n",
-                         this->plugin.c_str(), this->name.c_str(), header.size);
+                         plugin, name, header.size);
             return CR_LINK_FAILURE;
         }
 
         uint8_t *buf = new uint8_t[header.size];
 
-        if (!readFullBuffer(p_client->socket, buf, header.size))
+        if (!readFullBuffer(socket, buf, header.size))
         {
             out.printerr("In call to %s::%s: I/O error in receive %d bytes of data.\n",
-                         this->plugin.c_str(), this->name.c_str(), header.size);
+                         plugin, name, header.size);
+            delete[] buf;
             return CR_LINK_FAILURE;
         }
 
@@ -439,7 +414,7 @@ command_result RemoteFunctionBase::execute(color_ostream &out,
             if (!output->ParseFromArray(buf, header.size))
             {
                 out.printerr("In call to %s::%s: error parsing received result.\n",
-                             this->plugin.c_str(), this->name.c_str());
+                             plugin, name);
                 delete[] buf;
                 return CR_LINK_FAILURE;
             }
@@ -453,7 +428,7 @@ command_result RemoteFunctionBase::execute(color_ostream &out,
                 text_decoder.decode(&text_data);
             else
                 out.printerr("In call to %s::%s: received invalid text data.\n",
-                             this->plugin.c_str(), this->name.c_str());
+                             plugin, name);
             break;
 
         default:
@@ -462,3 +437,116 @@ command_result RemoteFunctionBase::execute(color_ostream &out,
         delete[] buf;
     }
 }
+
+command_result RemoteFunctionBase::execute(color_ostream &out,
+                                           const message_type *input, message_type *output)
+{
+    if (!isValid())
+    {
+        out.printerr("Calling an unbound RPC function %s::%s.\n",
+                     this->plugin.c_str(), this->name.c_str());
+        return CR_NOT_IMPLEMENTED;
+    }
+
+    if (!p_client->socket->IsSocketValid())
+    {
+        out.printerr("In call to %s::%s: invalid socket.\n",
+                     this->plugin.c_str(), this->name.c_str());
+        return CR_LINK_FAILURE;
+    }
+
+    int send_size = input->ByteSize();
+
+    if (send_size > RPCMessageHeader::MAX_MESSAGE_SIZE)
+    {
+        out.printerr("In call to %s::%s: message too large: %d.\n",
+                     this->plugin.c_str(), this->name.c_str(), send_size);
+        return CR_LINK_FAILURE;
+    }
+
+    if (!sendRemoteMessage(p_client->socket, id, input, true))
+    {
+        out.printerr("In call to %s::%s: I/O error in send.\n",
+                     this->plugin.c_str(), this->name.c_str());
+        return CR_LINK_FAILURE;
+    }
+
+    return receiveReply(out, p_client->socket, output,
+                        this->plugin.c_str(), this->name.c_str());
+}
+
+void RemoteBatch::add(RemoteFunctionBase *function, const message_type *input, message_type *output)
+{
+    Call call = { function, output, CR_NOT_IMPLEMENTED };
+    calls.push_back(call);
+
+    auto item = request.add_calls();
+    item->set_id(function->id);
+    input->SerializeToString(item->mutable_input());
+}
+
+command_result RemoteBatch::execute(color_ostream &out)
+{
+    if (!client->active || !client->socket->IsSocketValid())
+    {
+        out.printerr("In batch call: client connection not valid.\n");
+        return CR_LINK_FAILURE;
+    }
+
+    for (size_t i = 0; i < calls.size(); i++)
+    {
+        auto fn = calls[i].function;
+
+        if (!fn->isValid() || fn->p_client != client)
+        {
+            out.printerr("Batching an unbound RPC function %s::%s.\n",
+                         fn->plugin.c_str(), fn->name.c_str());
+            return CR_NOT_IMPLEMENTED;
+        }
+    }
+
+    int send_size = request.ByteSize();
+
+    if (send_size > RPCMessageHeader::MAX_MESSAGE_SIZE)
+    {
+        out.printerr("In batch call: message too large: %d.\n", send_size);
+        return CR_LINK_FAILURE;
+    }
+
+    if (!sendRemoteMessage(client->socket, RPC_REQUEST_BATCH, &request, true))
+    {
+        out.printerr("In batch call: I/O error in send.\n");
+        return CR_LINK_FAILURE;
+    }
+
+    dfproto::CoreBatchReply reply;
+
+    command_result res = receiveReply(out, client->socket, &reply, "", "batch");
+    if (res != CR_OK)
+        return res;
+
+    if (reply.results_size() != (int)calls.size())
+    {
+        out.printerr("In batch call: expected %d results, got %d.\n",
+                     (int)calls.size(), reply.results_size());
+        return CR_LINK_FAILURE;
+    }
+
+    for (size_t i = 0; i < calls.size(); i++)
+    {
+        auto &item = reply.results(i);
+        auto &call = calls[i];
+
+        call.result = command_result(item.code());
+        call.output->Clear();
+
+        if (call.result == CR_OK && !call.output->ParseFromString(item.output()))
+        {
+            out.printerr("In call to %s::%s: error parsing received result.\n",
+                         call.function->plugin.c_str(), call.function->name.c_str());
+            call.result = CR_LINK_FAILURE;
+        }
+    }
+
+    return CR_OK;
+}
@@ -57,10 +57,20 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <sstream>
 
 #include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
 
 #include "json/json.h"
 #include "tinythread.h"
 
+#ifdef _LINUX
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#define RPC_USE_EPOLL
+#endif
+
 using namespace DFHack;
 using namespace tthread;
 
@@ -127,20 +137,50 @@ void RPCService::dumpMethods(std::ostream & out) const
     }
 }
 
-ServerConnection::ServerConnection(CActiveSocket *socket)
-    : socket(socket), stream(this)
+
+/*
+ * Registry of live connections, used for stats reporting.
+ */
+
+static std::mutex connection_registry_mutex;
+static std::set<ServerConnection*> connection_registry;
+static int next_connection_id = 1;
+
+ServerConnection::ServerConnection(CActiveSocket *socket, ServerReactor *reactor)
+    : socket(socket), stream(this),
+      bytes_in(0), bytes_out(0), calls(0), failed_calls(0),
+      queue_depth(0), max_queue_depth(0),
+      thread(NULL), reactor(reactor), handshake_done(false), inbuf_pos(0),
+      outbuf_pos(0), own_thread(false), wants_own_thread(false)
 {
     in_error = false;
 
+    const char *addr = socket->GetClientAddr();
+    address = addr ? addr : "";
+
     core_service = new CoreService();
     core_service->finalize(this, &functions);
 
-    thread = new tthread::thread(threadFn, (void*)this);
-    thread->detach();
+    {
+        std::lock_guard<std::mutex> lock(connection_registry_mutex);
+        id = next_connection_id++;
+        connection_registry.insert(this);
+    }
+
+    if (!reactor)
+    {
+        thread = new tthread::thread(threadFn, (void*)this);
+        thread->detach();
+    }
 }
 
 ServerConnection::~ServerConnection()
 {
+    {
+        std::lock_guard<std::mutex> lock(connection_registry_mutex);
+        connection_registry.erase(this);
+    }
+
     in_error = true;
     socket->Close();
     delete socket;
@@ -152,6 +192,30 @@ ServerConnection::~ServerConnection()
     delete core_service;
 }
 
+void ServerConnection::getStats(ServerConnectionStats *stats)
+{
+    stats->id = id;
+    stats->address = address;
+    stats->multiplexed = isNonBlocking();
+    stats->bytes_in = bytes_in;
+    stats->bytes_out = bytes_out;
+    stats->calls = calls;
+    stats->failed_calls = failed_calls;
+    stats->queue_depth = queue_depth;
+    stats->max_queue_depth = max_queue_depth;
+}
+
+void ServerConnection::listStats(std::vector<ServerConnectionStats> *out)
+{
+    std::lock_guard<std::mutex> lock(connection_registry_mutex);
+
+    out->resize(connection_registry.size());
+
+    size_t i = 0;
+    for (auto conn : connection_registry)
+        conn->getStats(&(*out)[i++]);
+}
+
 ServerFunctionBase *ServerConnection::findFunction(color_ostream &out, const std::string &plugin, const std::string &name)
 {
     RPCService *svc;
@@ -186,6 +250,110 @@ ServerFunctionBase *ServerConnection::findFunction(color_ostream &out, const std
     return svc->getFunction(name);
 }
 
+/*
+ * On a reactor thread, sends never wait: whatever the socket doesn't
+ * take is kept in outbuf, and sent when the socket becomes writable.
+ */
+bool ServerConnection::sendRaw(const void *data, int size)
+{
+    if (isNonBlocking())
+    {
+        outbuf.insert(outbuf.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+        if (!flushOutput(false))
+            return false;
+    }
+    else if (socket->Send((const uint8_t*)data, size) != size)
+        return false;
+
+    bytes_out += size;
+    return true;
+}
+
+bool ServerConnection::sendMessage(int16_t id, const MessageLite *msg, bool size_ready)
+{
+    if (isNonBlocking())
+    {
+        int size = size_ready ? msg->GetCachedSize() : msg->ByteSize();
+        std::vector<uint8_t> data(size + sizeof(RPCMessageHeader));
+
+        RPCMessageHeader *hdr = (RPCMessageHeader*)data.data();
+        hdr->id = id;
+        hdr->size = size;
+        msg->SerializeWithCachedSizesToArray(data.data() + sizeof(RPCMessageHeader));
+
+        return sendRaw(data.data(), (int)data.size());
+    }
+
+    if (!sendRemoteMessage(socket, id, msg, size_ready))
+        return false;
+
+    bytes_out += msg->GetCachedSize() + sizeof(RPCMessageHeader);
+    return true;
+}
+
+/*
+ * Sends buffered output. Without block, returns true as soon as the
+ * socket is full. Returns false on socket error.
+ */
+bool ServerConnection::flushOutput(bool block)
+{
+#ifdef RPC_USE_EPOLL
+    int fd = socket->GetSocketDescriptor();
+
+    while (outbuf_pos < outbuf.size())
+    {
+        ssize_t cnt = ::send(fd, outbuf.data() + outbuf_pos, outbuf.size() - outbuf_pos,
+                             MSG_NOSIGNAL | (block ? 0 : MSG_DONTWAIT));
+
+        if (cnt > 0)
+        {
+            outbuf_pos += cnt;
+            continue;
+        }
+
+        if (cnt < 0 && errno == EINTR)
+            continue;
+        if (cnt < 0 && !block && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+
+        return false;
+    }
+
+    if (outbuf.capacity() > 1048576)
+        std::vector<uint8_t>().swap(outbuf);
+    else
+        outbuf.clear();
+    outbuf_pos = 0;
+#endif
+    return true;
+}
+
+/*
+ * True if the request calls a function that may block for long,
+ * directly or as part of a batch.
+ */
+bool ServerConnection::mayBlock(const RPCMessageHeader &header, const uint8_t *data)
+{
+    if ((DFHack::DFHackReplyCode)header.id == RPC_REQUEST_BATCH)
+    {
+        dfproto::CoreBatchRequest request;
+        if (!request.ParseFromArray(data, header.size))
+            return false;
+
+        for (int i = 0; i < request.calls_size(); i++)
+        {
+            ServerFunctionBase *fn = vector_get(functions, request.calls(i).id());
+            if (fn && (fn->flags & SF_MAY_BLOCK))
+                return true;
+        }
+
+        return false;
+    }
+
+    ServerFunctionBase *fn = vector_get(functions, header.id);
+    return fn && (fn->flags & SF_MAY_BLOCK);
+}
+
 void ServerConnection::connection_ostream::flush_proxy()
 {
     if (owner->in_error)
@@ -209,13 +377,226 @@ void ServerConnection::connection_ostream::flush_proxy()
 
     buffer.clear();
 
-    if (!sendRemoteMessage(owner->socket, RPC_REPLY_TEXT, &msg, false))
+    if (!owner->sendMessage(RPC_REPLY_TEXT, &msg, false))
     {
         owner->in_error = true;
         Core::printerr("Error writing text into client socket.\n");
     }
 }
 
+bool ServerConnection::handshake(color_ostream &out, RPCHandshakeHeader &header)
+{
+    if (memcmp(header.magic, RPCHandshakeHeader::REQUEST_MAGIC, sizeof(header.magic)) ||
+        header.version < 1 || header.version > 255)
+    {
+        out << "In RPC server: invalid handshake header." << endl;
+        return false;
+    }
+
+    memcpy(header.magic, RPCHandshakeHeader::RESPONSE_MAGIC, sizeof(header.magic));
+    header.version = 1;
+
+    if (!sendRaw(&header, sizeof(header)))
+    {
+        out << "In RPC server: could not send handshake response." << endl;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Decodes the input arguments of fn and runs it. If suspend is given,
+ * it is locked as needed and left locked for the next call, so that
+ * consecutive calls can share one suspend window.
+ */
+command_result ServerConnection::invoke(ServerFunctionBase *fn, int id, const void *data, int size,
+                                        CoreSuspender *suspend)
+{
+    calls++;
+
+    if (!fn)
+    {
+        stream.printerr("RPC call of invalid id %d\n", id);
+        return CR_FAILURE;
+    }
+
+    if (((fn->flags & SF_ALLOW_REMOTE) != SF_ALLOW_REMOTE) && strcmp(socket->GetClientAddr(), "127.0.0.1") != 0)
+    {
+        stream.printerr("In call to %s: forbidden host: %s\n", fn->name, socket->GetClientAddr());
+        return CR_FAILURE;
+    }
+
+    if (!fn->in()->ParseFromArray(data, size))
+    {
+        stream.printerr("In call to %s: could not decode input args.\n", fn->name);
+        return CR_FAILURE;
+    }
+
+    if (fn->flags & SF_DONT_SUSPEND)
+    {
+        if (suspend && suspend->owns_lock())
+            suspend->unlock();
+
+        return fn->execute(stream);
+    }
+    else if (suspend)
+    {
+        if (!suspend->owns_lock())
+            suspend->lock();
+
+        return fn->execute(stream);
+    }
+    else
+    {
+        CoreSuspender scoped;
+        return fn->execute(stream);
+    }
+}
+
+bool ServerConnection::processMessage(color_ostream &out, RPCMessageHeader &header, const uint8_t *data)
+{
+    //out.print("Handling %d:%d\n", header.id, header.size);
+
+    if ((DFHack::DFHackReplyCode)header.id == RPC_REQUEST_BATCH)
+        return processBatch(out, header, data);
+
+    // Find and call the function
+    int in_size = header.size;
+
+    ServerFunctionBase *fn = vector_get(functions, header.id);
+    command_result res = invoke(fn, header.id, data, header.size, NULL);
+    MessageLite *reply = (res == CR_OK) ? fn->out() : NULL;
+
+    // Flush all text output
+    if (in_error)
+        return false;
+
+    //out.print("Answer %d:%d\n", res, reply);
+
+    // Send reply
+    int out_size = (reply ? reply->ByteSize() : 0);
+
+    if (out_size > RPCMessageHeader::MAX_MESSAGE_SIZE)
+    {
+        stream.printerr("In call to %s: reply too large: %d.\n",
+                            (fn ? fn->name : "UNKNOWN"), out_size);
+        res = CR_LINK_FAILURE;
+    }
+
+    stream.flush();
+
+    if (res == CR_OK && reply)
+    {
+        if (!sendMessage(RPC_REPLY_RESULT, reply, true))
+        {
+            out.printerr("In RPC server: I/O error in send result.\n");
+            return false;
+        }
+    }
+    else
+    {
+        failed_calls++;
+
+        header.id = RPC_REPLY_FAIL;
+        header.size = res;
+
+        if (!sendRaw(&header, sizeof(header)))
+        {
+            out.printerr("In RPC server: I/O error in send failure code.\n");
+            return false;
+        }
+    }
+
+    // Cleanup; a failed call may have left a large partial reply behind
+    if (fn)
+    {
+        fn->reset((fn->flags & SF_CALLED_ONCE) || res != CR_OK ||
+                  (out_size > 128*1024 || in_size > 32*1024));
+    }
+
+    return true;
+}
+
+/*
+ * Runs all calls of a CoreBatchRequest in order and sends back their
+ * results in one CoreBatchReply. A single CoreSuspender is held across
+ * consecutive calls that need the core suspended.
+ */
+bool ServerConnection::processBatch(color_ostream &out, RPCMessageHeader &header, const uint8_t *data)
+{
+    dfproto::CoreBatchRequest request;
+    dfproto::CoreBatchReply reply;
+    command_result res = CR_OK;
+
+    if (!request.ParseFromArray(data, header.size))
+    {
+        stream.printerr("In batch call: could not decode input args.\n");
+        res = CR_FAILURE;
+    }
+    else
+    {
+        CoreSuspender suspend(std::defer_lock);
+
+        for (int i = 0; i < request.calls_size(); i++)
+        {
+            auto &call = request.calls(i);
+            auto item = reply.add_results();
+
+            ServerFunctionBase *fn = vector_get(functions, call.id());
+            command_result rv = invoke(fn, call.id(), call.input().data(),
+                                       (int)call.input().size(), &suspend);
+
+            item->set_code(dfproto::CoreErrorNotification::ErrorCode(rv));
+            if (rv == CR_OK)
+                fn->out()->SerializeToString(item->mutable_output());
+
+            if (fn)
+            {
+                fn->reset((fn->flags & SF_CALLED_ONCE) || rv != CR_OK ||
+                          (item->output().size() > 128*1024 || call.input().size() > 32*1024));
+            }
+
+            if (in_error)
+                return false;
+        }
+    }
+
+    int out_size = reply.ByteSize();
+
+    if (out_size > RPCMessageHeader::MAX_MESSAGE_SIZE)
+    {
+        stream.printerr("In batch call: reply too large: %d.\n", out_size);
+        res = CR_LINK_FAILURE;
+    }
+
+    stream.flush();
+
+    if (res == CR_OK)
+    {
+        if (!sendMessage(RPC_REPLY_RESULT, &reply, true))
+        {
+            out.printerr("In RPC server: I/O error in send batch result.\n");
+            return false;
+        }
+    }
+    else
+    {
+        failed_calls++;
+
+        header.id = RPC_REPLY_FAIL;
+        header.size = res;
+
+        if (!sendRaw(&header, sizeof(header)))
+        {
+            out.printerr("In RPC server: I/O error in send failure code.\n");
+            return false;
+        }
+    }
+
+    return true;
+}
+
 void ServerConnection::threadFn(void *arg)
 {
     ServerConnection *me = (ServerConnection*)arg;
@@ -240,21 +621,10 @@ void ServerConnection::threadFn()
             return;
         }
 
-        if (memcmp(header.magic, RPCHandshakeHeader::REQUEST_MAGIC, sizeof(header.magic)) ||
-            header.version < 1 || header.version > 255)
-        {
-            out << "In RPC server: invalid handshake header." << endl;
-            return;
-        }
-
-        memcpy(header.magic, RPCHandshakeHeader::RESPONSE_MAGIC, sizeof(header.magic));
-        header.version = 1;
+        bytes_in += sizeof(header);
 
-        if (socket->Send((uint8*)&header, sizeof(header)) != sizeof(header))
-        {
-            out << "In RPC server: could not send handshake response." << endl;
+        if (!handshake(out, header))
             return;
-        }
     }
 
     /* Processing */
@@ -288,99 +658,312 @@ void ServerConnection::threadFn()
             break;
         }
 
-        //out.print("Handling %d:%d\n", header.id, header.size);
+        bytes_in += sizeof(header) + header.size;
 
-        // Find and call the function
-        int in_size = header.size;
+        if (!processMessage(out, header, buf.get()))
+            break;
+    }
 
-        ServerFunctionBase *fn = vector_get(functions, header.id);
-        MessageLite *reply = NULL;
-        command_result res = CR_FAILURE;
+    std::cerr << "Shutting down client connection." << endl;
+}
 
-        if (!fn)
+/*
+ * Appends whatever input the socket has to the connection buffer.
+ * In non-blocking mode, returns true once the socket runs dry; in
+ * blocking mode, waits for at least one chunk. Returns false on
+ * EOF or socket error.
+ */
+bool ServerConnection::readAvailable(color_ostream &out, bool block)
+{
+#ifdef RPC_USE_EPOLL
+    const size_t max_pending = 1048576;
+    uint8_t tmp[16384];
+    int fd = socket->GetSocketDescriptor();
+
+    for (;;)
+    {
+        ssize_t cnt = ::recv(fd, tmp, sizeof(tmp), block ? 0 : MSG_DONTWAIT);
+
+        if (cnt > 0)
         {
-            stream.printerr("RPC call of invalid id %d\n", header.id);
+            inbuf.insert(inbuf.end(), tmp, tmp + cnt);
+            bytes_in += cnt;
+
+            // Anything left over re-triggers the level-triggered poll
+            if (block || inbuf.size() - inbuf_pos >= max_pending)
+                return true;
+            continue;
         }
-        else
+
+        if (cnt < 0 && errno == EINTR)
+            continue;
+        if (cnt < 0 && !block && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+        if (cnt < 0)
+            out.printerr("In RPC server: I/O error in receive: %s\n", strerror(errno));
+
+        return false;
+    }
+#else
+    return false;
+#endif
+}
+
+/*
+ * Executes every complete request currently in the input buffer.
+ * Returns false if the connection must be closed.
+ */
+bool ServerConnection::processBuffered(color_ostream &out)
+{
+    if (!handshake_done)
+    {
+        if (inbuf.size() - inbuf_pos < sizeof(RPCHandshakeHeader))
+            return true;
+
+        RPCHandshakeHeader header;
+        memcpy(&header, inbuf.data() + inbuf_pos, sizeof(header));
+        inbuf_pos += sizeof(header);
+
+        if (!handshake(out, header))
+            return false;
+
+        handshake_done = true;
+        std::cerr << "Client connection established." << endl;
+    }
+
+    // Count complete requests waiting to be executed
+    int pending = 0;
+
+    for (size_t pos = inbuf_pos; inbuf.size() - pos >= sizeof(RPCMessageHeader); )
+    {
+        RPCMessageHeader header;
+        memcpy(&header, inbuf.data() + pos, sizeof(header));
+
+        if (header.size < 0 || inbuf.size() - pos - sizeof(header) < size_t(header.size))
+            break;
+
+        pos += sizeof(header) + header.size;
+        pending++;
+    }
+
+    queue_depth = pending;
+    if (pending > max_queue_depth)
+        max_queue_depth = pending;
+
+    bool ok = true;
+
+    while (ok && !in_error)
+    {
+        size_t avail = inbuf.size() - inbuf_pos;
+        if (avail < sizeof(RPCMessageHeader))
+            break;
+
+        RPCMessageHeader header;
+        memcpy(&header, inbuf.data() + inbuf_pos, sizeof(header));
+
+        if ((DFHack::DFHackReplyCode)header.id == RPC_REQUEST_QUIT)
         {
-            if (((fn->flags & SF_ALLOW_REMOTE) != SF_ALLOW_REMOTE) && strcmp(socket->GetClientAddr(), "127.0.0.1") != 0)
-            {
-                stream.printerr("In call to %s: forbidden host: %s\n", fn->name, socket->GetClientAddr());
-            }
-            else if (!fn->in()->ParseFromArray(buf.get(), header.size))
-            {
-                stream.printerr("In call to %s: could not decode input args.\n", fn->name);
-            }
-            else
-            {
-                buf.reset();
-
-                reply = fn->out();
-
-                if (fn->flags & SF_DONT_SUSPEND)
-                {
-                    res = fn->execute(stream);
-                }
-                else
-                {
-                    CoreSuspender suspend;
-                    res = fn->execute(stream);
-                }
-            }
+            ok = false;
+            break;
+        }
+
+        if (header.size < 0 || header.size > RPCMessageHeader::MAX_MESSAGE_SIZE)
+        {
+            out.printerr("In RPC server: invalid received size %d.\n", header.size);
+            ok = false;
+            break;
         }
 
-        // Flush all text output
-        if (in_error)
+        if (avail - sizeof(header) < size_t(header.size))
             break;
 
-        //out.print("Answer %d:%d\n", res, reply);
+        // Wait for earlier replies to go out, so output can't pile up
+        if (outbuf_pos < outbuf.size())
+            break;
 
-        // Send reply
-        int out_size = (reply ? reply->ByteSize() : 0);
+        const uint8_t *data = inbuf.data() + inbuf_pos + sizeof(header);
 
-        if (out_size > RPCMessageHeader::MAX_MESSAGE_SIZE)
+        if (isNonBlocking() && mayBlock(header, data))
         {
-            stream.printerr("In call to %s: reply too large: %d.\n",
-                                (fn ? fn->name : "UNKNOWN"), out_size);
-            res = CR_LINK_FAILURE;
+            wants_own_thread = true;
+            break;
         }
 
-        stream.flush();
+        ok = processMessage(out, header, data);
+
+        inbuf_pos += sizeof(header) + header.size;
+        if (queue_depth > 0)
+            queue_depth--;
+    }
+
+    // Drop consumed input
+    if (inbuf_pos >= inbuf.size())
+    {
+        if (inbuf.capacity() > 1048576)
+            std::vector<uint8_t>().swap(inbuf);
+        else
+            inbuf.clear();
+    }
+    else if (inbuf_pos > 0)
+        inbuf.erase(inbuf.begin(), inbuf.begin() + inbuf_pos);
+
+    inbuf_pos = 0;
+
+    return ok && !in_error;
+}
+
+/*
+ * Serves all client connections from a small fixed pool of threads.
+ *
+ * Every worker waits on the same epoll set, and connections are
+ * registered with EPOLLONESHOT, so a connection is only ever being
+ * handled by one worker at a time.
+ *
+ * Workers never wait on a single client: replies the socket doesn't
+ * take are sent once it becomes writable, and before a call that may
+ * block (SF_MAY_BLOCK, e.g. CoreSuspend, RunCommand or a long poll)
+ * the connection moves to a thread of its own for the rest of its life.
+ * CoreSuspend needs that anyway, since the core lock must be released
+ * by the thread that took it.
+ */
+namespace DFHack {
+    class ServerReactor {
+        int epoll_fd;
+
+        enum Status { WAIT, CLOSE, OWN_THREAD };
+
+        void workerFn();
+        Status serve(color_ostream &out, ServerConnection *conn);
+        static void ownThreadFn(ServerConnection *conn);
+
+    public:
+        ServerReactor() : epoll_fd(-1) {}
+
+        bool start(int num_threads);
+        bool add(ServerConnection *conn);
+    };
+}
+
+bool ServerReactor::start(int num_threads)
+{
+#ifdef RPC_USE_EPOLL
+    if (num_threads <= 0)
+        return false;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+        return false;
+
+    // Detached like the accept thread: they live as long as the process.
+    for (int i = 0; i < num_threads; i++)
+        std::thread(&ServerReactor::workerFn, this).detach();
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool ServerReactor::add(ServerConnection *conn)
+{
+#ifdef RPC_USE_EPOLL
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.ptr = conn;
+
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn->socket->GetSocketDescriptor(), &ev) == 0;
+#else
+    return false;
+#endif
+}
+
+ServerReactor::Status ServerReactor::serve(color_ostream &out, ServerConnection *conn)
+{
+    if (!conn->flushOutput(false))
+        return CLOSE;
+
+    // Don't take more input from a client that isn't reading its replies
+    bool ok = conn->outbuf_pos < conn->outbuf.size() || conn->readAvailable(out, false);
+
+    if (!conn->processBuffered(out))
+        return CLOSE;
+
+    if (conn->wants_own_thread)
+        return OWN_THREAD;
+
+    return ok ? WAIT : CLOSE;
+}
+
+void ServerReactor::ownThreadFn(ServerConnection *conn)
+{
+    color_ostream_proxy out(Core::getInstance().getConsole());
+
+    conn->own_thread = true;
+    conn->wants_own_thread = false;
+
+    bool ok = conn->flushOutput(true);
+
+    while (ok && conn->processBuffered(out))
+        ok = conn->readAvailable(out, true);
+
+    std::cerr << "Shutting down client connection." << endl;
+    delete conn;
+}
+
+void ServerReactor::workerFn()
+{
+#ifdef RPC_USE_EPOLL
+    color_ostream_proxy out(Core::getInstance().getConsole());
 
-        if (res == CR_OK && reply)
+    for (;;)
+    {
+        epoll_event ev;
+
+        int cnt = epoll_wait(epoll_fd, &ev, 1, -1);
+        if (cnt < 0 && errno == EINTR)
+            continue;
+        if (cnt < 0)
         {
-            if (!sendRemoteMessage(socket, RPC_REPLY_RESULT, reply, true))
-            {
-                out.printerr("In RPC server: I/O error in send result.\n");
-                break;
-            }
+            out.printerr("In RPC server: epoll_wait failed: %s\n", strerror(errno));
+            return;
         }
-        else
+        if (cnt == 0)
+            continue;
+
+        ServerConnection *conn = (ServerConnection*)ev.data.ptr;
+        int fd = conn->socket->GetSocketDescriptor();
+
+        Status status = serve(out, conn);
+
+        if (status == WAIT)
         {
-            header.id = RPC_REPLY_FAIL;
-            header.size = res;
+            bool writing = conn->outbuf_pos < conn->outbuf.size();
+            ev.events = (writing ? EPOLLOUT : EPOLLIN) | EPOLLRDHUP | EPOLLONESHOT;
+            ev.data.ptr = conn;
 
-            if (socket->Send((uint8_t*)&header, sizeof(header)) != sizeof(header))
-            {
-                out.printerr("In RPC server: I/O error in send failure code.\n");
-                break;
-            }
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0)
+                continue;
         }
 
-        // Cleanup
-        if (fn)
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+
+        if (status == OWN_THREAD)
         {
-            fn->reset((fn->flags & SF_CALLED_ONCE) ||
-                      (out_size > 128*1024 || in_size > 32*1024));
+            std::thread(ownThreadFn, conn).detach();
+            continue;
         }
-    }
 
-    std::cerr << "Shutting down client connection." << endl;
+        std::cerr << "Shutting down client connection." << endl;
+        delete conn;
+    }
+#endif
 }
 
 ServerMain::ServerMain()
 {
     socket = new CPassiveSocket();
+    reactor = NULL;
     thread = NULL;
 }
 
@@ -389,6 +972,8 @@ ServerMain::~ServerMain()
     socket->Close();
     delete socket;
     delete thread;
+    // The reactor workers are detached and may still be polling,
+    // so the reactor itself is intentionally not destroyed.
 }
 
 bool ServerMain::listen(int port)
@@ -414,9 +999,15 @@ bool ServerMain::listen(int port)
         allow_remote = configJson.get("allow_remote", "false").asBool();
     }
 
+    // 0 selects the legacy thread-per-connection mode. Blocking calls get
+    // their own thread, so the pool only needs to cover concurrent short
+    // calls, several of which may wait for the core at the same time.
+    int io_threads = configJson.get("io_threads", 2).asInt();
+
     // rewrite/normalize config file
     configJson["allow_remote"] = allow_remote;
     configJson["port"] = configJson.get("port", RemoteClient::DEFAULT_PORT);
+    configJson["io_threads"] = io_threads;
 
     std::ofstream outFile(filename, std::ios_base::trunc);
 
@@ -438,6 +1029,17 @@ bool ServerMain::listen(int port)
             return false;
     }
 
+    if (io_threads > 0)
+    {
+        reactor = new ServerReactor();
+
+        if (!reactor->start(io_threads))
+        {
+            delete reactor;
+            reactor = NULL;
+        }
+    }
+
     thread = new tthread::thread(threadFn, this);
     thread->detach();
     return true;
@@ -450,6 +1052,17 @@ void ServerMain::threadFn(void *arg)
 
     while ((client = me->socket->Accept()) != NULL)
     {
-        new ServerConnection(client);
+        if (me->reactor)
+        {
+            auto conn = new ServerConnection(client, me->reactor);
+
+            if (!me->reactor->add(conn))
+            {
+                std::cerr << "In RPC server: could not register client connection." << endl;
+                delete conn;
+            }
+        }
+        else
+            new ServerConnection(client);
     }
 }
@@ -50,6 +50,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "MiscUtils.h"
 #include "VersionInfo.h"
 #include "DFHackVersion.h"
+#include "Profiler.h"
 
 #include "modules/Materials.h"
 #include "modules/Translation.h"
@@ -652,6 +653,31 @@ static command_result SetUnitLabors(color_ostream &stream, const SetUnitLaborsIn
     return CR_OK;
 }
 
+static command_result GetProfile(color_ostream &stream,
+                                 const dfproto::CoreProfileRequest *in,
+                                 dfproto::CoreProfileList *out)
+{
+    int window_ms = in->has_window_ms() ? in->window_ms() : 10000;
+    if (window_ms <= 0)
+        return CR_WRONG_USAGE;
+
+    auto stats = Profiler::getStats(uint64_t(window_ms) * 1000000);
+    for (auto &st : stats)
+    {
+        auto item = out->add_value();
+        item->set_name(st.name);
+        item->set_category(Profiler::getCategoryName(st.category));
+        item->set_calls(st.calls);
+        item->set_total_ns(st.total_ns);
+        item->set_p50_ns(st.p50_ns);
+        item->set_p95_ns(st.p95_ns);
+        item->set_p99_ns(st.p99_ns);
+        item->set_max_ns(st.max_ns);
+    }
+
+    return CR_OK;
+}
+
 CoreService::CoreService() :
     suspend_depth{0},
     coreSuspender{nullptr}
@@ -659,13 +685,15 @@ CoreService::CoreService() :
 
     // These 2 methods must be first, so that they get id 0 and 1
     addMethod("BindMethod", &CoreService::BindMethod, SF_DONT_SUSPEND | SF_ALLOW_REMOTE);
-    addMethod("RunCommand", &CoreService::RunCommand, SF_DONT_SUSPEND);
+    addMethod("RunCommand", &CoreService::RunCommand, SF_DONT_SUSPEND | SF_MAY_BLOCK);
 
     // Add others here:
-    addMethod("CoreSuspend", &CoreService::CoreSuspend, SF_DONT_SUSPEND | SF_ALLOW_REMOTE);
+    addMethod("CoreSuspend", &CoreService::CoreSuspend, SF_DONT_SUSPEND | SF_ALLOW_REMOTE | SF_MAY_BLOCK);
     addMethod("CoreResume", &CoreService::CoreResume, SF_DONT_SUSPEND | SF_ALLOW_REMOTE);
 
-    addMethod("RunLua", &CoreService::RunLua);
+    addMethod("RunLua", &CoreService::RunLua, SF_MAY_BLOCK);
+
+    addMethod("ListConnections", &CoreService::ListConnections, SF_DONT_SUSPEND);
 
     // Functions:
     addFunction("GetVersion", GetVersion, SF_DONT_SUSPEND | SF_ALLOW_REMOTE);
@@ -681,6 +709,8 @@ CoreService::CoreService() :
     addFunction("ListSquads", ListSquads, SF_ALLOW_REMOTE);
 
     addFunction("SetUnitLabors", SetUnitLabors, SF_ALLOW_REMOTE);
+
+    addFunction("GetProfile", GetProfile, SF_DONT_SUSPEND);
 }
 
 CoreService::~CoreService()
@@ -745,6 +775,32 @@ command_result CoreService::CoreResume(color_ostream &stream, const EmptyMessage
     return CR_OK;
 }
 
+command_result CoreService::ListConnections(color_ostream &stream, const EmptyMessage*,
+                                            dfproto::CoreConnectionList *out)
+{
+    std::vector<ServerConnectionStats> stats;
+    ServerConnection::listStats(&stats);
+
+    int self_id = connection() ? connection()->getId() : -1;
+
+    for (auto &st : stats)
+    {
+        auto item = out->add_value();
+        item->set_id(st.id);
+        item->set_address(st.address);
+        item->set_multiplexed(st.multiplexed);
+        item->set_bytes_in(st.bytes_in);
+        item->set_bytes_out(st.bytes_out);
+        item->set_calls(st.calls);
+        item->set_failed_calls(st.failed_calls);
+        item->set_queue_depth(st.queue_depth);
+        item->set_max_queue_depth(st.max_queue_depth);
+        item->set_is_self(st.id == self_id);
+    }
+
+    return CR_OK;
+}
+
 namespace {
     struct LuaFunctionData {
         command_result rv;
@@ -27,8 +27,11 @@ distribution.
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <map>
 #include <iostream>
+#include <fstream>
 using namespace std;
 
 #include "VersionInfoFactory.h"
@@ -36,12 +39,66 @@ using namespace std;
 #include "Error.h"
 #include "Memory.h"
 #include "PluginManager.h"
+#include "modules/Filesystem.h"
 using namespace DFHack;
 
 #include <tinyxml.h>
 
+struct VersionInfoFactory::SymbolTable
+{
+    struct Symbol
+    {
+        bool is_vtable;
+        string name;
+        string value;   // empty if mangled is used
+        string mangled;
+        string offset;
+    };
+
+    string name;
+    OSType os;
+    vector<string> md5_list;
+    vector<uint64_t> PE_list;
+    vector<Symbol> symbols;
+};
+
+/*
+ * Cache of the symbol table that matched the executable, so later
+ * startups don't have to parse the symbol tables of every version.
+ * It is only used while symbols.xml has the size and mtime it had
+ * when the cache was written.
+ */
+static const char cache_magic[8] = { 'D','F','H','S','Y','M','S','1' };
+
+static void writeInt(ostream &out, uint64_t value)
+{
+    out.write((const char*)&value, sizeof(value));
+}
+
+static void writeString(ostream &out, const string &value)
+{
+    writeInt(out, value.size());
+    out.write(value.data(), value.size());
+}
+
+static bool readInt(istream &in, uint64_t &value)
+{
+    return bool(in.read((char*)&value, sizeof(value)));
+}
+
+static bool readString(istream &in, string &value)
+{
+    uint64_t size;
+    if (!readInt(in, size) || size > (1 << 20))
+        return false;
+    value.resize(size_t(size));
+    return size == 0 || bool(in.read(&value[0], size));
+}
+
 VersionInfoFactory::VersionInfoFactory()
 {
+    xml_size = xml_mtime = -1;
+    from_cache = false;
     error = false;
 }
 
@@ -58,33 +115,67 @@ void VersionInfoFactory::clear()
         delete versions[i];
     }
     versions.clear();
+    for(size_t i = 0; i < tables.size();i++)
+    {
+        delete tables[i];
+    }
+    tables.clear();
+    from_cache = false;
     error = false;
 }
 
 VersionInfo * VersionInfoFactory::getVersionInfoByMD5(string hash)
 {
-    for(size_t i = 0; i < versions.size();i++)
+    do
     {
-        if(versions[i]->hasMD5(hash))
-            return versions[i];
-    }
+        for(size_t i = 0; i < versions.size();i++)
+        {
+            if(versions[i]->hasMD5(hash))
+                return matched(i);
+        }
+    } while (loadAll());
     return 0;
 }
 
 VersionInfo * VersionInfoFactory::getVersionInfoByPETimestamp(uintptr_t timestamp)
 {
-    for(size_t i = 0; i < versions.size();i++)
+    do
     {
-        if(versions[i]->hasPE(timestamp))
-            return versions[i];
-    }
+        for(size_t i = 0; i < versions.size();i++)
+        {
+            if(versions[i]->hasPE(timestamp))
+                return matched(i);
+        }
+    } while (loadAll());
     return 0;
 }
 
-void VersionInfoFactory::ParseVersion (TiXmlElement* entry, VersionInfo* mem)
+// The cached table is for another executable; read all of them
+bool VersionInfoFactory::loadAll()
+{
+    if (!from_cache)
+        return false;
+    try
+    {
+        loadXml();
+    }
+    catch (Error::All &err)
+    {
+        cerr << "Error while reading " << xml_path << ":\n" << err.what() << endl;
+        return false;
+    }
+    return true;
+}
+
+VersionInfo * VersionInfoFactory::matched(size_t index)
+{
+    if (!from_cache && index < tables.size())
+        saveCache(index);
+    return versions[index];
+}
+
+void VersionInfoFactory::ParseVersion (TiXmlElement* entry, SymbolTable* table)
 {
-    bool no_vtables = getenv("DFHACK_NO_VTABLES");
-    bool no_globals = getenv("DFHACK_NO_GLOBALS");
     TiXmlElement* pMemEntry;
     const char *cstr_name = entry->Attribute("name");
     if (!cstr_name)
@@ -95,25 +186,25 @@ void VersionInfoFactory::ParseVersion (TiXmlElement* entry, VersionInfo* mem)
         throw Error::SymbolsXmlBadAttribute("os-type");
 
     string os = cstr_os;
-    mem->setVersion(cstr_name);
+    table->name = cstr_name;
+    table->os = OS_BAD;
 
     if(os == "windows")
     {
-        mem->setOS(OS_WINDOWS);
+        table->os = OS_WINDOWS;
     }
     else if(os == "linux")
     {
-        mem->setOS(OS_LINUX);
+        table->os = OS_LINUX;
     }
     else if(os == "darwin")
     {
-        mem->setOS(OS_APPLE);
+        table->os = OS_APPLE;
     }
     else
     {
         return; // ignore it if it's invalid
     }
-    mem->setBase(DEFAULT_BASE_ADDR);  // Memory.h
 
     // process additional entries
     //cout << "Entry " << cstr_version << " " <<  cstr_os << endl;
@@ -140,53 +231,109 @@ void VersionInfoFactory::ParseVersion (TiXmlElement* entry, VersionInfo* mem)
                 cerr << "Dummy symbol table entry: " << cstr_key << endl;
                 continue;
             }
-            if ((is_vtable && no_vtables) || (!is_vtable && no_globals))
-                continue;
-            uintptr_t addr;
-            if (cstr_value) {
-                if (sizeof(addr) == sizeof(unsigned long))
-                    addr = strtoul(cstr_value, 0, 0);
-                else
-                    addr = strtoull(cstr_value, 0, 0);
-            } else {
-                addr = (uintptr_t)DFHack::LookupPlugin(DFHack::GLOBAL_NAMES, cstr_mangled);
-                if (!addr)
-                    continue;
-                const char *cstr_offset = pMemEntry->Attribute("offset");
-                if (cstr_offset) {
-                    unsigned long offset = strtoul(cstr_offset, 0, 0);
-                    addr += offset;
-                }
-            }
-            if (is_vtable)
-                mem->setVTable(cstr_key, addr);
-            else
-                mem->setAddress(cstr_key, addr);
+            const char *cstr_offset = pMemEntry->Attribute("offset");
+            SymbolTable::Symbol symbol;
+            symbol.is_vtable = is_vtable;
+            symbol.name = cstr_key;
+            symbol.value = cstr_value ? cstr_value : "";
+            symbol.mangled = cstr_mangled ? cstr_mangled : "";
+            symbol.offset = cstr_offset ? cstr_offset : "";
+            table->symbols.push_back(symbol);
         }
         else if (type == "md5-hash")
         {
             const char *cstr_value = pMemEntry->Attribute("value");
-            fprintf(stderr, "%s (%s): MD5: %s\n", cstr_name, cstr_os, cstr_value);
             if(!cstr_value)
                 throw Error::SymbolsXmlUnderspecifiedEntry(cstr_name);
-            mem->addMD5(cstr_value);
+            table->md5_list.push_back(cstr_value);
         }
         else if (type == "binary-timestamp")
         {
             const char *cstr_value = pMemEntry->Attribute("value");
-            fprintf(stderr, "%s (%s): PE: %s\n", cstr_name, cstr_os, cstr_value);
             if(!cstr_value)
                 throw Error::SymbolsXmlUnderspecifiedEntry(cstr_name);
-            mem->addPE(strtol(cstr_value, 0, 16));
+            table->PE_list.push_back(strtol(cstr_value, 0, 16));
         }
     } // for
 } // method
 
+// Turns a table into a version, resolving the addresses for this run
+void VersionInfoFactory::buildVersion(const SymbolTable &table, VersionInfo *mem)
+{
+    bool no_vtables = getenv("DFHACK_NO_VTABLES");
+    bool no_globals = getenv("DFHACK_NO_GLOBALS");
+    const char *os_name = table.os == OS_WINDOWS ? "windows" :
+                          table.os == OS_LINUX ? "linux" : "darwin";
+
+    mem->setVersion(table.name);
+    if (table.os == OS_BAD)
+        return;
+    mem->setOS(table.os);
+    mem->setBase(DEFAULT_BASE_ADDR);  // Memory.h
+
+    for (auto it = table.md5_list.begin(); it != table.md5_list.end(); ++it)
+    {
+        fprintf(stderr, "%s (%s): MD5: %s\n", table.name.c_str(), os_name, it->c_str());
+        mem->addMD5(*it);
+    }
+    for (auto it = table.PE_list.begin(); it != table.PE_list.end(); ++it)
+    {
+        fprintf(stderr, "%s (%s): PE: %llx\n", table.name.c_str(), os_name, (unsigned long long)*it);
+        mem->addPE(uintptr_t(*it));
+    }
+
+    for (auto it = table.symbols.begin(); it != table.symbols.end(); ++it)
+    {
+        if ((it->is_vtable && no_vtables) || (!it->is_vtable && no_globals))
+            continue;
+        uintptr_t addr;
+        if (!it->value.empty()) {
+            if (sizeof(addr) == sizeof(unsigned long))
+                addr = strtoul(it->value.c_str(), 0, 0);
+            else
+                addr = strtoull(it->value.c_str(), 0, 0);
+        } else {
+            addr = (uintptr_t)DFHack::LookupPlugin(DFHack::GLOBAL_NAMES, it->mangled.c_str());
+            if (!addr)
+                continue;
+            if (!it->offset.empty()) {
+                unsigned long offset = strtoul(it->offset.c_str(), 0, 0);
+                addr += offset;
+            }
+        }
+        if (it->is_vtable)
+            mem->setVTable(it->name, addr);
+        else
+            mem->setAddress(it->name, addr);
+    }
+}
+
 // load the XML file with offsets
 bool VersionInfoFactory::loadFile(string path_to_xml)
 {
-    TiXmlDocument doc( path_to_xml.c_str() );
-    std::cerr << "Loading " << path_to_xml << " ... ";
+    clear();
+    xml_path = path_to_xml;
+
+    STAT_STRUCT info;
+    if (Filesystem::stat(xml_path, info))
+    {
+        xml_size = info.st_size;
+        xml_mtime = info.st_mtime;
+    }
+    else
+        xml_size = xml_mtime = -1;
+
+    if (loadCache())
+        return true;
+
+    loadXml();
+    return true;
+}
+
+void VersionInfoFactory::loadXml()
+{
+    TiXmlDocument doc( xml_path.c_str() );
+    std::cerr << "Loading " << xml_path << " ... ";
     //bool loadOkay = doc.LoadFile();
     if (!doc.LoadFile())
     {
@@ -230,13 +377,119 @@ bool VersionInfoFactory::loadFile(string path_to_xml)
             const char *name = pMemInfo->Attribute("name");
             if(name)
             {
+                SymbolTable *table = new SymbolTable();
+                tables.push_back(table);
+                ParseVersion( pMemInfo , table );
                 VersionInfo *version = new VersionInfo();
-                ParseVersion( pMemInfo , version );
+                buildVersion( *table , version );
                 versions.push_back(version);
             }
         }
     }
     error = false;
     std::cerr << "Loaded " << versions.size() << " DF symbol tables." << std::endl;
+}
+
+bool VersionInfoFactory::loadCache()
+{
+    if (xml_size < 0)
+        return false;
+
+    ifstream in((xml_path + ".cache").c_str(), ios::binary);
+    char magic[sizeof(cache_magic)];
+    if (!in.read(magic, sizeof(magic)) || memcmp(magic, cache_magic, sizeof(magic)) != 0)
+        return false;
+
+    uint64_t size, mtime, os, count;
+    if (!readInt(in, size) || !readInt(in, mtime) ||
+        int64_t(size) != xml_size || int64_t(mtime) != xml_mtime)
+        return false;
+
+    SymbolTable table;
+    if (!readString(in, table.name) || !readInt(in, os) || os > OS_BAD)
+        return false;
+    table.os = OSType(os);
+
+    if (!readInt(in, count) || count > 1000)
+        return false;
+    table.md5_list.resize(size_t(count));
+    for (size_t i = 0; i < table.md5_list.size(); i++)
+        if (!readString(in, table.md5_list[i]))
+            return false;
+
+    if (!readInt(in, count) || count > 1000)
+        return false;
+    table.PE_list.resize(size_t(count));
+    for (size_t i = 0; i < table.PE_list.size(); i++)
+        if (!readInt(in, table.PE_list[i]))
+            return false;
+
+    if (!readInt(in, count) || count > 1000000)
+        return false;
+    table.symbols.resize(size_t(count));
+    for (size_t i = 0; i < table.symbols.size(); i++)
+    {
+        SymbolTable::Symbol &symbol = table.symbols[i];
+        uint64_t is_vtable;
+        if (!readInt(in, is_vtable) || !readString(in, symbol.name) ||
+            !readString(in, symbol.value) || !readString(in, symbol.mangled) ||
+            !readString(in, symbol.offset))
+            return false;
+        symbol.is_vtable = is_vtable != 0;
+    }
+
+    VersionInfo *version = new VersionInfo();
+    buildVersion(table, version);
+    versions.push_back(version);
+    from_cache = true;
+    std::cerr << "Loaded the " << table.name << " symbol table from " << xml_path << ".cache" << std::endl;
     return true;
 }
+
+void VersionInfoFactory::saveCache(size_t index)
+{
+    if (xml_size < 0)
+        return;
+
+    const SymbolTable &table = *tables[index];
+    string path = xml_path + ".cache";
+    string temp = path + ".tmp";
+    {
+        ofstream out(temp.c_str(), ios::binary | ios::trunc);
+        out.write(cache_magic, sizeof(cache_magic));
+        writeInt(out, xml_size);
+        writeInt(out, xml_mtime);
+        writeString(out, table.name);
+        writeInt(out, table.os);
+
+        writeInt(out, table.md5_list.size());
+        for (size_t i = 0; i < table.md5_list.size(); i++)
+            writeString(out, table.md5_list[i]);
+
+        writeInt(out, table.PE_list.size());
+        for (size_t i = 0; i < table.PE_list.size(); i++)
+            writeInt(out, table.PE_list[i]);
+
+        writeInt(out, table.symbols.size());
+        for (size_t i = 0; i < table.symbols.size(); i++)
+        {
+            const SymbolTable::Symbol &symbol = table.symbols[i];
+            writeInt(out, symbol.is_vtable);
+            writeString(out, symbol.name);
+            writeString(out, symbol.value);
+            writeString(out, symbol.mangled);
+            writeString(out, symbol.offset);
+        }
+
+        if (!out.good())
+        {
+            out.close();
+            remove(temp.c_str());
+            return;
+        }
+    }
+
+    remove(path.c_str());
+    if (rename(temp.c_str(), path.c_str()) != 0)
+        remove(temp.c_str());
+}
@@ -186,6 +186,8 @@ namespace DFHack
 
         bool isWorldLoaded() { return (last_world_data_ptr != NULL); }
         bool isMapLoaded() { return (last_local_map_ptr != NULL && last_world_data_ptr != NULL); }
+        // Number of per-frame updates so far, for caches that revalidate once per frame
+        uint32_t getUpdateCount() { return update_count; }
 
         static df::viewscreen *getTopViewscreen() { return getInstance().top_viewscreen; }
 
@@ -282,6 +284,7 @@ namespace DFHack
         friend struct Screen::Hide;
         df::viewscreen *top_viewscreen;
         bool last_pause_state;
+        uint32_t update_count;
         // Very important!
         bool started;
         // Additional state change scripts
@@ -272,8 +272,16 @@ namespace DFHack
         std::vector<struct_identity*> children;
         bool has_children;
 
+        // Pre-order number of this type in the class hierarchy, and the
+        // largest number within its subtree; -1 until numbered by Init.
+        int32_t tree_index, tree_last;
+
         const struct_field_info *fields;
 
+        friend class compound_identity;
+        void number_subtree(int32_t &next);
+        bool is_subclass_slow(struct_identity *subtype);
+
     protected:
         virtual void doInit(Core *core);
 
@@ -290,7 +298,13 @@ namespace DFHack
 
         const struct_field_info *getFields() { return fields; }
 
-        bool is_subclass(struct_identity *subtype);
+        bool is_subclass(struct_identity *subtype) {
+            if (subtype == this) return true;
+            if (!subtype || !has_children) return false;
+            if (tree_index >= 0 && subtype->tree_index >= 0)
+                return subtype->tree_index > tree_index && subtype->tree_index <= tree_last;
+            return is_subclass_slow(subtype);
+        }
 
         virtual void build_metatable(lua_State *state);
     };
@@ -315,8 +329,6 @@ namespace DFHack
     class MemoryPatcher;
 
     class DFHACK_EXPORT virtual_identity : public struct_identity {
-        static std::map<void*, virtual_identity*> known;
-
         const char *original_name;
 
         void *vtable_ptr;
@@ -69,6 +69,11 @@ namespace LuaWrapper {
      */
     extern LuaToken DFHACK_PTR_IDTABLE_TOKEN;
 
+    /**
+     * Metatable pkey: weak-valued hash of pointer -> live ref with this metatable.
+     */
+    extern LuaToken DFHACK_REF_CACHE_TOKEN;
+
 // Function registry names
 #define DFHACK_CHANGEERROR_NAME "DFHack::ChangeError"
 #define DFHACK_COMPARE_NAME "DFHack::ComparePtrs"
@@ -80,6 +85,7 @@ namespace LuaWrapper {
 #define DFHACK_IS_INSTANCE_NAME "DFHack::IsInstance"
 #define DFHACK_DELETE_NAME "DFHack::Delete"
 #define DFHACK_CAST_NAME "DFHack::Cast"
+#define DFHACK_FIELDS_NAME "DFHack::Fields"
 
     extern LuaToken DFHACK_EMPTY_TABLE_TOKEN;
 
@@ -207,6 +213,11 @@ namespace LuaWrapper {
      */
     void SetStructMethod(lua_State *state, int meta_idx, int ftable_idx,
                          lua_CFunction function, const char *name);
+    /**
+     * Push a closure that reads the field named by the value at name_idx
+     * from objects with the given struct metatable or a subclass of it.
+     */
+    void PushFieldGetter(lua_State *state, int meta_idx, int ftable_idx, int name_idx);
     /**
      * Add a 6 upvalue metamethod to the stack.
      */
@@ -29,6 +29,7 @@ distribution.
 #include "ColorText.h"
 #include "MiscUtils.h"
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -209,6 +210,9 @@ namespace DFHack
         DFLibrary * plugin_lib;
         PluginManager * parent;
         plugin_state state;
+        int profile_source;
+        // time taken by the last load, opening the library and in plugin_init
+        uint64_t open_ns, init_ns;
 
         struct LuaCommand;
         std::map<std::string, LuaCommand*> lua_commands;
@@ -260,6 +264,8 @@ namespace DFHack
 
         bool load (const std::string &name);
         bool loadAll();
+        // load a plugin that the manifest deferred, if it isn't loaded yet
+        bool loadDeferred (const std::string &name);
         bool unload (const std::string &name);
         bool unloadAll();
         bool reload (const std::string &name);
@@ -279,11 +285,17 @@ namespace DFHack
     private:
         Core *core;
         bool addPlugin(std::string name);
+        bool loadList(const std::vector<std::string> &names);
+        void deferPlugin(const std::string &name, const std::vector<std::string> &commands);
         tthread::recursive_mutex * plugin_mutex;
         tthread::mutex * cmdlist_mutex;
         std::map <std::string, Plugin*> command_map;
         std::map <std::string, Plugin*> all_plugins;
+        std::set <std::string> deferred_plugins; // guarded by cmdlist_mutex
         std::string plugin_path;
+        // last listing of hack/plugins, and when it was made
+        std::vector<std::string> listed_plugins;
+        int64_t listed_mtime, listed_at;
     };
 
     namespace Gui
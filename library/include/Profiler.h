@@ -0,0 +1,106 @@
+/*
+https://github.com/peterix/dfhack
+Copyright (c) 2009-2012 Petr Mrázek (peterix@gmail.com)
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any
+damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any
+purpose, including commercial applications, and to alter it and
+redistribute it freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must
+not claim that you wrote the original software. If you use this
+software in a product, an acknowledgment in the product documentation
+would be appreciated but is not required.
+
+2. Altered source versions must be plainly marked as such, and
+must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any source
+distribution.
+*/
+
+#pragma once
+
+#include "Export.h"
+
+#include <chrono>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace DFHack
+{
+    /**
+     * Timing of the work DFHack does on each update: the stages of
+     * Core::onUpdate, plugin_onupdate of every plugin, EventManager handlers
+     * and Lua timers. Every source keeps its latest samples in a fixed ring
+     * buffer that is written without locks, so recording is cheap enough to
+     * stay on all the time.
+     */
+    namespace Profiler
+    {
+        enum Category
+        {
+            STAGE,
+            PLUGIN,
+            EVENT_HANDLER,
+            LUA_TIMER
+        };
+
+        struct SourceStats
+        {
+            std::string name;
+            Category category;
+            uint32_t calls; // samples within the window
+            uint64_t total_ns;
+            uint64_t p50_ns;
+            uint64_t p95_ns;
+            uint64_t p99_ns;
+            uint64_t max_ns;
+        };
+
+        inline uint64_t now()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        DFHACK_EXPORT bool isEnabled();
+        DFHACK_EXPORT void setEnabled(bool enabled);
+
+        /// Id of the named source, registered on first use. -1 if there are too many.
+        DFHACK_EXPORT int getSource(Category category, const std::string &name);
+        /// Adds a sample to a source; times are from now()
+        DFHACK_EXPORT void record(int source, uint64_t start_ns, uint64_t end_ns);
+
+        /// Stats of the sources with samples in the last window_ns, most total time first
+        DFHACK_EXPORT std::vector<SourceStats> getStats(uint64_t window_ns);
+        /// Forgets all samples
+        DFHACK_EXPORT void reset();
+        /// Writes the samples of the last window_ns as Chrome trace event JSON
+        DFHACK_EXPORT bool writeTrace(const std::string &path, uint64_t window_ns);
+
+        DFHACK_EXPORT const char *getCategoryName(Category category);
+
+        /// Records the time until the end of the scope as one sample
+        class Scope
+        {
+            int source;
+            bool active;
+            uint64_t start;
+
+        public:
+            explicit Scope(int source)
+                : source(source), active(source >= 0 && isEnabled()), start(active ? now() : 0)
+            {}
+            ~Scope()
+            {
+                if (active)
+                    record(source, start, now());
+            }
+        };
+    }
+}
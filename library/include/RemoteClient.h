@@ -54,7 +54,8 @@ namespace  DFHack
         RPC_REPLY_RESULT = -1,
         RPC_REPLY_FAIL = -2,
         RPC_REPLY_TEXT = -3,
-        RPC_REQUEST_QUIT = -4
+        RPC_REQUEST_QUIT = -4,
+        RPC_REQUEST_BATCH = -5
     };
 
     struct RPCHandshakeHeader {
@@ -102,6 +103,13 @@ namespace  DFHack
      *   of the function if it succeeded, or RPC_REPLY_FAIL with the
      *   error code if it did not.
      *
+     *   Several calls can be combined by sending a RPC_REQUEST_BATCH
+     *   message containing a CoreBatchRequest. The server executes
+     *   them in order, keeping the core suspended across consecutive
+     *   calls that need it, and answers with the usual text messages
+     *   followed by a single RPC_REPLY_RESULT:CoreBatchReply holding
+     *   the result code and output of every call.
+     *
      * 3. Disconnect
      *
      *   The client terminates the connection by sending an
@@ -110,6 +118,7 @@ namespace  DFHack
      */
 
     class DFHACK_EXPORT RemoteClient;
+    class DFHACK_EXPORT RemoteBatch;
 
     class DFHACK_EXPORT RPCFunctionBase {
     public:
@@ -159,6 +168,7 @@ namespace  DFHack
 
     protected:
         friend class RemoteClient;
+        friend class RemoteBatch;
 
         RemoteFunctionBase(const message_type *in, const message_type *out)
             : RPCFunctionBase(in, out), p_client(NULL), id(-1)
@@ -225,6 +235,7 @@ namespace  DFHack
     class DFHACK_EXPORT RemoteClient
     {
         friend class RemoteFunctionBase;
+        friend class RemoteBatch;
 
         bool bind(color_ostream &out, RemoteFunctionBase *function,
                   const std::string &name, const std::string &plugin);
@@ -273,6 +284,48 @@ namespace  DFHack
         return bind(client->default_output(), client, name, plugin);
     }
 
+    /**
+     * Collects several calls and sends them in a single RPC_REQUEST_BATCH
+     * message, so that the server runs them within one suspend window.
+     * Inputs are serialized when added; outputs must stay valid until
+     * execute() returns.
+     */
+    class DFHACK_EXPORT RemoteBatch {
+        typedef RPCFunctionBase::message_type message_type;
+
+        struct Call {
+            RemoteFunctionBase *function;
+            message_type *output;
+            command_result result;
+        };
+
+        RemoteClient *client;
+        std::vector<Call> calls;
+        dfproto::CoreBatchRequest request;
+
+    public:
+        RemoteBatch(RemoteClient *client) : client(client) {}
+
+        void add(RemoteFunctionBase *function, const message_type *input, message_type *output);
+
+        template<typename In, typename Out>
+        void add(RemoteFunction<In,Out> &function) {
+            add(&function, function.in(), function.out());
+        }
+
+        size_t size() { return calls.size(); }
+        void clear() { calls.clear(); request.Clear(); }
+
+        // Returns CR_OK if the batch was delivered and answered;
+        // the outcome of each call is then available via result().
+        command_result execute(color_ostream &out);
+        command_result execute() { return execute(client->default_output()); }
+
+        command_result result(size_t i) {
+            return i < calls.size() ? calls[i].result : CR_NOT_FOUND;
+        }
+    };
+
     class RemoteSuspender {
         RemoteClient *client;
     public:
@@ -37,6 +37,7 @@ namespace  DFHack
     class Plugin;
     class CoreService;
     class ServerConnection;
+    class ServerReactor;
 
     class DFHACK_EXPORT RPCService;
 
@@ -49,7 +50,11 @@ namespace  DFHack
         SF_DONT_SUSPEND = 2,
         // The function is considered safe to call from a remote computer.
         // All other functions cannot be allowed for security reasons.
-        SF_ALLOW_REMOTE = 4
+        SF_ALLOW_REMOTE = 4,
+        // The function may block for a long time, e.g. running a command or
+        // waiting for an event. A connection served by the shared I/O threads
+        // moves to a thread of its own before calling it.
+        SF_MAY_BLOCK = 8
     };
 
     class DFHACK_EXPORT ServerFunctionBase : public RPCFunctionBase {
@@ -213,7 +218,22 @@ namespace  DFHack
         void dumpMethods(std::ostream & out) const;
     };
 
+    /**
+     * Snapshot of the I/O counters of one client connection.
+     */
+    struct ServerConnectionStats {
+        int id;
+        std::string address;
+        bool multiplexed;
+        uint64_t bytes_in, bytes_out;
+        uint64_t calls, failed_calls;
+        // Requests fully received but not yet executed
+        int queue_depth, max_queue_depth;
+    };
+
     class ServerConnection {
+        friend class ServerReactor;
+
         class connection_ostream : public buffered_color_ostream {
             ServerConnection *owner;
 
@@ -233,19 +253,62 @@ namespace  DFHack
         CoreService *core_service;
         std::map<std::string, RPCService*> plugin_services;
 
+        int id;
+        std::string address;
+
+        std::atomic<uint64_t> bytes_in, bytes_out;
+        std::atomic<uint64_t> calls, failed_calls;
+        std::atomic<int> queue_depth, max_queue_depth;
+
+        // Dedicated thread; NULL when served by a reactor
         tthread::thread *thread;
         static void threadFn(void *);
         void threadFn();
 
+        // Incremental input state used by the reactor
+        ServerReactor *reactor;
+        bool handshake_done;
+        std::vector<uint8_t> inbuf;
+        size_t inbuf_pos;
+
+        // Output the socket didn't take yet; only used on reactor threads
+        std::vector<uint8_t> outbuf;
+        size_t outbuf_pos;
+
+        // Set once a blocking call moved the connection off the reactor
+        bool own_thread;
+        // A blocking call is next in inbuf, and must wait for own_thread
+        bool wants_own_thread;
+
+        bool handshake(color_ostream &out, RPCHandshakeHeader &header);
+        command_result invoke(ServerFunctionBase *fn, int id, const void *data, int size,
+                              CoreSuspender *suspend);
+        bool processMessage(color_ostream &out, RPCMessageHeader &header, const uint8_t *data);
+        bool processBatch(color_ostream &out, RPCMessageHeader &header, const uint8_t *data);
+        bool processBuffered(color_ostream &out);
+        bool readAvailable(color_ostream &out, bool block);
+        bool flushOutput(bool block);
+        bool mayBlock(const RPCMessageHeader &header, const uint8_t *data);
+        bool isNonBlocking() { return reactor && !own_thread; }
+
+        bool sendMessage(int16_t id, const ::google::protobuf::MessageLite *msg, bool size_ready);
+        bool sendRaw(const void *data, int size);
+
     public:
-        ServerConnection(CActiveSocket *socket);
+        ServerConnection(CActiveSocket *socket, ServerReactor *reactor = NULL);
         ~ServerConnection();
 
+        int getId() { return id; }
+        void getStats(ServerConnectionStats *stats);
+
+        static void listStats(std::vector<ServerConnectionStats> *out);
+
         ServerFunctionBase *findFunction(color_ostream &out, const std::string &plugin, const std::string &name);
     };
 
     class ServerMain {
         CPassiveSocket *socket;
+        ServerReactor *reactor;
 
         tthread::thread *thread;
         static void threadFn(void *);
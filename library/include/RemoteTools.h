@@ -153,5 +153,8 @@ namespace DFHack
         command_result RunLua(color_ostream &stream,
                               const dfproto::CoreRunLuaRequest *in,
                               StringListMessage *out);
+
+        command_result ListConnections(color_ostream &stream, const EmptyMessage*,
+                                       dfproto::CoreConnectionList *out);
     };
 }
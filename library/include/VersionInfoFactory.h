@@ -28,6 +28,10 @@ distribution.
 #include "Pragma.h"
 #include "Export.h"
 
+#include <stdint.h>
+#include <string>
+#include <vector>
+
 class TiXmlElement;
 namespace DFHack
 {
@@ -45,7 +49,24 @@ namespace DFHack
             // trash existing list
             void clear();
         private:
-            void ParseVersion (TiXmlElement* version, VersionInfo* mem);
+            // Raw contents of one <symbol-table>, before addresses are resolved
+            struct SymbolTable;
+
+            void ParseVersion (TiXmlElement* version, SymbolTable* table);
+            static void buildVersion(const SymbolTable &table, VersionInfo *mem);
+            void loadXml();
+            bool loadAll();
+            bool loadCache();
+            void saveCache(size_t index);
+            VersionInfo * matched(size_t index);
+
+            // symbols.xml, and its size and mtime when it was loaded
+            std::string xml_path;
+            int64_t xml_size, xml_mtime;
+            // Tables behind versions, if they were parsed from the xml
+            std::vector<SymbolTable*> tables;
+            // True if versions only holds the table read from the cache
+            bool from_cache;
             bool error;
     };
 }
@@ -39,9 +39,10 @@ namespace DFHack {
         struct EventHandler {
             typedef void (*callback_t)(color_ostream&, void*); //called when the event happens
             callback_t eventHandler;
-            int32_t freq;
+            int32_t freq; //ticks between checks for this handler; 0 checks on every update
+            int32_t budget; //microseconds the handler and its check may take before it is checked less often; 0 for no limit
 
-            EventHandler(callback_t eventHandlerIn, int32_t freqIn): eventHandler(eventHandlerIn), freq(freqIn) {
+            EventHandler(callback_t eventHandlerIn, int32_t freqIn, int32_t budgetIn = 0): eventHandler(eventHandlerIn), freq(freqIn), budget(budgetIn) {
             }
 
             bool operator==(const EventHandler& handle) const {
@@ -90,10 +91,25 @@ namespace DFHack {
             int32_t defendReport;
         };
 
+        struct HandlerStats {
+            EventType::EventType type;
+            Plugin* plugin;
+            int32_t freq;
+            int32_t budget; //in effect, 0 for no limit
+            int32_t interval; //current ticks between checks, larger than freq while over budget
+            uint64_t calls;
+            uint64_t total_ns;
+            uint64_t max_ns;
+            uint32_t overruns; //checks where the handler went over its budget
+        };
+
         DFHACK_EXPORT void registerListener(EventType::EventType e, EventHandler handler, Plugin* plugin);
         DFHACK_EXPORT int32_t registerTick(EventHandler handler, int32_t when, Plugin* plugin, bool absolute=false);
         DFHACK_EXPORT void unregister(EventType::EventType e, EventHandler handler, Plugin* plugin);
         DFHACK_EXPORT void unregisterAll(Plugin* plugin);
+        DFHACK_EXPORT std::vector<HandlerStats> getHandlerStats();
+        DFHACK_EXPORT void resetHandlerStats();
+        DFHACK_EXPORT const char* getEventTypeName(EventType::EventType e);
         void manageEvents(color_ostream& out);
         void onStateChange(color_ostream& out, state_change_event event);
     }
@@ -195,6 +195,33 @@ DFHACK_EXPORT bool isRouteVehicle(df::item *item);
 /// Checks whether the item is assigned to a squad
 DFHACK_EXPORT bool isSquadEquipment(df::item *item);
 
+/**
+ * A group of items with the same type, subtype and actual material.
+ * Only the grouping is tracked: flags, wear, quality, stack size and
+ * so on must still be checked on the items themselves.
+ */
+struct ItemCensusBucket
+{
+    df::item_type type;
+    int16_t subtype;
+    int16_t mat_type;
+    int32_t mat_index;
+    std::vector<df::item*> items; ///< sorted by id
+};
+
+/**
+ * Returns the census buckets of an item type, covering the same items
+ * as items.other[IN_PLAY]. Only items that entered or left play since the
+ * last call are refiled, and materials are checked again once per frame
+ * for the requested type, so this costs roughly the number of items of
+ * that type rather than all items.
+ * The result is valid until the game runs again or items are deleted.
+ */
+DFHACK_EXPORT const std::vector<ItemCensusBucket*> &getItemCensus(df::item_type type);
+/// Appends the census items of a type, optionally restricted to a subtype and material (-1 for any).
+DFHACK_EXPORT void getCensusItems(std::vector<df::item*> *items, df::item_type type,
+    int16_t subtype = -1, int16_t mat_type = -1, int32_t mat_index = -1);
+
 }
 }
 
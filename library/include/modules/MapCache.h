@@ -39,8 +39,10 @@ distribution.
 #include "df/inclusion_type.h"
 
 #include <bitset>
+#include <memory>
 
 namespace df {
+    struct world_data;
     struct world_region_details;
 }
 
@@ -66,6 +68,17 @@ struct BiomeInfo {
     int16_t layer_stone[MAX_LAYERS];
 };
 
+/// Geology of the loaded map, built once and shared by all MapCache instances
+struct MapGeology {
+    bool valid;
+    std::vector<BiomeInfo> biomes;
+
+    // What the data was built from, to notice when it goes stale
+    df::world_data *world_data;
+    df::coord2d region;
+    size_t region_details_count;
+};
+
 typedef uint8_t t_veintype[16][16];
 typedef df::tiletype t_tilearr[16][16];
 
@@ -116,6 +129,10 @@ public:
     Block(MapCache *parent, DFCoord _bcoord);
     ~Block();
 
+    /// Blocks are allocated from a pool shared by all MapCache instances
+    static void *operator new(size_t size);
+    static void operator delete(void *ptr);
+
     DFCoord getCoord() { return bcoord; }
 
     void enableBlockUpdates(bool flow = false, bool temp = false) {
@@ -357,6 +374,7 @@ private:
     std::bitset<16*16> designated_tiles;
 
     DFCoord bcoord;
+    size_t list_index; // position in MapCache::block_list
 
     // Custom tags for floodfill
     typedef int16_t T_tags[16];
@@ -374,6 +392,9 @@ private:
     struct IceInfo {
         df::tile_bitmask frozen;
         df::tile_bitmask dirty;
+
+        static void *operator new(size_t size);
+        static void operator delete(void *ptr);
     };
     struct ConInfo {
         df::tile_bitmask constructed;
@@ -381,6 +402,9 @@ private:
         t_tilearr tiles;
         t_blockmaterials mat_type;
         t_blockmaterials mat_index;
+
+        static void *operator new(size_t size);
+        static void operator delete(void *ptr);
     };
     struct TileInfo {
         df::tile_bitmask dirty_raw;
@@ -394,6 +418,9 @@ private:
         TileInfo();
         ~TileInfo();
 
+        static void *operator new(size_t size);
+        static void operator delete(void *ptr);
+
         void init_iceinfo();
         void init_coninfo();
 
@@ -409,6 +436,9 @@ private:
 
         BasematInfo();
 
+        static void *operator new(size_t size);
+        static void operator delete(void *ptr);
+
         void set_base_mat(TileInfo *tiles, df::coord2d pos, int16_t type, int16_t idx);
     };
     TileInfo *tiles;
@@ -606,15 +636,7 @@ class DFHACK_EXPORT MapCache
 
     bool WriteAll();
 
-    void trash()
-    {
-        std::map<DFCoord, Block *>::iterator p;
-        for(p = blocks.begin(); p != blocks.end(); p++)
-        {
-            delete p->second;
-        }
-        blocks.clear();
-    }
+    void trash();
 
     uint32_t maxBlockX() { return x_bmax; }
     uint32_t maxBlockY() { return y_bmax; }
@@ -622,9 +644,9 @@ class DFHACK_EXPORT MapCache
     uint32_t maxTileY() { return y_tmax; }
     uint32_t maxZ() { return z_max; }
 
-    size_t getBiomeCount() { return biomes.size(); }
+    size_t getBiomeCount() { return geology->biomes.size(); }
     const BiomeInfo &getBiomeByIndex(unsigned idx) {
-        return (idx < biomes.size()) ? biomes[idx] : biome_stub;
+        return (idx < geology->biomes.size()) ? geology->biomes[idx] : biome_stub;
     }
 
 private:
@@ -640,9 +662,14 @@ private:
     uint32_t x_tmax;
     uint32_t y_tmax;
     uint32_t z_max;
-    std::vector<BiomeInfo> biomes;
-    std::map<df::coord2d, df::world_region_details*> region_details;
-    std::map<DFCoord, Block *> blocks;
+    std::shared_ptr<const MapGeology> geology;
+
+    // Loaded blocks by z level, then by y*x_bmax+x. Levels are sized on first use.
+    std::vector<std::vector<Block*> > block_grid;
+    // The same blocks in load order, for iteration.
+    std::vector<Block*> block_list;
+
+    Block *findBlock(DFCoord blockcoord);
 };
 }
 #endif
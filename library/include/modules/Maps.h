@@ -32,6 +32,8 @@ distribution.
 
 #include "Export.h"
 #include "Module.h"
+#include <bitset>
+#include <functional>
 #include <vector>
 #include "BitArray.h"
 #include "modules/Materials.h"
@@ -296,6 +298,62 @@ inline df::tile_occupancy *getTileOccupancy(df::coord pos) {
     return getTileOccupancy(pos.x, pos.y, pos.z);
 }
 
+/*
+ * BLOCK SCANS
+ */
+
+/**
+ * A set of tiletypes, tested with a table lookup instead of ENUM_ATTR chains.
+ * Build it once, e.g. in a static, and reuse it for every tile.
+ */
+class DFHACK_EXPORT TiletypeSet
+{
+public:
+    static const int size = df::enum_traits<df::tiletype>::last_item_value + 1;
+
+    bool contains(df::tiletype tt) const {
+        return unsigned(tt) < unsigned(size) && bits[tt];
+    }
+    void add(df::tiletype tt) {
+        if (unsigned(tt) < unsigned(size))
+            bits[tt] = true;
+    }
+
+    /// All tiletypes for which pred(tt) is true
+    template<class Pred>
+    static TiletypeSet where(Pred pred) {
+        TiletypeSet set;
+        for (int i = 0; i < size; i++)
+            if (pred(df::tiletype(i)))
+                set.bits[i] = true;
+        return set;
+    }
+
+private:
+    std::bitset<size> bits;
+};
+
+/// Number of tiles of the block with a tiletype in the set
+DFHACK_EXPORT int countTiles(df::map_block *block, const TiletypeSet &types);
+/// True if every tile of the block has a tiletype in the set
+DFHACK_EXPORT bool allTiles(df::map_block *block, const TiletypeSet &types);
+/// Number of tiles of the block for which (designation & mask) == value
+DFHACK_EXPORT int countTiles(df::map_block *block, df::tile_designation mask, df::tile_designation value);
+/// Number of tiles of the block for which (occupancy & mask) == value
+DFHACK_EXPORT int countTiles(df::map_block *block, df::tile_occupancy mask, df::tile_occupancy value);
+
+/**
+ * Calls fn for every block in world->map.map_blocks, spread over a pool of
+ * worker threads. The caller must hold the core suspended. fn runs on
+ * several threads at once, so it may only touch its own block and its own
+ * results, and must not call anything that needs the core lock or Lua.
+ */
+DFHACK_EXPORT void forEachBlock(const std::function<void(df::map_block*)> &fn);
+/// Sum of fn over all blocks, computed like forEachBlock
+DFHACK_EXPORT int64_t sumBlocks(const std::function<int64_t(df::map_block*)> &fn);
+/// True if fn is true for any block; stops early once one is found
+DFHACK_EXPORT bool anyBlock(const std::function<bool(df::map_block*)> &fn);
+
 /**
  * Returns biome info about the specified world region.
  */
@@ -0,0 +1,124 @@
+/*
+https://github.com/peterix/dfhack
+Copyright (c) 2009-2012 Petr Mrázek (peterix@gmail.com)
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any
+damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any
+purpose, including commercial applications, and to alter it and
+redistribute it freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must
+not claim that you wrote the original software. If you use this
+software in a product, an acknowledgment in the product documentation
+would be appreciated but is not required.
+
+2. Altered source versions must be plainly marked as such, and
+must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any source
+distribution.
+*/
+
+#pragma once
+#include "Export.h"
+#include "DataDefs.h"
+
+#include "df/coord.h"
+
+#include <functional>
+#include <vector>
+
+/**
+ * \defgroup grp_pathsearch Resumable shortest path search over map tiles
+ * @ingroup grp_modules
+ */
+
+namespace DFHack
+{
+    /**
+     * Dijkstra search over map tiles with caller supplied edge costs.
+     *
+     * Per-tile state lives in arrays allocated per map block on first use,
+     * and reused by later searches. Open tiles are kept in a radix heap, so
+     * pushing and popping doesn't depend on the number of open tiles.
+     *
+     * A search can be run a bounded number of expansions at a time and
+     * resumed later, e.g. to spread it over several ticks.
+     * \ingroup grp_pathsearch
+     */
+    class DFHACK_EXPORT PathSearch
+    {
+    public:
+        typedef int64_t cost_t;
+
+        struct Step
+        {
+            df::coord pos;
+            cost_t cost; // must not be negative
+        };
+
+        // Appends the steps that leave pos to the vector.
+        typedef std::function<void(df::coord pos, std::vector<Step> &steps)> Expander;
+
+        enum Result
+        {
+            Running,    // the expansion budget ran out
+            Found,      // a target was reached, see getFound
+            Exhausted   // no target can be reached
+        };
+
+        PathSearch();
+        ~PathSearch();
+
+        // Forgets the previous search and sizes the search to the current map.
+        void clear();
+
+        void addSource(df::coord pos, cost_t cost = 0);
+        void addTarget(df::coord pos);
+
+        // Expands at most maxExpansions tiles, or until done if maxExpansions <= 0.
+        Result run(const Expander &expand, int32_t maxExpansions = 0);
+
+        // True if sources were added and the search hasn't finished.
+        bool isRunning() const { return !finished && queued > 0; }
+
+        df::coord getFound() const { return found; }
+        size_t getExpanded() const { return expanded; }
+
+        // Cost of the best path found so far, or -1 if the tile wasn't reached.
+        cost_t getCost(df::coord pos) const;
+        // The tile the best path to pos comes from. False for sources and unreached tiles.
+        bool getParent(df::coord pos, df::coord *parent) const;
+
+    private:
+        struct NodeBlock;
+
+        struct Entry
+        {
+            uint64_t key;
+            df::coord pos;
+        };
+
+        int32_t x_blocks, y_blocks, z_levels;
+        uint32_t generation;
+        std::vector<NodeBlock*> blocks;
+
+        // Radix heap: bucket i holds keys whose highest bit differing from last_key is bit i-1.
+        std::vector<Entry> buckets[65];
+        uint64_t last_key;
+        size_t queued;
+
+        std::vector<Step> steps;
+        df::coord found;
+        size_t expanded;
+        bool finished;
+
+        NodeBlock *getBlock(df::coord pos, bool create);
+        const NodeBlock *getBlock(df::coord pos) const;
+        void push(df::coord pos, cost_t cost);
+        bool pop(Entry *entry);
+    };
+}
@@ -75,6 +75,10 @@ DFHACK_EXPORT df::unit *getUnit(const int32_t index);
 DFHACK_EXPORT bool getUnitsInBox(std::vector<df::unit*> &units,
     int16_t x1, int16_t y1, int16_t z1,
     int16_t x2, int16_t y2, int16_t z2);
+/// Units within radius tiles (straight-line distance) of center.
+DFHACK_EXPORT bool getUnitsInRadius(std::vector<df::unit*> &units, df::coord center, int radius);
+/// Units in the 16x16 map block with the given block coordinates (as in Maps::getBlock).
+DFHACK_EXPORT bool getUnitsInBlock(std::vector<df::unit*> &units, int16_t x, int16_t y, int16_t z);
 
 DFHACK_EXPORT int32_t findIndexById(int32_t id);
 
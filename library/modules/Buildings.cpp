@@ -103,6 +103,207 @@ struct CoordHash {
 
 static unordered_map<df::coord, int32_t, CoordHash> locationToBuilding;
 
+/*
+ * Grid of 16x16 tile cells listing the ids of all buildings, civzones
+ * included, whose bounding box touches each cell, in id order. The game
+ * never moves or resizes a building once it has an id, so new ones are
+ * picked up by watching building_next_id, and deleted ones are dropped
+ * when a lookup no longer finds them. Scripts can still edit a building's
+ * bounds, so on the first lookup of every frame, paused or not, all
+ * indexed boxes are compared with the buildings.
+ */
+namespace {
+    struct BuildingBox
+    {
+        int16_t x1, y1, x2, y2, z;
+
+        bool operator==(const BuildingBox &other) const
+        {
+            return x1 == other.x1 && y1 == other.y1 && x2 == other.x2 && y2 == other.y2 && z == other.z;
+        }
+        bool operator!=(const BuildingBox &other) const
+        {
+            return !(*this == other);
+        }
+    };
+
+    struct IndexedBox
+    {
+        int32_t id;
+        BuildingBox box;
+
+        bool operator<(int32_t other) const { return id < other; }
+    };
+
+    struct BuildingIndex
+    {
+        unordered_map<uint64_t, vector<int32_t>> cells;
+        vector<IndexedBox> boxes; // Sorted by id, like the building vector
+        int32_t next_id = -1; // ids below this are indexed
+        uint32_t checked = 0; // Core update count of the last box check
+        bool ever_checked = false;
+
+        static uint64_t cellKey(int x, int y, int z)
+        {
+            return (uint64_t(uint16_t(x >> 4)) << 32) | (uint64_t(uint16_t(y >> 4)) << 16) | uint16_t(z);
+        }
+
+        static BuildingBox boxOf(df::building *bld)
+        {
+            BuildingBox box;
+            box.x1 = min(bld->x1, bld->x2);
+            box.y1 = min(bld->y1, bld->y2);
+            box.x2 = max(bld->x1, bld->x2);
+            box.y2 = max(bld->y1, bld->y2);
+            box.z = bld->z;
+            return box;
+        }
+
+        void clear()
+        {
+            cells.clear();
+            boxes.clear();
+            next_id = -1;
+            ever_checked = false;
+        }
+
+        IndexedBox *findBox(int32_t id)
+        {
+            auto it = std::lower_bound(boxes.begin(), boxes.end(), id);
+            return it != boxes.end() && it->id == id ? &*it : NULL;
+        }
+
+        void add(df::building *bld)
+        {
+            IndexedBox entry = { bld->id, boxOf(bld) };
+            // New buildings have the highest ids, so this is an append
+            boxes.insert(std::lower_bound(boxes.begin(), boxes.end(), bld->id), entry);
+            const BuildingBox &box = entry.box;
+            for (int y = box.y1 & ~15; y <= box.y2; y += 16)
+                for (int x = box.x1 & ~15; x <= box.x2; x += 16)
+                    insert_into_vector(cells[cellKey(x, y, box.z)], bld->id);
+        }
+
+        void remove(int32_t id)
+        {
+            auto it = std::lower_bound(boxes.begin(), boxes.end(), id);
+            if (it == boxes.end() || it->id != id)
+                return;
+            BuildingBox box = it->box;
+            boxes.erase(it);
+            for (int y = box.y1 & ~15; y <= box.y2; y += 16)
+                for (int x = box.x1 & ~15; x <= box.x2; x += 16)
+                {
+                    auto cell = cells.find(cellKey(x, y, box.z));
+                    if (cell == cells.end())
+                        continue;
+                    erase_from_vector(cell->second, id);
+                    if (cell->second.empty())
+                        cells.erase(cell);
+                }
+        }
+
+        // Reindexes buildings whose bounds changed, and drops deleted ones
+        void checkBoxes()
+        {
+            auto &vec = df::building::get_vector();
+            vector<int32_t> gone;
+            vector<df::building*> moved;
+
+            size_t j = 0;
+            for (size_t i = 0; i < boxes.size(); i++)
+            {
+                while (j < vec.size() && vec[j]->id < boxes[i].id)
+                    j++;
+                if (j == vec.size() || vec[j]->id != boxes[i].id)
+                    gone.push_back(boxes[i].id);
+                else if (boxOf(vec[j]) != boxes[i].box)
+                    moved.push_back(vec[j]);
+            }
+
+            for (size_t i = 0; i < gone.size(); i++)
+                remove(gone[i]);
+            for (size_t i = 0; i < moved.size(); i++)
+            {
+                remove(moved[i]->id);
+                add(moved[i]);
+            }
+        }
+
+        void sync()
+        {
+            if (!building_next_id)
+                return;
+
+            if (next_id != *building_next_id)
+            {
+                auto &vec = df::building::get_vector();
+                if (next_id < 0)
+                {
+                    cells.clear();
+                    boxes.clear();
+                    for (size_t i = 0; i < vec.size(); i++)
+                        add(vec[i]);
+                }
+                else
+                {
+                    // The vector is sorted by id, so new buildings are at the end
+                    size_t first = vec.size();
+                    while (first > 0 && vec[first-1]->id >= next_id)
+                        first--;
+                    for (size_t i = first; i < vec.size(); i++)
+                    {
+                        if (!findBox(vec[i]->id))
+                            add(vec[i]);
+                    }
+                }
+                next_id = *building_next_id;
+            }
+
+            uint32_t frame = Core::getInstance().getUpdateCount();
+            if (!ever_checked || frame != checked)
+            {
+                checkBoxes();
+                checked = frame;
+                ever_checked = true;
+            }
+        }
+
+        // Calls fn for every live building listed in the cell, in id order.
+        // Returns false if fn did.
+        template<class F>
+        bool forCell(int x, int y, int z, F fn)
+        {
+            auto cell = cells.find(cellKey(x, y, z));
+            if (cell == cells.end())
+                return true;
+
+            // Copy, since stale ids are removed on the way
+            auto ids = cell->second;
+            for (size_t i = 0; i < ids.size(); i++)
+            {
+                auto bld = df::building::find(ids[i]);
+                if (!bld)
+                {
+                    remove(ids[i]);
+                    continue;
+                }
+                IndexedBox *entry = findBox(ids[i]);
+                if (!entry || boxOf(bld) != entry->box)
+                {
+                    remove(ids[i]);
+                    add(bld);
+                }
+                if (!fn(bld))
+                    return false;
+            }
+            return true;
+        }
+    };
+}
+
+static BuildingIndex buildingIndex;
+
 static uint8_t *getExtentTile(df::building_extents &extent, df::coord2d tile)
 {
     if (!extent.extents)
@@ -126,9 +327,11 @@ void buildings_onStateChange(color_ostream &out, state_change_event event)
     switch (event) {
     case SC_MAP_LOADED:
         buildings_do_onupdate = true;
+        buildingIndex.clear();
         break;
     case SC_MAP_UNLOADED:
         buildings_do_onupdate = false;
+        buildingIndex.clear();
         break;
     default:
         break;
@@ -281,7 +484,21 @@ df::building *Buildings::findAtTile(df::coord pos)
         }
     }
 
-    // The authentic method, i.e. how the game generally does this:
+    // The cell lists buildings in id order, so overlaps resolve like the vector scan below
+    df::building *found = NULL;
+    buildingIndex.sync();
+    buildingIndex.forCell(pos.x, pos.y, pos.z, [&](df::building *bld) -> bool {
+        if (bld->z == pos.z && bld->isSettingOccupancy() && containsTile(bld, pos, false))
+        {
+            found = bld;
+            return false;
+        }
+        return true;
+    });
+    if (found || building_next_id)
+        return found;
+
+    // Without the index, fall back to the authentic method, i.e. how the game generally does this:
     auto &vec = df::building::get_vector();
     for (size_t i = 0; i < vec.size(); i++)
     {
@@ -312,18 +529,54 @@ bool Buildings::findCivzonesAt(std::vector<df::building_civzonest*> *pvec, df::c
 {
     pvec->clear();
 
-    auto &vec = world->buildings.other[buildings_other_id::ANY_ZONE];
+    buildingIndex.sync();
+    buildingIndex.forCell(pos.x, pos.y, pos.z, [&](df::building *bld) -> bool {
+        auto zone = strict_virtual_cast<df::building_civzonest>(bld);
+        if (zone && zone->z == pos.z && containsTile(zone, pos))
+            pvec->push_back(zone);
+        return true;
+    });
 
-    for (size_t i = 0; i < vec.size(); i++)
-    {
-        auto bld = strict_virtual_cast<df::building_civzonest>(vec[i]);
+    return !pvec->empty();
+}
 
-        if (!bld || bld->z != pos.z || !containsTile(bld, pos))
-            continue;
+bool Buildings::findInBox(std::vector<df::building*> *pvec, df::coord p1, df::coord p2)
+{
+    pvec->clear();
+
+    int16_t x1 = min(p1.x, p2.x), x2 = max(p1.x, p2.x);
+    int16_t y1 = min(p1.y, p2.y), y2 = max(p1.y, p2.y);
+    int16_t z1 = min(p1.z, p2.z), z2 = max(p1.z, p2.z);
 
-        pvec->push_back(bld);
+    auto check = [&](df::building *bld) -> bool {
+        BuildingBox box = BuildingIndex::boxOf(bld);
+        if (box.z >= z1 && box.z <= z2 &&
+            box.x1 <= x2 && box.x2 >= x1 &&
+            box.y1 <= y2 && box.y2 >= y1)
+            pvec->push_back(bld);
+        return true;
+    };
+
+    buildingIndex.sync();
+
+    int64_t cells = int64_t((x2 >> 4) - (x1 >> 4) + 1) * ((y2 >> 4) - (y1 >> 4) + 1) * (z2 - z1 + 1);
+    if (cells > int64_t(buildingIndex.cells.size()))
+    {
+        // Cheaper to check every building
+        auto &vec = df::building::get_vector();
+        for (size_t i = 0; i < vec.size(); i++)
+            check(vec[i]);
+        return !pvec->empty();
     }
 
+    for (int z = z1; z <= z2; z++)
+        for (int y = y1 & ~15; y <= y2; y += 16)
+            for (int x = x1 & ~15; x <= x2; x += 16)
+                buildingIndex.forCell(x, y, z, check);
+
+    // Buildings spanning several cells were added once per cell
+    std::sort(pvec->begin(), pvec->end(), [](df::building *a, df::building *b) { return a->id < b->id; });
+    pvec->erase(std::unique(pvec->begin(), pvec->end()), pvec->end());
     return !pvec->empty();
 }
 
@@ -1150,6 +1403,7 @@ bool Buildings::deconstruct(df::building *bld)
     // Don't clear arrows.
 
     bld->uncategorize();
+    buildingIndex.remove(bld->id);
     delete bld;
 
     if (world->selected_building == bld)
@@ -1195,6 +1449,7 @@ void Buildings::clearBuildings(color_ostream& out) {
     corner1.clear();
     corner2.clear();
     locationToBuilding.clear();
+    buildingIndex.clear();
 }
 
 void Buildings::updateBuildings(color_ostream& out, void* ptr)
@@ -1202,6 +1457,9 @@ void Buildings::updateBuildings(color_ostream& out, void* ptr)
     int32_t id = *((int32_t*)ptr);
     auto building = df::building::find(id);
 
+    if (!building)
+        buildingIndex.remove(id);
+
     if (building)
     {
         // Already cached -> weird, so bail out
@@ -35,6 +35,8 @@
 #include "df/unit_wound.h"
 #include "df/world.h"
 
+#include "Profiler.h"
+
 #include <algorithm>
 #include <cstring>
 #include <map>
@@ -54,6 +56,7 @@ using namespace df::enums;
  **/
 
 static multimap<int32_t, EventHandler> tickQueue;
+static unordered_map<EventHandler::callback_t, int> tickSources; //profiler source of each tick callback
 
 //TODO: consider unordered_map of pairs, or unordered_map of unordered_set, or whatever
 static multimap<Plugin*, EventHandler> handlers[EventType::EVENT_MAX];
@@ -61,8 +64,235 @@ static int32_t eventLastTick[EventType::EVENT_MAX];
 
 static const int32_t ticksPerYear = 403200;
 
+/*
+ * Handler scheduling.
+ *
+ * Every handler has its own next check tick, kept in a timing wheel, and an
+ * event type is only checked on ticks where at least one of its handlers is
+ * due. All handlers of the type still receive whatever the check finds,
+ * since each check diffs against state shared by all of them. Handlers with
+ * a budget that keep going over it are checked less often, which in turn
+ * lets their event type be checked less often.
+ */
+struct HandlerState : HandlerStats {
+    int32_t due; //tick of this handler's live wheel entry, -1 if none
+    int32_t backoff; //interval is shifted left by this while over budget
+    uint64_t run_ns; //time spent during the current check
+    int profile_source;
+};
+
+struct ScheduledCheck {
+    int32_t due;
+    EventType::EventType type;
+    EventHandler handler;
+};
+
+static const int32_t wheelSize = 256;
+static const int32_t maxBackoff = 6;
+static vector<ScheduledCheck> wheel[wheelSize];
+static int32_t wheelTick = -1; //last tick collected from the wheel
+static unordered_map<EventHandler, HandlerState> handlerStates[EventType::EVENT_MAX];
+static int32_t everyUpdate[EventType::EVENT_MAX]; //number of handlers with interval 0
+static uint64_t handlerNs; //time spent in handlers during the current check
+
+static bool isScheduled(EventType::EventType e) {
+    return e != EventType::TICK && e != EventType::UNLOAD;
+}
+
+static constexpr bool overBudget(uint64_t ns, int32_t budget) {
+    return budget > 0 && ns > uint64_t(budget) * 1000;
+}
+
+//backoff after a check that took ns; it only comes down once the handler fits in half its budget
+static constexpr int32_t nextBackoff(int32_t backoff, uint64_t ns, int32_t budget) {
+    return budget <= 0 ? 0
+        : overBudget(ns, budget) ? (backoff < maxBackoff ? backoff + 1 : backoff)
+        : ns * 2 < uint64_t(budget) * 1000 && backoff > 0 ? backoff - 1
+        : backoff;
+}
+
+static constexpr int32_t checkInterval(int32_t freq, int32_t backoff) {
+    return backoff == 0 ? (freq > 0 ? freq : 0) : (freq > 1 ? freq : 1) << backoff;
+}
+
+static_assert(nextBackoff(0, 999000, 1000) == 0, "within budget keeps the interval");
+static_assert(nextBackoff(0, 1001000, 1000) == 1, "over budget backs off");
+static_assert(nextBackoff(maxBackoff, 5000000, 1000) == maxBackoff, "backoff is capped");
+static_assert(nextBackoff(3, 600000, 1000) == 3, "between half and full budget holds");
+static_assert(nextBackoff(3, 400000, 1000) == 2, "under half the budget recovers");
+static_assert(nextBackoff(3, 5000000, 0) == 0, "no budget never backs off");
+static_assert(checkInterval(0, 0) == 0 && checkInterval(0, 2) == 4, "every-update handlers back off from 1 tick");
+static_assert(checkInterval(10, 0) == 10 && checkInterval(10, maxBackoff) == 640, "up to 64x the frequency");
+
+static void scheduleCheck(HandlerState& state, const EventHandler& handler, int32_t due) {
+    if ( wheelTick >= 0 && due <= wheelTick )
+        due = wheelTick + 1;
+    state.due = due;
+    ScheduledCheck check = { due, state.type, handler };
+    wheel[due % wheelSize].push_back(check);
+}
+
+static void setInterval(HandlerState& state, int32_t interval) {
+    if ( state.interval == 0 )
+        everyUpdate[state.type]--;
+    if ( interval == 0 ) {
+        everyUpdate[state.type]++;
+        state.due = -1;
+    }
+    state.interval = interval;
+}
+
+static void rebuildSchedule(int32_t tick) {
+    for ( int32_t a = 0; a < wheelSize; a++ )
+        wheel[a].clear();
+    wheelTick = -1;
+    for ( size_t a = 0; a < EventType::EVENT_MAX; a++ ) {
+        for ( auto i = handlerStates[a].begin(); i != handlerStates[a].end(); i++ ) {
+            if ( (*i).second.interval > 0 )
+                scheduleCheck((*i).second, (*i).first, tick);
+        }
+    }
+}
+
+static void collectDueChecks(int32_t tick, bool* pending) {
+    if ( wheelTick >= 0 && tick < wheelTick )
+        rebuildSchedule(tick);
+    if ( wheelTick < 0 )
+        wheelTick = tick - 1;
+
+    int32_t steps = min(tick - wheelTick, wheelSize);
+    for ( int32_t s = 1; s <= steps; s++ ) {
+        vector<ScheduledCheck>& slot = wheel[(wheelTick + s) % wheelSize];
+        for ( size_t i = 0; i < slot.size(); ) {
+            if ( slot[i].due > tick ) {
+                i++;
+                continue;
+            }
+            auto state = handlerStates[slot[i].type].find(slot[i].handler);
+            if ( state != handlerStates[slot[i].type].end() && (*state).second.due == slot[i].due )
+                pending[slot[i].type] = true;
+            slot[i] = slot.back();
+            slot.pop_back();
+        }
+    }
+    wheelTick = tick;
+}
+
+//called after the checker for an event type ran; check_ns is the time it took outside of handlers
+static void rescheduleHandlers(EventType::EventType e, int32_t tick, uint64_t check_ns) {
+    for ( auto i = handlerStates[e].begin(); i != handlerStates[e].end(); i++ ) {
+        const EventHandler& handler = (*i).first;
+        HandlerState& state = (*i).second;
+        bool wasDue = state.interval == 0 || state.due <= tick;
+        //the handlers that were due are the reason the check ran, so they pay for it
+        if ( wasDue )
+            state.run_ns += check_ns;
+        if ( overBudget(state.run_ns, state.budget) )
+            state.overruns++;
+        state.backoff = nextBackoff(state.backoff, state.run_ns, state.budget);
+        state.run_ns = 0;
+
+        setInterval(state, checkInterval(handler.freq, state.backoff));
+        if ( state.interval > 0 && wasDue )
+            scheduleCheck(state, handler, tick + state.interval);
+    }
+}
+
+static void callHandler(color_ostream& out, EventType::EventType e, const EventHandler& handler, void* data) {
+    auto i = handlerStates[e].find(handler);
+    int source = i != handlerStates[e].end() ? (*i).second.profile_source : -1;
+
+    uint64_t start = Profiler::now();
+    handler.eventHandler(out, data);
+    uint64_t end = Profiler::now();
+    uint64_t ns = end - start;
+    handlerNs += ns;
+    if ( Profiler::isEnabled() )
+        Profiler::record(source, start, end);
+
+    //the handler may have unregistered itself
+    i = handlerStates[e].find(handler);
+    if ( i == handlerStates[e].end() )
+        return;
+    HandlerState& state = (*i).second;
+    state.calls++;
+    state.total_ns += ns;
+    state.max_ns = max(state.max_ns, ns);
+    state.run_ns += ns;
+}
+
+static void forgetHandler(EventType::EventType e, const EventHandler& handler) {
+    auto i = handlerStates[e].find(handler);
+    if ( i == handlerStates[e].end() )
+        return;
+    if ( (*i).second.interval == 0 )
+        everyUpdate[e]--;
+    handlerStates[e].erase(i);
+}
+
 void DFHack::EventManager::registerListener(EventType::EventType e, EventHandler handler, Plugin* plugin) {
     handlers[e].insert(pair<Plugin*, EventHandler>(plugin, handler));
+    if ( !isScheduled(e) || handlerStates[e].count(handler) )
+        return;
+
+    HandlerState& state = handlerStates[e][handler];
+    state.type = e;
+    state.plugin = plugin;
+    state.freq = handler.freq;
+    state.budget = max(handler.budget, 0);
+    state.interval = -1;
+    state.due = -1;
+    state.backoff = 0;
+    state.run_ns = 0;
+    state.profile_source = Profiler::getSource(Profiler::EVENT_HANDLER,
+        string(plugin ? plugin->getName() : "(core)") + "/" + getEventTypeName(e));
+    setInterval(state, checkInterval(handler.freq, 0));
+    if ( state.interval > 0 )
+        scheduleCheck(state, handler, df::global::world ? df::global::world->frame_counter : 0);
+}
+
+vector<HandlerStats> DFHack::EventManager::getHandlerStats() {
+    vector<HandlerStats> result;
+    for ( size_t a = 0; a < EventType::EVENT_MAX; a++ ) {
+        for ( auto i = handlerStates[a].begin(); i != handlerStates[a].end(); i++ )
+            result.push_back((*i).second);
+    }
+    return result;
+}
+
+void DFHack::EventManager::resetHandlerStats() {
+    for ( size_t a = 0; a < EventType::EVENT_MAX; a++ ) {
+        for ( auto i = handlerStates[a].begin(); i != handlerStates[a].end(); i++ ) {
+            HandlerState& state = (*i).second;
+            state.calls = 0;
+            state.total_ns = 0;
+            state.max_ns = 0;
+            state.overruns = 0;
+        }
+    }
+}
+
+const char* DFHack::EventManager::getEventTypeName(EventType::EventType e) {
+    static const char* const names[] = {
+        "TICK",
+        "JOB_INITIATED",
+        "JOB_COMPLETED",
+        "UNIT_DEATH",
+        "ITEM_CREATED",
+        "BUILDING",
+        "CONSTRUCTION",
+        "SYNDROME",
+        "INVASION",
+        "INVENTORY_CHANGE",
+        "REPORT",
+        "UNIT_ATTACK",
+        "UNLOAD",
+        "INTERACTION",
+    };
+    static_assert(sizeof(names) / sizeof(names[0]) == EventType::EVENT_MAX, "event type names out of date");
+    if ( e < 0 || e >= EventType::EVENT_MAX )
+        return "?";
+    return names[e];
 }
 
 int32_t DFHack::EventManager::registerTick(EventHandler handler, int32_t when, Plugin* plugin, bool absolute) {
@@ -76,6 +306,9 @@ int32_t DFHack::EventManager::registerTick(EventHandler handler, int32_t when, P
         }
     }
     handler.freq = when;
+    if ( !tickSources.count(handler.eventHandler) )
+        tickSources[handler.eventHandler] = Profiler::getSource(Profiler::EVENT_HANDLER,
+            string(plugin ? plugin->getName() : "(core)") + "/" + getEventTypeName(EventType::TICK));
     tickQueue.insert(pair<int32_t, EventHandler>(handler.freq, handler));
     handlers[EventType::TICK].insert(pair<Plugin*,EventHandler>(plugin,handler));
     return when;
@@ -106,6 +339,12 @@ void DFHack::EventManager::unregister(EventType::EventType e, EventHandler handl
         if ( e == EventType::TICK )
             removeFromTickQueue(handler);
     }
+
+    for ( auto i = handlers[e].begin(); i != handlers[e].end(); i++ ) {
+        if ( (*i).second == handler )
+            return;
+    }
+    forgetHandler(e, handler);
 }
 
 void DFHack::EventManager::unregisterAll(Plugin* plugin) {
@@ -117,6 +356,15 @@ void DFHack::EventManager::unregisterAll(Plugin* plugin) {
     }
     for ( size_t a = 0; a < (size_t)EventType::EVENT_MAX; a++ ) {
         handlers[a].erase(plugin);
+        for ( auto i = handlerStates[a].begin(); i != handlerStates[a].end(); ) {
+            if ( (*i).second.plugin != plugin ) {
+                i++;
+                continue;
+            }
+            if ( (*i).second.interval == 0 )
+                everyUpdate[a]--;
+            i = handlerStates[a].erase(i);
+        }
     }
     return;
 }
@@ -159,7 +407,28 @@ static const eventManager_t eventManager[] = {
 static int32_t lastJobId = -1;
 
 //job completed
-static unordered_map<int32_t, df::job*> prevJobs;
+struct JobSnapshot {
+    int32_t id;
+    bool repeat;
+    int32_t completion_timer;
+    //deep copy, only kept for jobs that can complete before the next poll
+    df::job* clone;
+};
+//sorted by id; both vectors are reused across polls
+static vector<JobSnapshot> prevJobs;
+static vector<JobSnapshot> nowJobs;
+
+static bool compareJobSnapshot(const JobSnapshot& a, const JobSnapshot& b) {
+    return a.id < b.id;
+}
+
+static void clearJobSnapshot(vector<JobSnapshot>& jobs) {
+    for ( auto i = jobs.begin(); i != jobs.end(); i++ ) {
+        if ( (*i).clone )
+            Job::deleteJobStruct((*i).clone, true);
+    }
+    jobs.clear();
+}
 
 //unit death
 static unordered_set<int32_t> livingUnits;
@@ -209,10 +478,7 @@ void DFHack::EventManager::onStateChange(color_ostream& out, state_change_event
     }
     if ( event == DFHack::SC_MAP_UNLOADED ) {
         lastJobId = -1;
-        for ( auto i = prevJobs.begin(); i != prevJobs.end(); i++ ) {
-            Job::deleteJobStruct((*i).second, true);
-        }
-        prevJobs.clear();
+        clearJobSnapshot(prevJobs);
         tickQueue.clear();
         livingUnits.clear();
         buildings.clear();
@@ -297,6 +563,7 @@ void DFHack::EventManager::onStateChange(color_ostream& out, state_change_event
         for ( size_t a = 0; a < EventType::EVENT_MAX; a++ ) {
             eventLastTick[a] = -1;//-1000000;
         }
+        rebuildSchedule(df::global::world->frame_counter);
         for ( size_t a = 0; a < df::global::world->history.figures.size(); a++ ) {
             df::historical_figure* unit = df::global::world->history.figures[a];
             if ( unit->id < 0 && unit->name.language < 0 )
@@ -318,23 +585,21 @@ void DFHack::EventManager::manageEvents(color_ostream& out) {
 
     int32_t tick = df::global::world->frame_counter;
 
-    for ( size_t a = 0; a < EventType::EVENT_MAX; a++ ) {
-        if ( handlers[a].empty() )
-            continue;
-        int32_t eventFrequency = -100;
-        if ( a != EventType::TICK )
-            for ( auto b = handlers[a].begin(); b != handlers[a].end(); b++ ) {
-                EventHandler bob = (*b).second;
-                if ( bob.freq < eventFrequency || eventFrequency == -100 )
-                    eventFrequency = bob.freq;
-            }
-        else eventFrequency = 1;
+    bool pending[EventType::EVENT_MAX] = {};
+    collectDueChecks(tick, pending);
+    pending[EventType::TICK] = !handlers[EventType::TICK].empty() && tick != eventLastTick[EventType::TICK];
 
-        if ( tick >= eventLastTick[a] && tick - eventLastTick[a] < eventFrequency )
+    for ( size_t a = 0; a < EventType::EVENT_MAX; a++ ) {
+        if ( !pending[a] && everyUpdate[a] == 0 )
             continue;
 
+        handlerNs = 0;
+        uint64_t start = Profiler::now();
         eventManager[a](out);
+        uint64_t ns = Profiler::now() - start;
         eventLastTick[a] = tick;
+        if ( isScheduled((EventType::EventType)a) )
+            rescheduleHandlers((EventType::EventType)a, tick, ns > handlerNs ? ns - handlerNs : 0);
     }
 }
 
@@ -348,6 +613,8 @@ static void manageTickEvent(color_ostream& out) {
             break;
         EventHandler handle = (*tickQueue.begin()).second;
         tickQueue.erase(tickQueue.begin());
+        auto source = tickSources.find(handle.eventHandler);
+        Profiler::Scope timing(source != tickSources.end() ? (*source).second : -1);
         handle.eventHandler(out, (void*)intptr_t(tick));
         toRemove.insert(handle);
     }
@@ -387,19 +654,13 @@ static void manageJobInitiatedEvent(color_ostream& out) {
         if ( link->item->id <= lastJobId )
             continue;
         for ( auto i = copy.begin(); i != copy.end(); i++ ) {
-            (*i).second.eventHandler(out, (void*)link->item);
+            callHandler(out, EventType::JOB_INITIATED, (*i).second, (void*)link->item);
         }
     }
 
     lastJobId = *df::global::job_next_id - 1;
 }
 
-//helper function for manageJobCompletedEvent
-//static int32_t getWorkerID(df::job* job) {
-//    auto ref = findRef(job->general_refs, general_ref_type::UNIT_WORKER);
-//    return ref ? ref->getID() : -1;
-//}
-
 /*
 TODO: consider checking item creation / experience gain just in case
 */
@@ -410,124 +671,57 @@ static void manageJobCompletedEvent(color_ostream& out) {
     int32_t tick1 = df::global::world->frame_counter;
 
     multimap<Plugin*,EventHandler> copy(handlers[EventType::JOB_COMPLETED].begin(), handlers[EventType::JOB_COMPLETED].end());
-    map<int32_t, df::job*> nowJobs;
-    for ( df::job_list_link* link = &df::global::world->jobs.list; link != NULL; link = link->next ) {
-        if ( link->item == NULL )
-            continue;
-        nowJobs[link->item->id] = link->item;
-    }
-
-#if 0
-    //testing info on job initiation/completion
-    //newly allocated jobs
-    for ( auto j = nowJobs.begin(); j != nowJobs.end(); j++ ) {
-        if ( prevJobs.find((*j).first) != prevJobs.end() )
-            continue;
 
-        df::job& job1 = *(*j).second;
-        out.print("new job\n"
-            "  location         : 0x%X\n"
-            "  id               : %d\n"
-            "  type             : %d %s\n"
-            "  working          : %d\n"
-            "  completion_timer : %d\n"
-            "  workerID         : %d\n"
-            "  time             : %d -> %d\n"
-            "\n", job1.list_link->item, job1.id, job1.job_type, ENUM_ATTR(job_type, caption, job1.job_type), job1.flags.bits.working, job1.completion_timer, getWorkerID(&job1), tick0, tick1);
-    }
-    for ( auto i = prevJobs.begin(); i != prevJobs.end(); i++ ) {
-        df::job& job0 = *(*i).second;
-        auto j = nowJobs.find((*i).first);
-        if ( j == nowJobs.end() ) {
-            out.print("job deallocated\n"
-                "  location         : 0x%X\n"
-                "  id               : %d\n"
-                "  type             : %d %s\n"
-                "  working          : %d\n"
-                "  completion_timer : %d\n"
-                "  workerID         : %d\n"
-                "  time             : %d -> %d\n"
-                ,job0.list_link == NULL ? 0 : job0.list_link->item, job0.id, job0.job_type, ENUM_ATTR(job_type, caption, job0.job_type), job0.flags.bits.working, job0.completion_timer, getWorkerID(&job0), tick0, tick1);
-            continue;
-        }
-        df::job& job1 = *(*j).second;
-
-        if ( job0.flags.bits.working == job1.flags.bits.working &&
-               (job0.completion_timer == job1.completion_timer || (job1.completion_timer > 0 && job0.completion_timer-1 == job1.completion_timer)) &&
-               getWorkerID(&job0) == getWorkerID(&job1) )
+    //a job is only reported if its completion timer was 0 on the previous poll, so only those jobs
+    //need a full copy for the handlers; everything else is compared by id and a couple of fields
+    nowJobs.clear();
+    bool sorted = true;
+    for ( df::job_list_link* link = &df::global::world->jobs.list; link != NULL; link = link->next ) {
+        df::job* job = link->item;
+        if ( job == NULL )
             continue;
-
-        out.print("job change\n"
-            "  location         : 0x%X -> 0x%X\n"
-            "  id               : %d -> %d\n"
-            "  type             : %d -> %d\n"
-            "  type             : %s -> %s\n"
-            "  working          : %d -> %d\n"
-            "  completion timer : %d -> %d\n"
-            "  workerID         : %d -> %d\n"
-            "  time             : %d -> %d\n"
-            "\n",
-            job0.list_link->item, job1.list_link->item,
-            job0.id, job1.id,
-            job0.job_type, job1.job_type,
-            ENUM_ATTR(job_type, caption, job0.job_type), ENUM_ATTR(job_type, caption, job1.job_type),
-            job0.flags.bits.working, job1.flags.bits.working,
-            job0.completion_timer, job1.completion_timer,
-            getWorkerID(&job0), getWorkerID(&job1),
-            tick0, tick1
-        );
+        JobSnapshot snapshot;
+        snapshot.id = job->id;
+        snapshot.repeat = job->flags.bits.repeat;
+        snapshot.completion_timer = job->completion_timer;
+        snapshot.clone = job->completion_timer == 0 ? Job::cloneJobStruct(job, true) : NULL;
+        if ( !nowJobs.empty() && nowJobs.back().id > snapshot.id )
+            sorted = false;
+        nowJobs.push_back(snapshot);
     }
-#endif
+    if ( !sorted )
+        std::sort(nowJobs.begin(), nowJobs.end(), compareJobSnapshot);
 
-    for ( auto i = prevJobs.begin(); i != prevJobs.end(); i++ ) {
-        //if it happened within a tick, must have been cancelled by the user or a plugin: not completed
-        if ( tick1 <= tick0 )
-            continue;
-
-        if ( nowJobs.find((*i).first) != nowJobs.end() ) {
-            //could have just finished if it's a repeat job
-            df::job& job0 = *(*i).second;
-            if ( !job0.flags.bits.repeat )
-                continue;
-            df::job& job1 = *nowJobs[(*i).first];
-            if ( job0.completion_timer != 0 )
-                continue;
-            if ( job1.completion_timer != -1 )
+    //if it happened within a tick, must have been cancelled by the user or a plugin: not completed
+    if ( tick1 > tick0 ) {
+        auto j = nowJobs.begin();
+        for ( auto i = prevJobs.begin(); i != prevJobs.end(); i++ ) {
+            while ( j != nowJobs.end() && (*j).id < (*i).id )
+                j++;
+            if ( (*i).clone == NULL )
                 continue;
 
-            //still false positive if cancelled at EXACTLY the right time, but experiments show this doesn't happen
-            for ( auto j = copy.begin(); j != copy.end(); j++ ) {
-                (*j).second.eventHandler(out, (void*)&job0);
+            if ( j != nowJobs.end() && (*j).id == (*i).id ) {
+                //could have just finished if it's a repeat job
+                if ( !(*i).repeat )
+                    continue;
+                if ( (*j).completion_timer != -1 )
+                    continue;
+                //still false positive if cancelled at EXACTLY the right time, but experiments show this doesn't happen
+            } else {
+                //recently finished or cancelled job
+                if ( (*i).repeat )
+                    continue;
             }
-            continue;
-        }
 
-        //recently finished or cancelled job
-        df::job& job0 = *(*i).second;
-        if ( job0.flags.bits.repeat || job0.completion_timer != 0 )
-            continue;
-
-        for ( auto j = copy.begin(); j != copy.end(); j++ ) {
-            (*j).second.eventHandler(out, (void*)&job0);
+            for ( auto h = copy.begin(); h != copy.end(); h++ ) {
+                callHandler(out, EventType::JOB_COMPLETED, (*h).second, (void*)(*i).clone);
+            }
         }
     }
 
-    //erase old jobs, copy over possibly altered jobs
-    for ( auto i = prevJobs.begin(); i != prevJobs.end(); i++ ) {
-        Job::deleteJobStruct((*i).second, true);
-    }
-    prevJobs.clear();
-
-    //create new jobs
-    for ( auto j = nowJobs.begin(); j != nowJobs.end(); j++ ) {
-        /*map<int32_t, df::job*>::iterator i = prevJobs.find((*j).first);
-        if ( i != prevJobs.end() ) {
-            continue;
-        }*/
-
-        df::job* newJob = Job::cloneJobStruct((*j).second, true);
-        prevJobs[newJob->id] = newJob;
-    }
+    clearJobSnapshot(prevJobs);
+    prevJobs.swap(nowJobs);
 }
 
 static void manageUnitDeathEvent(color_ostream& out) {
@@ -546,7 +740,7 @@ static void manageUnitDeathEvent(color_ostream& out) {
             continue;
 
         for ( auto i = copy.begin(); i != copy.end(); i++ ) {
-            (*i).second.eventHandler(out, (void*)intptr_t(unit->id));
+            callHandler(out, EventType::UNIT_DEATH, (*i).second, (void*)intptr_t(unit->id));
         }
         livingUnits.erase(unit->id);
     }
@@ -582,7 +776,7 @@ static void manageItemCreationEvent(color_ostream& out) {
         if ( item->flags.bits.spider_web )
             continue;
         for ( auto i = copy.begin(); i != copy.end(); i++ ) {
-            (*i).second.eventHandler(out, (void*)intptr_t(item->id));
+            callHandler(out, EventType::ITEM_CREATED, (*i).second, (void*)intptr_t(item->id));
         }
     }
     nextItem = *df::global::item_next_id;
@@ -609,7 +803,7 @@ static void manageBuildingEvent(color_ostream& out) {
         buildings.insert(a);
         for ( auto b = copy.begin(); b != copy.end(); b++ ) {
             EventHandler bob = (*b).second;
-            bob.eventHandler(out, (void*)&a);
+            callHandler(out, EventType::BUILDING, bob, (void*)&a);
         }
     }
     nextBuilding = *df::global::building_next_id;
@@ -625,7 +819,7 @@ static void manageBuildingEvent(color_ostream& out) {
 
         for ( auto b = copy.begin(); b != copy.end(); b++ ) {
             EventHandler bob = (*b).second;
-            bob.eventHandler(out, (void*)&id);
+            callHandler(out, EventType::BUILDING, bob, (void*)&id);
         }
         a = buildings.erase(a);
     }
@@ -647,7 +841,7 @@ static void manageConstructionEvent(color_ostream& out) {
         //out.print("Removed construction (%d,%d,%d)\n", construction.pos.x,construction.pos.y,construction.pos.z);
         for ( auto b = copy.begin(); b != copy.end(); b++ ) {
             EventHandler handle = (*b).second;
-            handle.eventHandler(out, (void*)&construction);
+            callHandler(out, EventType::CONSTRUCTION, handle, (void*)&construction);
         }
         a = constructions.erase(a);
     }
@@ -663,7 +857,7 @@ static void manageConstructionEvent(color_ostream& out) {
         //out.print("Created construction (%d,%d,%d)\n", construction->pos.x,construction->pos.y,construction->pos.z);
         for ( auto b = copy.begin(); b != copy.end(); b++ ) {
             EventHandler handle = (*b).second;
-            handle.eventHandler(out, (void*)construction);
+            callHandler(out, EventType::CONSTRUCTION, handle, (void*)construction);
         }
     }
 }
@@ -690,7 +884,7 @@ static void manageSyndromeEvent(color_ostream& out) {
             SyndromeData data(unit->id, b);
             for ( auto c = copy.begin(); c != copy.end(); c++ ) {
                 EventHandler handle = (*c).second;
-                handle.eventHandler(out, (void*)&data);
+                callHandler(out, EventType::SYNDROME, handle, (void*)&data);
             }
         }
     }
@@ -708,7 +902,7 @@ static void manageInvasionEvent(color_ostream& out) {
 
     for ( auto a = copy.begin(); a != copy.end(); a++ ) {
         EventHandler handle = (*a).second;
-        handle.eventHandler(out, (void*)intptr_t(nextInvasion-1));
+        callHandler(out, EventType::INVASION, handle, (void*)intptr_t(nextInvasion-1));
     }
 }
 
@@ -751,7 +945,7 @@ static void manageEquipmentEvent(color_ostream& out) {
                 InventoryChangeData data(unit->id, NULL, &item_new);
                 for ( auto h = copy.begin(); h != copy.end(); h++ ) {
                     EventHandler handle = (*h).second;
-                    handle.eventHandler(out, (void*)&data);
+                    callHandler(out, EventType::INVENTORY_CHANGE, handle, (void*)&data);
                 }
                 continue;
             }
@@ -766,7 +960,7 @@ static void manageEquipmentEvent(color_ostream& out) {
             InventoryChangeData data(unit->id, &item_old, &item_new);
             for ( auto h = copy.begin(); h != copy.end(); h++ ) {
                 EventHandler handle = (*h).second;
-                handle.eventHandler(out, (void*)&data);
+                callHandler(out, EventType::INVENTORY_CHANGE, handle, (void*)&data);
             }
         }
         //check for dropped items
@@ -778,7 +972,7 @@ static void manageEquipmentEvent(color_ostream& out) {
             InventoryChangeData data(unit->id, &i, NULL);
             for ( auto h = copy.begin(); h != copy.end(); h++ ) {
                 EventHandler handle = (*h).second;
-                handle.eventHandler(out, (void*)&data);
+                callHandler(out, EventType::INVENTORY_CHANGE, handle, (void*)&data);
             }
         }
         if ( !hadEquipment )
@@ -831,7 +1025,7 @@ static void manageReportEvent(color_ostream& out) {
         df::report* report = reports[a];
         for ( auto b = copy.begin(); b != copy.end(); b++ ) {
             EventHandler handle = (*b).second;
-            handle.eventHandler(out, (void*)intptr_t(report->id));
+            callHandler(out, EventType::REPORT, handle, (void*)intptr_t(report->id));
         }
         lastReport = report->id;
     }
@@ -910,7 +1104,7 @@ static void manageUnitAttackEvent(color_ostream& out) {
             alreadyDone[data.attacker][data.defender] = 1;
             for ( auto b = copy.begin(); b != copy.end(); b++ ) {
                 EventHandler handle = (*b).second;
-                handle.eventHandler(out, (void*)&data);
+                callHandler(out, EventType::UNIT_ATTACK, handle, (void*)&data);
             }
         }
 
@@ -923,7 +1117,7 @@ static void manageUnitAttackEvent(color_ostream& out) {
             alreadyDone[data.attacker][data.defender] = 1;
             for ( auto b = copy.begin(); b != copy.end(); b++ ) {
                 EventHandler handle = (*b).second;
-                handle.eventHandler(out, (void*)&data);
+                callHandler(out, EventType::UNIT_ATTACK, handle, (void*)&data);
             }
         }
 
@@ -935,7 +1129,7 @@ static void manageUnitAttackEvent(color_ostream& out) {
             alreadyDone[data.attacker][data.defender] = 1;
             for ( auto b = copy.begin(); b != copy.end(); b++ ) {
                 EventHandler handle = (*b).second;
-                handle.eventHandler(out, (void*)&data);
+                callHandler(out, EventType::UNIT_ATTACK, handle, (void*)&data);
             }
         }
 
@@ -947,7 +1141,7 @@ static void manageUnitAttackEvent(color_ostream& out) {
             alreadyDone[data.attacker][data.defender] = 1;
             for ( auto b = copy.begin(); b != copy.end(); b++ ) {
                 EventHandler handle = (*b).second;
-                handle.eventHandler(out, (void*)&data);
+                callHandler(out, EventType::UNIT_ATTACK, handle, (void*)&data);
             }
         }
 
@@ -1205,7 +1399,7 @@ static void manageInteractionEvent(color_ostream& out) {
         //fire event
         for ( auto b = copy.begin(); b != copy.end(); b++ ) {
             EventHandler handle = (*b).second;
-            handle.eventHandler(out, (void*)&data);
+            callHandler(out, EventType::INTERACTION, handle, (void*)&data);
         }
         //TODO: deduce attacker from latest defend event first
     }
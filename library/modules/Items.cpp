@@ -30,10 +30,13 @@ distribution.
 #include "Types.h"
 #include "VersionInfo.h"
 
+#include <algorithm>
 #include <cstdio>
+#include <deque>
 #include <map>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <set>
 using namespace std;
@@ -60,6 +63,7 @@ using namespace std;
 #include "df/historical_entity.h"
 #include "df/item.h"
 #include "df/item_type.h"
+#include "df/items_other_id.h"
 #include "df/itemdef_ammost.h"
 #include "df/itemdef_armorst.h"
 #include "df/itemdef_foodst.h"
@@ -1506,3 +1510,237 @@ bool Items::isSquadEquipment(df::item *item)
     auto &vec = ui->equipment.items_assigned[item->getType()];
     return binsearch_index(vec, &df::item::id, item->id) >= 0;
 }
+
+/*
+ * Item census: in-play items filed by type, subtype and actual material.
+ *
+ * The census keeps a copy of the IN_PLAY vector, which is sorted by id.
+ * When the census is next read, the copy is compared with the vector,
+ * and only the items that entered or left play since then are filed
+ * or dropped. Material is checked again, at most once per frame, for
+ * the item types that are actually read.
+ */
+namespace {
+    typedef std::pair<int16_t, std::pair<int16_t, int32_t> > CensusKey;
+
+    struct CensusType
+    {
+        std::deque<Items::ItemCensusBucket> storage;
+        std::vector<Items::ItemCensusBucket*> buckets;
+        std::vector<std::vector<int32_t> > ids; // parallel to buckets, sorted
+        std::map<CensusKey, size_t> index;
+        int32_t checked_tick; // frame materials were last checked at
+
+        CensusType() : checked_tick(-1) {}
+
+        size_t getBucket(df::item_type type, const CensusKey &key)
+        {
+            auto it = index.find(key);
+            if (it != index.end())
+                return it->second;
+
+            storage.push_back(Items::ItemCensusBucket());
+            auto &bucket = storage.back();
+            bucket.type = type;
+            bucket.subtype = key.first;
+            bucket.mat_type = key.second.first;
+            bucket.mat_index = key.second.second;
+            buckets.push_back(&bucket);
+            ids.push_back(std::vector<int32_t>());
+            index[key] = buckets.size()-1;
+            return buckets.size()-1;
+        }
+
+        void insert(size_t bucket, df::item *item)
+        {
+            auto &bucket_ids = ids[bucket];
+            auto pos = std::lower_bound(bucket_ids.begin(), bucket_ids.end(), item->id) - bucket_ids.begin();
+            bucket_ids.insert(bucket_ids.begin() + pos, item->id);
+            auto &items = buckets[bucket]->items;
+            items.insert(items.begin() + pos, item);
+        }
+
+        // Doesn't touch the item, which may already be deleted
+        void erase(size_t bucket, int32_t id)
+        {
+            auto &bucket_ids = ids[bucket];
+            auto it = std::lower_bound(bucket_ids.begin(), bucket_ids.end(), id);
+            if (it == bucket_ids.end() || *it != id)
+                return;
+            auto &items = buckets[bucket]->items;
+            items.erase(items.begin() + (it - bucket_ids.begin()));
+            bucket_ids.erase(it);
+        }
+    };
+
+    struct ItemCensus
+    {
+        std::map<df::item_type, CensusType> types;
+        std::unordered_map<int32_t, std::pair<df::item_type, size_t> > filed;
+
+        // IN_PLAY as of the last sync
+        std::vector<df::item*> seen_items;
+        std::vector<int32_t> seen_ids;
+
+        void clear()
+        {
+            types.clear();
+            filed.clear();
+            seen_items.clear();
+            seen_ids.clear();
+        }
+
+        static CensusKey keyOf(df::item *item)
+        {
+            return CensusKey(item->getSubtype(),
+                std::make_pair(item->getActualMaterial(), item->getActualMaterialIndex()));
+        }
+
+        void add(df::item *item)
+        {
+            df::item_type type = item->getType();
+            auto &ctype = types[type];
+            size_t bucket = ctype.getBucket(type, keyOf(item));
+            ctype.insert(bucket, item);
+            filed[item->id] = std::make_pair(type, bucket);
+        }
+
+        void remove(int32_t id)
+        {
+            auto it = filed.find(id);
+            if (it == filed.end())
+                return;
+            types[it->second.first].erase(it->second.second, id);
+            filed.erase(it);
+        }
+
+        void sync()
+        {
+            auto &in_play = world->items.other[items_other_id::IN_PLAY];
+
+            // The usual case: nothing entered or left play
+            if (in_play.size() == seen_items.size() &&
+                (in_play.empty() ||
+                 (in_play.back()->id == seen_ids.back() &&
+                  std::equal(in_play.begin(), in_play.end(), seen_items.begin()))))
+                return;
+
+            // Both are sorted by id, so they can be merged
+            size_t i = 0, j = 0;
+            while (i < in_play.size() || j < seen_ids.size())
+            {
+                if (j == seen_ids.size() ||
+                    (i < in_play.size() && in_play[i]->id < seen_ids[j]))
+                {
+                    add(in_play[i++]);
+                }
+                else if (i == in_play.size() || in_play[i]->id > seen_ids[j])
+                {
+                    remove(seen_ids[j++]);
+                }
+                else
+                {
+                    // Same id at another address: not the same item
+                    if (in_play[i] != seen_items[j])
+                    {
+                        remove(seen_ids[j]);
+                        add(in_play[i]);
+                    }
+                    i++;
+                    j++;
+                }
+            }
+
+            seen_items = in_play;
+            seen_ids.resize(in_play.size());
+            for (size_t k = 0; k < in_play.size(); k++)
+                seen_ids[k] = in_play[k]->id;
+        }
+
+        // Refile items of the type whose subtype or material changed, e.g. by decoration
+        void recheck(df::item_type type, CensusType &ctype)
+        {
+            if (ctype.checked_tick == world->frame_counter)
+                return;
+            ctype.checked_tick = world->frame_counter;
+
+            std::vector<df::item*> moved;
+            for (size_t i = 0; i < ctype.buckets.size(); i++)
+            {
+                auto bucket = ctype.buckets[i];
+                auto &items = bucket->items;
+                auto &bucket_ids = ctype.ids[i];
+
+                size_t out = 0;
+                for (size_t j = 0; j < items.size(); j++)
+                {
+                    df::item *item = items[j];
+                    if (item->getSubtype() != bucket->subtype ||
+                        item->getActualMaterial() != bucket->mat_type ||
+                        item->getActualMaterialIndex() != bucket->mat_index)
+                    {
+                        moved.push_back(item);
+                        continue;
+                    }
+                    items[out] = item;
+                    bucket_ids[out++] = bucket_ids[j];
+                }
+                items.resize(out);
+                bucket_ids.resize(out);
+            }
+
+            for (size_t i = 0; i < moved.size(); i++)
+            {
+                size_t bucket = ctype.getBucket(type, keyOf(moved[i]));
+                ctype.insert(bucket, moved[i]);
+                filed[moved[i]->id].second = bucket;
+            }
+        }
+    };
+}
+
+static ItemCensus item_census;
+
+void items_onStateChange(color_ostream &out, state_change_event event)
+{
+    switch (event) {
+    case SC_MAP_LOADED:
+    case SC_MAP_UNLOADED:
+    case SC_WORLD_UNLOADED:
+        item_census.clear();
+        break;
+    default:
+        break;
+    }
+}
+
+const std::vector<Items::ItemCensusBucket*> &Items::getItemCensus(df::item_type type)
+{
+    static const std::vector<ItemCensusBucket*> empty;
+    if (!world)
+        return empty;
+
+    item_census.sync();
+
+    auto it = item_census.types.find(type);
+    if (it == item_census.types.end())
+        return empty;
+
+    item_census.recheck(type, it->second);
+    return it->second.buckets;
+}
+
+void Items::getCensusItems(std::vector<df::item*> *items, df::item_type type,
+    int16_t subtype, int16_t mat_type, int32_t mat_index)
+{
+    auto &buckets = getItemCensus(type);
+    for (size_t i = 0; i < buckets.size(); i++)
+    {
+        auto bucket = buckets[i];
+        if ((subtype != -1 && bucket->subtype != subtype) ||
+            (mat_type != -1 && bucket->mat_type != mat_type) ||
+            (mat_index != -1 && bucket->mat_index != mat_index))
+            continue;
+        items->insert(items->end(), bucket->items.begin(), bucket->items.end());
+    }
+}
@@ -41,6 +41,7 @@ using namespace std;
 #include "MiscUtils.h"
 #include "ModuleFactory.h"
 #include "VersionInfo.h"
+#include "tinythread.h"
 
 #include "modules/Buildings.h"
 #include "modules/MapCache.h"
@@ -89,6 +90,148 @@ const BiomeInfo MapCache::biome_stub = {
 
 #define COPY(a,b) memcpy(&a,&b,sizeof(a))
 
+namespace {
+    /*
+     * Fixed size allocator for blocks and their parsed data. Objects are
+     * carved from chunks and recycled through a free list, so a MapCache
+     * that loads many blocks doesn't go to the heap for each of them, and
+     * the memory is reused by the next MapCache.
+     */
+    class PoolBase
+    {
+    public:
+        virtual void trim() = 0;
+
+        // Releases chunks beyond the idle limit of pools that are not in use.
+        static void trimAll()
+        {
+            tthread::lock_guard<tthread::mutex> lock(registry_mutex());
+            for (size_t i = 0; i < registry().size(); i++)
+                registry()[i]->trim();
+        }
+
+    protected:
+        static void add(PoolBase *pool)
+        {
+            tthread::lock_guard<tthread::mutex> lock(registry_mutex());
+            registry().push_back(pool);
+        }
+
+    private:
+        // Never destroyed, as caches may still be released during shutdown.
+        static std::vector<PoolBase*> &registry()
+        {
+            static std::vector<PoolBase*> *pools = new std::vector<PoolBase*>();
+            return *pools;
+        }
+        static tthread::mutex &registry_mutex()
+        {
+            static tthread::mutex *mutex = new tthread::mutex();
+            return *mutex;
+        }
+    };
+
+    template<size_t Size>
+    class ObjectPool : public PoolBase
+    {
+        static const size_t item_size = (Size + 15) & ~size_t(15);
+        static const size_t chunk_items = 64;
+        static const size_t chunk_size = item_size * chunk_items;
+        static const size_t max_idle_chunks = chunk_size < (8u << 20) ? (8u << 20) / chunk_size : 1;
+
+        struct FreeItem { FreeItem *next; };
+
+        tthread::mutex mutex;
+        std::vector<char*> chunks;
+        FreeItem *free_list;
+        size_t live;
+
+        ObjectPool() : free_list(NULL), live(0) {}
+
+        static ObjectPool *create()
+        {
+            ObjectPool *pool = new ObjectPool();
+            add(pool);
+            return pool;
+        }
+
+        void link_chunk(char *chunk)
+        {
+            for (size_t i = chunk_items; i > 0; i--)
+            {
+                FreeItem *item = (FreeItem*)(chunk + (i-1) * item_size);
+                item->next = free_list;
+                free_list = item;
+            }
+        }
+
+    public:
+        static ObjectPool &get()
+        {
+            static ObjectPool *pool = create();
+            return *pool;
+        }
+
+        void *alloc()
+        {
+            tthread::lock_guard<tthread::mutex> lock(mutex);
+            if (!free_list)
+            {
+                char *chunk = (char*)::operator new(chunk_size);
+                chunks.push_back(chunk);
+                link_chunk(chunk);
+            }
+            FreeItem *item = free_list;
+            free_list = item->next;
+            live++;
+            return item;
+        }
+
+        void release(void *ptr)
+        {
+            if (!ptr)
+                return;
+            tthread::lock_guard<tthread::mutex> lock(mutex);
+            FreeItem *item = (FreeItem*)ptr;
+            item->next = free_list;
+            free_list = item;
+            live--;
+        }
+
+        virtual void trim()
+        {
+            tthread::lock_guard<tthread::mutex> lock(mutex);
+            if (live > 0 || chunks.size() <= max_idle_chunks)
+                return;
+
+            for (size_t i = max_idle_chunks; i < chunks.size(); i++)
+                ::operator delete(chunks[i]);
+            chunks.resize(max_idle_chunks);
+
+            free_list = NULL;
+            for (size_t i = 0; i < chunks.size(); i++)
+                link_chunk(chunks[i]);
+        }
+    };
+}
+
+#define POOLED_NEW_DELETE(type) \
+    void *type::operator new(size_t size) { \
+        return ObjectPool<sizeof(type)>::get().alloc(); \
+    } \
+    void type::operator delete(void *ptr) { \
+        ObjectPool<sizeof(type)>::get().release(ptr); \
+    }
+
+POOLED_NEW_DELETE(MapExtras::Block)
+POOLED_NEW_DELETE(MapExtras::Block::IceInfo)
+POOLED_NEW_DELETE(MapExtras::Block::ConInfo)
+POOLED_NEW_DELETE(MapExtras::Block::TileInfo)
+POOLED_NEW_DELETE(MapExtras::Block::BasematInfo)
+
+typedef ObjectPool<sizeof(int16_t)*16*16> TagPool;
+typedef ObjectPool<sizeof(int)*16*16> ItemCountPool;
+
 MapExtras::Block::Block(MapCache *parent, DFCoord _bcoord) :
     parent(parent),
     designated_tiles{}
@@ -100,6 +243,7 @@ MapExtras::Block::Block(MapCache *parent, DFCoord _bcoord) :
     dirty_occupancies = false;
     valid = false;
     bcoord = _bcoord;
+    list_index = 0;
     block = Maps::getBlock(bcoord);
     tags = NULL;
 
@@ -140,7 +284,7 @@ bool MapExtras::Block::Allocate()
     if (!block)
         return false;
 
-    delete[] item_counts;
+    ItemCountPool::get().release(item_counts);
     delete tiles;
     delete basemats;
     init();
@@ -150,8 +294,8 @@ bool MapExtras::Block::Allocate()
 
 MapExtras::Block::~Block()
 {
-    delete[] item_counts;
-    delete[] tags;
+    ItemCountPool::get().release(item_counts);
+    TagPool::get().release(tags);
     delete tiles;
     delete basemats;
 }
@@ -159,7 +303,7 @@ MapExtras::Block::~Block()
 void MapExtras::Block::init_tags()
 {
     if (!tags)
-        tags = new T_tags[16];
+        tags = (T_tags*)TagPool::get().alloc();
     memset(tags,0,sizeof(T_tags)*16);
 }
 
@@ -1069,7 +1213,7 @@ int MapExtras::Block::biomeIndexAt(df::coord2d p)
     if (idx >= 9)
         return -1;
     idx = block->region_offset[idx];
-    if (idx >= parent->biomes.size())
+    if (idx >= parent->geology->biomes.size())
         return -1;
     return idx;
 }
@@ -1088,7 +1232,7 @@ df::coord2d MapExtras::Block::biomeRegionAt(df::coord2d p)
     if (idx < 0)
         return block->region_pos;
 
-    return parent->biomes[idx].pos;
+    return parent->geology->biomes[idx].pos;
 }
 
 bool MapExtras::Block::GetGlobalFeature(t_feature *out)
@@ -1111,7 +1255,7 @@ void MapExtras::Block::init_item_counts()
 {
     if (item_counts) return;
 
-    item_counts = new T_item_counts[16];
+    item_counts = (T_item_counts*)ItemCountPool::get().alloc();
     memset(item_counts, 0, sizeof(T_item_counts)*16);
 
     if (!block) return;
@@ -1192,17 +1336,23 @@ bool MapExtras::Block::removeItemOnGround(df::item *item)
     return true;
 }
 
-MapExtras::MapCache::MapCache()
+static tthread::mutex geology_mutex;
+static std::shared_ptr<const MapGeology> shared_geology;
+
+static std::shared_ptr<const MapGeology> buildGeology()
 {
-    valid = 0;
-    Maps::getSize(x_bmax, y_bmax, z_max);
-    x_tmax = x_bmax*16; y_tmax = y_bmax*16;
+    auto geology = std::make_shared<MapGeology>();
+    auto data = df::global::world->world_data;
+
     std::vector<df::coord2d> geoidx;
     std::vector<std::vector<int16_t> > layer_mats;
-    validgeo = Maps::ReadGeology(&layer_mats, &geoidx);
-    valid = true;
+    geology->valid = Maps::ReadGeology(&layer_mats, &geoidx);
+    geology->world_data = data;
+    geology->region = df::coord2d(world->map.region_x / 16, world->map.region_y / 16);
+    geology->region_details_count = data ? data->region_details.size() : 0;
 
-    if (auto data = df::global::world->world_data)
+    std::map<df::coord2d, df::world_region_details*> region_details;
+    if (data)
     {
         for (size_t i = 0; i < data->region_details.size(); i++)
         {
@@ -1211,6 +1361,7 @@ MapExtras::MapCache::MapCache()
         }
     }
 
+    auto &biomes = geology->biomes;
     biomes.resize(layer_mats.size());
 
     for (size_t i = 0; i < layer_mats.size(); i++)
@@ -1245,12 +1396,62 @@ MapExtras::MapCache::MapCache()
             else if (biomes[i].default_stone == -1)
                 biomes[i].default_stone = layer_mats[i][j];
         }
+    }
 
-        while (layer_mats[i].size() < 16)
-            layer_mats[i].push_back(-1);
+    return geology;
+}
+
+/*
+ * The geology only depends on where the map is in the world, so it is
+ * computed once and reused until the map is unloaded, moves (adventure
+ * mode travel), or the world gains region details it didn't have yet.
+ */
+static std::shared_ptr<const MapGeology> getGeology()
+{
+    tthread::lock_guard<tthread::mutex> lock(geology_mutex);
+
+    auto data = df::global::world->world_data;
+    df::coord2d region(world->map.region_x / 16, world->map.region_y / 16);
+    size_t details_count = data ? data->region_details.size() : 0;
+
+    if (!shared_geology ||
+        shared_geology->world_data != data ||
+        shared_geology->region != region ||
+        shared_geology->region_details_count != details_count)
+    {
+        shared_geology = buildGeology();
+    }
+
+    return shared_geology;
+}
+
+void mapcache_onStateChange(color_ostream &out, state_change_event event)
+{
+    switch (event) {
+    case SC_MAP_LOADED:
+    case SC_MAP_UNLOADED:
+    case SC_WORLD_UNLOADED:
+    {
+        tthread::lock_guard<tthread::mutex> lock(geology_mutex);
+        shared_geology.reset();
+        break;
+    }
+    default:
+        break;
     }
 }
 
+MapExtras::MapCache::MapCache()
+{
+    valid = 0;
+    Maps::getSize(x_bmax, y_bmax, z_max);
+    x_tmax = x_bmax*16; y_tmax = y_bmax*16;
+    geology = getGeology();
+    validgeo = geology->valid;
+    valid = true;
+    block_grid.resize(z_max);
+}
+
 bool MapExtras::MapCache::WriteAll()
 {
     auto world = df::global::world;
@@ -1261,11 +1462,10 @@ bool MapExtras::MapCache::WriteAll()
         df::job* job = job_link->item;
         df::coord pos = job->pos;
         df::coord blockpos(pos.x>>4,pos.y>>4,pos.z);
-        auto iter = blocks.find(blockpos);
-        if (iter == blocks.end())
+        auto block = findBlock(blockpos);
+        if (!block)
             continue;
         df::coord2d bpos(pos.x - (blockpos.x<<4),pos.y - (blockpos.y<<4));
-        auto block = iter->second;
         if (!block->designated_tiles.test(bpos.x+bpos.y*16))
             continue;
         bool is_designed = ENUM_ATTR(job_type,is_designation,job->job_type);
@@ -1275,48 +1475,79 @@ bool MapExtras::MapCache::WriteAll()
         // processing.
         Job::removeJob(job);
     }
-    std::map<DFCoord, Block *>::iterator p;
-    for(p = blocks.begin(); p != blocks.end(); p++)
+    for (size_t i = 0; i < block_list.size(); i++)
     {
-        p->second->Write();
+        block_list[i]->Write();
     }
     return true;
 }
 
+MapExtras::Block *MapExtras::MapCache::findBlock(DFCoord blockcoord)
+{
+    if(unsigned(blockcoord.x) >= x_bmax ||
+       unsigned(blockcoord.y) >= y_bmax ||
+       unsigned(blockcoord.z) >= z_max)
+        return NULL;
+
+    std::vector<Block*> &level = block_grid[blockcoord.z];
+    if (level.empty())
+        return NULL;
+    return level[blockcoord.y*x_bmax + blockcoord.x];
+}
+
 MapExtras::Block *MapExtras::MapCache::BlockAt(DFCoord blockcoord)
 {
     if(!valid)
         return 0;
-    std::map <DFCoord, Block*>::iterator iter = blocks.find(blockcoord);
-    if(iter != blocks.end())
-    {
-        return (*iter).second;
-    }
-    else
-    {
-        if(unsigned(blockcoord.x) < x_bmax &&
-           unsigned(blockcoord.y) < y_bmax &&
-           unsigned(blockcoord.z) < z_max)
-        {
-            Block * nblo = new Block(this, blockcoord);
-            blocks[blockcoord] = nblo;
-            return nblo;
-        }
+    if(unsigned(blockcoord.x) >= x_bmax ||
+       unsigned(blockcoord.y) >= y_bmax ||
+       unsigned(blockcoord.z) >= z_max)
         return 0;
+
+    std::vector<Block*> &level = block_grid[blockcoord.z];
+    if (level.empty())
+        level.resize(x_bmax*y_bmax, NULL);
+
+    Block *&slot = level[blockcoord.y*x_bmax + blockcoord.x];
+    if (!slot)
+    {
+        slot = new Block(this, blockcoord);
+        slot->list_index = block_list.size();
+        block_list.push_back(slot);
     }
+    return slot;
 }
 
 void MapExtras::MapCache::discardBlock(Block *block)
 {
-    blocks.erase(block->bcoord);
+    if (!block || findBlock(block->bcoord) != block)
+        return;
+
+    block_grid[block->bcoord.z][block->bcoord.y*x_bmax + block->bcoord.x] = NULL;
+    Block *last = block_list.back();
+    block_list[block->list_index] = last;
+    last->list_index = block->list_index;
+    block_list.pop_back();
     delete block;
 }
 
+void MapExtras::MapCache::trash()
+{
+    for (size_t i = 0; i < block_list.size(); i++)
+    {
+        Block *block = block_list[i];
+        block_grid[block->bcoord.z][block->bcoord.y*x_bmax + block->bcoord.x] = NULL;
+        delete block;
+    }
+    block_list.clear();
+    PoolBase::trimAll();
+}
+
 void MapExtras::MapCache::resetTags()
 {
-    for (auto it = blocks.begin(); it != blocks.end(); ++it)
+    for (size_t i = 0; i < block_list.size(); i++)
     {
-        delete[] it->second->tags;
-        it->second->tags = NULL;
+        TagPool::get().release(block_list[i]->tags);
+        block_list[i]->tags = NULL;
     }
 }
@@ -25,7 +25,12 @@ distribution.
 
 #include "Internal.h"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 #include <map>
 #include <set>
@@ -711,3 +716,213 @@ bool Maps::canStepBetween(df::coord pos1, df::coord pos2)
 
     return false;
 }
+
+/*
+ * Block scans
+ */
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MAPS_SCAN_SSE2
+#include <emmintrin.h>
+#endif
+
+int Maps::countTiles(df::map_block *block, const TiletypeSet &types)
+{
+    if (!block)
+        return 0;
+
+    const df::tiletype *tiles = &block->tiletype[0][0];
+    int count = 0;
+    for (int i = 0; i < 256; i++)
+        count += types.contains(tiles[i]);
+    return count;
+}
+
+bool Maps::allTiles(df::map_block *block, const TiletypeSet &types)
+{
+    if (!block)
+        return false;
+
+    const df::tiletype *tiles = &block->tiletype[0][0];
+    for (int i = 0; i < 256; i++)
+        if (!types.contains(tiles[i]))
+            return false;
+    return true;
+}
+
+// Counts the 256 words of a block plane for which (word & mask) == value
+static int countMasked(const uint32_t *plane, uint32_t mask, uint32_t value)
+{
+#ifdef MAPS_SCAN_SSE2
+    const __m128i vmask = _mm_set1_epi32(mask);
+    const __m128i vvalue = _mm_set1_epi32(value);
+    __m128i acc = _mm_setzero_si128();
+    for (int i = 0; i < 256; i += 4)
+    {
+        __m128i words = _mm_loadu_si128((const __m128i*)(plane + i));
+        // matching lanes are all ones, i.e. -1
+        acc = _mm_sub_epi32(acc, _mm_cmpeq_epi32(_mm_and_si128(words, vmask), vvalue));
+    }
+    int32_t lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#else
+    int count = 0;
+    for (int i = 0; i < 256; i++)
+        count += (plane[i] & mask) == value;
+    return count;
+#endif
+}
+
+int Maps::countTiles(df::map_block *block, df::tile_designation mask, df::tile_designation value)
+{
+    if (!block)
+        return 0;
+    return countMasked(&block->designation[0][0].whole, mask.whole, value.whole & mask.whole);
+}
+
+int Maps::countTiles(df::map_block *block, df::tile_occupancy mask, df::tile_occupancy value)
+{
+    if (!block)
+        return 0;
+    return countMasked(&block->occupancy[0][0].whole, mask.whole, value.whole & mask.whole);
+}
+
+namespace {
+    /*
+     * Worker threads for block scans. A scan is cut into chunks of blocks
+     * that the workers and the calling thread take in turn. Only one scan
+     * runs on the pool at a time; a scan started while another is running,
+     * including from inside a scan callback, runs on the calling thread.
+     */
+    class ScanPool
+    {
+    public:
+        typedef std::function<void(size_t, size_t)> Job;
+
+        static ScanPool &get()
+        {
+            // Never destroyed: the workers are detached and may still wait on it at exit.
+            static ScanPool *pool = new ScanPool();
+            return *pool;
+        }
+
+        void run(size_t count, const Job &job)
+        {
+            bool idle = false;
+            if (workers == 0 || count <= chunk_size || !busy.compare_exchange_strong(idle, true))
+            {
+                job(0, count);
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                current = &job;
+                total = count;
+                next = 0;
+                active = workers;
+                generation++;
+            }
+            wake.notify_all();
+
+            work(job, count);
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                done.wait(lock, [this] { return active == 0; });
+                current = NULL;
+            }
+            busy = false;
+        }
+
+    private:
+        static const size_t chunk_size = 64;
+
+        std::atomic<bool> busy;
+        std::mutex mutex;
+        std::condition_variable wake, done;
+        const Job *current;
+        size_t total;
+        std::atomic<size_t> next;
+        unsigned workers;
+        unsigned active;
+        uint64_t generation;
+
+        ScanPool() : busy(false), current(NULL), total(0), next(0), active(0), generation(0)
+        {
+            unsigned threads = std::thread::hardware_concurrency();
+            workers = threads > 1 ? std::min(threads - 1, 7u) : 0;
+            for (unsigned i = 0; i < workers; i++)
+                std::thread(&ScanPool::workerFn, this).detach();
+        }
+
+        void work(const Job &job, size_t count)
+        {
+            for (;;)
+            {
+                size_t begin = next.fetch_add(chunk_size);
+                if (begin >= count)
+                    break;
+                job(begin, std::min(begin + chunk_size, count));
+            }
+        }
+
+        void workerFn()
+        {
+            uint64_t seen = 0;
+            for (;;)
+            {
+                const Job *job;
+                size_t count;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [&] { return generation != seen; });
+                    seen = generation;
+                    job = current;
+                    count = total;
+                }
+
+                work(*job, count);
+
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--active == 0)
+                    done.notify_one();
+            }
+        }
+    };
+}
+
+void Maps::forEachBlock(const std::function<void(df::map_block*)> &fn)
+{
+    auto &blocks = world->map.map_blocks;
+    ScanPool::get().run(blocks.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            fn(blocks[i]);
+    });
+}
+
+int64_t Maps::sumBlocks(const std::function<int64_t(df::map_block*)> &fn)
+{
+    auto &blocks = world->map.map_blocks;
+    std::atomic<int64_t> total(0);
+    ScanPool::get().run(blocks.size(), [&](size_t begin, size_t end) {
+        int64_t sum = 0;
+        for (size_t i = begin; i < end; i++)
+            sum += fn(blocks[i]);
+        total += sum;
+    });
+    return total;
+}
+
+bool Maps::anyBlock(const std::function<bool(df::map_block*)> &fn)
+{
+    auto &blocks = world->map.map_blocks;
+    std::atomic<bool> found(false);
+    ScanPool::get().run(blocks.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end && !found; i++)
+            if (fn(blocks[i]))
+                found = true;
+    });
+    return found;
+}
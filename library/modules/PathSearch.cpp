@@ -0,0 +1,278 @@
+/*
+https://github.com/peterix/dfhack
+Copyright (c) 2009-2012 Petr Mrázek (peterix@gmail.com)
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any
+damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any
+purpose, including commercial applications, and to alter it and
+redistribute it freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must
+not claim that you wrote the original software. If you use this
+software in a product, an acknowledgment in the product documentation
+would be appreciated but is not required.
+
+2. Altered source versions must be plainly marked as such, and
+must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any source
+distribution.
+*/
+
+#include "Internal.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "modules/Maps.h"
+#include "modules/PathSearch.h"
+
+using namespace DFHack;
+
+// Tile state of one map block. A block whose generation is out of date
+// is wiped before use, so a new search doesn't have to touch every block.
+struct PathSearch::NodeBlock
+{
+    uint32_t generation;
+    PathSearch::cost_t cost[256];   // -1 = not reached
+    df::coord parent[256];
+    bool closed[256];
+    bool target[256];
+
+    void reset(uint32_t gen)
+    {
+        generation = gen;
+        std::fill(cost, cost + 256, -1);
+        std::fill(parent, parent + 256, df::coord());
+        memset(closed, 0, sizeof(closed));
+        memset(target, 0, sizeof(target));
+    }
+};
+
+static inline int tileIndex(df::coord pos)
+{
+    return ((pos.y & 15) << 4) | (pos.x & 15);
+}
+
+static inline int bucketIndex(uint64_t key, uint64_t last)
+{
+    uint64_t diff = key ^ last;
+    int bit = 0;
+    while (diff)
+    {
+        bit++;
+        diff >>= 1;
+    }
+    return bit;
+}
+
+PathSearch::PathSearch()
+    : x_blocks(0), y_blocks(0), z_levels(0), generation(0),
+      last_key(0), queued(0), expanded(0), finished(false)
+{
+}
+
+PathSearch::~PathSearch()
+{
+    for (size_t i = 0; i < blocks.size(); i++)
+        delete blocks[i];
+}
+
+void PathSearch::clear()
+{
+    uint32_t x, y, z;
+    if (Maps::IsValid())
+        Maps::getSize(x, y, z);
+    else
+        x = y = z = 0;
+
+    if (int32_t(x) != x_blocks || int32_t(y) != y_blocks || int32_t(z) != z_levels)
+    {
+        for (size_t i = 0; i < blocks.size(); i++)
+            delete blocks[i];
+        x_blocks = x;
+        y_blocks = y;
+        z_levels = z;
+        blocks.assign(size_t(x_blocks) * y_blocks * z_levels, NULL);
+    }
+
+    generation++;
+    for (int i = 0; i < 65; i++)
+        buckets[i].clear();
+    last_key = 0;
+    queued = 0;
+    found = df::coord();
+    expanded = 0;
+    finished = false;
+}
+
+PathSearch::NodeBlock *PathSearch::getBlock(df::coord pos, bool create)
+{
+    if (pos.x < 0 || pos.y < 0 || pos.z < 0 ||
+        (pos.x >> 4) >= x_blocks || (pos.y >> 4) >= y_blocks || pos.z >= z_levels)
+        return NULL;
+
+    NodeBlock *&block = blocks[(size_t(pos.z) * y_blocks + (pos.y >> 4)) * x_blocks + (pos.x >> 4)];
+    if (block && block->generation == generation)
+        return block;
+    if (!create)
+        return NULL;
+    if (!block)
+        block = new NodeBlock;
+    block->reset(generation);
+    return block;
+}
+
+const PathSearch::NodeBlock *PathSearch::getBlock(df::coord pos) const
+{
+    if (pos.x < 0 || pos.y < 0 || pos.z < 0 ||
+        (pos.x >> 4) >= x_blocks || (pos.y >> 4) >= y_blocks || pos.z >= z_levels)
+        return NULL;
+
+    const NodeBlock *block = blocks[(size_t(pos.z) * y_blocks + (pos.y >> 4)) * x_blocks + (pos.x >> 4)];
+    return block && block->generation == generation ? block : NULL;
+}
+
+void PathSearch::push(df::coord pos, cost_t cost)
+{
+    Entry entry = { uint64_t(cost), pos };
+    buckets[bucketIndex(entry.key, last_key)].push_back(entry);
+    queued++;
+}
+
+bool PathSearch::pop(Entry *entry)
+{
+    if (!queued)
+        return false;
+
+    if (buckets[0].empty())
+    {
+        int i = 1;
+        while (buckets[i].empty())
+            i++;
+
+        // Everything left in bucket i is closer to its minimum than to the
+        // old last_key, so it spreads into the lower buckets.
+        std::vector<Entry> &bucket = buckets[i];
+        uint64_t min_key = bucket[0].key;
+        for (size_t j = 1; j < bucket.size(); j++)
+            min_key = std::min(min_key, bucket[j].key);
+
+        last_key = min_key;
+        for (size_t j = 0; j < bucket.size(); j++)
+            buckets[bucketIndex(bucket[j].key, last_key)].push_back(bucket[j]);
+        bucket.clear();
+    }
+
+    *entry = buckets[0].back();
+    buckets[0].pop_back();
+    queued--;
+    return true;
+}
+
+void PathSearch::addSource(df::coord pos, cost_t cost)
+{
+    NodeBlock *block = getBlock(pos, true);
+    if (!block || cost < 0)
+        return;
+
+    int index = tileIndex(pos);
+    if (block->cost[index] >= 0 && block->cost[index] <= cost)
+        return;
+
+    // Sources can't be cheaper than what was already expanded
+    cost = std::max(cost, cost_t(last_key));
+    block->cost[index] = cost;
+    block->parent[index] = df::coord();
+    push(pos, cost);
+    finished = false;
+}
+
+void PathSearch::addTarget(df::coord pos)
+{
+    NodeBlock *block = getBlock(pos, true);
+    if (block)
+        block->target[tileIndex(pos)] = true;
+}
+
+PathSearch::Result PathSearch::run(const Expander &expand, int32_t maxExpansions)
+{
+    if (finished)
+        return found.isValid() ? Found : Exhausted;
+
+    int32_t count = 0;
+    Entry entry;
+
+    while (pop(&entry))
+    {
+        NodeBlock *block = getBlock(entry.pos, false);
+        int index = tileIndex(entry.pos);
+
+        // Skip stale queue entries left behind when a cheaper path was found
+        if (!block || block->closed[index] || uint64_t(block->cost[index]) != entry.key)
+            continue;
+
+        block->closed[index] = true;
+        if (block->target[index])
+        {
+            found = entry.pos;
+            finished = true;
+            return Found;
+        }
+
+        cost_t cost = block->cost[index];
+        steps.clear();
+        expand(entry.pos, steps);
+        expanded++;
+
+        for (size_t i = 0; i < steps.size(); i++)
+        {
+            const Step &step = steps[i];
+            if (step.cost < 0)
+                continue;
+
+            NodeBlock *next = getBlock(step.pos, true);
+            if (!next)
+                continue;
+
+            int next_index = tileIndex(step.pos);
+            cost_t next_cost = cost + step.cost;
+            if (next->closed[next_index] ||
+                (next->cost[next_index] >= 0 && next->cost[next_index] <= next_cost))
+                continue;
+
+            next->cost[next_index] = next_cost;
+            next->parent[next_index] = entry.pos;
+            push(step.pos, next_cost);
+        }
+
+        if (maxExpansions > 0 && ++count >= maxExpansions && queued > 0)
+            return Running;
+    }
+
+    finished = true;
+    return Exhausted;
+}
+
+PathSearch::cost_t PathSearch::getCost(df::coord pos) const
+{
+    const NodeBlock *block = getBlock(pos);
+    return block ? block->cost[tileIndex(pos)] : -1;
+}
+
+bool PathSearch::getParent(df::coord pos, df::coord *parent) const
+{
+    const NodeBlock *block = getBlock(pos);
+    if (!block)
+        return false;
+
+    int index = tileIndex(pos);
+    if (block->cost[index] < 0 || !block->parent[index].isValid())
+        return false;
+
+    *parent = block->parent[index];
+    return true;
+}
@@ -32,6 +32,7 @@ distribution.
 #include <cstring>
 #include <algorithm>
 #include <numeric>
+#include <unordered_map>
 using namespace std;
 
 #include "VersionInfo.h"
@@ -94,7 +95,185 @@ df::unit *Units::getUnit (const int32_t index)
     return vector_get(world->units.all, index);
 }
 
-// returns index of creature actually read or -1 if no creature can be found
+/*
+ * Block-granular spatial hash of unit positions behind the getUnitsIn*
+ * queries. Buckets hold indices into world->units.all, and are rebuilt
+ * when units join or leave that list. Otherwise, on the first query of
+ * every frame, paused or not, each unit's block is compared with the one
+ * it is filed under, and only the units that changed block are moved.
+ * The index is dropped when a map is loaded or unloaded.
+ */
+namespace {
+    struct UnitSpatialIndex
+    {
+        struct Entry
+        {
+            uint64_t key;
+            uint32_t slot;
+        };
+
+        unordered_map<uint64_t, vector<uint32_t>> buckets;
+        vector<Entry> entries; // Parallel to world->units.all
+        uint32_t checked = 0; // Core update count of the last check
+        size_t count = 0;
+        int32_t next_id = -1;
+        bool valid = false;
+
+        static uint64_t blockKey(int16_t bx, int16_t by, int16_t z)
+        {
+            return (uint64_t(uint16_t(bx)) << 32) | (uint64_t(uint16_t(by)) << 16) | uint16_t(z);
+        }
+
+        static uint64_t blockKey(const df::coord &pos)
+        {
+            return blockKey(pos.x >> 4, pos.y >> 4, pos.z);
+        }
+
+        static int32_t unitNextId()
+        {
+            return df::global::unit_next_id ? *df::global::unit_next_id : -1;
+        }
+
+        void clear()
+        {
+            buckets.clear();
+            entries.clear();
+            valid = false;
+        }
+
+        void remove(uint32_t index)
+        {
+            Entry &entry = entries[index];
+            auto it = buckets.find(entry.key);
+            auto &bucket = it->second;
+            if (entry.slot + 1 < bucket.size())
+            {
+                uint32_t moved = bucket.back();
+                bucket[entry.slot] = moved;
+                entries[moved].slot = entry.slot;
+            }
+            bucket.pop_back();
+            if (bucket.empty())
+                buckets.erase(it);
+        }
+
+        void insert(uint32_t index, uint64_t key)
+        {
+            auto &bucket = buckets[key];
+            entries[index].key = key;
+            entries[index].slot = bucket.size();
+            bucket.push_back(index);
+        }
+
+        // Refiles the unit if it left the block it is filed under
+        void check(uint32_t index)
+        {
+            uint64_t key = blockKey(world->units.all[index]->pos);
+            if (entries[index].key == key)
+                return;
+            remove(index);
+            insert(index, key);
+        }
+
+        void rebuild()
+        {
+            auto &all = world->units.all;
+            buckets.clear();
+            entries.resize(all.size());
+            for (size_t i = 0; i < all.size(); i++)
+                insert(i, blockKey(all[i]->pos));
+            count = all.size();
+            next_id = unitNextId();
+            checked = Core::getInstance().getUpdateCount();
+            valid = true;
+        }
+
+        void refresh()
+        {
+            auto &all = world->units.all;
+            // Units that arrive get new ids, so a departure and an arrival
+            // within one frame still change the signature
+            if (!valid || count != all.size() || next_id != unitNextId())
+            {
+                rebuild();
+                return;
+            }
+
+            uint32_t frame = Core::getInstance().getUpdateCount();
+            if (frame == checked)
+                return;
+            checked = frame;
+            for (size_t i = 0; i < all.size(); i++)
+                check(i);
+        }
+
+        template<class F>
+        void query(int16_t x1, int16_t y1, int16_t z1, int16_t x2, int16_t y2, int16_t z2, F filter, vector<df::unit*> &units)
+        {
+            refresh();
+            units.clear();
+
+            auto &all = world->units.all;
+            vector<uint32_t> stale;
+            auto add = [&](uint64_t key, const vector<uint32_t> &bucket) {
+                for (uint32_t index : bucket)
+                {
+                    df::unit *u = all[index];
+                    // Moved since this frame's check; refiled below
+                    if (blockKey(u->pos) != key)
+                        stale.push_back(index);
+                    if (u->pos.x >= x1 && u->pos.x <= x2 &&
+                        u->pos.y >= y1 && u->pos.y <= y2 &&
+                        u->pos.z >= z1 && u->pos.z <= z2 &&
+                        filter(u))
+                        units.push_back(u);
+                }
+            };
+
+            // Large boxes are cheaper to answer by walking the occupied blocks
+            int64_t blocks = int64_t((x2 >> 4) - (x1 >> 4) + 1) * ((y2 >> 4) - (y1 >> 4) + 1) * (z2 - z1 + 1);
+            if (blocks > int64_t(buckets.size()))
+            {
+                for (auto &bucket : buckets)
+                    add(bucket.first, bucket.second);
+            }
+            else
+            {
+                for (int z = z1; z <= z2; z++)
+                    for (int by = y1 >> 4; by <= (y2 >> 4); by++)
+                        for (int bx = x1 >> 4; bx <= (x2 >> 4); bx++)
+                        {
+                            uint64_t key = blockKey(bx, by, z);
+                            auto it = buckets.find(key);
+                            if (it != buckets.end())
+                                add(key, it->second);
+                        }
+            }
+
+            for (uint32_t index : stale)
+                check(index);
+
+            // Same order as world->units.all
+            std::sort(units.begin(), units.end(), [](df::unit *a, df::unit *b) { return a->id < b->id; });
+        }
+    };
+}
+
+static UnitSpatialIndex unit_index;
+
+void units_onStateChange(color_ostream &out, state_change_event event)
+{
+    switch (event) {
+    case SC_MAP_LOADED:
+    case SC_MAP_UNLOADED:
+    case SC_WORLD_UNLOADED:
+        unit_index.clear();
+        break;
+    default:
+        break;
+    }
+}
+
 bool Units::getUnitsInBox (std::vector<df::unit*> &units,
     int16_t x1, int16_t y1, int16_t z1,
     int16_t x2, int16_t y2, int16_t z2)
@@ -106,20 +285,38 @@ bool Units::getUnitsInBox (std::vector<df::unit*> &units,
     if (y1 > y2) swap(y1, y2);
     if (z1 > z2) swap(z1, z2);
 
-    units.clear();
-    for (df::unit *u : world->units.all)
-    {
-        if (u->pos.x >= x1 && u->pos.x <= x2)
-        {
-            if (u->pos.y >= y1 && u->pos.y <= y2)
-            {
-                if (u->pos.z >= z1 && u->pos.z <= z2)
-                {
-                    units.push_back(u);
-                }
-            }
-        }
-    }
+    unit_index.query(x1, y1, z1, x2, y2, z2, [](df::unit *) { return true; }, units);
+    return true;
+}
+
+bool Units::getUnitsInRadius (std::vector<df::unit*> &units, df::coord center, int radius)
+{
+    if (!world)
+        return false;
+    if (radius < 0)
+        radius = -radius;
+
+    auto clamp = [](int v) { return int16_t(std::max(-32768, std::min(32767, v))); };
+    int64_t r2 = int64_t(radius) * radius;
+    unit_index.query(
+        clamp(center.x - radius), clamp(center.y - radius), clamp(center.z - radius),
+        clamp(center.x + radius), clamp(center.y + radius), clamp(center.z + radius),
+        [&](df::unit *u) {
+            int64_t dx = u->pos.x - center.x, dy = u->pos.y - center.y, dz = u->pos.z - center.z;
+            return dx*dx + dy*dy + dz*dz <= r2;
+        },
+        units);
+    return true;
+}
+
+bool Units::getUnitsInBlock (std::vector<df::unit*> &units, int16_t x, int16_t y, int16_t z)
+{
+    if (!world)
+        return false;
+
+    x <<= 4;
+    y <<= 4;
+    unit_index.query(x, y, z, x + 15, y + 15, z, [](df::unit *) { return true; }, units);
     return true;
 }
 
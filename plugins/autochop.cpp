@@ -13,7 +13,6 @@
 #include "df/burrow.h"
 #include "df/item.h"
 #include "df/item_flags.h"
-#include "df/items_other_id.h"
 #include "df/job.h"
 #include "df/map_block.h"
 #include "df/material.h"
@@ -27,6 +26,7 @@
 #include "modules/Burrows.h"
 #include "modules/Designations.h"
 #include "modules/Gui.h"
+#include "modules/Items.h"
 #include "modules/MapCache.h"
 #include "modules/Maps.h"
 #include "modules/Screen.h"
@@ -382,7 +382,8 @@ static bool is_valid_item(df::item *item)
 
 static int get_log_count()
 {
-    std::vector<df::item*> &items = world->items.other[items_other_id::IN_PLAY];
+    std::vector<df::item*> items;
+    Items::getCensusItems(&items, item_type::WOOD);
 
     // Pre-compute a bitmask with the bad flags
     df::item_flags bad_flags;
@@ -400,9 +401,6 @@ static int get_log_count()
     {
         df::item *item = items[i];
 
-        if (item->getType() != item_type::WOOD)
-            continue;
-
         if (item->flags.whole & bad_flags.whole)
             continue;
 
@@ -11,6 +11,7 @@
 #include "modules/Buildings.h"
 #include "modules/Filesystem.h"
 #include "modules/Gui.h"
+#include "modules/Items.h"
 #include "modules/Job.h"
 #include "modules/World.h"
 
@@ -207,11 +208,16 @@ void create_jobs() {
     if (unlinked.size() > 0) {
         // Count how many gems of each type are available to be cut.
         // Gems in stockpiles linked to specific workshops don't count.
-        auto gems = world->items.other[items_other_id::ROUGH];
-        for (auto g = gems.begin(); g != gems.end(); ++g) {
-            auto item = *g;
-            if (valid_gem(item) && !stockpiled.count(item->id)) {
-                available[item->getMaterialIndex()] += 1;
+        auto &buckets = Items::getItemCensus(item_type::ROUGH);
+        for (auto b = buckets.begin(); b != buckets.end(); ++b) {
+            auto bucket = *b;
+            if (bucket->mat_type != builtin_mats::INORGANIC || blacklist.count(bucket->mat_index))
+                continue;
+            for (auto g = bucket->items.begin(); g != bucket->items.end(); ++g) {
+                auto item = *g;
+                if (valid_gem(item) && !stockpiled.count(item->id)) {
+                    available[bucket->mat_index] += 1;
+                }
             }
         }
 
@@ -14,6 +14,7 @@
 #include "modules/Job.h"
 #include "modules/Maps.h"
 #include "modules/MapCache.h"
+#include "modules/PathSearch.h"
 #include "modules/Units.h"
 #include "modules/World.h"
 
@@ -193,31 +194,6 @@ DFhackCExport command_result plugin_onstatechange(color_ostream &out, state_chan
 
 df::coord getRoot(df::coord point, unordered_map<df::coord, df::coord>& rootMap);
 
-class PointComp {
-public:
-    unordered_map<df::coord, cost_t, PointHash> *pointCost;
-    PointComp(unordered_map<df::coord, cost_t, PointHash> *p): pointCost(p) {
-
-    }
-
-    int32_t operator()(df::coord p1, df::coord p2) const {
-        if ( p1 == p2 ) return 0;
-        auto i1 = pointCost->find(p1);
-        auto i2 = pointCost->find(p2);
-        if ( i1 == pointCost->end() && i2 == pointCost->end() )
-            return p1 < p2;
-        if ( i1 == pointCost->end() )
-            return true;
-        if ( i2 == pointCost->end() )
-            return false;
-        cost_t c1 = (*i1).second;
-        cost_t c2 = (*i2).second;
-        if ( c1 != c2 )
-            return c1 < c2;
-        return p1 < p2;
-    }
-};
-
 //bool important(df::coord pos, map<df::coord, set<Edge> >& edges, df::coord prev, set<df::coord>& importantPoints, set<Edge>& importantEdges);
 
 void newInvasionHandler(color_ostream& out, void* ptr) {
@@ -335,31 +311,14 @@ command_result diggingInvadersCommand(color_ostream& out, std::vector<std::strin
 vector<int32_t> invaders;
 unordered_set<df::coord, PointHash> invaderPts;
 unordered_set<df::coord, PointHash> localPts;
-unordered_map<df::coord,df::coord,PointHash> parentMap;
-unordered_map<df::coord,cost_t,PointHash> costMap;
-
-PointComp comp(&costMap);
-set<df::coord, PointComp> fringe(comp);
+PathSearch search;
 EventManager::EventHandler findJobTickHandler(findAndAssignInvasionJob, 1);
 
-int32_t localPtsFound = 0;
-unordered_set<df::coord,PointHash> closedSet;
-unordered_map<df::coord,int32_t,PointHash> workNeeded; //non-walking work needed to get there
-bool foundTarget = false;
-int32_t edgeCount = 0;
-
 void clearDijkstra() {
     invaders.clear();
     invaderPts.clear();
     localPts.clear();
-    parentMap.clear();
-    costMap.clear();
-    comp = PointComp(&costMap);
-    fringe = set<df::coord,PointComp>(comp);
-    localPtsFound = edgeCount = 0;
-    foundTarget = false;
-    closedSet.clear();
-    workNeeded.clear();
+    search.clear();
 }
 /////////////////////////////////////////////////////////////////////////////////////////
 
@@ -375,7 +334,7 @@ void findAndAssignInvasionJob(color_ostream& out, void* tickTime) {
     EventManager::unregister(EventManager::EventType::TICK, findJobTickHandler, plugin_self);
     EventManager::registerTick(findJobTickHandler, 1, plugin_self);
 
-    if ( fringe.empty() ) {
+    if ( !search.isRunning() ) {
         df::unit* lastDigger = df::unit::find(lastInvasionDigger);
         if ( lastDigger && lastDigger->job.current_job && lastDigger->job.current_job->id == lastInvasionJob ) {
             return;
@@ -396,6 +355,7 @@ void findAndAssignInvasionJob(color_ostream& out, void* tickTime) {
                 if ( localPts.find(unit->pos) != localPts.end() )
                     continue;
                 localPts.insert(unit->pos);
+                search.addTarget(unit->pos);
                 df::map_block* block = Maps::getTileBlock(unit->pos);
                 localConnectivity.insert(block->walkable[unit->pos.x&0xF][unit->pos.y&0xF]);
             } else if ( unit->flags1.bits.active_invader ) {
@@ -420,8 +380,7 @@ void findAndAssignInvasionJob(color_ostream& out, void* tickTime) {
                 if ( invaderPts.size() > 0 )
                     continue;
                 invaderPts.insert(unit->pos);
-                costMap[unit->pos] = 0;
-                fringe.insert(unit->pos);
+                search.addSource(unit->pos);
                 invaders.push_back(unit->id);
             } else {
                 continue;
@@ -450,14 +409,14 @@ void findAndAssignInvasionJob(color_ostream& out, void* tickTime) {
 
     df::unit* firstInvader = df::unit::find(invaders[0]);
     if ( firstInvader == NULL ) {
-        fringe.clear();
+        search.clear();
         return;
     }
 
     df::creature_raw* creature_raw = df::creature_raw::find(firstInvader->race);
     if ( creature_raw == NULL || digAbilities.find(creature_raw->creature_id) == digAbilities.end() ) {
         //inappropriate digger: no dig abilities
-        fringe.clear();
+        search.clear();
         return;
     }
     DigAbilities& abilities = digAbilities[creature_raw->creature_id];
@@ -472,68 +431,11 @@ void findAndAssignInvasionJob(color_ostream& out, void* tickTime) {
     yMax *= 16;
     MapExtras::MapCache cache;
 
-    clock_t t0 = clock();
-    clock_t totalEdgeTime = 0;
-    int32_t edgesExpanded = 0;
-    while(!fringe.empty()) {
-        if ( edgesPerTick > 0 && edgesExpanded++ >= edgesPerTick ) {
-            return;
-        }
-        df::coord pt = *(fringe.begin());
-        fringe.erase(fringe.begin());
-        //out.print("line %d: fringe size = %d, localPtsFound = %d / %d, closedSetSize = %d, pt = %d,%d,%d\n", __LINE__, fringe.size(), localPtsFound, localPts.size(), closedSet.size(), pt.x,pt.y,pt.z);
-        if ( closedSet.find(pt) != closedSet.end() ) {
-            out.print("%s, line %d: Double closure! Bad!\n", __FILE__, __LINE__);
-            break;
-        }
-        closedSet.insert(pt);
-
-        if ( localPts.find(pt) != localPts.end() ) {
-            localPtsFound++;
-            if ( true || localPtsFound >= localPts.size() ) {
-                foundTarget = true;
-                break;
-            }
-            if ( workNeeded.find(pt) == workNeeded.end() || workNeeded[pt] == 0 ) {
-                //there are still dwarves to kill that don't require digging to get to
-                return;
-            }
-        }
-
-        cost_t myCost = costMap[pt];
-        clock_t edgeTime = clock();
-        vector<Edge>* myEdges = getEdgeSet(out, pt, cache, xMax, yMax, zMax, abilities);
-        totalEdgeTime += (clock() - edgeTime);
-        for ( auto a = myEdges->begin(); a != myEdges->end(); a++ ) {
-            Edge &e = *a;
-            if ( e.p1 == df::coord() )
-                break;
-            edgeCount++;
-            df::coord& other = e.p1;
-            if ( other == pt )
-                other = e.p2;
-            //if ( closedSet.find(other) != closedSet.end() )
-            //    continue;
-            auto i = costMap.find(other);
-            if ( i != costMap.end() ) {
-                cost_t cost = (*i).second;
-                if ( cost <= myCost + e.cost ) {
-                    continue;
-                }
-                fringe.erase((*i).first);
-            }
-            costMap[other] = myCost + e.cost;
-            fringe.insert(other);
-            parentMap[other] = pt;
-            workNeeded[other] = (e.cost > 1 ? 1 : 0) + workNeeded[pt];
-        }
-        delete myEdges;
-    }
-    clock_t time = clock() - t0;
-    //out.print("tickTime = %d, time = %d, totalEdgeTime = %d, total points = %d, total edges = %d, time per point = %.3f, time per edge = %.3f, clocks/sec = %d\n", (int32_t)tickTime, time, totalEdgeTime, closedSet.size(), edgeCount, (float)time / closedSet.size(), (float)time / edgeCount, CLOCKS_PER_SEC);
-    fringe.clear();
-
-    if ( !foundTarget )
+    //the search stops once it settles the closest local, and is resumed next tick if it runs out of expansions
+    auto expand = [&](df::coord pt, vector<PathSearch::Step>& steps) {
+        getEdgeSet(out, pt, xMax, yMax, zMax, abilities, steps);
+    };
+    if ( search.run(expand, edgesPerTick) != PathSearch::Found )
         return;
 
     unordered_set<df::coord, PointHash> requiresZNeg;
@@ -544,46 +446,29 @@ void findAndAssignInvasionJob(color_ostream& out, void* tickTime) {
     //df::coord closest;
     //cost_t closestCostEstimate=0;
     //cost_t closestCostActual=0;
-    for ( auto i = localPts.begin(); i != localPts.end(); i++ ) {
-        df::coord pt = *i;
-        if ( costMap.find(pt) == costMap.end() )
-            continue;
-        if ( parentMap.find(pt) == parentMap.end() )
-            continue;
-        //closest = pt;
-        //closestCostEstimate = costMap[closest];
-        //if ( workNeeded[pt] == 0 )
-        //    continue;
-        while ( parentMap.find(pt) != parentMap.end() ) {
-            //out.print("(%d,%d,%d)\n", pt.x, pt.y, pt.z);
-            df::coord parent = parentMap[pt];
-            cost_t cost = getEdgeCost(out, parent, pt, abilities);
-            if ( cost < 0 ) {
-                //path invalidated
-                return;
-            }
-            //closestCostActual += cost;
-            if ( Maps::canStepBetween(parent, pt) ) {
-
-            } else {
-                if ( pt.x == parent.x && pt.y == parent.y ) {
-                    if ( pt.z < parent.z ) {
-                        requiresZNeg.insert(parent);
-                        requiresZPos.insert(pt);
-                    } else if ( pt.z > parent.z ) {
-                        requiresZNeg.insert(pt);
-                        requiresZPos.insert(parent);
-                    }
+    df::coord pt = search.getFound();
+    df::coord parent;
+    while ( search.getParent(pt, &parent) ) {
+        //out.print("(%d,%d,%d)\n", pt.x, pt.y, pt.z);
+        cost_t cost = getEdgeCost(out, parent, pt, abilities);
+        if ( cost < 0 ) {
+            //path invalidated
+            return;
+        }
+        if ( !Maps::canStepBetween(parent, pt) ) {
+            if ( pt.x == parent.x && pt.y == parent.y ) {
+                if ( pt.z < parent.z ) {
+                    requiresZNeg.insert(parent);
+                    requiresZPos.insert(pt);
+                } else if ( pt.z > parent.z ) {
+                    requiresZNeg.insert(pt);
+                    requiresZPos.insert(parent);
                 }
-                //if ( workNeeded[pt] > workNeeded[parent] ) {
-                    //importantEdges.push_front(Edge(pt,parent,0));
-                //}
-                firstImportantEdge = Edge(pt,parent,0);
-                //out.print("(%d,%d,%d) -> (%d,%d,%d)\n", parent.x,parent.y,parent.z, pt.x,pt.y,pt.z);
             }
-            pt = parent;
+            firstImportantEdge = Edge(pt,parent,0);
+            //out.print("(%d,%d,%d) -> (%d,%d,%d)\n", parent.x,parent.y,parent.z, pt.x,pt.y,pt.z);
         }
-        break;
+        pt = parent;
     }
     if ( firstImportantEdge.p1 == df::coord() )
         return;
@@ -595,7 +480,7 @@ void findAndAssignInvasionJob(color_ostream& out, void* tickTime) {
     }
 */
 
-    assignJob(out, firstImportantEdge, parentMap, costMap, invaders, requiresZNeg, requiresZPos, cache, abilities);
+    assignJob(out, firstImportantEdge, search, invaders, requiresZNeg, requiresZPos, cache, abilities);
     lastInvasionDigger = firstInvader->id;
     lastInvasionJob = firstInvader->job.current_job ? firstInvader->job.current_job->id : -1;
     invaderJobs.erase(lastInvasionJob);
@@ -453,12 +453,7 @@ cost_t getEdgeCostOld(color_ostream& out, df::coord pt1, df::coord pt2) {
 }
 */
 
-vector<Edge>* getEdgeSet(color_ostream &out, df::coord point, MapExtras::MapCache& cache, int32_t xMax, int32_t yMax, int32_t zMax, DigAbilities& abilities) {
-    //vector<Edge>* result = new vector<Edge>(26);
-    vector<Edge>* result = new vector<Edge>();
-    result->reserve(26);
-
-    //size_t count = 0;
+void getEdgeSet(color_ostream &out, df::coord point, int32_t xMax, int32_t yMax, int32_t zMax, DigAbilities& abilities, vector<PathSearch::Step>& steps) {
     for ( int32_t dx = -1; dx <= 1; dx++ ) {
         for ( int32_t dy = -1; dy <= 1; dy++ ) {
             for ( int32_t dz = -1; dz <= 1; dz++ ) {
@@ -472,14 +467,10 @@ vector<Edge>* getEdgeSet(color_ostream &out, df::coord point, MapExtras::MapCach
                 cost_t cost = getEdgeCost(out, point, neighbor, abilities);
                 if ( cost == -1 )
                     continue;
-                Edge edge(point, neighbor, cost);
-                //(*result)[count] = edge;
-                result->push_back(edge);
-                //count++;
+                PathSearch::Step step = { neighbor, cost };
+                steps.push_back(step);
             }
         }
     }
-
-    return result;
 }
 
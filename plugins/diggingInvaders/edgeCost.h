@@ -6,6 +6,7 @@
 
 #include "modules/Maps.h"
 #include "modules/MapCache.h"
+#include "modules/PathSearch.h"
 
 #include "df/coord.h"
 
@@ -94,5 +95,5 @@ struct PointHash {
 };
 
 cost_t getEdgeCost(DFHack::color_ostream& out, df::coord pt1, df::coord pt2, DigAbilities& abilities);
-std::vector<Edge>* getEdgeSet(DFHack::color_ostream &out, df::coord point, MapExtras::MapCache& cache, int32_t xMax, int32_t yMax, int32_t zMax, DigAbilities& abilities);
+void getEdgeSet(DFHack::color_ostream &out, df::coord point, int32_t xMax, int32_t yMax, int32_t zMax, DigAbilities& abilities, std::vector<DFHack::PathSearch::Step>& steps);
 
@@ -0,0 +1,455 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "Core.h"
+#include <Console.h>
+#include <modules/Filesystem.h>
+#include <modules/World.h>
+
+#include "DataDefs.h"
+#include "df/world.h"
+#include "df/world_raws.h"
+
+#include "cache.h"
+#include "defs.h"
+
+using namespace DFHack;
+
+using df::global::world;
+
+//  File layout, all values in native byte order:
+//
+//  header:    magic, version, dim_x, dim_y, max_inorganic, inorganic count, seed length, seed
+//  directory: dim_x * dim_y (offset, size) pairs, in x major order. Size 0 = not cached.
+//  records:   region_tile_datum bytes, uncompressed size of the mid level tiles, and the
+//             zlib compressed mid level tiles.
+//
+//  The region part is kept uncompressed as it's read for every cached tile at startup,
+//  while the mid level tiles are only unpacked when a search needs them.
+
+namespace embark_assist {
+    namespace cache {
+        const char magic[4] = { 'E', 'A', 'S', 'C' };
+        const uint32_t version = 1;
+
+        struct states {
+            std::string path;
+            std::string seed;
+            uint16_t dim_x;
+            uint16_t dim_y;
+            uint16_t max_inorganic;
+            uint32_t inorganic_count;
+            std::vector<std::string> records;  //  Indexed by x * dim_y + y
+            bool dirty;
+        };
+
+        static states *state = nullptr;
+
+        //=======================================================================================
+
+        template <typename T>
+        void pack(std::string &out, const T &value) {
+            out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+        }
+
+        template <typename T>
+        bool unpack(const std::string &in, size_t &pos, T &value) {
+            if (in.size() - pos < sizeof(T)) return false;
+            memcpy(&value, in.data() + pos, sizeof(T));
+            pos += sizeof(T);
+            return true;
+        }
+
+        //=======================================================================================
+
+        //  The inorganic flags are sparse, so only the indices of the set ones are stored.
+        void put_flags(std::string &out, const std::vector<bool> &flags) {
+            std::vector<uint16_t> indices;
+            for (uint16_t i = 0; i < flags.size(); i++) {
+                if (flags[i]) indices.push_back(i);
+            }
+
+            pack(out, uint16_t(indices.size()));
+            for (auto index : indices) pack(out, index);
+        }
+
+        bool get_flags(const std::string &in, size_t &pos, std::vector<bool> &flags) {
+            uint16_t count;
+            uint16_t index;
+
+            if (!unpack(in, pos, count)) return false;
+            flags.assign(flags.size(), false);
+
+            for (uint16_t i = 0; i < count; i++) {
+                if (!unpack(in, pos, index) || index >= flags.size()) return false;
+                flags[index] = true;
+            }
+
+            return true;
+        }
+
+        //=======================================================================================
+
+        void put_tile(std::string &out, const embark_assist::defs::region_tile_datum &tile) {
+            pack(out, tile.aquifer_count);
+            pack(out, tile.clay_count);
+            pack(out, tile.sand_count);
+            pack(out, tile.flux_count);
+            pack(out, tile.min_region_soil);
+            pack(out, tile.max_region_soil);
+            pack(out, tile.waterfall);
+            pack(out, int8_t(tile.river_size));
+            pack(out, tile.biome_index);
+            pack(out, tile.biome);
+            pack(out, tile.biome_count);
+            pack(out, tile.min_temperature);
+            pack(out, tile.max_temperature);
+            pack(out, tile.blood_rain);
+            pack(out, tile.blood_rain_possible);
+            pack(out, tile.blood_rain_full);
+            pack(out, tile.permanent_syndrome_rain);
+            pack(out, tile.permanent_syndrome_rain_possible);
+            pack(out, tile.permanent_syndrome_rain_full);
+            pack(out, tile.temporary_syndrome_rain);
+            pack(out, tile.temporary_syndrome_rain_possible);
+            pack(out, tile.temporary_syndrome_rain_full);
+            pack(out, tile.reanimating);
+            pack(out, tile.reanimating_possible);
+            pack(out, tile.reanimating_full);
+            pack(out, tile.thralling);
+            pack(out, tile.thralling_possible);
+            pack(out, tile.thralling_full);
+            pack(out, tile.savagery_count);
+            pack(out, tile.evilness_count);
+            put_flags(out, tile.metals);
+            put_flags(out, tile.economics);
+            put_flags(out, tile.minerals);
+        }
+
+        bool get_tile(const std::string &in, size_t &pos, embark_assist::defs::region_tile_datum &tile) {
+            int8_t river_size;
+
+            if (!unpack(in, pos, tile.aquifer_count) ||
+                !unpack(in, pos, tile.clay_count) ||
+                !unpack(in, pos, tile.sand_count) ||
+                !unpack(in, pos, tile.flux_count) ||
+                !unpack(in, pos, tile.min_region_soil) ||
+                !unpack(in, pos, tile.max_region_soil) ||
+                !unpack(in, pos, tile.waterfall) ||
+                !unpack(in, pos, river_size) ||
+                !unpack(in, pos, tile.biome_index) ||
+                !unpack(in, pos, tile.biome) ||
+                !unpack(in, pos, tile.biome_count) ||
+                !unpack(in, pos, tile.min_temperature) ||
+                !unpack(in, pos, tile.max_temperature) ||
+                !unpack(in, pos, tile.blood_rain) ||
+                !unpack(in, pos, tile.blood_rain_possible) ||
+                !unpack(in, pos, tile.blood_rain_full) ||
+                !unpack(in, pos, tile.permanent_syndrome_rain) ||
+                !unpack(in, pos, tile.permanent_syndrome_rain_possible) ||
+                !unpack(in, pos, tile.permanent_syndrome_rain_full) ||
+                !unpack(in, pos, tile.temporary_syndrome_rain) ||
+                !unpack(in, pos, tile.temporary_syndrome_rain_possible) ||
+                !unpack(in, pos, tile.temporary_syndrome_rain_full) ||
+                !unpack(in, pos, tile.reanimating) ||
+                !unpack(in, pos, tile.reanimating_possible) ||
+                !unpack(in, pos, tile.reanimating_full) ||
+                !unpack(in, pos, tile.thralling) ||
+                !unpack(in, pos, tile.thralling_possible) ||
+                !unpack(in, pos, tile.thralling_full) ||
+                !unpack(in, pos, tile.savagery_count) ||
+                !unpack(in, pos, tile.evilness_count) ||
+                !get_flags(in, pos, tile.metals) ||
+                !get_flags(in, pos, tile.economics) ||
+                !get_flags(in, pos, tile.minerals)) return false;
+
+            tile.river_size = static_cast<embark_assist::defs::river_sizes>(river_size);
+            tile.surveyed = true;
+            return true;
+        }
+
+        //=======================================================================================
+
+        void put_mlt(std::string &out, const embark_assist::defs::mid_level_tiles &mlt) {
+            for (uint8_t i = 0; i < 16; i++) {
+                for (uint8_t k = 0; k < 16; k++) {
+                    const embark_assist::defs::mid_level_tile &tile = mlt[i][k];
+                    pack(out, tile.aquifer);
+                    pack(out, tile.clay);
+                    pack(out, tile.sand);
+                    pack(out, tile.flux);
+                    pack(out, tile.soil_depth);
+                    pack(out, tile.offset);
+                    pack(out, tile.elevation);
+                    pack(out, tile.river_present);
+                    pack(out, tile.river_elevation);
+                    pack(out, tile.adamantine_level);
+                    pack(out, tile.magma_level);
+                    pack(out, tile.biome_offset);
+                    pack(out, tile.savagery_level);
+                    pack(out, tile.evilness_level);
+                    put_flags(out, tile.metals);
+                    put_flags(out, tile.economics);
+                    put_flags(out, tile.minerals);
+                }
+            }
+        }
+
+        bool get_mlt(const std::string &in, embark_assist::defs::mid_level_tiles &mlt) {
+            size_t pos = 0;
+
+            for (uint8_t i = 0; i < 16; i++) {
+                for (uint8_t k = 0; k < 16; k++) {
+                    embark_assist::defs::mid_level_tile &tile = mlt[i][k];
+                    if (!unpack(in, pos, tile.aquifer) ||
+                        !unpack(in, pos, tile.clay) ||
+                        !unpack(in, pos, tile.sand) ||
+                        !unpack(in, pos, tile.flux) ||
+                        !unpack(in, pos, tile.soil_depth) ||
+                        !unpack(in, pos, tile.offset) ||
+                        !unpack(in, pos, tile.elevation) ||
+                        !unpack(in, pos, tile.river_present) ||
+                        !unpack(in, pos, tile.river_elevation) ||
+                        !unpack(in, pos, tile.adamantine_level) ||
+                        !unpack(in, pos, tile.magma_level) ||
+                        !unpack(in, pos, tile.biome_offset) ||
+                        !unpack(in, pos, tile.savagery_level) ||
+                        !unpack(in, pos, tile.evilness_level) ||
+                        !get_flags(in, pos, tile.metals) ||
+                        !get_flags(in, pos, tile.economics) ||
+                        !get_flags(in, pos, tile.minerals)) return false;
+                }
+            }
+
+            return pos == in.size();
+        }
+
+        //=======================================================================================
+
+        bool read_file(const std::string &data) {
+            size_t pos = 0;
+            char file_magic[4];
+            uint32_t file_version;
+            uint16_t dim_x;
+            uint16_t dim_y;
+            uint16_t max_inorganic;
+            uint32_t inorganic_count;
+            uint32_t seed_length;
+
+            if (!unpack(data, pos, file_magic) ||
+                memcmp(file_magic, magic, sizeof(magic)) != 0 ||
+                !unpack(data, pos, file_version) ||
+                file_version != version ||
+                !unpack(data, pos, dim_x) ||
+                !unpack(data, pos, dim_y) ||
+                !unpack(data, pos, max_inorganic) ||
+                !unpack(data, pos, inorganic_count) ||
+                !unpack(data, pos, seed_length) ||
+                data.size() - pos < seed_length) return false;
+
+            if (dim_x != state->dim_x ||
+                dim_y != state->dim_y ||
+                max_inorganic != state->max_inorganic ||
+                inorganic_count != state->inorganic_count ||
+                data.compare(pos, seed_length, state->seed) != 0) return false;
+
+            pos += seed_length;
+
+            for (size_t i = 0; i < state->records.size(); i++) {
+                uint32_t offset;
+                uint32_t size;
+
+                if (!unpack(data, pos, offset) ||
+                    !unpack(data, pos, size)) return false;
+
+                if (size == 0) continue;
+                if (offset > data.size() || data.size() - offset < size) return false;
+
+                state->records[i].assign(data, offset, size);
+            }
+
+            return true;
+        }
+
+        //=======================================================================================
+
+        void write_file() {
+            color_ostream_proxy out(Core::getInstance().getConsole());
+            std::string header;
+
+            header.append(magic, sizeof(magic));
+            pack(header, version);
+            pack(header, state->dim_x);
+            pack(header, state->dim_y);
+            pack(header, state->max_inorganic);
+            pack(header, state->inorganic_count);
+            pack(header, uint32_t(state->seed.size()));
+            header.append(state->seed);
+
+            uint32_t offset = uint32_t(header.size() + state->records.size() * 2 * sizeof(uint32_t));
+            for (auto &record : state->records) {
+                pack(header, record.empty() ? uint32_t(0) : offset);
+                pack(header, uint32_t(record.size()));
+                offset += uint32_t(record.size());
+            }
+
+            //  Write to a temporary file first so an interrupted write can't leave a damaged cache.
+            std::string temp_path = state->path + ".tmp";
+            {
+                std::ofstream file(temp_path.c_str(), std::ios::binary | std::ios::trunc);
+                file.write(header.data(), header.size());
+                for (auto &record : state->records) {
+                    file.write(record.data(), record.size());
+                }
+
+                if (!file.good()) {
+                    out.printerr("embark-assistant: Failed to write the survey cache %s\n", temp_path.c_str());
+                    return;
+                }
+            }
+
+            remove(state->path.c_str());
+            if (rename(temp_path.c_str(), state->path.c_str()) != 0) {
+                out.printerr("embark-assistant: Failed to replace the survey cache %s\n", state->path.c_str());
+            }
+        }
+    }
+}
+
+//=======================================================================================
+//  Visible operations
+//=======================================================================================
+
+void embark_assist::cache::setup(uint16_t max_inorganic) {
+    color_ostream_proxy out(Core::getInstance().getConsole());
+    std::string folder = World::ReadWorldFolder();
+
+    delete state;
+    state = nullptr;
+
+    if (folder.empty() || !Filesystem::isdir("data/save/" + folder)) return;
+
+    state = new(states);
+    state->path = "data/save/" + folder + "/embark-assistant.dat";
+    state->seed = world->worldgen.worldgen_parms.seed;
+    state->dim_x = world->worldgen.worldgen_parms.dim_x;
+    state->dim_y = world->worldgen.worldgen_parms.dim_y;
+    state->max_inorganic = max_inorganic;
+    state->inorganic_count = world->raws.inorganics.size();
+    state->records.resize(state->dim_x * state->dim_y);
+    state->dirty = false;
+
+    std::ifstream file(state->path.c_str(), std::ios::binary);
+    if (!file.good()) return;
+
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (!read_file(data)) {
+        out.print("embark-assistant: Discarding the survey cache of a different world or version\n");
+        state->records.assign(state->records.size(), std::string());
+        state->dirty = true;
+    }
+}
+
+//=======================================================================================
+
+void embark_assist::cache::restore(embark_assist::defs::world_tile_data *survey_results) {
+    if (!state) return;
+
+    for (uint16_t i = 0; i < state->dim_x; i++) {
+        for (uint16_t k = 0; k < state->dim_y; k++) {
+            std::string &record = state->records[i * state->dim_y + k];
+            if (record.empty()) continue;
+
+            embark_assist::defs::region_tile_datum tile = survey_results->at(i).at(k);
+            size_t pos = 0;
+            uint32_t region_size;
+
+            if (!unpack(record, pos, region_size) ||
+                record.size() - pos < region_size) {
+                record.clear();
+                state->dirty = true;
+                continue;
+            }
+
+            std::string region = record.substr(pos, region_size);
+            size_t region_pos = 0;
+
+            if (!get_tile(region, region_pos, tile) ||
+                region_pos != region.size()) {
+                record.clear();
+                state->dirty = true;
+                continue;
+            }
+
+            survey_results->at(i).at(k) = tile;
+        }
+    }
+}
+
+//=======================================================================================
+
+void embark_assist::cache::store(uint16_t x,
+    uint16_t y,
+    const embark_assist::defs::region_tile_datum *tile,
+    const embark_assist::defs::mid_level_tiles *mlt) {
+
+    if (!state || x >= state->dim_x || y >= state->dim_y) return;
+
+    std::string region;
+    std::string levels;
+    put_tile(region, *tile);
+    put_mlt(levels, *mlt);
+
+    uLongf size = compressBound(levels.size());
+    std::string packed(size, '\0');
+    if (compress2((Bytef *)&packed[0], &size, (const Bytef *)levels.data(), levels.size(), Z_BEST_SPEED) != Z_OK) return;
+    packed.resize(size);
+
+    std::string &record = state->records[x * state->dim_y + y];
+    record.clear();
+    pack(record, uint32_t(region.size()));
+    record.append(region);
+    pack(record, uint32_t(levels.size()));
+    record.append(packed);
+    state->dirty = true;
+}
+
+//=======================================================================================
+
+bool embark_assist::cache::get(uint16_t x, uint16_t y, embark_assist::defs::mid_level_tiles *mlt) {
+    if (!state || x >= state->dim_x || y >= state->dim_y) return false;
+
+    const std::string &record = state->records[x * state->dim_y + y];
+    size_t pos = 0;
+    uint32_t region_size;
+    uint32_t levels_size;
+
+    if (record.empty() ||
+        !unpack(record, pos, region_size) ||
+        record.size() - pos < region_size) return false;
+
+    pos += region_size;
+    if (!unpack(record, pos, levels_size)) return false;
+
+    std::string levels(levels_size, '\0');
+    uLongf size = levels_size;
+    if (uncompress((Bytef *)&levels[0], &size, (const Bytef *)record.data() + pos, record.size() - pos) != Z_OK ||
+        size != levels_size) return false;
+
+    return get_mlt(levels, *mlt);
+}
+
+//=======================================================================================
+
+void embark_assist::cache::shutdown() {
+    if (state && state->dirty) write_file();
+
+    delete state;
+    state = nullptr;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "defs.h"
+
+//  Survey results kept in the world's save folder, so that tiles surveyed in an
+//  earlier session don't have to be visited with the cursor again. The file is
+//  only used when the world seed, dimensions, and inorganic raws match.
+
+namespace embark_assist {
+    namespace cache {
+        //  Reads the cache file of the current world, if there is a usable one.
+        void setup(uint16_t max_inorganic);
+
+        //  Replaces the high level results of every cached tile with its full survey results.
+        void restore(embark_assist::defs::world_tile_data *survey_results);
+
+        //  Records the results of a mid level survey of the tile.
+        void store(uint16_t x,
+            uint16_t y,
+            const embark_assist::defs::region_tile_datum *tile,
+            const embark_assist::defs::mid_level_tiles *mlt);
+
+        //  Retrieves the mid level tiles of a cached tile. mlt has to be initiated.
+        bool get(uint16_t x, uint16_t y, embark_assist::defs::mid_level_tiles *mlt);
+
+        //  Writes the cache file if anything was added, and releases the cache.
+        void shutdown();
+    }
+}
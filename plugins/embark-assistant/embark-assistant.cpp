@@ -19,6 +19,7 @@
 #include "df/world_geo_biome.h"
 #include "df/world_raws.h"
 
+#include "cache.h"
 #include "defs.h"
 #include "embark-assistant.h"
 #include "finder_ui.h"
@@ -117,6 +118,7 @@ namespace embark_assist {
         void shutdown() {
 //            color_ostream_proxy out(Core::getInstance().getConsole());
             embark_assist::survey::shutdown();
+            embark_assist::cache::shutdown();
             embark_assist::finder_ui::shutdown();
             embark_assist::overlay::shutdown();
             delete state;
@@ -239,6 +241,7 @@ command_result embark_assistant(color_ostream &out, std::vector <std::string> &
     }
 
     embark_assist::survey::setup(embark_assist::main::state->max_inorganic);
+    embark_assist::cache::setup(embark_assist::main::state->max_inorganic);
     embark_assist::main::state->geo_summary.resize(world_data->geo_biomes.size());
     embark_assist::main::state->survey_results.resize(world->worldgen.worldgen_parms.dim_x);
 
@@ -14,8 +14,10 @@
 #include "df/world_region.h"
 #include "df/world_region_type.h"
 
+#include "cache.h"
 #include "matcher.h"
 #include "survey.h"
+#include "world_index.h"
 
 using df::global::world;
 
@@ -438,889 +440,6 @@ namespace embark_assist {
 
         //=======================================================================================
 
-        bool world_tile_match(embark_assist::defs::world_tile_data *survey_results,
-            uint16_t x,
-            uint16_t y,
-            embark_assist::defs::finders *finder) {
-
-            color_ostream_proxy out(Core::getInstance().getConsole());
-            df::world_data *world_data = world->world_data;
-            embark_assist::defs::region_tile_datum *tile = &survey_results->at(x).at(y);
-            const uint16_t embark_size = finder->x_dim * finder->y_dim;
-            bool found;
-
-            if (tile->surveyed) {
-                //  Savagery
-                for (uint8_t i = 0; i < 3; i++)
-                {
-                    switch (finder->savagery[i]) {
-                    case embark_assist::defs::evil_savagery_values::NA:
-                        break;  //  No restriction
-
-                    case embark_assist::defs::evil_savagery_values::All:
-                        if (tile->savagery_count[i] < embark_size) return false;
-                        break;
-
-                    case embark_assist::defs::evil_savagery_values::Present:
-                        if (tile->savagery_count[i] == 0) return false;
-                        break;
-
-                    case embark_assist::defs::evil_savagery_values::Absent:
-                        if (tile->savagery_count[i] > 256 - embark_size) return false;
-                        break;
-                    }
-                }
-
-                // Evilness
-                for (uint8_t i = 0; i < 3; i++)
-                {
-                    switch (finder->evilness[i]) {
-                    case embark_assist::defs::evil_savagery_values::NA:
-                        break;  //  No restriction
-
-                    case embark_assist::defs::evil_savagery_values::All:
-                        if (tile->evilness_count[i] < embark_size) return false;
-                        break;
-
-                    case embark_assist::defs::evil_savagery_values::Present:
-                        if (tile->evilness_count[i] == 0) return false;
-                        break;
-
-                    case embark_assist::defs::evil_savagery_values::Absent:
-                        if (tile->evilness_count[i] > 256 - embark_size) return false;
-                        break;
-                    }
-                }
-
-                // Aquifer
-                switch (finder->aquifer) {
-                case embark_assist::defs::aquifer_ranges::NA:
-                    break;  //  No restriction
-
-                case embark_assist::defs::aquifer_ranges::All:
-                    if (tile->aquifer_count < 256 - embark_size) return false;
-                    break;
-
-                case embark_assist::defs::aquifer_ranges::Present:
-                    if (tile->aquifer_count == 0) return false;
-                    break;
-
-                case embark_assist::defs::aquifer_ranges::Partial:
-                    if (tile->aquifer_count == 0 ||
-                        tile->aquifer_count == 256) return false;
-                    break;
-
-                case embark_assist::defs::aquifer_ranges::Not_All:
-                    if (tile->aquifer_count == 256) return false;
-                    break;
-
-                case embark_assist::defs::aquifer_ranges::Absent:
-                    if (tile->aquifer_count > 256 - embark_size) return false;
-                    break;
-                }
-
-                // River size. Every tile has riverless tiles, so max rivers has to be checked on the detailed level.
-                switch (tile->river_size) {
-                case embark_assist::defs::river_sizes::None:
-                    if (finder->min_river > embark_assist::defs::river_ranges::None) return false;
-                    break;
-
-                case embark_assist::defs::river_sizes::Brook:
-                    if (finder->min_river > embark_assist::defs::river_ranges::Brook) return false;
-                    break;
-
-                case embark_assist::defs::river_sizes::Stream:
-                    if (finder->min_river > embark_assist::defs::river_ranges::Stream) return false;
-                    break;
-
-                case embark_assist::defs::river_sizes::Minor:
-                    if (finder->min_river > embark_assist::defs::river_ranges::Minor) return false;
-                    break;
-
-                case embark_assist::defs::river_sizes::Medium:
-                    if (finder->min_river > embark_assist::defs::river_ranges::Medium) return false;
-                    break;
-
-                case embark_assist::defs::river_sizes::Major:
-                    if (finder->max_river != embark_assist::defs::river_ranges::NA) return false;
-                    break;
-                }
-
-                //  Waterfall
-                switch (finder->waterfall) {
-                case embark_assist::defs::yes_no_ranges::NA:
-                    break;  //  No restriction
-
-                case embark_assist::defs::yes_no_ranges::Yes:
-                    if (!tile->waterfall) return false;
-                    break;
-
-                case embark_assist::defs::yes_no_ranges::No:
-                    if (tile->waterfall &&
-                        embark_size == 256) return false;
-                    break;
-                }
-
-                //  Flat. No world tile checks. Need to look at the details
-
-                //  Clay
-                switch (finder->clay) {
-                case embark_assist::defs::present_absent_ranges::NA:
-                    break;  //  No restriction
-
-                case embark_assist::defs::present_absent_ranges::Present:
-                    if (tile->clay_count == 0) return false;
-                    break;
-                case embark_assist::defs::present_absent_ranges::Absent:
-                    if (tile->clay_count > 256 - embark_size) return false;
-                    break;
-                }
-
-                //  Sand
-                switch (finder->sand) {
-                case embark_assist::defs::present_absent_ranges::NA:
-                    break;  //  No restriction
-
-                case embark_assist::defs::present_absent_ranges::Present:
-                    if (tile->sand_count == 0) return false;
-                    break;
-                case embark_assist::defs::present_absent_ranges::Absent:
-                    if (tile->sand_count > 256 - embark_size) return false;
-                    break;
-                }
-
-                //  Flux
-                switch (finder->flux) {
-                case embark_assist::defs::present_absent_ranges::NA:
-                    break;  //  No restriction
-
-                case embark_assist::defs::present_absent_ranges::Present:
-                    if (tile->flux_count == 0) return false;
-                    break;
-                case embark_assist::defs::present_absent_ranges::Absent:
-                    if (tile->flux_count > 256 - embark_size) return false;
-                    break;
-                }
-
-                //  Soil Min
-                switch (finder->soil_min) {
-                case embark_assist::defs::soil_ranges::NA:
-                case embark_assist::defs::soil_ranges::None:
-                    break;  //  No restriction
-
-                case embark_assist::defs::soil_ranges::Very_Shallow:
-                    if (tile->max_region_soil < 1) return false;
-                    break;
-
-                case embark_assist::defs::soil_ranges::Shallow:
-                    if (tile->max_region_soil < 2) return false;
-                    break;
-
-                case embark_assist::defs::soil_ranges::Deep:
-                    if (tile->max_region_soil < 3) return false;
-                    break;
-
-                case embark_assist::defs::soil_ranges::Very_Deep:
-                    if (tile->max_region_soil < 4) return false;
-                    break;
-                }
-
-                //  soil_min_everywhere only applies on the detailed level
-
-                //  Soil Max
-                switch (finder->soil_max) {
-                case embark_assist::defs::soil_ranges::NA:
-                case embark_assist::defs::soil_ranges::Very_Deep:
-                    break;  //  No restriction
-
-                case embark_assist::defs::soil_ranges::None:
-                    if (tile->min_region_soil > 0) return false;
-                    break;
-
-                case embark_assist::defs::soil_ranges::Very_Shallow:
-                    if (tile->min_region_soil > 1) return false;
-                    break;
-
-                case embark_assist::defs::soil_ranges::Shallow:
-                    if (tile->min_region_soil > 2) return false;
-                    break;
-
-                case embark_assist::defs::soil_ranges::Deep:
-                    if (tile->min_region_soil > 3) return false;
-                    break;
-                }
-
-                //  Freezing
-                if (finder->freezing != embark_assist::defs::freezing_ranges::NA)
-                {
-                    int16_t max_max_temperature = tile->max_temperature[5];
-                    int16_t min_max_temperature = tile->max_temperature[5];
-                    int16_t max_min_temperature = tile->min_temperature[5];
-                    int16_t min_min_temperature = tile->min_temperature[5];
-
-                    for (uint8_t i = 1; i < 10; i++) {
-                        if (tile->max_temperature[i] > max_max_temperature) {
-                            max_max_temperature = tile->max_temperature[i];
-                        }
-
-                        if (tile->max_temperature[i] != - 30000 &&
-                            tile->max_temperature[i] < min_max_temperature) {
-                            min_max_temperature = tile->max_temperature[i];
-                        }
-
-                        if (tile->min_temperature[i] != -30000 &&
-                            tile->min_temperature[i] < min_min_temperature) {
-                            min_min_temperature = tile->min_temperature[i];
-                        }
-
-                        if (tile->min_temperature[i] > max_min_temperature) {
-                            max_min_temperature = tile->min_temperature[i];
-                        }
-                    }
-
-                    switch (finder->freezing) {
-                    case embark_assist::defs::freezing_ranges::NA:
-                        break;  //  Excluded above, but the Travis complains if it's not here.
-
-                    case embark_assist::defs::freezing_ranges::Permanent:
-                        if (min_max_temperature > 0) return false;
-                        break;
-
-                    case embark_assist::defs::freezing_ranges::At_Least_Partial:
-                        if (min_min_temperature > 0) return false;
-                        break;
-
-                    case embark_assist::defs::freezing_ranges::Partial:
-                        if (min_min_temperature > 0 ||
-                            max_max_temperature <= 0) return false;
-                        break;
-
-                    case embark_assist::defs::freezing_ranges::At_Most_Partial:
-                        if (max_max_temperature <= 0) return false;
-                        break;
-
-                    case embark_assist::defs::freezing_ranges::Never:
-                        if (max_min_temperature <= 0) return false;
-                        break;
-                    }
-                }
-
-                //  Blood Rain
-                switch (finder->blood_rain) {
-                case embark_assist::defs::yes_no_ranges::NA:
-                    break;  //  No restriction
-
-                case embark_assist::defs::yes_no_ranges::Yes:
-                    if (!tile->blood_rain_possible) return false;
-                    break;
-
-                case embark_assist::defs::yes_no_ranges::No:
-                    if (tile->blood_rain_full) return false;
-                    break;
-                }
-
-                //  Syndrome Rain
-                switch (finder->syndrome_rain) {
-                case embark_assist::defs::syndrome_rain_ranges::NA:
-                    break;  //  No restriction
-
-                case embark_assist::defs::syndrome_rain_ranges::Any:
-                    if (!tile->permanent_syndrome_rain_possible && !tile->temporary_syndrome_rain_possible) return false;
-                    break;
-
-                case embark_assist::defs::syndrome_rain_ranges::Permanent:
-                    if (!tile->permanent_syndrome_rain_possible) return false;
-                    break;
-
-                case embark_assist::defs::syndrome_rain_ranges::Temporary:
-                    if (!tile->temporary_syndrome_rain_possible) return false;
-                    break;
-
-                case embark_assist::defs::syndrome_rain_ranges::Not_Permanent:
-                    if (tile->permanent_syndrome_rain_full) return false;
-                    break;
-
-                case embark_assist::defs::syndrome_rain_ranges::None:
-                    if (tile->permanent_syndrome_rain_full || tile->temporary_syndrome_rain_full) return false;
-                    break;
-                }
-
-                //  Reanimating
-                switch (finder->reanimation) {
-                case embark_assist::defs::reanimation_ranges::NA:
-                    break;  //  No restriction
-
-                case embark_assist::defs::reanimation_ranges::Both:
-                    if (!tile->reanimating_possible || !tile->thralling_possible) return false;
-                    break;
-
-                case embark_assist::defs::reanimation_ranges::Any:
-                    if (!tile->reanimating_possible && !tile->thralling_possible) return false;
-                    break;
-
-                case embark_assist::defs::reanimation_ranges::Thralling:
-                    if (!tile->thralling_possible) return false;
-                    break;
-
-                case embark_assist::defs::reanimation_ranges::Reanimation:
-                    if (!tile->reanimating_possible) return false;
-                    break;
-
-                case embark_assist::defs::reanimation_ranges::Not_Thralling:
-                    if (tile->thralling_full) return false;
-                    break;
-
-                case embark_assist::defs::reanimation_ranges::None:
-                    if (tile->reanimating_full || tile->thralling_full) return false;
-                    break;
-                }
-
-                //  Spire Count Min/Max
-                //  Magma Min/Max
-                //  Biome Count Min (Can't do anything with Max at this level)
-                if (finder->biome_count_min > tile->biome_count) return false;
-
-                //  Region Type 1
-                if (finder->region_type_1 != -1) {
-                    found = false;
-
-                    for (uint8_t k = 1; k < 10; k++) {
-                        if (tile->biome_index[k] != -1) {
-                            if (world_data->regions[tile->biome_index[k]]->type == finder->region_type_1) {
-                                found = true;
-                                break;
-                            }
-                        }
-
-                        if (found) break;
-                    }
-
-                    if (!found) return false;
-                }
-
-                //  Region Type 2
-                if (finder->region_type_2 != -1) {
-                    found = false;
-
-                    for (uint8_t k = 1; k < 10; k++) {
-                        if (tile->biome_index[k] != -1) {
-                            if (world_data->regions[tile->biome_index[k]]->type == finder->region_type_2) {
-                                found = true;
-                                break;
-                            }
-                        }
-
-                        if (found) break;
-                    }
-
-                    if (!found) return false;
-                }
-
-                //  Region Type 3
-                if (finder->region_type_3 != -1) {
-                    found = false;
-
-                    for (uint8_t k = 1; k < 10; k++) {
-                        if (tile->biome_index[k] != -1) {
-                            if (world_data->regions[tile->biome_index[k]]->type == finder->region_type_3) {
-                                found = true;
-                                break;
-                            }
-                        }
-
-                        if (found) break;
-                    }
-
-                    if (!found) return false;
-                }
-
-                //  Biome 1
-                if (finder->biome_1 != -1) {
-                    found = false;
-
-                    for (uint8_t i = 1; i < 10; i++) {
-                        if (tile->biome[i] == finder->biome_1) {
-                            found = true;
-                            break;
-                        }
-                    }
-
-                    if (!found) return false;
-                }
-
-                //  Biome 2
-                if (finder->biome_2 != -1) {
-                    found = false;
-
-                    for (uint8_t i = 1; i < 10; i++) {
-                        if (tile->biome[i] == finder->biome_2) {
-                            found = true;
-                            break;
-                        }
-                    }
-
-                    if (!found) return false;
-                }
-
-                //  Biome 3
-                if (finder->biome_3 != -1) {
-                    found = false;
-
-                    for (uint8_t i = 1; i < 10; i++) {
-                        if (tile->biome[i] == finder->biome_3) {
-                            found = true;
-                            break;
-                        }
-                    }
-
-                    if (!found) return false;
-                }
-
-                if (finder->metal_1 != -1 ||
-                    finder->metal_2 != -1 ||
-                    finder->metal_3 != -1 ||
-                    finder->economic_1 != -1 ||
-                    finder->economic_2 != -1 ||
-                    finder->economic_3 != -1 ||
-                    finder->mineral_1 != -1 ||
-                    finder->mineral_2 != -1 ||
-                    finder->mineral_3 != -1) {
-                    bool metal_1 = finder->metal_1 == -1;
-                    bool metal_2 = finder->metal_2 == -1;
-                    bool metal_3 = finder->metal_3 == -1;
-                    bool economic_1 = finder->economic_1 == -1;
-                    bool economic_2 = finder->economic_2 == -1;
-                    bool economic_3 = finder->economic_3 == -1;
-                    bool mineral_1 = finder->mineral_1 == -1;
-                    bool mineral_2 = finder->mineral_2 == -1;
-                    bool mineral_3 = finder->mineral_3 == -1;
-
-                    metal_1 = metal_1 || tile->metals[finder->metal_1];
-                    metal_2 = metal_2 || tile->metals[finder->metal_2];
-                    metal_3 = metal_3 || tile->metals[finder->metal_3];
-                    economic_1 = economic_1 || tile->economics[finder->economic_1];
-                    economic_2 = economic_2 || tile->economics[finder->economic_2];
-                    economic_3 = economic_3 || tile->economics[finder->economic_3];
-                    mineral_1 = mineral_1 || tile->minerals[finder->mineral_1];
-                    mineral_2 = mineral_2 || tile->minerals[finder->mineral_2];
-                    mineral_3 = mineral_3 || tile->minerals[finder->mineral_3];
-
-                    if (!metal_1 ||
-                        !metal_2 ||
-                        !metal_3 ||
-                        !economic_1 ||
-                        !economic_2 ||
-                        !economic_3 ||
-                        !mineral_1 ||
-                        !mineral_2 ||
-                        !mineral_3) return false;
-                }
-            }
-            else {  //  Not surveyed
-                    //  Savagery
-                for (uint8_t i = 0; i < 3; i++)
-                {
-                    switch (finder->savagery[i]) {
-                    case embark_assist::defs::evil_savagery_values::NA:
-                        break;  //  No restriction
-
-                    case embark_assist::defs::evil_savagery_values::All:
-                        if (tile->savagery_count[i] == 0) return false;
-                        break;
-
-                    case embark_assist::defs::evil_savagery_values::Present:
-                        if (tile->savagery_count[i] == 0) return false;
-                        break;
-
-                    case embark_assist::defs::evil_savagery_values::Absent:
-                        if (tile->savagery_count[i] == 256) return false;
-                        break;
-                    }
-                }
-
-                // Evilness
-                for (uint8_t i = 0; i < 3; i++)
-                {
-                    switch (finder->evilness[i]) {
-                    case embark_assist::defs::evil_savagery_values::NA:
-                        break;  //  No restriction
-
-                    case embark_assist::defs::evil_savagery_values::All:
-                        if (tile->evilness_count[i] == 0) return false;
-                        break;
-
-                    case embark_assist::defs::evil_savagery_values::Present:
-                        if (tile->evilness_count[i] == 0) return false;
-                        break;
-
-                    case embark_assist::defs::evil_savagery_values::Absent:
-                        if (tile->evilness_count[i] == 256) return false;
-                        break;
-                    }
-                }
-
-                // Aquifer
-                switch (finder->aquifer) {
-                case embark_assist::defs::aquifer_ranges::NA:
-                    break;  //  No restriction
-
-                case embark_assist::defs::aquifer_ranges::All:
-                    if (tile->aquifer_count == 0) return false;
-                    break;
-
-                case embark_assist::defs::aquifer_ranges::Present:
-                    if (tile->aquifer_count == 0) return false;
-                    break;
-
-                case embark_assist::defs::aquifer_ranges::Partial:
-                    if (tile->aquifer_count == 0 ||
-                        tile->aquifer_count == 256) return false;
-                    break;
-
-                case embark_assist::defs::aquifer_ranges::Not_All:
-                    if (tile->aquifer_count == 256) return false;
-                    break;
-
-                case embark_assist::defs::aquifer_ranges::Absent:
-                    if (tile->aquifer_count == 256) return false;
-                    break;
-                }
-
-                // River size
-                switch (tile->river_size) {
-                case embark_assist::defs::river_sizes::None:
-                    if (finder->min_river > embark_assist::defs::river_ranges::None) return false;
-                    break;
-
-                case embark_assist::defs::river_sizes::Brook:
-                    if (finder->min_river > embark_assist::defs::river_ranges::Brook) return false;
-                    break;
-
-                case embark_assist::defs::river_sizes::Stream:
-                    if (finder->min_river > embark_assist::defs::river_ranges::Stream) return false;
-                    break;
-
-                case embark_assist::defs::river_sizes::Minor:
-                    if (finder->min_river > embark_assist::defs::river_ranges::Minor) return false;
-                    break;
-
-                case embark_assist::defs::river_sizes::Medium:
-                    if (finder->min_river > embark_assist::defs::river_ranges::Medium) return false;
-                    break;
-
-                case embark_assist::defs::river_sizes::Major:
-                    if (finder->max_river != embark_assist::defs::river_ranges::NA) return false;
-                    break;
-                }
-
-                //  Waterfall
-                if (finder->waterfall == embark_assist::defs::yes_no_ranges::Yes &&
-                    tile->river_size == embark_assist::defs::river_sizes::None) return false;
-
-                //  Flat. No world tile checks. Need to look at the details
-
-                //  Clay
-                switch (finder->clay) {
-                case embark_assist::defs::present_absent_ranges::NA:
-                    break;  //  No restriction
-
-                case embark_assist::defs::present_absent_ranges::Present:
-                    if (tile->clay_count == 0) return false;
-                    break;
-                case embark_assist::defs::present_absent_ranges::Absent:
-                    if (tile->clay_count == 256) return false;
-                    break;
-                }
-
-                //  Sand
-                switch (finder->sand) {
-                case embark_assist::defs::present_absent_ranges::NA:
-                    break;  //  No restriction
-
-                case embark_assist::defs::present_absent_ranges::Present:
-                    if (tile->sand_count == 0) return false;
-                    break;
-                case embark_assist::defs::present_absent_ranges::Absent:
-                    if (tile->sand_count == 256) return false;
-                    break;
-                }
-
-                //  Flux
-                switch (finder->flux) {
-                case embark_assist::defs::present_absent_ranges::NA:
-                    break;  //  No restriction
-
-                case embark_assist::defs::present_absent_ranges::Present:
-                    if (tile->flux_count == 0) return false;
-                    break;
-                case embark_assist::defs::present_absent_ranges::Absent:
-                    if (tile->flux_count == 256) return false;
-                    break;
-                }
-
-                //  Soil Min
-                switch (finder->soil_min) {
-                case embark_assist::defs::soil_ranges::NA:
-                case embark_assist::defs::soil_ranges::None:
-                    break;  //  No restriction
-
-                case embark_assist::defs::soil_ranges::Very_Shallow:
-                    if (tile->max_region_soil < 1) return false;
-                    break;
-
-                case embark_assist::defs::soil_ranges::Shallow:
-                    if (tile->max_region_soil < 2) return false;
-                    break;
-
-                case embark_assist::defs::soil_ranges::Deep:
-                    if (tile->max_region_soil < 3) return false;
-                    break;
-
-                case embark_assist::defs::soil_ranges::Very_Deep:
-                    if (tile->max_region_soil < 4) return false;
-                    break;
-                }
-
-                //  soil_min_everywhere only applies on the detailed level
-
-                //  Soil Max
-                //  Can't say anything as the preliminary data isn't reliable
-
-                //  Blood Rain
-                switch (finder->blood_rain) {
-                case embark_assist::defs::yes_no_ranges::NA:
-                    break;  //  No restriction
-
-                case embark_assist::defs::yes_no_ranges::Yes:
-                    if (!tile->blood_rain_possible) return false;
-                    break;
-
-                case embark_assist::defs::yes_no_ranges::No:
-                    if (tile->blood_rain_full) return false;
-                    break;
-                }
-
-                //  Syndrome Rain
-                switch (finder->syndrome_rain) {
-                case embark_assist::defs::syndrome_rain_ranges::NA:
-                    break;  //  No restriction
-
-                case embark_assist::defs::syndrome_rain_ranges::Any:
-                    if (!tile->permanent_syndrome_rain_possible && !tile->temporary_syndrome_rain_possible) return false;
-                    break;
-
-                case embark_assist::defs::syndrome_rain_ranges::Permanent:
-                    if (!tile->permanent_syndrome_rain_possible) return false;
-                    break;
-
-                case embark_assist::defs::syndrome_rain_ranges::Temporary:
-                    if (!tile->temporary_syndrome_rain_possible) return false;
-                    break;
-
-                case embark_assist::defs::syndrome_rain_ranges::Not_Permanent:
-                    if (tile->permanent_syndrome_rain_full) return false;
-                    break;
-
-                case embark_assist::defs::syndrome_rain_ranges::None:
-                    if (tile->permanent_syndrome_rain_full || tile->temporary_syndrome_rain_full) return false;
-                    break;
-                }
-
-                //  Reanimating
-                switch (finder->reanimation) {
-                case embark_assist::defs::reanimation_ranges::NA:
-                    break;  //  No restriction
-
-                case embark_assist::defs::reanimation_ranges::Both:
-                    if (!tile->reanimating_possible || !tile->thralling_possible) return false;
-                    break;
-
-                case embark_assist::defs::reanimation_ranges::Any:
-                    if (!tile->reanimating_possible && !tile->thralling_possible) return false;
-                    break;
-
-                case embark_assist::defs::reanimation_ranges::Thralling:
-                    if (!tile->thralling_possible) return false;
-                    break;
-
-                case embark_assist::defs::reanimation_ranges::Reanimation:
-                    if (!tile->reanimating_possible) return false;
-                    break;
-
-                case embark_assist::defs::reanimation_ranges::Not_Thralling:
-                    if (tile->thralling_full) return false;
-                    break;
-
-                case embark_assist::defs::reanimation_ranges::None:
-                    if (tile->reanimating_full || tile->thralling_full) return false;
-                    break;
-                }
-
-                //  Spire Count Min/Max
-                //  Magma Min/Max
-                //  Biome Count Min (Can't do anything with Max at this level)
-                if (finder->biome_count_min > tile->biome_count) return false;
-
-                //  Region Type 1
-                if (finder->region_type_1 != -1) {
-                    found = false;
-
-                    for (uint8_t k = 1; k < 10; k++) {
-                        if (tile->biome_index[k] != -1) {
-                            if (world_data->regions[tile->biome_index[k]]->type == finder->region_type_1) {
-                                found = true;
-                                break;
-                            }
-                        }
-
-                        if (found) break;
-                    }
-
-                    if (!found) return false;
-                }
-
-                //  Region Type 2
-                if (finder->region_type_2 != -1) {
-                    found = false;
-
-                    for (uint8_t k = 1; k < 10; k++) {
-                        if (tile->biome_index[k] != -1) {
-                            if (world_data->regions[tile->biome_index[k]]->type == finder->region_type_2) {
-                                found = true;
-                                break;
-                            }
-                        }
-
-                        if (found) break;
-                    }
-
-                    if (!found) return false;
-                }
-
-                //  Region Type 3
-                if (finder->region_type_3 != -1) {
-                    found = false;
-
-                    for (uint8_t k = 1; k < 10; k++) {
-                        if (tile->biome_index[k] != -1) {
-                            if (world_data->regions[tile->biome_index[k]]->type == finder->region_type_3) {
-                                found = true;
-                                break;
-                            }
-                        }
-
-                        if (found) break;
-                    }
-
-                    if (!found) return false;
-                }
-
-                //  Biome 1
-                if (finder->biome_1 != -1) {
-                    found = false;
-
-                    for (uint8_t i = 1; i < 10; i++) {
-                        if (tile->biome[i] == finder->biome_1) {
-                            found = true;
-                            break;
-                        }
-                    }
-
-                    if (!found) return false;
-                }
-
-                //  Biome 2
-                if (finder->biome_2 != -1) {
-                    found = false;
-
-                    for (uint8_t i = 1; i < 10; i++) {
-                        if (tile->biome[i] == finder->biome_2) {
-                            found = true;
-                            break;
-                        }
-                    }
-
-                    if (!found) return false;
-                }
-
-                //  Biome 3
-                if (finder->biome_3 != -1) {
-                    found = false;
-
-                    for (uint8_t i = 1; i < 10; i++) {
-                        if (tile->biome[i] == finder->biome_3) {
-                            found = true;
-                            break;
-                        }
-                    }
-
-                    if (!found) return false;
-                }
-
-                if (finder->metal_1 != -1 ||
-                    finder->metal_2 != -1 ||
-                    finder->metal_3 != -1 ||
-                    finder->economic_1 != -1 ||
-                    finder->economic_2 != -1 ||
-                    finder->economic_3 != -1 ||
-                    finder->mineral_1 != -1 ||
-                    finder->mineral_2 != -1 ||
-                    finder->mineral_3 != -1) {
-                    bool metal_1 = finder->metal_1 == -1;
-                    bool metal_2 = finder->metal_2 == -1;
-                    bool metal_3 = finder->metal_3 == -1;
-                    bool economic_1 = finder->economic_1 == -1;
-                    bool economic_2 = finder->economic_2 == -1;
-                    bool economic_3 = finder->economic_3 == -1;
-                    bool mineral_1 = finder->mineral_1 == -1;
-                    bool mineral_2 = finder->mineral_2 == -1;
-                    bool mineral_3 = finder->mineral_3 == -1;
-
-                    metal_1 = metal_1 || tile->metals[finder->metal_1];
-                    metal_2 = metal_2 || tile->metals[finder->metal_2];
-                    metal_3 = metal_3 || tile->metals[finder->metal_3];
-                    economic_1 = economic_1 || tile->economics[finder->economic_1];
-                    economic_2 = economic_2 || tile->economics[finder->economic_2];
-                    economic_3 = economic_3 || tile->economics[finder->economic_3];
-                    mineral_1 = mineral_1 || tile->minerals[finder->mineral_1];
-                    mineral_2 = mineral_2 || tile->minerals[finder->mineral_2];
-                    mineral_3 = mineral_3 || tile->minerals[finder->mineral_3];
-
-                    if (!metal_1 ||
-                        !metal_2 ||
-                        !metal_3 ||
-                        !economic_1 ||
-                        !economic_2 ||
-                        !economic_3 ||
-                        !mineral_1 ||
-                        !mineral_2 ||
-                        !mineral_3) return false;
-                }
-            }
-            return true;
-        }
-
-        //=======================================================================================
-
-        uint32_t preliminary_world_match(embark_assist::defs::world_tile_data *survey_results,
-            embark_assist::defs::finders *finder,
-            embark_assist::defs::match_results *match_results) {
-            //            color_ostream_proxy out(Core::getInstance().getConsole());
-            uint32_t count = 0;
-            for (uint16_t i = 0; i < world->worldgen.worldgen_parms.dim_x; i++) {
-                for (uint16_t k = 0; k < world->worldgen.worldgen_parms.dim_y; k++) {
-                    match_results->at(i).at(k).preliminary_match =
-                        world_tile_match(survey_results, i, k, finder);
-                    if (match_results->at(i).at(k).preliminary_match) count++;
-                    match_results->at(i).at(k).contains_match = false;
-                }
-            }
-
-            return count;
-        }
-
-        //=======================================================================================
-
         void match_world_tile(embark_assist::defs::geo_data *geo_summary,
             embark_assist::defs::world_tile_data *survey_results,
             embark_assist::defs::finders *finder,
@@ -1342,6 +461,40 @@ namespace embark_assist {
                 finder,
                 match_results);
         }
+
+        //=======================================================================================
+
+        //  Matches the preliminarily matching tiles that have cached survey results, which don't
+        //  have to be visited with the cursor. Returns the number of tiles containing matches.
+        uint16_t match_cached_tiles(embark_assist::defs::world_tile_data *survey_results,
+            embark_assist::defs::finders *finder,
+            embark_assist::defs::match_results *match_results,
+            uint32_t *cached) {
+
+            embark_assist::defs::mid_level_tiles mlt;
+            uint16_t count = 0;
+
+            embark_assist::survey::initiate(&mlt);
+
+            for (uint16_t i = 0; i < world->worldgen.worldgen_parms.dim_x; i++) {
+                for (uint16_t k = 0; k < world->worldgen.worldgen_parms.dim_y; k++) {
+                    if (match_results->at(i).at(k).preliminary_match &&
+                        embark_assist::cache::get(i, k, &mlt)) {
+                        mid_level_tile_match(survey_results,
+                            &mlt,
+                            i,
+                            k,
+                            finder,
+                            match_results);
+
+                        (*cached)++;
+                        if (match_results->at(i).at(k).contains_match) count++;
+                    }
+                }
+            }
+
+            return count;
+        }
     }
 }
 
@@ -1515,7 +668,7 @@ uint16_t embark_assist::matcher::find(embark_assist::defs::match_iterators *iter
             return 0;
         }
 
-        preliminary_matches = preliminary_world_match(survey_results, &iterator->finder, match_results);
+        preliminary_matches = embark_assist::world_index::preliminary_match(&iterator->finder, match_results);
 
         if (preliminary_matches == 0) {
             out.printerr("matcher::find: Preliminarily matching world tiles: %i\n", preliminary_matches);
@@ -1525,6 +678,18 @@ uint16_t embark_assist::matcher::find(embark_assist::defs::match_iterators *iter
             out.print("matcher::find: Preliminarily matching world tiles: %i\n", preliminary_matches);
         }
 
+        uint32_t cached = 0;
+        uint16_t cached_count = match_cached_tiles(survey_results, &iterator->finder, match_results, &cached);
+
+        if (cached > 0) {
+            out.print("matcher::find: World tiles matched from the survey cache: %i\n", cached);
+        }
+
+        if (cached == preliminary_matches) {
+            iterator->active = false;
+            return cached_count;
+        }
+
         while (screen->location.region_pos.x != 0 || screen->location.region_pos.y != 0) {
             screen->feed_key(df::interface_key::CURSOR_UPLEFT_FAST);
         }
@@ -1535,7 +700,7 @@ uint16_t embark_assist::matcher::find(embark_assist::defs::match_iterators *iter
         iterator->y_down = true;
         iterator->inhibit_x_turn = false;
         iterator->inhibit_y_turn = false;
-        iterator->count = 0;
+        iterator->count = cached_count;
     }
 
     if ((iterator->k == world->worldgen.worldgen_parms.dim_x / 16 && iterator->x_right) ||
@@ -1567,7 +732,7 @@ uint16_t embark_assist::matcher::find(embark_assist::defs::match_iterators *iter
                     iterator->count++;
                 }
             }
-            else {
+            else if (!match_results->at(screen->location.region_pos.x).at(screen->location.region_pos.y).contains_match) {
                 for (uint16_t n = 0; n < 16; n++) {
                     for (uint16_t p = 0; p < 16; p++) {
                         match_results->at(screen->location.region_pos.x).at(screen->location.region_pos.y).mlt_match[n][p] = false;
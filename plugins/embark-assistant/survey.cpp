@@ -52,8 +52,10 @@
 #include "df/world_underground_region.h"
 
 #include "biome_type.h"
+#include "cache.h"
 #include "defs.h"
 #include "survey.h"
+#include "world_index.h"
 
 using namespace DFHack;
 using namespace df::enums;
@@ -623,6 +625,8 @@ void embark_assist::survey::high_level_world_survey(embark_assist::defs::geo_dat
 
     embark_assist::survey::survey_rivers(survey_results);
     embark_assist::survey::survey_evil_weather(survey_results);
+    embark_assist::cache::restore(survey_results);
+    embark_assist::world_index::build(survey_results);
 }
 
 //=================================================================================
@@ -993,6 +997,8 @@ void embark_assist::survey::survey_mid_level_tile(embark_assist::defs::geo_data
 
     tile->biome_count = count;
     tile->surveyed = true;
+    embark_assist::world_index::update_tile(x, y);
+    embark_assist::cache::store(x, y, tile, mlt);
 }
 //=================================================================================
 
@@ -1247,6 +1253,7 @@ void embark_assist::survey::survey_embark(embark_assist::defs::mid_level_tiles *
 //=================================================================================
 
 void embark_assist::survey::shutdown() {
+    embark_assist::world_index::shutdown();
     delete state;
 }
 
@@ -0,0 +1,665 @@
+#include <algorithm>
+#include <bitset>
+#include <climits>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "DataDefs.h"
+#include "df/biome_type.h"
+#include "df/world.h"
+#include "df/world_data.h"
+#include "df/world_region.h"
+#include "df/world_region_type.h"
+
+#include "defs.h"
+#include "world_index.h"
+
+using namespace DFHack;
+using namespace df::enums;
+
+using df::global::world;
+
+namespace embark_assist {
+    namespace world_index {
+        typedef std::vector<uint64_t> tile_sets;  //  One bit per world tile
+
+        enum columns {
+            savagery_low,
+            savagery_medium,
+            savagery_high,
+            evilness_low,
+            evilness_medium,
+            evilness_high,
+            aquifer_count,
+            clay_count,
+            sand_count,
+            flux_count,
+            river_size,
+            min_region_soil,
+            max_region_soil,
+            biome_count,
+            max_max_temperature,
+            min_max_temperature,
+            max_min_temperature,
+            min_min_temperature,
+            column_count
+        };
+
+        enum sets {
+            surveyed,
+            waterfall,
+            blood_rain_possible,
+            blood_rain_full,
+            permanent_syndrome_rain_possible,
+            permanent_syndrome_rain_full,
+            temporary_syndrome_rain_possible,
+            temporary_syndrome_rain_full,
+            reanimating_possible,
+            reanimating_full,
+            thralling_possible,
+            thralling_full,
+            empty,  //  Never has any bits set. Used for criteria no tile can match.
+            set_count
+        };
+
+        typedef std::vector<bool> embark_assist::defs::region_tile_datum::*inorganic_fields;
+
+        struct states {
+            embark_assist::defs::world_tile_data *survey_results;
+            uint16_t dim_y;
+            uint32_t tiles;
+            uint32_t words;
+            std::vector<int16_t> column[column_count];
+            tile_sets set[set_count];
+            std::vector<tile_sets> region_types;  //  Indexed by df::world_region_type
+            std::vector<tile_sets> biomes;        //  Indexed by df::biome_type
+            //  Per inorganic sets are only built once a search asks for them, as
+            //  there are far too many inorganics to keep one for each of them.
+            std::map<int16_t, tile_sets> metals;
+            std::map<int16_t, tile_sets> economics;
+            std::map<int16_t, tile_sets> minerals;
+        };
+
+        static states *state = nullptr;
+
+        //  Index 0 holds the bounds for unsurveyed tiles, index 1 those for surveyed ones.
+        struct range_passes {
+            const std::vector<int16_t> *column;
+            int16_t min[2];
+            int16_t max[2];
+        };
+
+        //  Requires (first | second) to be set (or clear) for tiles in the applicable survey states.
+        struct bit_passes {
+            const tile_sets *first;
+            const tile_sets *second;
+            bool set;
+            bool applies[2];
+        };
+
+        struct queries {
+            std::vector<range_passes> ranges;
+            std::vector<bit_passes> bits;
+        };
+
+        //=======================================================================================
+
+        void set_bit(tile_sets &tile_set, uint32_t index, bool value) {
+            if (value) {
+                tile_set[index / 64] |= uint64_t(1) << (index % 64);
+            }
+            else {
+                tile_set[index / 64] &= ~(uint64_t(1) << (index % 64));
+            }
+        }
+
+        //=======================================================================================
+
+        void index_tile(uint16_t x, uint16_t y) {
+            df::world_data *world_data = world->world_data;
+            const embark_assist::defs::region_tile_datum &tile = state->survey_results->at(x).at(y);
+            const uint32_t index = x * state->dim_y + y;
+
+            for (uint8_t i = 0; i < 3; i++) {
+                state->column[savagery_low + i][index] = tile.savagery_count[i];
+                state->column[evilness_low + i][index] = tile.evilness_count[i];
+            }
+
+            state->column[aquifer_count][index] = tile.aquifer_count;
+            state->column[clay_count][index] = tile.clay_count;
+            state->column[sand_count][index] = tile.sand_count;
+            state->column[flux_count][index] = tile.flux_count;
+            state->column[river_size][index] = static_cast<int16_t>(tile.river_size);
+            state->column[min_region_soil][index] = tile.min_region_soil;
+            state->column[max_region_soil][index] = tile.max_region_soil;
+            state->column[biome_count][index] = tile.biome_count;
+
+            int16_t max_max = tile.max_temperature[5];
+            int16_t min_max = tile.max_temperature[5];
+            int16_t max_min = tile.min_temperature[5];
+            int16_t min_min = tile.min_temperature[5];
+
+            for (uint8_t i = 1; i < 10; i++) {
+                if (tile.max_temperature[i] > max_max) max_max = tile.max_temperature[i];
+                if (tile.max_temperature[i] != -30000 && tile.max_temperature[i] < min_max) min_max = tile.max_temperature[i];
+                if (tile.min_temperature[i] != -30000 && tile.min_temperature[i] < min_min) min_min = tile.min_temperature[i];
+                if (tile.min_temperature[i] > max_min) max_min = tile.min_temperature[i];
+            }
+
+            state->column[max_max_temperature][index] = max_max;
+            state->column[min_max_temperature][index] = min_max;
+            state->column[max_min_temperature][index] = max_min;
+            state->column[min_min_temperature][index] = min_min;
+
+            set_bit(state->set[surveyed], index, tile.surveyed);
+            set_bit(state->set[waterfall], index, tile.waterfall);
+            set_bit(state->set[blood_rain_possible], index, tile.blood_rain_possible);
+            set_bit(state->set[blood_rain_full], index, tile.blood_rain_full);
+            set_bit(state->set[permanent_syndrome_rain_possible], index, tile.permanent_syndrome_rain_possible);
+            set_bit(state->set[permanent_syndrome_rain_full], index, tile.permanent_syndrome_rain_full);
+            set_bit(state->set[temporary_syndrome_rain_possible], index, tile.temporary_syndrome_rain_possible);
+            set_bit(state->set[temporary_syndrome_rain_full], index, tile.temporary_syndrome_rain_full);
+            set_bit(state->set[reanimating_possible], index, tile.reanimating_possible);
+            set_bit(state->set[reanimating_full], index, tile.reanimating_full);
+            set_bit(state->set[thralling_possible], index, tile.thralling_possible);
+            set_bit(state->set[thralling_full], index, tile.thralling_full);
+
+            for (size_t i = 0; i < state->region_types.size(); i++) {
+                set_bit(state->region_types[i], index, false);
+            }
+
+            for (size_t i = 0; i < state->biomes.size(); i++) {
+                set_bit(state->biomes[i], index, false);
+            }
+
+            for (uint8_t i = 1; i < 10; i++) {
+                if (tile.biome_index[i] != -1) {
+                    size_t region_type = world_data->regions[tile.biome_index[i]]->type;
+                    if (region_type < state->region_types.size()) {
+                        set_bit(state->region_types[region_type], index, true);
+                    }
+                }
+
+                if (tile.biome[i] >= 0 && size_t(tile.biome[i]) < state->biomes.size()) {
+                    set_bit(state->biomes[tile.biome[i]], index, true);
+                }
+            }
+
+            for (auto &entry : state->metals) {
+                set_bit(entry.second, index, tile.metals[entry.first]);
+            }
+
+            for (auto &entry : state->economics) {
+                set_bit(entry.second, index, tile.economics[entry.first]);
+            }
+
+            for (auto &entry : state->minerals) {
+                set_bit(entry.second, index, tile.minerals[entry.first]);
+            }
+        }
+
+        //=======================================================================================
+
+        const tile_sets *inorganic_set(std::map<int16_t, tile_sets> &cache,
+            inorganic_fields field,
+            int16_t inorganic) {
+
+            auto found = cache.find(inorganic);
+            if (found != cache.end()) return &found->second;
+
+            if (inorganic < 0 ||
+                size_t(inorganic) >= (state->survey_results->at(0).at(0).*field).size()) {
+                return &state->set[empty];
+            }
+
+            tile_sets &result = cache[inorganic];
+            result.resize(state->words);
+
+            for (uint32_t i = 0; i < state->tiles; i++) {
+                const embark_assist::defs::region_tile_datum &tile =
+                    state->survey_results->at(i / state->dim_y).at(i % state->dim_y);
+                if ((tile.*field)[inorganic]) set_bit(result, i, true);
+            }
+
+            return &result;
+        }
+
+        //=======================================================================================
+
+        const tile_sets *indexed_set(std::vector<tile_sets> &sets, int16_t value) {
+            if (value < 0 || size_t(value) >= sets.size()) return &state->set[empty];
+            return &sets[value];
+        }
+
+        //=======================================================================================
+
+        void add_range(queries *query,
+            columns column,
+            int surveyed_min,
+            int surveyed_max,
+            int unsurveyed_min,
+            int unsurveyed_max) {
+
+            range_passes pass;
+            pass.column = &state->column[column];
+            pass.min[0] = int16_t(std::max(unsurveyed_min, SHRT_MIN));
+            pass.max[0] = int16_t(std::min(unsurveyed_max, SHRT_MAX));
+            pass.min[1] = int16_t(std::max(surveyed_min, SHRT_MIN));
+            pass.max[1] = int16_t(std::min(surveyed_max, SHRT_MAX));
+            query->ranges.push_back(pass);
+        }
+
+        //=======================================================================================
+
+        void add_bits(queries *query,
+            const tile_sets *first,
+            const tile_sets *second,
+            bool set,
+            bool surveyed_only) {
+
+            bit_passes pass;
+            pass.first = first;
+            pass.second = second;
+            pass.set = set;
+            pass.applies[0] = !surveyed_only;
+            pass.applies[1] = true;
+            query->bits.push_back(pass);
+        }
+
+        //=======================================================================================
+
+        //  Translates the world tile level criteria into passes. The bounds mirror the checks
+        //  formerly made tile by tile: surveyed tiles are held to the embark size while
+        //  unsurveyed tiles only fail when no part of them can match.
+        void compile(embark_assist::defs::finders *finder, queries *query) {
+            const int embark_size = finder->x_dim * finder->y_dim;
+
+            for (uint8_t i = 0; i < 3; i++) {
+                switch (finder->savagery[i]) {
+                case embark_assist::defs::evil_savagery_values::NA:
+                    break;  //  No restriction
+
+                case embark_assist::defs::evil_savagery_values::All:
+                    add_range(query, columns(savagery_low + i), embark_size, INT_MAX, 1, INT_MAX);
+                    break;
+
+                case embark_assist::defs::evil_savagery_values::Present:
+                    add_range(query, columns(savagery_low + i), 1, INT_MAX, 1, INT_MAX);
+                    break;
+
+                case embark_assist::defs::evil_savagery_values::Absent:
+                    add_range(query, columns(savagery_low + i), INT_MIN, 256 - embark_size, INT_MIN, 255);
+                    break;
+                }
+
+                switch (finder->evilness[i]) {
+                case embark_assist::defs::evil_savagery_values::NA:
+                    break;  //  No restriction
+
+                case embark_assist::defs::evil_savagery_values::All:
+                    add_range(query, columns(evilness_low + i), embark_size, INT_MAX, 1, INT_MAX);
+                    break;
+
+                case embark_assist::defs::evil_savagery_values::Present:
+                    add_range(query, columns(evilness_low + i), 1, INT_MAX, 1, INT_MAX);
+                    break;
+
+                case embark_assist::defs::evil_savagery_values::Absent:
+                    add_range(query, columns(evilness_low + i), INT_MIN, 256 - embark_size, INT_MIN, 255);
+                    break;
+                }
+            }
+
+            switch (finder->aquifer) {
+            case embark_assist::defs::aquifer_ranges::NA:
+                break;  //  No restriction
+
+            case embark_assist::defs::aquifer_ranges::All:
+                add_range(query, aquifer_count, 256 - embark_size, INT_MAX, 1, INT_MAX);
+                break;
+
+            case embark_assist::defs::aquifer_ranges::Present:
+                add_range(query, aquifer_count, 1, INT_MAX, 1, INT_MAX);
+                break;
+
+            case embark_assist::defs::aquifer_ranges::Partial:
+                add_range(query, aquifer_count, 1, 255, 1, 255);
+                break;
+
+            case embark_assist::defs::aquifer_ranges::Not_All:
+                add_range(query, aquifer_count, INT_MIN, 255, INT_MIN, 255);
+                break;
+
+            case embark_assist::defs::aquifer_ranges::Absent:
+                add_range(query, aquifer_count, INT_MIN, 256 - embark_size, INT_MIN, 255);
+                break;
+            }
+
+            //  River size. A tile's own river has to be at least min_river, and only
+            //  a major river rules a tile out when there's a max river.
+            if (finder->min_river > embark_assist::defs::river_ranges::None ||
+                finder->max_river != embark_assist::defs::river_ranges::NA) {
+                int min = static_cast<int>(finder->min_river);
+                int max = finder->max_river != embark_assist::defs::river_ranges::NA ?
+                    static_cast<int>(embark_assist::defs::river_sizes::Medium) : INT_MAX;
+                add_range(query, river_size, min, max, min, max);
+            }
+
+            switch (finder->waterfall) {
+            case embark_assist::defs::yes_no_ranges::NA:
+                break;  //  No restriction
+
+            case embark_assist::defs::yes_no_ranges::Yes:
+                add_bits(query, &state->set[waterfall], nullptr, true, true);
+                add_range(query, river_size, INT_MIN, INT_MAX, static_cast<int>(embark_assist::defs::river_sizes::Brook), INT_MAX);
+                break;
+
+            case embark_assist::defs::yes_no_ranges::No:
+                if (embark_size == 256) add_bits(query, &state->set[waterfall], nullptr, false, true);
+                break;
+            }
+
+            //  Flat. No world tile checks. Need to look at the details
+
+            const embark_assist::defs::present_absent_ranges present_absent[3] = { finder->clay, finder->sand, finder->flux };
+            const columns present_absent_columns[3] = { clay_count, sand_count, flux_count };
+
+            for (uint8_t i = 0; i < 3; i++) {
+                switch (present_absent[i]) {
+                case embark_assist::defs::present_absent_ranges::NA:
+                    break;  //  No restriction
+
+                case embark_assist::defs::present_absent_ranges::Present:
+                    add_range(query, present_absent_columns[i], 1, INT_MAX, 1, INT_MAX);
+                    break;
+
+                case embark_assist::defs::present_absent_ranges::Absent:
+                    add_range(query, present_absent_columns[i], INT_MIN, 256 - embark_size, INT_MIN, 255);
+                    break;
+                }
+            }
+
+            //  Soil Min. soil_min_everywhere only applies on the detailed level
+            if (finder->soil_min > embark_assist::defs::soil_ranges::None) {
+                int min = static_cast<int>(finder->soil_min);
+                add_range(query, max_region_soil, min, INT_MAX, min, INT_MAX);
+            }
+
+            //  Soil Max. The preliminary data isn't reliable for unsurveyed tiles
+            if (finder->soil_max != embark_assist::defs::soil_ranges::NA &&
+                finder->soil_max != embark_assist::defs::soil_ranges::Very_Deep) {
+                add_range(query, min_region_soil, INT_MIN, static_cast<int>(finder->soil_max), INT_MIN, INT_MAX);
+            }
+
+            //  Freezing. Only known for surveyed tiles
+            switch (finder->freezing) {
+            case embark_assist::defs::freezing_ranges::NA:
+                break;  //  No restriction
+
+            case embark_assist::defs::freezing_ranges::Permanent:
+                add_range(query, min_max_temperature, INT_MIN, 0, INT_MIN, INT_MAX);
+                break;
+
+            case embark_assist::defs::freezing_ranges::At_Least_Partial:
+                add_range(query, min_min_temperature, INT_MIN, 0, INT_MIN, INT_MAX);
+                break;
+
+            case embark_assist::defs::freezing_ranges::Partial:
+                add_range(query, min_min_temperature, INT_MIN, 0, INT_MIN, INT_MAX);
+                add_range(query, max_max_temperature, 1, INT_MAX, INT_MIN, INT_MAX);
+                break;
+
+            case embark_assist::defs::freezing_ranges::At_Most_Partial:
+                add_range(query, max_max_temperature, 1, INT_MAX, INT_MIN, INT_MAX);
+                break;
+
+            case embark_assist::defs::freezing_ranges::Never:
+                add_range(query, max_min_temperature, 1, INT_MAX, INT_MIN, INT_MAX);
+                break;
+            }
+
+            switch (finder->blood_rain) {
+            case embark_assist::defs::yes_no_ranges::NA:
+                break;  //  No restriction
+
+            case embark_assist::defs::yes_no_ranges::Yes:
+                add_bits(query, &state->set[blood_rain_possible], nullptr, true, false);
+                break;
+
+            case embark_assist::defs::yes_no_ranges::No:
+                add_bits(query, &state->set[blood_rain_full], nullptr, false, false);
+                break;
+            }
+
+            switch (finder->syndrome_rain) {
+            case embark_assist::defs::syndrome_rain_ranges::NA:
+                break;  //  No restriction
+
+            case embark_assist::defs::syndrome_rain_ranges::Any:
+                add_bits(query, &state->set[permanent_syndrome_rain_possible], &state->set[temporary_syndrome_rain_possible], true, false);
+                break;
+
+            case embark_assist::defs::syndrome_rain_ranges::Permanent:
+                add_bits(query, &state->set[permanent_syndrome_rain_possible], nullptr, true, false);
+                break;
+
+            case embark_assist::defs::syndrome_rain_ranges::Temporary:
+                add_bits(query, &state->set[temporary_syndrome_rain_possible], nullptr, true, false);
+                break;
+
+            case embark_assist::defs::syndrome_rain_ranges::Not_Permanent:
+                add_bits(query, &state->set[permanent_syndrome_rain_full], nullptr, false, false);
+                break;
+
+            case embark_assist::defs::syndrome_rain_ranges::None:
+                add_bits(query, &state->set[permanent_syndrome_rain_full], &state->set[temporary_syndrome_rain_full], false, false);
+                break;
+            }
+
+            switch (finder->reanimation) {
+            case embark_assist::defs::reanimation_ranges::NA:
+                break;  //  No restriction
+
+            case embark_assist::defs::reanimation_ranges::Both:
+                add_bits(query, &state->set[reanimating_possible], nullptr, true, false);
+                add_bits(query, &state->set[thralling_possible], nullptr, true, false);
+                break;
+
+            case embark_assist::defs::reanimation_ranges::Any:
+                add_bits(query, &state->set[reanimating_possible], &state->set[thralling_possible], true, false);
+                break;
+
+            case embark_assist::defs::reanimation_ranges::Thralling:
+                add_bits(query, &state->set[thralling_possible], nullptr, true, false);
+                break;
+
+            case embark_assist::defs::reanimation_ranges::Reanimation:
+                add_bits(query, &state->set[reanimating_possible], nullptr, true, false);
+                break;
+
+            case embark_assist::defs::reanimation_ranges::Not_Thralling:
+                add_bits(query, &state->set[thralling_full], nullptr, false, false);
+                break;
+
+            case embark_assist::defs::reanimation_ranges::None:
+                add_bits(query, &state->set[reanimating_full], &state->set[thralling_full], false, false);
+                break;
+            }
+
+            //  Spire Count Min/Max
+            //  Magma Min/Max
+            //  Biome Count Min (Can't do anything with Max at this level)
+            if (finder->biome_count_min != -1) {
+                add_range(query, biome_count, finder->biome_count_min, INT_MAX, finder->biome_count_min, INT_MAX);
+            }
+
+            const int8_t region_types[3] = { finder->region_type_1, finder->region_type_2, finder->region_type_3 };
+            const int8_t biomes[3] = { finder->biome_1, finder->biome_2, finder->biome_3 };
+            const int16_t metals[3] = { finder->metal_1, finder->metal_2, finder->metal_3 };
+            const int16_t economics[3] = { finder->economic_1, finder->economic_2, finder->economic_3 };
+            const int16_t minerals[3] = { finder->mineral_1, finder->mineral_2, finder->mineral_3 };
+
+            for (uint8_t i = 0; i < 3; i++) {
+                if (region_types[i] != -1) {
+                    add_bits(query, indexed_set(state->region_types, region_types[i]), nullptr, true, false);
+                }
+
+                if (biomes[i] != -1) {
+                    add_bits(query, indexed_set(state->biomes, biomes[i]), nullptr, true, false);
+                }
+
+                if (metals[i] != -1) {
+                    add_bits(query, inorganic_set(state->metals, &embark_assist::defs::region_tile_datum::metals, metals[i]), nullptr, true, false);
+                }
+
+                if (economics[i] != -1) {
+                    add_bits(query, inorganic_set(state->economics, &embark_assist::defs::region_tile_datum::economics, economics[i]), nullptr, true, false);
+                }
+
+                if (minerals[i] != -1) {
+                    add_bits(query, inorganic_set(state->minerals, &embark_assist::defs::region_tile_datum::minerals, minerals[i]), nullptr, true, false);
+                }
+            }
+        }
+
+        //=======================================================================================
+
+        //  Evaluates the words [first, last) and writes the results for the tiles they cover.
+        uint32_t evaluate(const queries *query,
+            embark_assist::defs::match_results *match_results,
+            uint32_t first,
+            uint32_t last) {
+
+            uint32_t count = 0;
+
+            for (uint32_t word = first; word < last; word++) {
+                const uint32_t base = word * 64;
+                const uint32_t size = std::min(state->tiles - base, uint32_t(64));
+                const uint64_t surveyed_tiles = state->set[surveyed][word];
+                uint64_t match = size == 64 ? ~uint64_t(0) : (uint64_t(1) << size) - 1;
+
+                for (auto &pass : query->bits) {
+                    if (!match) break;
+
+                    uint64_t bits = (*pass.first)[word];
+                    if (pass.second) bits |= (*pass.second)[word];
+                    if (!pass.set) bits = ~bits;
+
+                    uint64_t exempt = 0;
+                    if (!pass.applies[0]) exempt |= ~surveyed_tiles;
+                    if (!pass.applies[1]) exempt |= surveyed_tiles;
+
+                    match &= bits | exempt;
+                }
+
+                for (auto &pass : query->ranges) {
+                    if (!match) break;
+
+                    const int16_t *values = pass.column->data() + base;
+                    uint64_t in_range = 0;
+
+                    for (uint32_t i = 0; i < size; i++) {
+                        const uint8_t tile_state = (surveyed_tiles >> i) & 1;
+                        in_range |= uint64_t(values[i] >= pass.min[tile_state] && values[i] <= pass.max[tile_state]) << i;
+                    }
+
+                    match &= in_range;
+                }
+
+                count += uint32_t(std::bitset<64>(match).count());
+
+                for (uint32_t i = 0; i < size; i++) {
+                    auto &result = match_results->at((base + i) / state->dim_y).at((base + i) % state->dim_y);
+                    result.preliminary_match = (match >> i) & 1;
+                    result.contains_match = false;
+                }
+            }
+
+            return count;
+        }
+    }
+}
+
+//=======================================================================================
+//  Visible operations
+//=======================================================================================
+
+void embark_assist::world_index::build(embark_assist::defs::world_tile_data *survey_results) {
+    const uint16_t dim_x = world->worldgen.worldgen_parms.dim_x;
+    const uint16_t dim_y = world->worldgen.worldgen_parms.dim_y;
+
+    delete state;
+    state = new(states);
+    state->survey_results = survey_results;
+    state->dim_y = dim_y;
+    state->tiles = dim_x * dim_y;
+    state->words = (state->tiles + 63) / 64;
+
+    for (uint8_t i = 0; i < column_count; i++) {
+        state->column[i].resize(state->words * 64);
+    }
+
+    for (uint8_t i = 0; i < set_count; i++) {
+        state->set[i].resize(state->words);
+    }
+
+    state->region_types.resize(ENUM_LAST_ITEM(world_region_type) + 1, tile_sets(state->words));
+    state->biomes.resize(ENUM_LAST_ITEM(biome_type) + 1, tile_sets(state->words));
+
+    for (uint16_t i = 0; i < dim_x; i++) {
+        for (uint16_t k = 0; k < dim_y; k++) {
+            index_tile(i, k);
+        }
+    }
+}
+
+//=======================================================================================
+
+void embark_assist::world_index::update_tile(uint16_t x, uint16_t y) {
+    if (state) index_tile(x, y);
+}
+
+//=======================================================================================
+
+uint32_t embark_assist::world_index::preliminary_match(embark_assist::defs::finders *finder,
+    embark_assist::defs::match_results *match_results) {
+
+    queries query;
+    compile(finder, &query);
+
+    //  Each thread handles a contiguous range of words, so the tiles it writes
+    //  results for are never touched by any other thread.
+    const uint32_t min_words_per_thread = 64;
+    uint32_t thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+    thread_count = std::min(thread_count, std::max(state->words / min_words_per_thread, uint32_t(1)));
+
+    const uint32_t words_per_thread = (state->words + thread_count - 1) / thread_count;
+    std::vector<uint32_t> counts(thread_count, 0);
+    std::vector<std::thread> threads;
+
+    for (uint32_t i = 1; i < thread_count; i++) {
+        const uint32_t first = std::min(i * words_per_thread, state->words);
+        const uint32_t last = std::min(first + words_per_thread, state->words);
+        threads.emplace_back([&query, &counts, match_results, i, first, last]() {
+            counts[i] = evaluate(&query, match_results, first, last);
+        });
+    }
+
+    counts[0] = evaluate(&query, match_results, 0, std::min(words_per_thread, state->words));
+
+    uint32_t count = counts[0];
+    for (uint32_t i = 1; i < thread_count; i++) {
+        threads[i - 1].join();
+        count += counts[i];
+    }
+
+    return count;
+}
+
+//=======================================================================================
+
+void embark_assist::world_index::shutdown() {
+    delete state;
+    state = nullptr;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "defs.h"
+
+//  Column oriented copy of the world tile survey data used to evaluate the world
+//  tile level finder criteria. Each attribute is held as an array (or a bit set)
+//  over all world tiles, and the criteria are turned into a list of range and bit
+//  set passes that are applied 64 tiles at a time, spread over several threads.
+
+namespace embark_assist {
+    namespace world_index {
+        //  (Re)builds the index from the high level survey results.
+        void build(embark_assist::defs::world_tile_data *survey_results);
+
+        //  Refreshes the index entries of a single world tile after a mid level survey.
+        void update_tile(uint16_t x, uint16_t y);
+
+        //  Sets preliminary_match and clears contains_match for every world tile,
+        //  returning the number of preliminarily matching tiles.
+        uint32_t preliminary_match(embark_assist::defs::finders *finder,
+            embark_assist::defs::match_results *match_results);
+
+        void shutdown();
+    }
+}
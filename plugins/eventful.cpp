@@ -207,6 +207,7 @@ static void ev_mng_interaction(color_ostream& out, void* ptr) {
     onInteraction(out, data->attackVerb, data->defendVerb, data->attacker, data->defender, data->attackReport, data->defendReport);
 }
 std::vector<int> enabledEventManagerEvents(EventManager::EventType::EVENT_MAX,-1);
+std::vector<int> eventManagerBudgets(EventManager::EventType::EVENT_MAX,0);
 typedef void (*handler_t) (color_ostream&,void*);
 static const handler_t eventHandlers[] = {
  NULL,
@@ -239,11 +240,26 @@ static void enableEvent(int evType,int freq)
             return;
         EventManager::unregister(typeToEnable,EventManager::EventHandler(fun_ptr,oldFreq),plugin_self);
     }
-    EventManager::registerListener(typeToEnable,EventManager::EventHandler(fun_ptr,freq),plugin_self);
+    EventManager::registerListener(typeToEnable,EventManager::EventHandler(fun_ptr,freq,eventManagerBudgets[typeToEnable]),plugin_self);
     enabledEventManagerEvents[typeToEnable] = freq;
 }
+static void setEventBudget(int evType,int budget)
+{
+    CHECK_INVALID_ARGUMENT(evType >= 0 && evType < EventManager::EventType::EVENT_MAX &&
+                           evType != EventManager::EventType::TICK);
+    EventManager::EventHandler::callback_t fun_ptr = eventHandlers[evType];
+    EventManager::EventType::EventType type=static_cast<EventManager::EventType::EventType>(evType);
+
+    eventManagerBudgets[type] = budget;
+    int freq = enabledEventManagerEvents[type];
+    if (freq == -1)
+        return;
+    EventManager::unregister(type,EventManager::EventHandler(fun_ptr,freq),plugin_self);
+    EventManager::registerListener(type,EventManager::EventHandler(fun_ptr,freq,budget),plugin_self);
+}
 DFHACK_PLUGIN_LUA_FUNCTIONS{
     DFHACK_LUA_FUNCTION(enableEvent),
+    DFHACK_LUA_FUNCTION(setEventBudget),
     DFHACK_LUA_END
 };
 struct workshop_hook : df::building_workshopst{
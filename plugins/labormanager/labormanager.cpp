@@ -13,8 +13,12 @@
 #include <algorithm>
 #include <queue>
 #include <map>
+#include <set>
+#include <unordered_map>
 #include <iterator>
 
+#include "modules/EventManager.h"
+#include "modules/Gui.h"
 #include "modules/Units.h"
 #include "modules/World.h"
 #include "modules/Maps.h"
@@ -564,6 +568,296 @@ static JobLaborMapper* labor_mapper = 0;
 
 static bool initialized = false;
 
+/*
+ * Designation counts are cached per map block. Blocks are recounted when
+ * a job at one of their tiles completes, or when the player finishes a
+ * designation box over them. Designations made by other tools are found
+ * by reading the flags of a slice of the map blocks per update, and by
+ * rechecking a few cached blocks per update in turn. Butcher shops,
+ * fisheries and trade depots are tracked through building events, so
+ * the per-update cost no longer grows with the map or building count.
+ */
+
+struct designation_counts
+{
+    int dig;
+    int tree;
+    int plant;
+    int detail;
+
+    designation_counts() : dig(0), tree(0), plant(0), detail(0) {}
+
+    void add(const designation_counts& other, int sign)
+    {
+        dig += sign * other.dig;
+        tree += sign * other.tree;
+        plant += sign * other.plant;
+        detail += sign * other.detail;
+    }
+};
+
+struct block_designations
+{
+    uint32_t hash;
+    designation_counts counts;
+};
+
+// Keyed by block position, so nothing dangles if blocks are reallocated
+static std::map<uint64_t, block_designations> designation_cache;
+static std::set<uint64_t> dirty_blocks;
+static uint64_t recheck_cursor = 0;
+static designation_counts designation_totals;
+
+// Cached blocks rechecked per update, in addition to new and dirty ones
+static const int recheck_budget = 32;
+// Map blocks whose flags are read per update to find newly designated ones
+static const int discover_budget = 512;
+static size_t discover_cursor = 0;
+static bool discover_all = true; // Read every block on the next update
+
+// The designation box the player is dragging, in tiles
+static bool player_selecting = false;
+static df::coord player_select_start, player_select_end;
+
+static uint64_t block_key(df::coord pos)
+{
+    return (uint64_t(uint16_t(pos.z)) << 32) | (uint64_t(uint16_t(pos.y >> 4)) << 16) | uint16_t(pos.x >> 4);
+}
+
+static df::map_block* block_of_key(uint64_t key)
+{
+    return Maps::getBlock(int16_t(key & 0xffff), int16_t((key >> 16) & 0xffff), int16_t(key >> 32));
+}
+
+static std::set<int32_t> butcher_shops;
+static std::set<int32_t> fisheries;
+static std::set<int32_t> trade_depots;
+
+static uint32_t hash_block_designations(df::map_block* bl)
+{
+    df::tile_designation mask;
+    mask.whole = 0;
+    mask.bits.dig = (df::tile_dig_designation)7;
+    mask.bits.smooth = 3;
+    mask.bits.hidden = true;
+
+    // Hidden tiles count only if the tile below the block origin is visible
+    df::coord p = bl->map_pos;
+    uint32_t hash = Maps::isTileVisible(p.x, p.y, p.z - 1) ? 0x9e3779b9 : 0x85ebca6b;
+
+    for (int x = 0; x < 16; x++)
+        for (int y = 0; y < 16; y++)
+        {
+            uint32_t des = bl->designation[x][y].whole & mask.whole;
+            hash = (hash ^ des) * 16777619;
+            if (des)
+                hash = (hash ^ uint32_t(bl->tiletype[x][y])) * 16777619;
+        }
+
+    return hash;
+}
+
+static designation_counts count_block_designations(df::map_block* bl)
+{
+    static const Maps::TiletypeSet trees = Maps::TiletypeSet::where([](df::tiletype tt) {
+        return ENUM_ATTR(tiletype, material, tt) == df::enums::tiletype_material::TREE;
+    });
+    static const Maps::TiletypeSet shrubs = Maps::TiletypeSet::where([](df::tiletype tt) {
+        return ENUM_ATTR(tiletype, shape, tt) == df::enums::tiletype_shape::SHRUB;
+    });
+
+    designation_counts counts;
+
+    // Hidden tiles count only if the tile below the block origin is visible
+    df::coord p = bl->map_pos;
+    bool skip_hidden = !Maps::isTileVisible(p.x, p.y, p.z-1);
+
+    df::tile_designation hidden_mask, dig_mask, smooth_mask;
+    hidden_mask.bits.hidden = true;
+    dig_mask.bits.dig = (df::tile_dig_designation)7;
+    smooth_mask.bits.smooth = 3;
+    if (skip_hidden)
+        dig_mask.bits.hidden = smooth_mask.bits.hidden = true;
+
+    // Visible tiles without the designation match (mask, 0); the rest are skipped or designated
+    int skipped = skip_hidden ? 256 - Maps::countTiles(bl, hidden_mask, df::tile_designation()) : 0;
+    int dig = 256 - skipped - Maps::countTiles(bl, dig_mask, df::tile_designation());
+    counts.detail = 256 - skipped - Maps::countTiles(bl, smooth_mask, df::tile_designation());
+
+    // Only designated tiles need their tiletype split up
+    for (int x = 0; x < 16 && dig > 0; x++)
+        for (int y = 0; y < 16; y++)
+        {
+            if (bl->designation[x][y].bits.dig == df::enums::tile_dig_designation::No ||
+                (skip_hidden && bl->designation[x][y].bits.hidden))
+                continue;
+
+            df::tiletype tt = bl->tiletype[x][y];
+            if (trees.contains(tt))
+                counts.tree++;
+            else if (shrubs.contains(tt))
+                counts.plant++;
+            else
+                counts.dig++;
+            dig--;
+        }
+
+    return counts;
+}
+
+// Recounts a cached block if it changed, or drops it if it lost its designations
+static void recheck_block(std::map<uint64_t, block_designations>::iterator it)
+{
+    df::map_block* bl = block_of_key(it->first);
+    designation_totals.add(it->second.counts, -1);
+
+    if (!bl || !bl->flags.bits.designated)
+    {
+        designation_cache.erase(it);
+        return;
+    }
+
+    uint32_t hash = hash_block_designations(bl);
+    if (it->second.hash != hash)
+    {
+        it->second.hash = hash;
+        it->second.counts = count_block_designations(bl);
+    }
+    designation_totals.add(it->second.counts, 1);
+}
+
+// Starts caching a block that got designations
+static void discover_block(df::map_block* bl)
+{
+    if (!bl || !bl->flags.bits.designated)
+        return;
+
+    uint64_t key = block_key(bl->map_pos);
+    if (designation_cache.count(key))
+        return;
+
+    block_designations& entry = designation_cache[key];
+    entry.hash = hash_block_designations(bl);
+    entry.counts = count_block_designations(bl);
+    designation_totals.add(entry.counts, 1);
+}
+
+// Marks the blocks under a designation box dirty once the player finishes (or cancels) it
+static void watch_player_designation()
+{
+    int32_t x, y, z;
+    if (Gui::getDesignationCoords(x, y, z))
+    {
+        player_selecting = true;
+        player_select_start = df::coord(x, y, z);
+        if (Gui::getCursorCoords(x, y, z))
+            player_select_end = df::coord(x, y, z);
+        return;
+    }
+    if (!player_selecting)
+        return;
+    player_selecting = false;
+
+    df::coord lo(std::min(player_select_start.x, player_select_end.x),
+                 std::min(player_select_start.y, player_select_end.y),
+                 std::min(player_select_start.z, player_select_end.z));
+    df::coord hi(std::max(player_select_start.x, player_select_end.x),
+                 std::max(player_select_start.y, player_select_end.y),
+                 std::max(player_select_start.z, player_select_end.z));
+    for (int z = lo.z; z <= hi.z; z++)
+        for (int y = lo.y & ~15; y <= hi.y; y += 16)
+            for (int x = lo.x & ~15; x <= hi.x; x += 16)
+                dirty_blocks.insert(block_key(df::coord(x, y, z)));
+}
+
+static void update_designation_counts()
+{
+    // Only the block flags are read here; tiles of new blocks are counted once
+    auto& blocks = world->map.map_blocks;
+    size_t discover = discover_all ? blocks.size() : std::min<size_t>(discover_budget, blocks.size());
+    discover_all = false;
+    for (size_t n = 0; n < discover; n++)
+    {
+        if (discover_cursor >= blocks.size())
+            discover_cursor = 0;
+        discover_block(blocks[discover_cursor++]);
+    }
+
+    for (auto d = dirty_blocks.begin(); d != dirty_blocks.end(); ++d)
+    {
+        auto it = designation_cache.find(*d);
+        if (it != designation_cache.end())
+            recheck_block(it);
+        else
+            discover_block(block_of_key(*d));
+    }
+    dirty_blocks.clear();
+
+    // Round-robin over the rest, so the cost doesn't grow with the designated area
+    size_t budget = std::min<size_t>(recheck_budget, designation_cache.size());
+    for (size_t n = 0; n < budget && !designation_cache.empty(); n++)
+    {
+        auto it = designation_cache.lower_bound(recheck_cursor);
+        if (it == designation_cache.end())
+            it = designation_cache.begin();
+        recheck_cursor = it->first + 1;
+        recheck_block(it);
+    }
+}
+
+static void job_completed_event(color_ostream& out, void* ptr)
+{
+    df::job* job = (df::job*)ptr;
+    uint64_t key = block_key(job->pos);
+    if (designation_cache.count(key))
+        dirty_blocks.insert(key);
+}
+
+static void register_building(df::building* build)
+{
+    auto type = build->getType();
+    if (building_type::Workshop == type)
+    {
+        df::workshop_type subType = (df::workshop_type)build->getSubtype();
+        if (workshop_type::Butchers == subType)
+            butcher_shops.insert(build->id);
+        if (workshop_type::Fishery == subType)
+            fisheries.insert(build->id);
+    }
+    else if (building_type::TradeDepot == type)
+        trade_depots.insert(build->id);
+}
+
+static void building_event(color_ostream& out, void* ptr)
+{
+    int32_t id = *((int32_t*)ptr);
+    df::building* build = df::building::find(id);
+
+    if (build)
+        register_building(build);
+    else
+    {
+        butcher_shops.erase(id);
+        fisheries.erase(id);
+        trade_depots.erase(id);
+    }
+}
+
+static void reset_caches()
+{
+    designation_cache.clear();
+    dirty_blocks.clear();
+    recheck_cursor = 0;
+    discover_cursor = 0;
+    discover_all = true;
+    player_selecting = false;
+    designation_totals = designation_counts();
+
+    butcher_shops.clear();
+    fisheries.clear();
+    trade_depots.clear();
+}
+
 static bool isOptionEnabled(unsigned flag)
 {
     return config.isValid() && (config.ival(0) & flag) != 0;
@@ -585,6 +879,9 @@ static void cleanup_state()
     enable_labormanager = false;
     labor_infos.clear();
     initialized = false;
+
+    EventManager::unregisterAll(plugin_self);
+    reset_caches();
 }
 
 static void reset_labor(df::unit_labor labor)
@@ -635,6 +932,18 @@ static void init_state()
         reset_labor((df::unit_labor) i);
     }
 
+    // Existing buildings are registered once, later ones through events
+    for (auto b = world->buildings.all.begin(); b != world->buildings.all.end(); b++)
+        register_building(*b);
+
+    EventManager::EventHandler handler(building_event, 100);
+    EventManager::registerListener(EventManager::EventType::BUILDING, handler, plugin_self);
+
+    // Finished dig, chop, gather and smoothing jobs change designation counts;
+    // completions are only seen by handlers that check on every tick
+    EventManager::EventHandler job_handler(job_completed_event, 0);
+    EventManager::registerListener(EventManager::EventType::JOB_COMPLETED, job_handler, plugin_self);
+
     initialized = true;
 
 }
@@ -1021,81 +1330,41 @@ private:
 
     void scan_buildings()
     {
-        has_butchers = false;
-        has_fishery = false;
+        has_butchers = !butcher_shops.empty();
+        has_fishery = !fisheries.empty();
         trader_requested = false;
         labors_changed = false;
 
-        for (auto b = world->buildings.all.begin(); b != world->buildings.all.end(); b++)
+        for (auto id = trade_depots.begin(); id != trade_depots.end(); )
         {
-            df::building *build = *b;
-            auto type = build->getType();
-            if (building_type::Workshop == type)
+            df::building_tradedepotst* depot = (df::building_tradedepotst*) df::building::find(*id);
+            if (!depot)
             {
-                df::workshop_type subType = (df::workshop_type)build->getSubtype();
-                if (workshop_type::Butchers == subType)
-                    has_butchers = true;
-                if (workshop_type::Fishery == subType)
-                    has_fishery = true;
+                id = trade_depots.erase(id);
+                continue;
             }
-            else if (building_type::TradeDepot == type)
-            {
-                df::building_tradedepotst* depot = (df::building_tradedepotst*) build;
-                trader_requested = depot->trade_flags.bits.trader_requested;
+            ++id;
 
-                if (print_debug)
-                {
-                    if (trader_requested)
-                        out.print("Trade depot found and trader requested, trader will be excluded from all labors.\n");
-                    else
-                        out.print("Trade depot found but trader is not requested.\n");
-                }
+            trader_requested = depot->trade_flags.bits.trader_requested;
 
+            if (print_debug)
+            {
+                if (trader_requested)
+                    out.print("Trade depot found and trader requested, trader will be excluded from all labors.\n");
+                else
+                    out.print("Trade depot found but trader is not requested.\n");
             }
         }
     }
 
     void count_map_designations()
     {
-        dig_count = 0;
-        tree_count = 0;
-        plant_count = 0;
-        detail_count = 0;
+        update_designation_counts();
 
-        for (size_t i = 0; i < world->map.map_blocks.size(); ++i)
-        {
-            df::map_block* bl = world->map.map_blocks[i];
-
-            if (!bl->flags.bits.designated)
-                continue;
-
-            for (int x = 0; x < 16; x++)
-                for (int y = 0; y < 16; y++)
-                {
-                    if (bl->designation[x][y].bits.hidden)
-                    {
-                        df::coord p = bl->map_pos;
-                        if (! Maps::isTileVisible(p.x, p.y, p.z-1))
-                            continue;
-                    }
-
-                    df::tile_dig_designation dig = bl->designation[x][y].bits.dig;
-                    if (dig != df::enums::tile_dig_designation::No)
-                    {
-                        df::tiletype tt = bl->tiletype[x][y];
-                        df::tiletype_material ttm = ENUM_ATTR(tiletype, material, tt);
-                        df::tiletype_shape tts = ENUM_ATTR(tiletype, shape, tt);
-                        if (ttm == df::enums::tiletype_material::TREE)
-                            tree_count++;
-                        else if (tts == df::enums::tiletype_shape::SHRUB)
-                            plant_count++;
-                        else
-                            dig_count++;
-                    }
-                    if (bl->designation[x][y].bits.smooth != 0)
-                        detail_count++;
-                }
-        }
+        dig_count = designation_totals.dig;
+        tree_count = designation_totals.tree;
+        plant_count = designation_totals.plant;
+        detail_count = designation_totals.detail;
 
         if (print_debug)
             out.print("Dig count = %d, Cut tree count = %d, gather plant count = %d, detail count = %d\n", dig_count, tree_count, plant_count, detail_count);
@@ -2098,6 +2367,8 @@ DFhackCExport command_result plugin_onupdate(color_ostream &out)
         return CR_OK;
     }
 
+    watch_player_designation();
+
     //    if (++step_count < 60)
     //        return CR_OK;
 
@@ -0,0 +1,336 @@
+#include "block_codec.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <zlib.h>
+
+using namespace RemoteFortressReader;
+using google::protobuf::RepeatedField;
+using google::protobuf::RepeatedPtrField;
+
+// Upper bound on decoded plane length; blocks have 256 tiles.
+static const uint32_t max_plane_size = 4096;
+
+static void putVarint(std::string & out, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(char(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(char(value));
+}
+
+static bool getVarint(const std::string & in, size_t & pos, uint32_t & value)
+{
+    value = 0;
+    for (int shift = 0; shift < 35 && pos < in.size(); shift += 7)
+    {
+        uint8_t byte = in[pos++];
+        value |= uint32_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+namespace {
+    typedef std::pair<int32_t, int32_t> PlaneValue;
+
+    class PlaneEncoder
+    {
+        BlockPlane * plane;
+        bool pairs;
+        std::vector<PlaneValue> dictionary;
+        std::string runs;
+        PlaneValue current;
+        uint32_t run_length;
+
+        void flush()
+        {
+            if (!run_length)
+                return;
+            size_t index = 0;
+            while (index < dictionary.size() && dictionary[index] != current)
+                index++;
+            if (index == dictionary.size())
+            {
+                dictionary.push_back(current);
+                plane->add_dictionary(current.first);
+                if (pairs)
+                    plane->add_dictionary(current.second);
+            }
+            putVarint(runs, run_length - 1);
+            putVarint(runs, index);
+        }
+
+    public:
+        PlaneEncoder(BlockPlane * plane, int field, bool pairs)
+            : plane(plane), pairs(pairs), run_length(0)
+        {
+            plane->set_field(field);
+        }
+
+        void add(const PlaneValue & value)
+        {
+            if (run_length && value == current)
+            {
+                run_length++;
+                return;
+            }
+            flush();
+            current = value;
+            run_length = 1;
+        }
+
+        void finish()
+        {
+            flush();
+            plane->set_runs(runs);
+        }
+    };
+
+    template<class T>
+    void encodePlane(MapBlock * block, int field, RepeatedField<T> * values)
+    {
+        if (values->size() == 0)
+            return;
+        PlaneEncoder encoder(block->add_compressed_planes(), field, false);
+        for (int i = 0; i < values->size(); i++)
+            encoder.add(PlaneValue(int32_t(values->Get(i)), 0));
+        encoder.finish();
+        values->Clear();
+    }
+
+    void encodePlane(MapBlock * block, int field, RepeatedPtrField<MatPair> * values)
+    {
+        if (values->size() == 0)
+            return;
+        PlaneEncoder encoder(block->add_compressed_planes(), field, true);
+        for (int i = 0; i < values->size(); i++)
+            encoder.add(PlaneValue(values->Get(i).mat_type(), values->Get(i).mat_index()));
+        encoder.finish();
+        values->Clear();
+    }
+
+    // Calls out(dictionary index) for every tile of the plane.
+    template<class F>
+    bool decodeRuns(const BlockPlane & plane, int entries, F out)
+    {
+        const std::string & runs = plane.runs();
+        size_t pos = 0;
+        uint32_t total = 0;
+        while (pos < runs.size())
+        {
+            uint32_t length, index;
+            if (!getVarint(runs, pos, length) || !getVarint(runs, pos, index))
+                return false;
+            length++;
+            if (index >= uint32_t(entries) || length > max_plane_size - total)
+                return false;
+            total += length;
+            for (uint32_t i = 0; i < length; i++)
+                out(int(index));
+        }
+        return true;
+    }
+
+    template<class T>
+    bool decodePlane(const BlockPlane & plane, RepeatedField<T> * values)
+    {
+        return decodeRuns(plane, plane.dictionary_size(), [&](int index) {
+            values->Add(T(plane.dictionary(index)));
+        });
+    }
+
+    bool decodePlane(const BlockPlane & plane, RepeatedField<bool> * values)
+    {
+        return decodeRuns(plane, plane.dictionary_size(), [&](int index) {
+            values->Add(plane.dictionary(index) != 0);
+        });
+    }
+
+    bool decodePlane(const BlockPlane & plane, RepeatedPtrField<MatPair> * values)
+    {
+        return decodeRuns(plane, plane.dictionary_size() / 2, [&](int index) {
+            MatPair * mat = values->Add();
+            mat->set_mat_type(plane.dictionary(index * 2));
+            mat->set_mat_index(plane.dictionary(index * 2 + 1));
+        });
+    }
+}
+
+void CompressBlockPlanes(MapBlock * block)
+{
+    encodePlane(block, MapBlock::kTilesFieldNumber, block->mutable_tiles());
+    encodePlane(block, MapBlock::kMaterialsFieldNumber, block->mutable_materials());
+    encodePlane(block, MapBlock::kLayerMaterialsFieldNumber, block->mutable_layer_materials());
+    encodePlane(block, MapBlock::kVeinMaterialsFieldNumber, block->mutable_vein_materials());
+    encodePlane(block, MapBlock::kBaseMaterialsFieldNumber, block->mutable_base_materials());
+    encodePlane(block, MapBlock::kMagmaFieldNumber, block->mutable_magma());
+    encodePlane(block, MapBlock::kWaterFieldNumber, block->mutable_water());
+    encodePlane(block, MapBlock::kHiddenFieldNumber, block->mutable_hidden());
+    encodePlane(block, MapBlock::kLightFieldNumber, block->mutable_light());
+    encodePlane(block, MapBlock::kSubterraneanFieldNumber, block->mutable_subterranean());
+    encodePlane(block, MapBlock::kOutsideFieldNumber, block->mutable_outside());
+    encodePlane(block, MapBlock::kAquiferFieldNumber, block->mutable_aquifer());
+    encodePlane(block, MapBlock::kWaterStagnantFieldNumber, block->mutable_water_stagnant());
+    encodePlane(block, MapBlock::kWaterSaltFieldNumber, block->mutable_water_salt());
+    encodePlane(block, MapBlock::kConstructionItemsFieldNumber, block->mutable_construction_items());
+    encodePlane(block, MapBlock::kTreePercentFieldNumber, block->mutable_tree_percent());
+    encodePlane(block, MapBlock::kTreeXFieldNumber, block->mutable_tree_x());
+    encodePlane(block, MapBlock::kTreeYFieldNumber, block->mutable_tree_y());
+    encodePlane(block, MapBlock::kTreeZFieldNumber, block->mutable_tree_z());
+    encodePlane(block, MapBlock::kTileDigDesignationFieldNumber, block->mutable_tile_dig_designation());
+    encodePlane(block, MapBlock::kTileDigDesignationMarkerFieldNumber, block->mutable_tile_dig_designation_marker());
+    encodePlane(block, MapBlock::kTileDigDesignationAutoFieldNumber, block->mutable_tile_dig_designation_auto());
+    encodePlane(block, MapBlock::kGrassPercentFieldNumber, block->mutable_grass_percent());
+}
+
+bool DecompressBlockPlanes(MapBlock * block)
+{
+    bool ok = true;
+    for (int i = 0; i < block->compressed_planes_size() && ok; i++)
+    {
+        const BlockPlane & plane = block->compressed_planes(i);
+        switch (plane.field())
+        {
+        case MapBlock::kTilesFieldNumber:
+            ok = decodePlane(plane, block->mutable_tiles());
+            break;
+        case MapBlock::kMaterialsFieldNumber:
+            ok = decodePlane(plane, block->mutable_materials());
+            break;
+        case MapBlock::kLayerMaterialsFieldNumber:
+            ok = decodePlane(plane, block->mutable_layer_materials());
+            break;
+        case MapBlock::kVeinMaterialsFieldNumber:
+            ok = decodePlane(plane, block->mutable_vein_materials());
+            break;
+        case MapBlock::kBaseMaterialsFieldNumber:
+            ok = decodePlane(plane, block->mutable_base_materials());
+            break;
+        case MapBlock::kMagmaFieldNumber:
+            ok = decodePlane(plane, block->mutable_magma());
+            break;
+        case MapBlock::kWaterFieldNumber:
+            ok = decodePlane(plane, block->mutable_water());
+            break;
+        case MapBlock::kHiddenFieldNumber:
+            ok = decodePlane(plane, block->mutable_hidden());
+            break;
+        case MapBlock::kLightFieldNumber:
+            ok = decodePlane(plane, block->mutable_light());
+            break;
+        case MapBlock::kSubterraneanFieldNumber:
+            ok = decodePlane(plane, block->mutable_subterranean());
+            break;
+        case MapBlock::kOutsideFieldNumber:
+            ok = decodePlane(plane, block->mutable_outside());
+            break;
+        case MapBlock::kAquiferFieldNumber:
+            ok = decodePlane(plane, block->mutable_aquifer());
+            break;
+        case MapBlock::kWaterStagnantFieldNumber:
+            ok = decodePlane(plane, block->mutable_water_stagnant());
+            break;
+        case MapBlock::kWaterSaltFieldNumber:
+            ok = decodePlane(plane, block->mutable_water_salt());
+            break;
+        case MapBlock::kConstructionItemsFieldNumber:
+            ok = decodePlane(plane, block->mutable_construction_items());
+            break;
+        case MapBlock::kTreePercentFieldNumber:
+            ok = decodePlane(plane, block->mutable_tree_percent());
+            break;
+        case MapBlock::kTreeXFieldNumber:
+            ok = decodePlane(plane, block->mutable_tree_x());
+            break;
+        case MapBlock::kTreeYFieldNumber:
+            ok = decodePlane(plane, block->mutable_tree_y());
+            break;
+        case MapBlock::kTreeZFieldNumber:
+            ok = decodePlane(plane, block->mutable_tree_z());
+            break;
+        case MapBlock::kTileDigDesignationFieldNumber:
+            ok = decodePlane(plane, block->mutable_tile_dig_designation());
+            break;
+        case MapBlock::kTileDigDesignationMarkerFieldNumber:
+            ok = decodePlane(plane, block->mutable_tile_dig_designation_marker());
+            break;
+        case MapBlock::kTileDigDesignationAutoFieldNumber:
+            ok = decodePlane(plane, block->mutable_tile_dig_designation_auto());
+            break;
+        case MapBlock::kGrassPercentFieldNumber:
+            ok = decodePlane(plane, block->mutable_grass_percent());
+            break;
+        default:
+            ok = false;
+            break;
+        }
+    }
+    block->clear_compressed_planes();
+    return ok;
+}
+
+bool DeflateBlockList(BlockList * list, int level)
+{
+    if (list->map_blocks_size() == 0)
+        return true;
+
+    BlockList blocks;
+    blocks.mutable_map_blocks()->Swap(list->mutable_map_blocks());
+
+    std::string raw;
+    blocks.SerializeToString(&raw);
+
+    uLongf size = compressBound(raw.size());
+    std::string packed(size, '\0');
+    if (compress2((Bytef*)&packed[0], &size, (const Bytef*)raw.data(), raw.size(), level) != Z_OK)
+    {
+        list->mutable_map_blocks()->Swap(blocks.mutable_map_blocks());
+        return false;
+    }
+    packed.resize(size);
+
+    list->set_deflated_blocks(packed);
+    list->set_inflated_size(raw.size());
+    return true;
+}
+
+bool InflateBlockList(BlockList * list)
+{
+    if (!list->has_deflated_blocks())
+        return true;
+    if (list->inflated_size() <= 0)
+        return false;
+
+    const std::string & packed = list->deflated_blocks();
+    std::string raw(list->inflated_size(), '\0');
+    uLongf size = raw.size();
+    if (uncompress((Bytef*)&raw[0], &size, (const Bytef*)packed.data(), packed.size()) != Z_OK || size != raw.size())
+        return false;
+
+    BlockList blocks;
+    if (!blocks.ParseFromString(raw))
+        return false;
+
+    list->mutable_map_blocks()->Swap(blocks.mutable_map_blocks());
+    list->clear_deflated_blocks();
+    list->clear_inflated_size();
+    return true;
+}
+
+bool DecodeBlockList(BlockList * list)
+{
+    if (!InflateBlockList(list))
+        return false;
+    for (int i = 0; i < list->map_blocks_size(); i++)
+    {
+        if (!DecompressBlockPlanes(list->mutable_map_blocks(i)))
+            return false;
+    }
+    return true;
+}
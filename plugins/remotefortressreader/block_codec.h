@@ -0,0 +1,27 @@
+#ifndef BLOCK_CODEC_H
+#define BLOCK_CODEC_H
+#include "RemoteFortressReader.pb.h"
+
+/*
+ * Compact encodings for GetBlockList replies, requested with
+ * BlockRequest.compress_planes and BlockRequest.deflate.
+ *
+ * This file only depends on the generated protocol code and zlib, so
+ * C++ clients can build it as-is and call DecodeBlockList on every
+ * reply to get plain MapBlock messages back.
+ */
+
+// Moves the per-tile fields of a block into compressed_planes.
+void CompressBlockPlanes(RemoteFortressReader::MapBlock * block);
+// Restores fields stored by CompressBlockPlanes. False on malformed input.
+bool DecompressBlockPlanes(RemoteFortressReader::MapBlock * block);
+
+// Moves map_blocks into a zlib stream in deflated_blocks.
+bool DeflateBlockList(RemoteFortressReader::BlockList * list, int level = 6);
+// Reverses DeflateBlockList; does nothing if the list was not deflated.
+bool InflateBlockList(RemoteFortressReader::BlockList * list);
+
+// Undoes both encodings, leaving the list as an uncompressed request would.
+bool DecodeBlockList(RemoteFortressReader::BlockList * list);
+
+#endif
@@ -0,0 +1,113 @@
+#include "block_index.h"
+
+#include <string.h>
+
+#include "df_version_int.h"
+#include "modules/Maps.h"
+
+#include "df/block_square_event_item_spatterst.h"
+#include "df/block_square_event_material_spatterst.h"
+#include "df/map_block.h"
+#include "df/world.h"
+
+using namespace DFHack;
+using df::global::world;
+
+static uint32_t grid_generation = 1;
+
+uint32_t BlockHash(const void * data, size_t bytes)
+{
+    const uint8_t * ptr = (const uint8_t*)data;
+    uint32_t a[4] = { 1, 1, 1, 1 };
+    uint32_t b[4] = { 0, 0, 0, 0 };
+
+    for (; bytes >= 16; bytes -= 16, ptr += 16)
+    {
+        uint32_t words[4];
+        memcpy(words, ptr, 16);
+        for (int l = 0; l < 4; l++)
+        {
+            a[l] += words[l];
+            b[l] += a[l];
+        }
+    }
+
+    if (bytes > 0)
+    {
+        uint32_t words[4] = { 0, 0, 0, 0 };
+        memcpy(words, ptr, bytes);
+        for (int l = 0; l < 4; l++)
+        {
+            a[l] += words[l] + uint32_t(bytes);
+            b[l] += a[l];
+        }
+    }
+
+    // FNV-1a style mix of the lanes
+    uint32_t hash = 2166136261u;
+    for (int l = 0; l < 4; l++)
+    {
+        hash = (hash ^ a[l]) * 16777619u;
+        hash = (hash ^ b[l]) * 16777619u;
+    }
+    return hash;
+}
+
+uint32_t TiletypeHash(df::map_block * block)
+{
+    return BlockHash(block->tiletype, sizeof(block->tiletype));
+}
+
+uint32_t DesignationHash(df::map_block * block)
+{
+    return BlockHash(block->designation, sizeof(block->designation));
+}
+
+uint32_t SpatterHash(df::map_block * block)
+{
+    std::vector<df::block_square_event_material_spatterst *> materials;
+#if DF_VERSION_INT > 34011
+    std::vector<df::block_square_event_item_spatterst *> items;
+    if (!Maps::SortBlockEvents(block, NULL, NULL, &materials, NULL, NULL, NULL, &items))
+        return 0;
+#else
+    if (!Maps::SortBlockEvents(block, NULL, NULL, &materials, NULL, NULL))
+        return 0;
+#endif
+
+    uint32_t hash = 0;
+
+    for (size_t i = 0; i < materials.size(); i++)
+    {
+        auto mat = materials[i];
+        hash ^= BlockHash(mat, sizeof(df::block_square_event_material_spatterst));
+    }
+#if DF_VERSION_INT > 34011
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        auto item = items[i];
+        hash ^= BlockHash(item, sizeof(df::block_square_event_item_spatterst));
+    }
+#endif
+    return hash;
+}
+
+void InvalidateBlockGrids()
+{
+    grid_generation++;
+}
+
+uint32_t BlockGridGeneration()
+{
+    return grid_generation;
+}
+
+bool GetBlockGridSize(int * x_count, int * y_count, int * z_count)
+{
+    if (!world || !Maps::IsValid())
+        return false;
+    *x_count = world->map.x_count_block;
+    *y_count = world->map.y_count_block;
+    *z_count = world->map.z_count_block;
+    return true;
+}
@@ -0,0 +1,81 @@
+#ifndef BLOCK_INDEX_H
+#define BLOCK_INDEX_H
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "DataDefs.h"
+#include "df/coord.h"
+
+namespace df
+{
+    struct map_block;
+}
+
+// Checksum used for block change detection. Runs four independent
+// Fletcher-style lanes over 32-bit words, which compilers turn into
+// plain SSE2 additions, instead of the old byte-wise fletcher16.
+uint32_t BlockHash(const void * data, size_t bytes);
+
+uint32_t TiletypeHash(df::map_block * block);
+uint32_t DesignationHash(df::map_block * block);
+uint32_t SpatterHash(df::map_block * block);
+
+// Called on map load and unload; makes every grid drop its contents.
+void InvalidateBlockGrids();
+uint32_t BlockGridGeneration();
+bool GetBlockGridSize(int * x_count, int * y_count, int * z_count);
+
+/*
+ * Dense per-block storage covering the whole loaded map, indexed by
+ * block coordinates. Only touch it with the core suspended.
+ */
+template<class T>
+class FlatBlockGrid
+{
+    std::vector<T> cells;
+    int x_count, y_count, z_count;
+    uint32_t generation;
+
+public:
+    FlatBlockGrid() : x_count(0), y_count(0), z_count(0), generation(0) {}
+
+    // Resets all cells if the map was (re)loaded since the last call.
+    void sync()
+    {
+        int x, y, z;
+        if (!GetBlockGridSize(&x, &y, &z))
+        {
+            clear();
+            return;
+        }
+        if (generation == BlockGridGeneration() && x == x_count && y == y_count && z == z_count)
+            return;
+        generation = BlockGridGeneration();
+        x_count = x;
+        y_count = y;
+        z_count = z;
+        cells.assign(size_t(x) * y * z, T());
+    }
+
+    void clear()
+    {
+        std::vector<T>().swap(cells);
+        x_count = y_count = z_count = 0;
+    }
+
+    void reset()
+    {
+        cells.assign(cells.size(), T());
+    }
+
+    // Returns NULL outside the map.
+    T * get(const df::coord & pos)
+    {
+        if (pos.x < 0 || pos.x >= x_count || pos.y < 0 || pos.y >= y_count || pos.z < 0 || pos.z >= z_count)
+            return NULL;
+        return &cells[(size_t(pos.z) * y_count + pos.y) * x_count + pos.x];
+    }
+};
+
+#endif
@@ -0,0 +1,384 @@
+#include "block_subscription.h"
+#include "block_codec.h"
+#include "block_index.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+
+#include "Core.h"
+#include "DataDefs.h"
+#include "modules/MapCache.h"
+#include "modules/Maps.h"
+
+#include "df/flow_info.h"
+#include "df/map_block.h"
+#include "df/world.h"
+
+using namespace DFHack;
+using namespace RemoteFortressReader;
+using namespace std;
+using df::global::world;
+
+/*
+ * Change detection for block subscriptions.
+ *
+ * Every subscribed block is hashed at most once per scan, no matter how
+ * many subscribers watch it. Each part of a block remembers the serial
+ * number of the scan that last saw it change, and each subscriber
+ * remembers the last scan it was sent, so a fetch only has to compare
+ * two integers per block to know what to send.
+ */
+
+bool IsAirBlock(df::map_block * block);
+void CopyBlock(df::map_block * DfBlock, RemoteFortressReader::MapBlock * NetBlock, MapExtras::MapCache * MC, DFCoord pos);
+void CopyDesignation(df::map_block * DfBlock, RemoteFortressReader::MapBlock * NetBlock, MapExtras::MapCache * MC, DFCoord pos);
+void Copyspatters(df::map_block * DfBlock, RemoteFortressReader::MapBlock * NetBlock, MapExtras::MapCache * MC, DFCoord pos);
+void CopyItems(df::map_block * DfBlock, RemoteFortressReader::MapBlock * NetBlock, MapExtras::MapCache * MC, DFCoord pos);
+void CopyFlows(df::map_block * DfBlock, RemoteFortressReader::MapBlock * NetBlock);
+
+namespace {
+    enum BlockPart {
+        PART_TILES,
+        PART_DESIGNATION,
+        PART_SPATTER,
+        PART_ITEMS,
+        PART_FLOWS,
+        PART_COUNT
+    };
+
+    struct BlockState {
+        bool known; // Hashed at least once since the map was loaded
+        uint32_t scanned; // Serial of the last scan that hashed this block
+        uint32_t hash[PART_COUNT];
+        uint32_t changed[PART_COUNT]; // Serial of the last scan that saw a change
+    };
+
+    struct Subscriber {
+        int min_x, max_x, min_y, max_y, min_z, max_z; // Block coordinates, max exclusive
+        int tick_interval;
+        bool compress_planes, deflate; // As in BlockRequest
+        uint32_t seen; // Serial of the last scan sent to the client
+        bool pending; // A scan found changes inside the box since the last fetch
+        chrono::steady_clock::time_point last_poll;
+
+        bool contains(const DFCoord &pos) const
+        {
+            return pos.x >= min_x && pos.x < max_x &&
+                pos.y >= min_y && pos.y < max_y &&
+                pos.z >= min_z && pos.z < max_z;
+        }
+    };
+
+    // Subscriptions not polled for this long are dropped
+    const chrono::seconds subscriber_timeout(60);
+    // Longest wait a GetBlockUpdates call may ask for
+    const int max_wait_ms = 10000;
+}
+
+// Accessed with the core suspended
+static FlatBlockGrid<BlockState> block_states;
+static int updates_since_scan = 0;
+
+// Guards the subscriber table; always taken after the core lock
+static mutex subscriber_mutex;
+static condition_variable subscriber_cond;
+static map<int, Subscriber> subscribers;
+static int next_subscriber_id = 1;
+static uint32_t scan_serial = 0;
+static bool shutting_down = false;
+
+static uint32_t ItemsHash(df::map_block * block)
+{
+    if (block->items.empty())
+        return 0;
+    return BlockHash(block->items.data(), block->items.size() * sizeof(block->items[0]));
+}
+
+static uint32_t FlowsHash(df::map_block * block)
+{
+    uint32_t hash = 0;
+    for (size_t i = 0; i < block->flows.size(); i++)
+        hash ^= BlockHash(block->flows[i], sizeof(df::flow_info)) + i;
+    return hash;
+}
+
+static void ScanBlock(df::map_block * block, BlockState &state, bool is_new, bool &changed)
+{
+    uint32_t hash[PART_COUNT];
+    hash[PART_TILES] = TiletypeHash(block);
+    hash[PART_DESIGNATION] = DesignationHash(block);
+    hash[PART_SPATTER] = SpatterHash(block);
+    hash[PART_ITEMS] = ItemsHash(block);
+    hash[PART_FLOWS] = FlowsHash(block);
+
+    // Blocks that start out as plain air are not worth sending
+    // until something actually happens in them.
+    bool skip = is_new && IsAirBlock(block);
+
+    for (int i = 0; i < PART_COUNT; i++)
+    {
+        if (is_new || state.hash[i] != hash[i])
+        {
+            state.hash[i] = hash[i];
+            if (!skip)
+            {
+                state.changed[i] = scan_serial;
+                changed = true;
+            }
+        }
+    }
+
+    state.known = true;
+    state.scanned = scan_serial;
+}
+
+void UpdateBlockSubscriptions()
+{
+    lock_guard<mutex> lock(subscriber_mutex);
+
+    if (subscribers.empty() || !world || !Maps::IsValid())
+        return;
+
+    updates_since_scan++;
+
+    int interval = -1;
+    auto now = chrono::steady_clock::now();
+
+    for (auto it = subscribers.begin(); it != subscribers.end();)
+    {
+        if (now - it->second.last_poll > subscriber_timeout)
+        {
+            it = subscribers.erase(it);
+            continue;
+        }
+        if (interval < 0 || it->second.tick_interval < interval)
+            interval = it->second.tick_interval;
+        ++it;
+    }
+
+    if (interval < 0 || updates_since_scan < interval)
+        return;
+
+    updates_since_scan = 0;
+    scan_serial++;
+    block_states.sync();
+
+    bool any_changed = false;
+
+    for (auto &sub : subscribers)
+    {
+        auto &box = sub.second;
+        // Boxes were clamped to the map they subscribed on, which may since have been replaced
+        int max_x = min(box.max_x, int(world->map.x_count_block));
+        int max_y = min(box.max_y, int(world->map.y_count_block));
+        int max_z = min(box.max_z, int(world->map.z_count_block));
+
+        for (int z = box.min_z; z < max_z; z++)
+            for (int y = box.min_y; y < max_y; y++)
+                for (int x = box.min_x; x < max_x; x++)
+                {
+                    DFCoord pos(x, y, z);
+                    df::map_block * block = Maps::getBlock(pos);
+                    if (!block)
+                        continue;
+
+                    BlockState * state = block_states.get(pos);
+                    if (!state)
+                        continue;
+                    bool is_new = !state->known;
+
+                    // Shared by overlapping subscriptions
+                    if (!is_new && state->scanned == scan_serial)
+                        continue;
+
+                    bool changed = false;
+                    ScanBlock(block, *state, is_new, changed);
+
+                    if (!changed)
+                        continue;
+
+                    any_changed = true;
+                    for (auto &other : subscribers)
+                        if (other.second.contains(pos))
+                            other.second.pending = true;
+                }
+    }
+
+    if (any_changed)
+        subscriber_cond.notify_all();
+}
+
+void ResetBlockSubscriptions()
+{
+    lock_guard<mutex> lock(subscriber_mutex);
+
+    block_states.clear();
+    updates_since_scan = 0;
+
+    for (auto &sub : subscribers)
+    {
+        sub.second.seen = 0;
+        sub.second.pending = false;
+    }
+}
+
+void ShutdownBlockSubscriptions()
+{
+    lock_guard<mutex> lock(subscriber_mutex);
+
+    shutting_down = true;
+    subscribers.clear();
+    block_states.clear();
+    subscriber_cond.notify_all();
+}
+
+command_result SubscribeBlocks(color_ostream &stream, const BlockSubscribeRequest *in, BlockSubscription *out)
+{
+    lock_guard<mutex> lock(subscriber_mutex);
+
+    if (in->has_id() && !subscribers.count(in->id()))
+    {
+        stream.printerr("No such block subscription: %d\n", in->id());
+        return CR_NOT_FOUND;
+    }
+
+    if (!world || !Maps::IsValid())
+        return CR_WRONG_USAGE;
+
+    auto &view = in->view();
+    if (view.min_x() > view.max_x() || view.min_y() > view.max_y() || view.min_z() > view.max_z())
+    {
+        stream.printerr("Invalid block subscription box.\n");
+        return CR_WRONG_USAGE;
+    }
+
+    int id = in->has_id() ? in->id() : next_subscriber_id++;
+    Subscriber &sub = subscribers[id];
+    // The box is scanned on the simulation thread, so keep it inside the map
+    auto clamp = [](int v, int lo, int hi) { return max(lo, min(hi, v)); };
+    sub.min_x = clamp(view.min_x(), 0, world->map.x_count_block - 1);
+    sub.max_x = clamp(view.max_x(), 0, world->map.x_count_block);
+    sub.min_y = clamp(view.min_y(), 0, world->map.y_count_block - 1);
+    sub.max_y = clamp(view.max_y(), 0, world->map.y_count_block);
+    sub.min_z = clamp(view.min_z(), 0, world->map.z_count_block - 1);
+    sub.max_z = clamp(view.max_z(), 0, world->map.z_count_block);
+    sub.tick_interval = in->has_tick_interval() ? max(1, in->tick_interval()) : 1;
+    sub.compress_planes = view.compress_planes();
+    sub.deflate = view.deflate();
+    // A new or moved box starts with a full resend
+    sub.seen = 0;
+    sub.pending = false;
+    sub.last_poll = chrono::steady_clock::now();
+
+    out->set_id(id);
+    return CR_OK;
+}
+
+command_result UnsubscribeBlocks(color_ostream &stream, const BlockSubscription *in)
+{
+    lock_guard<mutex> lock(subscriber_mutex);
+
+    if (!subscribers.erase(in->id()))
+        return CR_NOT_FOUND;
+
+    subscriber_cond.notify_all();
+    return CR_OK;
+}
+
+// Registered with SF_DONT_SUSPEND, so that waiting does not hold the core,
+// and SF_MAY_BLOCK, so that it does not hold a shared RPC thread either.
+command_result GetBlockUpdates(color_ostream &stream, const BlockUpdateRequest *in, BlockList *out)
+{
+    int id = in->id();
+
+    {
+        unique_lock<mutex> lock(subscriber_mutex);
+
+        auto it = subscribers.find(id);
+        if (it == subscribers.end())
+            return CR_NOT_FOUND;
+
+        it->second.last_poll = chrono::steady_clock::now();
+
+        if (in->wait_ms() > 0 && !it->second.pending && it->second.seen != 0)
+        {
+            int wait_ms = min(in->wait_ms(), max_wait_ms);
+            subscriber_cond.wait_for(lock, chrono::milliseconds(wait_ms), [id]() {
+                auto it = subscribers.find(id);
+                return shutting_down || it == subscribers.end() || it->second.pending;
+            });
+        }
+    }
+
+    CoreSuspender suspend;
+    lock_guard<mutex> lock(subscriber_mutex);
+
+    auto it = subscribers.find(id);
+    if (it == subscribers.end())
+        return CR_NOT_FOUND;
+
+    Subscriber &sub = it->second;
+
+    if (!Maps::IsValid())
+        return CR_WRONG_USAGE;
+
+    int x, y, z;
+    Maps::getPosition(x, y, z);
+    out->set_map_x(x);
+    out->set_map_y(y);
+
+    block_states.sync();
+    MapExtras::MapCache MC;
+
+    for (int zz = sub.max_z - 1; zz >= sub.min_z; zz--)
+        for (int yy = sub.min_y; yy < sub.max_y; yy++)
+            for (int xx = sub.min_x; xx < sub.max_x; xx++)
+            {
+                DFCoord pos(xx, yy, zz);
+
+                const BlockState * state = block_states.get(pos);
+                if (!state || !state->known)
+                    continue;
+
+                bool send[PART_COUNT];
+                bool any = false;
+
+                for (int i = 0; i < PART_COUNT; i++)
+                {
+                    send[i] = state->changed[i] > sub.seen;
+                    any = any || send[i];
+                }
+
+                if (!any)
+                    continue;
+
+                df::map_block * block = Maps::getBlock(pos);
+                if (!block)
+                    continue;
+
+                auto net_block = out->add_map_blocks();
+
+                if (send[PART_TILES])
+                    CopyBlock(block, net_block, &MC, pos);
+                if (send[PART_DESIGNATION])
+                    CopyDesignation(block, net_block, &MC, pos);
+                if (send[PART_SPATTER])
+                    Copyspatters(block, net_block, &MC, pos);
+                if (send[PART_ITEMS])
+                    CopyItems(block, net_block, &MC, pos);
+                if (send[PART_FLOWS])
+                    CopyFlows(block, net_block);
+                if (sub.compress_planes)
+                    CompressBlockPlanes(net_block);
+            }
+
+    sub.seen = scan_serial;
+    sub.pending = false;
+
+    MC.trash();
+    if (sub.deflate && !DeflateBlockList(out))
+        return CR_FAILURE;
+    return CR_OK;
+}
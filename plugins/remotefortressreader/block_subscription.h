@@ -0,0 +1,18 @@
+#ifndef BLOCK_SUBSCRIPTION_H
+#define BLOCK_SUBSCRIPTION_H
+#include <stdint.h>
+#include "RemoteClient.h"
+#include "RemoteFortressReader.pb.h"
+
+DFHack::command_result SubscribeBlocks(DFHack::color_ostream &stream, const RemoteFortressReader::BlockSubscribeRequest *in, RemoteFortressReader::BlockSubscription *out);
+DFHack::command_result UnsubscribeBlocks(DFHack::color_ostream &stream, const RemoteFortressReader::BlockSubscription *in);
+DFHack::command_result GetBlockUpdates(DFHack::color_ostream &stream, const RemoteFortressReader::BlockUpdateRequest *in, RemoteFortressReader::BlockList *out);
+
+// Runs the shared change scan when due; called from plugin_onupdate.
+void UpdateBlockSubscriptions();
+// Forgets all block state, e.g. when the map is unloaded.
+void ResetBlockSubscriptions();
+// Wakes up waiting GetBlockUpdates calls before the plugin goes away.
+void ShutdownBlockSubscriptions();
+
+#endif
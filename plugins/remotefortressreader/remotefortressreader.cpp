@@ -116,6 +116,9 @@
 #include "df/unit_relationship_type.h"
 
 #include "adventure_control.h"
+#include "block_codec.h"
+#include "block_index.h"
+#include "block_subscription.h"
 #include "building_reader.h"
 #include "item_reader.h"
 
@@ -139,17 +142,18 @@ REQUIRE_GLOBAL(ui_advmode);
 // Here go all the command declarations...
 // mostly to allow having the mandatory stuff on top of the file and commands on the bottom
 
+class BlockChangeTracker;
+
 static command_result GetGrowthList(color_ostream &stream, const EmptyMessage *in, MaterialList *out);
 static command_result GetMaterialList(color_ostream &stream, const EmptyMessage *in, MaterialList *out);
 static command_result GetTiletypeList(color_ostream &stream, const EmptyMessage *in, TiletypeList *out);
-static command_result GetBlockList(color_ostream &stream, const BlockRequest *in, BlockList *out);
+static command_result GetBlockList(color_ostream &stream, const BlockRequest *in, BlockList *out, BlockChangeTracker *tracker);
 static command_result GetPlantList(color_ostream &stream, const BlockRequest *in, PlantList *out);
 static command_result CheckHashes(color_ostream &stream, const EmptyMessage *in);
 static command_result GetUnitList(color_ostream &stream, const EmptyMessage *in, UnitList *out);
 static command_result GetUnitListInside(color_ostream &stream, const BlockRequest *in, UnitList *out);
 static command_result GetViewInfo(color_ostream &stream, const EmptyMessage *in, ViewInfo *out);
 static command_result GetMapInfo(color_ostream &stream, const EmptyMessage *in, MapInfo *out);
-static command_result ResetMapHashes(color_ostream &stream, const EmptyMessage *in);
 static command_result GetWorldMap(color_ostream &stream, const EmptyMessage *in, WorldMap *out);
 static command_result GetWorldMapNew(color_ostream &stream, const EmptyMessage *in, WorldMap *out);
 static command_result GetWorldMapCenter(color_ostream &stream, const EmptyMessage *in, WorldMap *out);
@@ -171,6 +175,110 @@ static command_result GetLanguage(color_ostream & stream, const EmptyMessage * i
 
 void CopyBlock(df::map_block * DfBlock, RemoteFortressReader::MapBlock * NetBlock, MapExtras::MapCache * MC, DFCoord pos);
 
+/*
+ * Per-client state for GetBlockList change detection. Each connection
+ * gets its own instance through RemoteFortressReaderService, so several
+ * viewers no longer reset each other's hashes.
+ */
+class BlockChangeTracker
+{
+    struct Entry
+    {
+        uint8_t seen; // One bit per hash below
+        uint32_t tiletype, designation, spatter;
+    };
+
+    enum {
+        SEEN_TILETYPE = 1,
+        SEEN_DESIGNATION = 2,
+        SEEN_SPATTER = 4
+    };
+
+    FlatBlockGrid<Entry> blocks;
+    std::vector<uint8_t> engravings_sent;
+    uint32_t engraving_generation;
+
+    static bool update(Entry * entry, int bit, uint32_t Entry::*field, uint32_t hash)
+    {
+        if (!entry)
+            return true;
+        if ((entry->seen & bit) && entry->*field == hash)
+            return false;
+        entry->seen |= bit;
+        entry->*field = hash;
+        return true;
+    }
+
+public:
+    BlockChangeTracker() : engraving_generation(0) {}
+
+    void sync()
+    {
+        blocks.sync();
+        if (engraving_generation != BlockGridGeneration())
+        {
+            engraving_generation = BlockGridGeneration();
+            engravings_sent.clear();
+        }
+    }
+
+    void reset()
+    {
+        blocks.reset();
+        engravings_sent.clear();
+    }
+
+    bool isTiletypeChanged(DFCoord pos, df::map_block * block)
+    {
+        return update(blocks.get(pos), SEEN_TILETYPE, &Entry::tiletype, TiletypeHash(block));
+    }
+
+    bool isDesignationChanged(DFCoord pos, df::map_block * block)
+    {
+        return update(blocks.get(pos), SEEN_DESIGNATION, &Entry::designation, DesignationHash(block));
+    }
+
+    bool isSpatterChanged(DFCoord pos, df::map_block * block)
+    {
+        return update(blocks.get(pos), SEEN_SPATTER, &Entry::spatter, SpatterHash(block));
+    }
+
+    bool isEngravingNew(size_t index)
+    {
+        if (index >= engravings_sent.size())
+            engravings_sent.resize(index + 1, 0);
+        if (engravings_sent[index])
+            return false;
+        engravings_sent[index] = 1;
+        return true;
+    }
+
+    void engravingIsNotNew(size_t index)
+    {
+        if (index < engravings_sent.size())
+            engravings_sent[index] = 0;
+    }
+};
+
+class RemoteFortressReaderService : public RPCService
+{
+    BlockChangeTracker tracker;
+
+public:
+    RemoteFortressReaderService();
+
+    command_result GetBlockList(color_ostream &stream, const BlockRequest *in, BlockList *out)
+    {
+        return ::GetBlockList(stream, in, out, &tracker);
+    }
+
+    command_result ResetMapHashes(color_ostream &stream, const EmptyMessage *in)
+    {
+        tracker.reset();
+        return CR_OK;
+    }
+};
+
 const char* growth_locations[] = {
     "TWIGS",
     "LIGHT_BRANCHES",
@@ -291,45 +399,51 @@ DFhackCExport command_result plugin_init(color_ostream &out, std::vector <Plugin
 #define SF_ALLOW_REMOTE 0
 #endif // !SF_ALLOW_REMOTE
 
+RemoteFortressReaderService::RemoteFortressReaderService()
+{
+    addFunction("GetMaterialList", GetMaterialList, SF_ALLOW_REMOTE);
+    addFunction("GetGrowthList", GetGrowthList, SF_ALLOW_REMOTE);
+    addMethod("GetBlockList", &RemoteFortressReaderService::GetBlockList, SF_ALLOW_REMOTE);
+    addFunction("CheckHashes", CheckHashes, SF_ALLOW_REMOTE);
+    addFunction("GetTiletypeList", GetTiletypeList, SF_ALLOW_REMOTE);
+    addFunction("GetPlantList", GetPlantList, SF_ALLOW_REMOTE);
+    addFunction("GetUnitList", GetUnitList, SF_ALLOW_REMOTE);
+    addFunction("GetUnitListInside", GetUnitListInside, SF_ALLOW_REMOTE);
+    addFunction("GetViewInfo", GetViewInfo, SF_ALLOW_REMOTE);
+    addFunction("GetMapInfo", GetMapInfo, SF_ALLOW_REMOTE);
+    addMethod("ResetMapHashes", &RemoteFortressReaderService::ResetMapHashes, SF_ALLOW_REMOTE);
+    addFunction("GetItemList", GetItemList, SF_ALLOW_REMOTE);
+    addFunction("GetBuildingDefList", GetBuildingDefList, SF_ALLOW_REMOTE);
+    addFunction("GetWorldMap", GetWorldMap, SF_ALLOW_REMOTE);
+    addFunction("GetWorldMapNew", GetWorldMapNew, SF_ALLOW_REMOTE);
+    addFunction("GetRegionMaps", GetRegionMaps, SF_ALLOW_REMOTE);
+    addFunction("GetRegionMapsNew", GetRegionMapsNew, SF_ALLOW_REMOTE);
+    addFunction("GetCreatureRaws", GetCreatureRaws, SF_ALLOW_REMOTE);
+    addFunction("GetPartialCreatureRaws", GetPartialCreatureRaws, SF_ALLOW_REMOTE);
+    addFunction("GetWorldMapCenter", GetWorldMapCenter, SF_ALLOW_REMOTE);
+    addFunction("GetPlantRaws", GetPlantRaws, SF_ALLOW_REMOTE);
+    addFunction("GetPartialPlantRaws", GetPartialPlantRaws, SF_ALLOW_REMOTE);
+    addFunction("CopyScreen", CopyScreen, SF_ALLOW_REMOTE);
+    addFunction("PassKeyboardEvent", PassKeyboardEvent, SF_ALLOW_REMOTE);
+    addFunction("SendDigCommand", SendDigCommand, SF_ALLOW_REMOTE);
+    addFunction("SetPauseState", SetPauseState, SF_ALLOW_REMOTE);
+    addFunction("GetPauseState", GetPauseState, SF_ALLOW_REMOTE);
+    addFunction("GetVersionInfo", GetVersionInfo, SF_ALLOW_REMOTE);
+    addFunction("GetReports", GetReports, SF_ALLOW_REMOTE);
+    addFunction("MoveCommand", MoveCommand, SF_ALLOW_REMOTE);
+    addFunction("JumpCommand", JumpCommand, SF_ALLOW_REMOTE);
+    addFunction("MenuQuery", MenuQuery, SF_ALLOW_REMOTE);
+    addFunction("MovementSelectCommand", MovementSelectCommand, SF_ALLOW_REMOTE);
+    addFunction("MiscMoveCommand", MiscMoveCommand, SF_ALLOW_REMOTE);
+    addFunction("GetLanguage", GetLanguage, SF_ALLOW_REMOTE);
+    addFunction("SubscribeBlocks", SubscribeBlocks, SF_ALLOW_REMOTE);
+    addFunction("UnsubscribeBlocks", UnsubscribeBlocks, SF_ALLOW_REMOTE);
+    addFunction("GetBlockUpdates", GetBlockUpdates, SF_ALLOW_REMOTE | SF_DONT_SUSPEND | SF_MAY_BLOCK);
+}
+
 DFhackCExport RPCService *plugin_rpcconnect(color_ostream &)
 {
-    RPCService *svc = new RPCService();
-    svc->addFunction("GetMaterialList", GetMaterialList, SF_ALLOW_REMOTE);
-    svc->addFunction("GetGrowthList", GetGrowthList, SF_ALLOW_REMOTE);
-    svc->addFunction("GetBlockList", GetBlockList, SF_ALLOW_REMOTE);
-    svc->addFunction("CheckHashes", CheckHashes, SF_ALLOW_REMOTE);
-    svc->addFunction("GetTiletypeList", GetTiletypeList, SF_ALLOW_REMOTE);
-    svc->addFunction("GetPlantList", GetPlantList, SF_ALLOW_REMOTE);
-    svc->addFunction("GetUnitList", GetUnitList, SF_ALLOW_REMOTE);
-    svc->addFunction("GetUnitListInside", GetUnitListInside, SF_ALLOW_REMOTE);
-    svc->addFunction("GetViewInfo", GetViewInfo, SF_ALLOW_REMOTE);
-    svc->addFunction("GetMapInfo", GetMapInfo, SF_ALLOW_REMOTE);
-    svc->addFunction("ResetMapHashes", ResetMapHashes, SF_ALLOW_REMOTE);
-    svc->addFunction("GetItemList", GetItemList, SF_ALLOW_REMOTE);
-    svc->addFunction("GetBuildingDefList", GetBuildingDefList, SF_ALLOW_REMOTE);
-    svc->addFunction("GetWorldMap", GetWorldMap, SF_ALLOW_REMOTE);
-    svc->addFunction("GetWorldMapNew", GetWorldMapNew, SF_ALLOW_REMOTE);
-    svc->addFunction("GetRegionMaps", GetRegionMaps, SF_ALLOW_REMOTE);
-    svc->addFunction("GetRegionMapsNew", GetRegionMapsNew, SF_ALLOW_REMOTE);
-    svc->addFunction("GetCreatureRaws", GetCreatureRaws, SF_ALLOW_REMOTE);
-    svc->addFunction("GetPartialCreatureRaws", GetPartialCreatureRaws, SF_ALLOW_REMOTE);
-    svc->addFunction("GetWorldMapCenter", GetWorldMapCenter, SF_ALLOW_REMOTE);
-    svc->addFunction("GetPlantRaws", GetPlantRaws, SF_ALLOW_REMOTE);
-    svc->addFunction("GetPartialPlantRaws", GetPartialPlantRaws, SF_ALLOW_REMOTE);
-    svc->addFunction("CopyScreen", CopyScreen, SF_ALLOW_REMOTE);
-    svc->addFunction("PassKeyboardEvent", PassKeyboardEvent, SF_ALLOW_REMOTE);
-    svc->addFunction("SendDigCommand", SendDigCommand, SF_ALLOW_REMOTE);
-    svc->addFunction("SetPauseState", SetPauseState, SF_ALLOW_REMOTE);
-    svc->addFunction("GetPauseState", GetPauseState, SF_ALLOW_REMOTE);
-    svc->addFunction("GetVersionInfo", GetVersionInfo, SF_ALLOW_REMOTE);
-    svc->addFunction("GetReports", GetReports, SF_ALLOW_REMOTE);
-    svc->addFunction("MoveCommand", MoveCommand, SF_ALLOW_REMOTE);
-    svc->addFunction("JumpCommand", JumpCommand, SF_ALLOW_REMOTE);
-    svc->addFunction("MenuQuery", MenuQuery, SF_ALLOW_REMOTE);
-    svc->addFunction("MovementSelectCommand", MovementSelectCommand, SF_ALLOW_REMOTE);
-    svc->addFunction("MiscMoveCommand", MiscMoveCommand, SF_ALLOW_REMOTE);
-    svc->addFunction("GetLanguage", GetLanguage, SF_ALLOW_REMOTE);
-    return svc;
+    return new RemoteFortressReaderService();
 }
 
 // This is called right before the plugin library is removed from memory.
@@ -338,6 +452,16 @@ DFhackCExport command_result plugin_shutdown(color_ostream &out)
     // You *MUST* kill all threads you created before this returns.
     // If everything fails, just return CR_FAILURE. Your plugin will be
     // in a zombie state, but things won't crash.
+    ShutdownBlockSubscriptions();
+    return CR_OK;
+}
+
+DFhackCExport command_result plugin_onstatechange(color_ostream &out, state_change_event event)
+{
+    if (event == SC_MAP_LOADED || event == SC_MAP_UNLOADED)
+        InvalidateBlockGrids();
+    if (event == SC_MAP_UNLOADED)
+        ResetBlockSubscriptions();
     return CR_OK;
 }
 
@@ -346,28 +470,10 @@ DFhackCExport command_result plugin_onupdate(color_ostream &out)
     if (!enableUpdates)
         return CR_OK;
     KeyUpdate();
+    UpdateBlockSubscriptions();
     return CR_OK;
 }
 
-uint16_t fletcher16(uint8_t const *data, size_t bytes)
-{
-    uint16_t sum1 = 0xff, sum2 = 0xff;
-
-    while (bytes) {
-        size_t tlen = bytes > 20 ? 20 : bytes;
-        bytes -= tlen;
-        do {
-            sum2 += sum1 += *data++;
-        } while (--tlen);
-        sum1 = (sum1 & 0xff) + (sum1 >> 8);
-        sum2 = (sum2 & 0xff) + (sum2 >> 8);
-    }
-    /* Second reduction step to reduce sums to 8 bits */
-    sum1 = (sum1 & 0xff) + (sum1 >> 8);
-    sum2 = (sum2 & 0xff) + (sum2 >> 8);
-    return sum2 << 8 | sum1;
-}
-
 void ConvertDfColor(int16_t index, RemoteFortressReader::ColorDefinition * out)
 {
     if (!df::global::enabler)
@@ -668,7 +774,7 @@ static command_result CheckHashes(color_ostream &stream, const EmptyMessage *in)
     for (size_t i = 0; i < world->map.map_blocks.size(); i++)
     {
         df::map_block * block = world->map.map_blocks[i];
-        fletcher16((uint8_t*)(block->tiletype), 16 * 16 * sizeof(df::enums::tiletype::tiletype));
+        TiletypeHash(block);
     }
     clock_t end = clock();
     double elapsed_secs = double(end - start) / CLOCKS_PER_SEC;
@@ -692,152 +798,23 @@ void CopyMat(RemoteFortressReader::MatPair * mat, int type, int index)
 
 }
 
-map<DFCoord, uint16_t> hashes;
-
-bool IsTiletypeChanged(DFCoord pos)
-{
-    uint16_t hash;
-    df::map_block * block = Maps::getBlock(pos);
-    if (block)
-        hash = fletcher16((uint8_t*)(block->tiletype), 16 * 16 * (sizeof(df::enums::tiletype::tiletype)));
-    else
-        hash = 0;
-    if (hashes[pos] != hash)
-    {
-        hashes[pos] = hash;
-        return true;
-    }
-    return false;
-}
-
-map<DFCoord, uint16_t> waterHashes;
-
-bool IsDesignationChanged(DFCoord pos)
-{
-    uint16_t hash;
-    df::map_block * block = Maps::getBlock(pos);
-    if (block)
-        hash = fletcher16((uint8_t*)(block->designation), 16 * 16 * (sizeof(df::tile_designation)));
-    else
-        hash = 0;
-    if (waterHashes[pos] != hash)
-    {
-        waterHashes[pos] = hash;
-        return true;
-    }
-    return false;
-}
-
-map<DFCoord, uint8_t> buildingHashes;
-
-bool IsBuildingChanged(DFCoord pos)
-{
-    df::map_block * block = Maps::getBlock(pos);
-    bool changed = false;
-    for (int x = 0; x < 16; x++)
-        for (int y = 0; y < 16; y++)
-        {
-            auto bld = block->occupancy[x][y].bits.building;
-            if (buildingHashes[pos] != bld)
-            {
-                buildingHashes[pos] = bld;
-                changed = true;
-            }
-        }
-    return changed;
-}
-
-map<DFCoord, uint16_t> spatterHashes;
-
-bool IsspatterChanged(DFCoord pos)
+// True if the block has nothing worth drawing: only empty or open tiles,
+// no liquids, no buildings and no flows.
+bool IsAirBlock(df::map_block * block)
 {
-    df::map_block * block = Maps::getBlock(pos);
-    bool changed = false;
-    std::vector<df::block_square_event_material_spatterst *> materials;
-#if DF_VERSION_INT > 34011
-    std::vector<df::block_square_event_item_spatterst *> items;
-    if (!Maps::SortBlockEvents(block, NULL, NULL, &materials, NULL, NULL, NULL, &items))
-        return false;
-#else
-    if (!Maps::SortBlockEvents(block, NULL, NULL, &materials, NULL, NULL))
-        return false;
-#endif
-
-    uint16_t hash = 0;
+    static const Maps::TiletypeSet airTiles = Maps::TiletypeSet::where([](df::tiletype tt) {
+        auto shape = DFHack::tileShapeBasic(DFHack::tileShape(tt));
+        return shape == df::tiletype_shape_basic::None || shape == df::tiletype_shape_basic::Open;
+    });
+    df::tile_designation flowMask;
+    flowMask.bits.flow_size = 7;
+    df::tile_occupancy buildingMask;
+    buildingMask.bits.building = (df::tile_building_occ)7;
 
-    for (size_t i = 0; i < materials.size(); i++)
-    {
-        auto mat = materials[i];
-        hash ^= fletcher16((uint8_t*)mat, sizeof(df::block_square_event_material_spatterst));
-    }
-#if DF_VERSION_INT > 34011
-    for (size_t i = 0; i < items.size(); i++)
-    {
-        auto item = items[i];
-        hash ^= fletcher16((uint8_t*)item, sizeof(df::block_square_event_item_spatterst));
-    }
-#endif
-    if (spatterHashes[pos] != hash)
-    {
-        spatterHashes[pos] = hash;
-        return true;
-    }
-    return false;
-}
-
-map<int, uint16_t> itemHashes;
-
-bool isItemChanged(int i)
-{
-    uint16_t hash = 0;
-    auto item = df::item::find(i);
-    if (item)
-    {
-        hash = fletcher16((uint8_t*)item, sizeof(df::item));
-    }
-    if (itemHashes[i] != hash)
-    {
-        itemHashes[i] = hash;
-        return true;
-    }
-    return false;
-}
-
-bool areItemsChanged(vector<int> * items)
-{
-    bool result = false;
-    for (size_t i = 0; i < items->size(); i++)
-    {
-        if (isItemChanged(items->at(i)))
-            result = true;
-    }
-    return result;
-}
-
-map<int, int> engravingHashes;
-
-bool isEngravingNew(int index)
-{
-    if (engravingHashes[index])
-        return false;
-    engravingHashes[index] = true;
-    return true;
-}
-
-void engravingIsNotNew(int index)
-{
-    engravingHashes[index] = false;
-}
-
-static command_result ResetMapHashes(color_ostream &stream, const EmptyMessage *in)
-{
-    hashes.clear();
-    waterHashes.clear();
-    buildingHashes.clear();
-    spatterHashes.clear();
-    itemHashes.clear();
-    engravingHashes.clear();
-    return CR_OK;
+    return block->flows.size() == 0
+        && Maps::allTiles(block, airTiles)
+        && Maps::countTiles(block, flowMask, df::tile_designation()) == 256
+        && Maps::countTiles(block, buildingMask, df::tile_occupancy()) == 256;
 }
 
 df::matter_state GetState(df::material * mat, uint16_t temp = 10015)
@@ -1447,8 +1424,9 @@ void CopyFlows(df::map_block * DfBlock, RemoteFortressReader::MapBlock * NetBloc
     }
 }
 
-static command_result GetBlockList(color_ostream &stream, const BlockRequest *in, BlockList *out)
+static command_result GetBlockList(color_ostream &stream, const BlockRequest *in, BlockList *out, BlockChangeTracker *tracker)
 {
+    tracker->sync();
     int x, y, z;
     DFHack::Maps::getPosition(x, y, z);
     out->set_map_x(x);
@@ -1493,27 +1471,12 @@ static command_result GetBlockList(color_ostream &stream, const BlockRequest *in
                 df::map_block * block = DFHack::Maps::getBlock(pos);
                 if (block != NULL)
                 {
-                    bool nonAir = false;
-                    for (int xxx = 0; xxx < 16; xxx++)
-                        for (int yyy = 0; yyy < 16; yyy++)
-                        {
-                            if ((DFHack::tileShapeBasic(DFHack::tileShape(block->tiletype[xxx][yyy])) != df::tiletype_shape_basic::None &&
-                                DFHack::tileShapeBasic(DFHack::tileShape(block->tiletype[xxx][yyy])) != df::tiletype_shape_basic::Open)
-                                || block->designation[xxx][yyy].bits.flow_size > 0
-                                || block->occupancy[xxx][yyy].bits.building > 0)
-                            {
-                                nonAir = true;
-                                goto ItsAir;
-                            }
-                        }
-                    ItsAir:
-                    if (block->flows.size() > 0)
-                        nonAir = true;
+                    bool nonAir = !IsAirBlock(block);
                     if (nonAir || firstBlock)
                     {
-                        bool tileChanged = IsTiletypeChanged(pos);
-                        bool desChanged = IsDesignationChanged(pos);
-                        bool spatterChanged = IsspatterChanged(pos);
+                        bool tileChanged = tracker->isTiletypeChanged(pos, block);
+                        bool desChanged = tracker->isDesignationChanged(pos, block);
+                        bool spatterChanged = tracker->isSpatterChanged(pos, block);
                         bool itemsChanged = block->items.size() > 0;
                         bool flows = block->flows.size() > 0;
                         RemoteFortressReader::MapBlock *net_block = nullptr;
@@ -1540,6 +1503,8 @@ static command_result GetBlockList(color_ostream &stream, const BlockRequest *in
                         {
                             CopyFlows(block, net_block);
                         }
+                        if (net_block && in->compress_planes())
+                            CompressBlockPlanes(net_block);
                     }
                 }
             }
@@ -1577,7 +1542,7 @@ static command_result GetBlockList(color_ostream &stream, const BlockRequest *in
             continue;
         if (engraving->pos.z < min_z || engraving->pos.z > max_z)
             continue;
-        if (!isEngravingNew(i))
+        if (!tracker->isEngravingNew(i))
             continue;
 
         df::art_image_chunk * chunk = NULL;
@@ -1596,7 +1561,7 @@ static command_result GetBlockList(color_ostream &stream, const BlockRequest *in
         }
         if (!chunk)
         {
-            engravingIsNotNew(i);
+            tracker->engravingIsNotNew(i);
             continue;
         }
         auto netEngraving = out->add_engravings();
@@ -1623,6 +1588,8 @@ static command_result GetBlockList(color_ostream &stream, const BlockRequest *in
         ConvertDFCoord(wave->x2, wave->y2, wave->z, netWave->mutable_pos());
     }
     MC.trash();
+    if (in->deflate() && !DeflateBlockList(out))
+        return CR_FAILURE;
     return CR_OK;
 }
 
@@ -1,5 +1,6 @@
 #include "renderer_light.hpp"
 
+#include <algorithm>
 #include <functional>
 #include <math.h>
 #include <string>
@@ -294,8 +295,7 @@ void lightingEngineViewscreen::calculate()
         lightMap[getIndex(i,j)]=dim;
     }
     doOcupancyAndLights();
-    threading.signalDoneOcclusion();
-    threading.waitForWrites();
+    threading.process();
 }
 void lightingEngineViewscreen::updateWindow()
 {
@@ -788,12 +788,16 @@ void lightingEngineViewscreen::doOcupancyAndLights()
     }
     //citizen only emit light, if defined
     //or other creatures
+    std::vector<df::unit*> units;
     if(matCitizen.isEmiting || creatureDefs.size()>0)
-    for (size_t i=0;i<df::global::world->units.active.size();++i)
+        Units::getUnitsInBox(units,window_x,window_y,window_z,window_x+vpSize.x-1,window_y+vpSize.y-1,window_z);
+    for (size_t i=0;i<units.size();++i)
     {
-        df::unit *u = df::global::world->units.active[i];
+        df::unit *u = units[i];
+        if(!Units::isActive(u))
+            continue;
         coord2d pos=worldToViewportCoord(coord2d(u->pos.x,u->pos.y),vp,window2d);
-        if(u->pos.z==window_z && isInRect(pos,vp))
+        if(isInRect(pos,vp))
         {
             if (DFHack::Units::isCitizen(u) && !u->counters.unconscious)
                 addLight(getIndex(pos.x,pos.y),matCitizen.makeSource());
@@ -1247,9 +1251,10 @@ void lightingEngineViewscreen::loadSettings()
 /*
  *      Threading stuff
  */
-lightThread::lightThread( lightThreadDispatch& dispatch ):dispatch(dispatch),myThread(0),isDone(false)
+lightThread::lightThread( lightThreadDispatch& dispatch,int index ):dispatch(dispatch),myThread(0),index(index),
+    nextTask(0),endTask(0)
 {
-
+    dirty=mkrect_wh(0,0,0,0);
 }
 lightThread::~lightThread()
 {
@@ -1258,64 +1263,63 @@ lightThread::~lightThread()
 
 void lightThread::run()
 {
-    while(!isDone)
+    int seen=0;
+    int phase;
+    while(dispatch.waitForWork(seen,phase))
     {
-        //TODO: get area to process, and then process (by rounds): 1. occlusions, 2.sun, 3.lights(could be difficult, units/items etc...)
-        {//wait for occlusion (and lights) to be ready
-            tthread::lock_guard<tthread::mutex> guard(dispatch.occlusionMutex);
-            if(!dispatch.occlusionReady)
-            dispatch.occlusionDone.wait(dispatch.occlusionMutex);//wait for work
-            if(dispatch.unprocessed.size()==0 || !dispatch.occlusionReady) //spurious wake-up
-                continue;
-            if(dispatch.occlusion.size()!=canvas.size()) //oh no somebody resized stuff
-                canvas.resize(dispatch.occlusion.size());
-        }
-
-
-        { //get my rectangle (any will do)
-            tthread::lock_guard<tthread::mutex> guard(dispatch.unprocessedMutex);
-            if (dispatch.unprocessed.size()==0)
-            {
-                //wtf?? why?!
-                continue;
-            }
-            myRect=dispatch.unprocessed.top();
-            dispatch.unprocessed.pop();
-            if (dispatch.unprocessed.size()==0)
-            {
-                dispatch.occlusionReady=false;
-            }
-
+        if(phase==lightThreadDispatch::PHASE_LIGHT)
+        {
+            clearCanvas();
+            int task;
+            while((task=dispatch.takeTask(index))>=0)
+                work(dispatch.tasks[task]);
         }
-        work();
+        else
         {
-            tthread::lock_guard<tthread::mutex> guard(dispatch.writeLock);
-            combine();//write it back
-            dispatch.writeCount++;
+            int band;
+            while((band=dispatch.takeBand())>=0)
+                dispatch.blendBand(band);
         }
-        dispatch.writesDone.notify_one();//tell about it to the dispatch.
+        dispatch.finishWork();
     }
 }
 
-void lightThread::work()
+void lightThread::clearCanvas()
 {
-    canvas.assign(canvas.size(),rgbf(0,0,0));
-    for(int i=myRect.first.x;i<myRect.second.x;i++)
-    for(int j=myRect.first.y;j<myRect.second.y;j++)
+    if(dispatch.occlusion.size()!=canvas.size()) //oh no somebody resized stuff
     {
-        doLight(i,j);
+        canvas.assign(dispatch.occlusion.size(),rgbf(0,0,0));
+    }
+    else
+    {
+        int h=dispatch.getH();
+        for(int i=dirty.first.x;i<dirty.second.x;i++)
+            std::fill(canvas.begin()+i*h+dirty.first.y,canvas.begin()+i*h+dirty.second.y,rgbf(0,0,0));
     }
+    dirty=mkrect_wh(0,0,0,0);
 }
 
-void lightThread::combine()
+void lightThread::work(const rect2d& area)
 {
-    for(size_t i=0;i<canvas.size();i++)
+    for(int i=area.first.x;i<area.second.x;i++)
+    for(int j=area.first.y;j<area.second.y;j++)
     {
-        rgbf& c=dispatch.lightMap[i];
-        c=blend(c,canvas[i]);
+        doLight(i,j);
     }
 }
 
+void lightThread::blendInto(const rect2d& band)
+{
+    int h=dispatch.getH();
+    int x1=std::max(band.first.x,dirty.first.x);
+    int x2=std::min(band.second.x,dirty.second.x);
+    for(int i=x1;i<x2;i++)
+    for(int j=dirty.first.y;j<dirty.second.y;j++)
+    {
+        rgbf& c=dispatch.lightMap[i*h+j];
+        c=blend(c,canvas[i*h+j]);
+    }
+}
 
 rgbf lightThread::lightUpCell(rgbf power,int dx,int dy,int tx,int ty)
 {
@@ -1352,6 +1356,17 @@ rgbf lightThread::lightUpCell(rgbf power,int dx,int dy,int tx,int ty)
         rgbf oldCol=canvas[tile];
         rgbf ncol=blendMax(power,oldCol);
         canvas[tile]=ncol;
+        if(dirty.first.x==dirty.second.x)
+        {
+            dirty=mkrect_wh(tx,ty,1,1);
+        }
+        else
+        {
+            if(tx<dirty.first.x) dirty.first.x=tx;
+            if(ty<dirty.first.y) dirty.first.y=ty;
+            if(tx>=dirty.second.x) dirty.second.x=tx+1;
+            if(ty>=dirty.second.y) dirty.second.y=ty+1;
+        }
 
         if(wallhack)
             return rgbf();
@@ -1397,49 +1412,119 @@ void lightThread::doLight( int x,int y )
         }
     }
 }
-void lightThreadDispatch::signalDoneOcclusion()
+void lightThreadDispatch::process()
 {
+    viewPort=getMapViewport();
+    int threadCount=threadPool.size();
+    if(threadCount==0)
+        return;
+
+    tasks.clear();
+    for(int i=viewPort.first.x;i<viewPort.second.x;i+=TASK_SIZE)
+    for(int j=viewPort.first.y;j<viewPort.second.y;j+=TASK_SIZE)
     {
-        tthread::lock_guard<tthread::mutex> guardWrite(writeLock);
-        writeCount=0;
+        rect2d area=mkrect_wh(i,j,TASK_SIZE,TASK_SIZE);
+        if(area.second.x>viewPort.second.x)
+            area.second.x=viewPort.second.x;
+        if(area.second.y>viewPort.second.y)
+            area.second.y=viewPort.second.y;
+        tasks.push_back(area);
+    }
+    //neighbouring tiles go to the same thread, so each canvas stays compact
+    int taskCount=tasks.size();
+    for(int i=0;i<threadCount;i++)
+    {
+        threadPool[i]->nextTask=taskCount*i/threadCount;
+        threadPool[i]->endTask=taskCount*(i+1)/threadCount;
     }
-    tthread::lock_guard<tthread::mutex> guard1(occlusionMutex);
-    tthread::lock_guard<tthread::mutex> guard2(unprocessedMutex);
-    while(!unprocessed.empty())
-        unprocessed.pop();
-    viewPort=getMapViewport();
+    runPhase(PHASE_LIGHT);
+
+    bands.clear();
+    for(int i=viewPort.first.x;i<viewPort.second.x;i+=TASK_SIZE)
+    {
+        rect2d band=viewPort;
+        band.first.x=i;
+        if(i+TASK_SIZE<viewPort.second.x)
+            band.second.x=i+TASK_SIZE;
+        bands.push_back(band);
+    }
+    nextBand=0;
+    runPhase(PHASE_BLEND);
+}
+
+void lightThreadDispatch::runPhase(int newPhase)
+{
+    tthread::lock_guard<tthread::mutex> guard(stateMutex);
+    phase=newPhase;
+    running=threadPool.size();
+    generation++;
+    workReady.notify_all();
+    while(running>0)
+        workDone.wait(stateMutex);
+}
+
+bool lightThreadDispatch::waitForWork(int& seen,int& currentPhase)
+{
+    tthread::lock_guard<tthread::mutex> guard(stateMutex);
+    while(!shuttingDown && generation==seen)
+        workReady.wait(stateMutex);
+    if(shuttingDown)
+        return false;
+    seen=generation;
+    currentPhase=phase;
+    return true;
+}
+
+void lightThreadDispatch::finishWork()
+{
+    tthread::lock_guard<tthread::mutex> guard(stateMutex);
+    if(--running==0)
+        workDone.notify_all();
+}
+
+int lightThreadDispatch::takeTask(int thread)
+{
     int threadCount=threadPool.size();
-    int w=viewPort.second.x-viewPort.first.x;
-    int slicew=w/threadCount;
     for(int i=0;i<threadCount;i++)
     {
-        rect2d area=viewPort;
-        area.first.x=viewPort.first.x+i*slicew;
-        if(i==threadCount-1)
-            area.second.x=viewPort.second.x; //fix, when area is even number or sth.
-        else
-            area.second.x=viewPort.first.x+(i+1)*slicew;
-        unprocessed.push(area);
+        lightThread& from=*threadPool[(thread+i)%threadCount];
+        if(from.nextTask.load(std::memory_order_relaxed)>=from.endTask)
+            continue;
+        int task=from.nextTask.fetch_add(1);
+        if(task<from.endTask)
+            return task;
     }
-    occlusionReady=true;
-    occlusionDone.notify_all();
+    return -1;
+}
+
+int lightThreadDispatch::takeBand()
+{
+    int band=nextBand.fetch_add(1);
+    if(band<int(bands.size()))
+        return band;
+    return -1;
+}
+
+void lightThreadDispatch::blendBand(int band)
+{
+    for(size_t i=0;i<threadPool.size();i++)
+        threadPool[i]->blendInto(bands[band]);
 }
 
-lightThreadDispatch::lightThreadDispatch( lightingEngineViewscreen* p ):parent(p),lights(parent->lights),
-    occlusionReady(false),occlusion(parent->ocupancy),num_diffusion(parent->num_diffuse),
-    lightMap(parent->lightMap),writeCount(0)
+lightThreadDispatch::lightThreadDispatch( lightingEngineViewscreen* p ):parent(p),generation(0),phase(PHASE_LIGHT),
+    running(0),shuttingDown(false),lights(parent->lights),occlusion(parent->ocupancy),num_diffusion(parent->num_diffuse),
+    lightMap(parent->lightMap),nextBand(0)
 {
 
 }
 
 void lightThreadDispatch::shutdown()
 {
-    for(size_t i=0;i<threadPool.size();i++)
     {
-        threadPool[i]->isDone=true;
-
+        tthread::lock_guard<tthread::mutex> guard(stateMutex);
+        shuttingDown=true;
+        workReady.notify_all();
     }
-    occlusionDone.notify_all();//if stuck signal that you are done with stuff.
     for(size_t i=0;i<threadPool.size();i++)
     {
         threadPool[i]->myThread->join();
@@ -1463,20 +1548,16 @@ void threadStub(void * arg)
 }
 void lightThreadDispatch::start(int count)
 {
+    shuttingDown=false;
     for(int i=0;i<count;i++)
     {
-        std::unique_ptr<lightThread> nthread(new lightThread(*this));
-        nthread->myThread=new tthread::thread(&threadStub,nthread.get());
+        std::unique_ptr<lightThread> nthread(new lightThread(*this,i));
         threadPool.push_back(std::move(nthread));
     }
-}
-
-void lightThreadDispatch::waitForWrites()
-{
-    tthread::lock_guard<tthread::mutex> guard(writeLock);
-    while(threadPool.size()>size_t(writeCount))//missed it somehow already.
+    //threads look at each other's task ranges, so create them all first
+    for(int i=0;i<count;i++)
     {
-        writesDone.wait(writeLock); //if not, wait a bit
+        threadPool[i]->myThread=new tthread::thread(&threadStub,threadPool[i].get());
     }
 }
 
@@ -2,8 +2,8 @@
 #define RENDERER_LIGHT_INCLUDED
 #include "renderer_opengl.hpp"
 #include "Types.h"
+#include <atomic>
 #include <tuple>
-#include <stack>
 #include <memory>
 #include <unordered_map>
 // we are not using boost so let's cheat:
@@ -224,31 +224,42 @@ class lightingEngineViewscreen;
 class lightThreadDispatch
 {
     lightingEngineViewscreen *parent;
+
+    tthread::mutex stateMutex;
+    tthread::condition_variable workReady; //workers wait for the next phase
+    tthread::condition_variable workDone; //dispatch waits for the phase to finish
+    int generation; //bumped for every phase
+    int phase;
+    int running; //workers still busy with the current phase
+    bool shuttingDown;
+
+    void runPhase(int phase);
 public:
+    enum { PHASE_LIGHT, PHASE_BLEND };
+    static const int TASK_SIZE=16; //tasks are TASK_SIZE x TASK_SIZE tiles of the viewport
+
     DFHack::rect2d viewPort;
 
     std::vector<std::unique_ptr<lightThread> > threadPool;
     std::vector<lightSource>& lights;
-
-    tthread::mutex occlusionMutex;
-    tthread::condition_variable occlusionDone; //all threads wait for occlusion to finish
-    bool occlusionReady;
-    tthread::mutex unprocessedMutex;
-    std::stack<DFHack::rect2d> unprocessed; //stack of parts of map where lighting is not finished
     std::vector<rgbf>& occlusion;
     int& num_diffusion;
-
-    tthread::mutex writeLock; //mutex for lightMap
     std::vector<rgbf>& lightMap;
 
-    tthread::condition_variable writesDone;
-    int writeCount;
+    std::vector<DFHack::rect2d> tasks; //each thread owns a range, others steal from it when idle
+    std::vector<DFHack::rect2d> bands; //column bands of lightMap, blended in parallel
+    std::atomic<int> nextBand;
 
     lightThreadDispatch(lightingEngineViewscreen* p);
     ~lightThreadDispatch();
-    void signalDoneOcclusion();
+    void process(); //light up the viewport into lightMap, returns when done
     void shutdown();
-    void waitForWrites();
+
+    int takeTask(int thread); //index into tasks, or -1 when there is no work left
+    int takeBand();
+    void blendBand(int band); //blend all threads' canvases into one band of lightMap
+    bool waitForWork(int& seen,int& currentPhase); //false when shutting down
+    void finishWork();
 
     int getW();
     int getH();
@@ -257,16 +268,19 @@ public:
 class lightThread
 {
     std::vector<rgbf> canvas;
+    DFHack::rect2d dirty; //part of canvas lit this frame
     lightThreadDispatch& dispatch;
-    DFHack::rect2d myRect;
-    void work(); //main light calculation function
-    void combine(); //combine existing canvas into global lightmap
+    void clearCanvas();
+    void work(const DFHack::rect2d& area); //main light calculation function
 public:
     tthread::thread *myThread;
-    bool isDone; //no mutex, because bool is atomic
-    lightThread(lightThreadDispatch& dispatch);
+    int index;
+    std::atomic<int> nextTask; //owned task range, shared with thieves
+    int endTask;
+    lightThread(lightThreadDispatch& dispatch,int index);
     ~lightThread();
     void run();
+    void blendInto(const DFHack::rect2d& band); //blend lit part of canvas into lightMap
 private:
     void doLight(int x,int y);
     void doRay(const rgbf& power,int cx,int cy,int tx,int ty,int num_diffuse);
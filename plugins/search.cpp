@@ -38,6 +38,8 @@
 #include "df/viewscreen_unitlistst.h"
 #include "df/viewscreen_workshop_profilest.h"
 
+#include <unordered_map>
+
 using namespace std;
 using std::set;
 using std::vector;
@@ -330,6 +332,7 @@ protected:
         end_entry_mode();
         search_string = "";
         saved_list1.clear();
+        reset_search_cache();
     }
 
     // Shortcut to clear the search immediately
@@ -341,6 +344,27 @@ protected:
             saved_list1.clear();
         }
         search_string = "";
+        reset_search_cache();
+    }
+
+    // Forget the descriptions and matches of the saved list
+    void reset_search_cache()
+    {
+        saved_descriptions.assign(saved_list1.size(), string());
+        has_description.assign(saved_list1.size(), false);
+        last_search_l = "";
+        last_matches.clear();
+    }
+
+    // Lower case description of saved_list1[i], only built the first time it's needed
+    const string &get_saved_description(size_t i)
+    {
+        if (!has_description[i])
+        {
+            saved_descriptions[i] = toLower(get_element_description(saved_list1[i]));
+            has_description[i] = true;
+        }
+        return saved_descriptions[i];
     }
 
     virtual void save_original_values()
@@ -388,33 +412,49 @@ protected:
         }
 
         if (saved_list1.size() == 0)
+        {
             // On first run, save the original list
             save_original_values();
+            reset_search_cache();
+        }
         else
             do_pre_incremental_search();
 
+        if (saved_descriptions.size() != saved_list1.size())
+            reset_search_cache();
+
         clear_viewscreen_vectors();
 
         string search_string_l = toLower(search_string);
-        for (size_t i = 0; i < saved_list1.size(); i++ )
+
+        // If the query only grew, nothing outside the previous matches can match it
+        bool refine = !last_search_l.empty() && search_string_l.find(last_search_l) != string::npos;
+        size_t count = refine ? last_matches.size() : saved_list1.size();
+        vector<size_t> matches;
+
+        for (size_t n = 0; n < count; n++)
         {
+            size_t i = refine ? last_matches[n] : n;
             if (force_in_search(i))
             {
                 add_to_filtered_list(i);
+                matches.push_back(i);
                 continue;
             }
 
             if (!is_valid_for_search(i))
                 continue;
 
-            T element = saved_list1[i];
-            string desc = toLower(get_element_description(element));
-            if (desc.find(search_string_l) != string::npos)
+            if (get_saved_description(i).find(search_string_l) != string::npos)
             {
                 add_to_filtered_list(i);
+                matches.push_back(i);
             }
         }
 
+        last_search_l = search_string_l;
+        last_matches.swap(matches);
+
         do_post_search();
 
         if (cursor_pos)
@@ -448,6 +488,11 @@ protected:
     string search_string;
 
 protected:
+    vector<string> saved_descriptions;
+    vector<bool> has_description;
+    string last_search_l;
+    vector<size_t> last_matches;
+
     int *cursor_pos;
     char select_key;
     bool valid;
@@ -567,6 +612,22 @@ protected:
 
     virtual bool is_match(vector<T> &a, vector<T> &b) = 0;
 
+    // Called before find_in_primary_list lookups on a sorted list
+    virtual void index_primary_list()
+    {
+    }
+
+    // Position of element in the primary list, or -1 if it isn't there
+    virtual int find_in_primary_list(T &element)
+    {
+        for (size_t j = 0; j < this->primary_list->size(); j++)
+        {
+            if (is_match((*this->primary_list)[j], element))
+                return j;
+        }
+        return -1;
+    }
+
     void do_pre_incremental_search()
     {
         PARENT::do_pre_incremental_search();
@@ -576,19 +637,17 @@ protected:
         bool list_has_been_sorted = (this->primary_list->size() == reference_list.size()
             && !is_match(*this->primary_list, reference_list));
 
+        if (list_has_been_sorted)
+            index_primary_list();
+
         for (size_t i = 0; i < saved_indexes.size(); i++)
         {
             int adjusted_item_index = i;
             if (list_has_been_sorted)
             {
-                for (size_t j = 0; j < this->primary_list->size(); j++)
-                {
-                    if (is_match((*this->primary_list)[j], reference_list[i]))
-                    {
-                        adjusted_item_index = j;
-                        break;
-                    }
-                }
+                int j = find_in_primary_list(reference_list[i]);
+                if (j >= 0)
+                    adjusted_item_index = j;
             }
 
             update_saved_secondary_list_item(saved_indexes[i], adjusted_item_index);
@@ -639,6 +698,22 @@ class search_multicolumn_modifiable : public search_multicolumn_modifiable_gener
     {
         return a == b;
     }
+
+    // Elements can be hashed here, so sorted lists are matched through a map instead of a scan
+    unordered_map<T, int> primary_index;
+
+    void index_primary_list()
+    {
+        primary_index.clear();
+        for (size_t j = 0; j < this->primary_list->size(); j++)
+            primary_index.emplace((*this->primary_list)[j], j);
+    }
+
+    int find_in_primary_list(T &element)
+    {
+        auto it = primary_index.find(element);
+        return it == primary_index.end() ? -1 : it->second;
+    }
 };
 
 // General class for screens that have only one secondary list to keep in sync
@@ -9,12 +9,12 @@
 #include "Export.h"
 #include "PluginManager.h"
 #include "modules/World.h"
+#include "modules/Items.h"
 #include "modules/Kitchen.h"
 #include "VersionInfo.h"
 #include "df/world.h"
 #include "df/plant_raw.h"
 #include "df/item_flags.h"
-#include "df/items_other_id.h"
 
 using namespace std;
 using namespace DFHack;
@@ -320,11 +320,14 @@ DFhackCExport command_result plugin_onupdate(color_ostream &out)
         map<t_materialIndex, unsigned int> seedCount; // the number of seeds
 
         // count all seeds and plants by RAW material
-        for(size_t i = 0; i < world->items.other[items_other_id::SEEDS].size(); ++i)
+        auto &buckets = Items::getItemCensus(item_type::SEEDS);
+        for(size_t i = 0; i < buckets.size(); ++i)
         {
-            df::item * item = world->items.other[items_other_id::SEEDS][i];
-            t_materialIndex materialIndex = item->getMaterialIndex();
-            if(!ignoreSeeds(item->flags)) ++seedCount[materialIndex];
+            auto bucket = buckets[i];
+            for(size_t j = 0; j < bucket->items.size(); ++j)
+            {
+                if(!ignoreSeeds(bucket->items[j]->flags)) ++seedCount[bucket->mat_index];
+            }
         }
 
         map<t_materialIndex, unsigned int> watchMap;
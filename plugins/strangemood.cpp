@@ -9,6 +9,7 @@
 #include "modules/Units.h"
 #include "modules/Items.h"
 #include "modules/Job.h"
+#include "modules/Maps.h"
 #include "modules/Translation.h"
 #include "modules/Random.h"
 
@@ -552,15 +553,12 @@ command_result df_strangemood (color_ostream &out, vector <string> & parameters)
         for (size_t i = 0; i < created_item_count->size(); i++)
             num_items += created_item_count->at(i);
 
-        int num_revealed_tiles = 0;
-        for (size_t i = 0; i < world->map.map_blocks.size(); i++)
-        {
-            df::map_block *blk = world->map.map_blocks[i];
-            for (int x = 0; x < 16; x++)
-                for (int y = 0; y < 16; y++)
-                    if (blk->designation[x][y].bits.subterranean && !blk->designation[x][y].bits.hidden)
-                        num_revealed_tiles++;
-        }
+        df::tile_designation mask, revealed;
+        mask.bits.subterranean = mask.bits.hidden = true;
+        revealed.bits.subterranean = true;
+        int num_revealed_tiles = Maps::sumBlocks([&](df::map_block *blk) {
+            return (int64_t)Maps::countTiles(blk, mask, revealed);
+        });
         if (num_revealed_tiles / 2304 < ui->tasks.num_artifacts)
         {
             out.printerr("Fortress is not eligible for a strange mood at this time - not enough subterranean tiles revealed.\n");
@@ -1158,6 +1158,91 @@ static bool itemInRealJob(df::item *item)
                != job_type_class::Hauling;
 }
 
+static bool itemUnavailable(df::item *item)
+{
+    // don't count worn items
+    if (item->getWear() >= 1)
+        return true;
+
+    switch (item->getType()) {
+    case item_type::THREAD:
+        if (item->getTotalDimension() < 15000)
+            return true;
+        break;
+
+    case item_type::CLOTH:
+        if (item->getTotalDimension() < 10000)
+            return true;
+        break;
+
+    default:
+        break;
+    }
+
+    return item->flags.bits.owned ||
+           item->flags.bits.in_chest ||
+           item->isAssignedToStockpile() ||
+           Items::isRouteVehicle(item) ||
+           itemInRealJob(item) ||
+           itemBusy(item) ||
+           Items::isSquadEquipment(item);
+}
+
+static void map_constraint_items(ItemConstraint *cv, df::item_type itype, df::item_flags bad_flags)
+{
+    auto &buckets = Items::getItemCensus(itype);
+
+    for (size_t i = 0; i < buckets.size(); i++)
+    {
+        auto bucket = buckets[i];
+
+        if (!cv->is_craft && cv->item.subtype != -1 && cv->item.subtype != bucket->subtype)
+            continue;
+
+        TMaterialCache::key_type matkey(bucket->mat_type, bucket->mat_index);
+        TMaterialCache::iterator it = cv->material_cache.find(matkey);
+
+        bool ok = true;
+        if (it != cv->material_cache.end())
+            ok = it->second;
+        else
+        {
+            MaterialInfo mat(bucket->mat_type, bucket->mat_index);
+            ok = mat.matches(cv->material) &&
+                 (cv->mat_mask.whole == 0 || mat.matches(cv->mat_mask));
+            cv->material_cache[matkey] = ok;
+        }
+
+        if (!ok)
+            continue;
+
+        for (size_t j = 0; j < bucket->items.size(); j++)
+        {
+            df::item *item = bucket->items[j];
+
+            if (item->flags.whole & bad_flags.whole)
+                continue;
+            if (itype == item_type::THREAD && item->flags.bits.spider_web)
+                continue;
+            if (cv->is_local && item->flags.bits.foreign)
+                continue;
+            if (item->getQuality() < cv->min_quality)
+                continue;
+
+            if (itemUnavailable(item))
+            {
+                cv->item_inuse_count++;
+                cv->item_inuse_amount += item->getStackSize();
+            }
+            else
+            {
+                cv->item_count++;
+                cv->item_amount += item->getStackSize();
+            }
+        }
+    }
+}
+
 static void map_job_items(color_ostream &out)
 {
     for (size_t i = 0; i < constraints.size(); i++)
@@ -1180,113 +1265,48 @@ static void map_job_items(color_ostream &out)
     F(in_building); F(construction); F(artifact);
 #undef F
 
-    bool dry_buckets = isOptionEnabled(CF_DRYBUCKETS);
+    if (isOptionEnabled(CF_DRYBUCKETS))
+    {
+        auto &buckets = Items::getItemCensus(item_type::BUCKET);
+        for (size_t i = 0; i < buckets.size(); i++)
+        {
+            for (size_t j = 0; j < buckets[i]->items.size(); j++)
+            {
+                df::item *item = buckets[i]->items[j];
+                if (!(item->flags.whole & bad_flags.whole) && !item->flags.bits.in_job)
+                    dryBucket(item);
+            }
+        }
+    }
 
-    std::vector<df::item*> &items = world->items.other[items_other_id::IN_PLAY];
+    std::vector<df::item*> &melt = world->items.other[items_other_id::ANY_MELT_DESIGNATED];
 
-    for (size_t i = 0; i < items.size(); i++)
+    for (size_t i = 0; i < melt.size(); i++)
     {
-        df::item *item = items[i];
+        df::item *item = melt[i];
 
         if (item->flags.whole & bad_flags.whole)
             continue;
-
-        df::item_type itype = item->getType();
-        int16_t isubtype = item->getSubtype();
-        int16_t imattype = item->getActualMaterial();
-        int32_t imatindex = item->getActualMaterialIndex();
-
-        bool is_invalid = false;
-
-        // don't count worn items
-        if (item->getWear() >= 1)
-            is_invalid = true;
-
-        // Special handling
-        switch (itype) {
-        case item_type::BUCKET:
-            if (dry_buckets && !item->flags.bits.in_job)
-                dryBucket(item);
-            break;
-
-        case item_type::THREAD:
-            if (item->flags.bits.spider_web)
-                continue;
-            if (item->getTotalDimension() < 15000)
-                is_invalid = true;
-            break;
-
-        case item_type::CLOTH:
-            if (item->getTotalDimension() < 10000)
-                is_invalid = true;
-            break;
-
-        default:
-            break;
-        }
+        if (item->flags.bits.spider_web && item->getType() == item_type::THREAD)
+            continue;
 
         if (item->flags.bits.melt && !item->flags.bits.owned && !itemBusy(item))
             meltable_count++;
+    }
 
-        // Match to constraints
-        TMaterialCache::key_type matkey(imattype, imatindex);
+    // Match each constraint against the census buckets of its item type
+    for (size_t i = 0; i < constraints.size(); i++)
+    {
+        ItemConstraint *cv = constraints[i];
 
-        for (size_t i = 0; i < constraints.size(); i++)
+        if (cv->is_craft)
         {
-            ItemConstraint *cv = constraints[i];
-
-            if (cv->is_craft)
-            {
-                if (!isCraftItem(itype))
-                    continue;
-            }
-            else
-            {
-                if (cv->item.type != itype ||
-                    (cv->item.subtype != -1 && cv->item.subtype != isubtype))
-                    continue;
-            }
-
-            if (cv->is_local && item->flags.bits.foreign)
-                continue;
-            if (item->getQuality() < cv->min_quality)
-                continue;
-
-            TMaterialCache::iterator it = cv->material_cache.find(matkey);
-
-            bool ok = true;
-            if (it != cv->material_cache.end())
-                ok = it->second;
-            else
-            {
-                MaterialInfo mat(imattype, imatindex);
-                ok = mat.matches(cv->material) &&
-                     (cv->mat_mask.whole == 0 || mat.matches(cv->mat_mask));
-                cv->material_cache[matkey] = ok;
-            }
-
-            if (!ok)
-                continue;
-
-            if (is_invalid ||
-                item->flags.bits.owned ||
-                item->flags.bits.in_chest ||
-                item->isAssignedToStockpile() ||
-                Items::isRouteVehicle(item) ||
-                itemInRealJob(item) ||
-                itemBusy(item) ||
-                Items::isSquadEquipment(item))
-            {
-                is_invalid = true;
-                cv->item_inuse_count++;
-                cv->item_inuse_amount += item->getStackSize();
-            }
-            else
-            {
-                cv->item_count++;
-                cv->item_amount += item->getStackSize();
-            }
+            auto lst = ENUM_ATTR(job_type, possible_item, job_type::MakeCrafts);
+            for (size_t k = 0; k < lst.size; k++)
+                map_constraint_items(cv, (df::item_type)lst.items[k], bad_flags);
         }
+        else
+            map_constraint_items(cv, cv->item.type, bad_flags);
     }
 
     for (size_t i = 0; i < constraints.size(); i++)